@@ -7,6 +7,7 @@ BUILD_DOCS="ON"
 ENABLE_TESTING="OFF"
 ENABLE_TRACE="OFF"
 ENABLE_TRACE_ESSENTIAL="OFF"
+ENABLE_USDT="ON"
 RUN_PERF_STAT="OFF"
 RUN_PERF_RECORD="OFF"
 RUN_MEMCHECK="OFF"
@@ -23,6 +24,7 @@ do
     -T|--tests)           ENABLE_TESTING="ON";;
        --trace)           ENABLE_TRACE="ON";;
        --trace-essential) ENABLE_TRACE_ESSENTIAL="ON";;
+       --no-usdt)         ENABLE_USDT="OFF";;
     -P|--perf-stat)       RUN_PERF_STAT="ON";;
        --perf-record)     RUN_PERF_RECORD="ON";;
     -V|--memcheck)        RUN_MEMCHECK="ON";;
@@ -40,7 +42,8 @@ cmake .. \
   -DCMAKE_BUILD_TYPE=$BUILD_TYPE \
   -DENABLE_TESTING=$ENABLE_TESTING \
   -DENABLE_TRACE=$ENABLE_TRACE \
-  -DENABLE_TRACE_ESSENTIAL=$ENABLE_TRACE_ESSENTIAL
+  -DENABLE_TRACE_ESSENTIAL=$ENABLE_TRACE_ESSENTIAL \
+  -DENABLE_USDT=$ENABLE_USDT
 
 make -j8
 mv compile_commands.json .. || true
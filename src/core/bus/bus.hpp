@@ -2,13 +2,57 @@
 #define BUS_HPP_
 
 #include <array>
+#include <vector>
+#include <algorithm>
 #include <sstream>
 #include <iomanip>
 #include <stdexcept>
+#include <cerrno>
+#include <poll.h>
 
 #include "typedef.hpp"
 #include "card.hpp"
 #include "util.hpp"
+#include "probes.hpp"
+
+/// @brief Bitmasks of the kinds of bus access a tap can be interested in.
+/// @note `FORCED_WRITE` is a write that ignores the write lock (loading ROMs, debugger writes), not a bus cycle.
+enum class bus_access : u8 {
+    READ = 0x01, WRITE = 0x02, FORCED_WRITE = 0x04
+};
+
+/**
+ * @brief Base class for observers of bus accesses.
+ *
+ * A tap is notified of reads and writes on the pages of memory or I/O space it declares interest for. Forced writes
+ * are not bus cycles, only taps that mirror memory should ask for them. The bus keeps the union of all interests in a
+ * per-page table, so accesses to pages nobody is interested in only pay for a table lookup. Taps must call
+ * `bus::refresh_taps()` whenever their interest changes.
+ *
+ * @note Pages are 256 bytes wide. In I/O space, since the 8080 duplicates the port number on both halves of the address
+ * bus, the page number is the port number.
+ */
+class bus_tap {
+public:
+    /**
+     * @brief Get the kinds of access to a page this tap wants to be notified of.
+     * @param page The page number (high byte of the address).
+     * @param io Whether the page is in I/O space.
+     * @return A mask of `bus_access` bits, zero if not interested.
+     */
+    virtual u8 page_interest(u8 page, bool io) const = 0;
+
+    /**
+     * @brief Called on each access to a page of interest.
+     * @param adr The address accessed.
+     * @param byte The byte read or written.
+     * @param io Whether the access is in I/O space.
+     * @param kind The kind of access.
+     */
+    virtual void on_access(u16 adr, u8 byte, bool io, bus_access kind) = 0;
+
+    virtual ~bus_tap() = default;
+};
 
 /**
  * @brief Represents the S-100 bus of the emulator.
@@ -107,6 +151,15 @@ private:
     std::array<card*, MAX_BUS_CARDS> cards;
     std::array<bool, MAX_BUS_CARDS> ignore_conflicts;
 
+    std::vector<bus_tap*> taps;
+    std::array<std::array<u8, 256>, 2> tapped_pages;
+
+    inline void notify_taps(u16 adr, u8 byte, bool io, bus_access kind) {
+        for (bus_tap* tap : taps)
+            if (tap->page_interest(adr >> 8, io) & static_cast<u8>(kind))
+                tap->on_access(adr, byte, io, kind);
+    }
+
     inline bool test_for_bus_conflict(card* card) const {
         for (usize i = 0; i < MAX_BUS_CARDS; ++i)
             if (!ignore_conflicts[i] and cards[i] != NO_CARD
@@ -175,8 +228,34 @@ public:
      * @warning This method will return only the first valid card slot that is in range of the address. Be mindful of allowed collision ranges.
      */
     inline u8 read(u16 adr, bool ior = false) {
+        u8 byte = BAD_U8;
+
         for (card* card : cards)
-            if (card != NO_CARD and card->in_range(adr) and ior == card->is_io())
+            if (card != NO_CARD and card->in_range(adr) and ior == card->is_io()) {
+                byte = card->read(adr);
+                break;
+            }
+
+        if (ior)
+            BUDDY_PROBE2(io_read, adr & 0xFF, byte);
+
+        if (tapped_pages[ior][adr >> 8] & static_cast<u8>(bus_access::READ))
+            notify_taps(adr, byte, ior, bus_access::READ);
+
+        return byte;
+    }
+
+    /**
+     * @brief Reads a memory byte from the bus without it being seen by taps.
+     * @param adr The address to read from.
+     * @return The byte read from the first valid memory card on the bus.
+     *
+     * Meant for debugging tools inspecting memory (tracing, coverage, GDB...), so that their reads don't show up as
+     * bus cycles to other taps. Only memory is read, since reading I/O registers might have side effects.
+     */
+    inline u8 peek(u16 adr) const {
+        for (card* card : cards)
+            if (card != NO_CARD and card->in_range(adr) and !card->is_io())
                 return card->read(adr);
 
         return BAD_U8;
@@ -193,6 +272,12 @@ public:
         for (card* card : cards)
             if (card != NO_CARD and card->in_range(adr) and iow == card->is_io())
                 card->write(adr, byte);
+
+        if (iow)
+            BUDDY_PROBE2(io_write, adr & 0xFF, byte);
+
+        if (tapped_pages[iow][adr >> 8] & static_cast<u8>(bus_access::WRITE))
+            notify_taps(adr, byte, iow, bus_access::WRITE);
     }
 
     /**
@@ -206,6 +291,9 @@ public:
         for (card* card : cards)
             if (card != NO_CARD and card->in_range(adr) and iow == card->is_io())
                 card->write_force(adr, byte);
+
+        if (tapped_pages[iow][adr >> 8] & static_cast<u8>(bus_access::FORCED_WRITE))
+            notify_taps(adr, byte, iow, bus_access::FORCED_WRITE);
     }
 
     /**
@@ -255,12 +343,54 @@ public:
      */
     inline std::array<u8, 3> get_irq() {
         for (card* card : cards)
-            if (card != NO_CARD and card->is_irq())
-                return card->get_irq();
+            if (card != NO_CARD and card->is_irq()) {
+                const std::array<u8, 3> inst = card->get_irq();
+                BUDDY_PROBE2(irq_ack, inst[0], inst[1]);
+                return inst;
+            }
 
         throw std::runtime_error("tried get_irq() while none was raised");
     }
 
+    /// @brief Let every card check for host events and raise its IRQ accordingly, see `card::poll_events()`.
+    inline void poll_events() {
+        for (card* card : cards)
+            if (card != NO_CARD)
+                card->poll_events();
+    }
+
+    /**
+     * @brief Sleep until a host event may raise an IRQ, then let the cards check for it.
+     * @param extra More file descriptors to wake up on, such as a debugger socket.
+     * @param timeout_ms The longest time to sleep in milliseconds, -1 for no limit.
+     * @return False without sleeping if nothing could wake the machine up: no card has an event to wait for, no extra
+     * file descriptor was given, and there is no time limit.
+     * @throws std::runtime_error if `poll()` failed.
+     *
+     * Meant for a CPU halted with interrupts enabled: the host thread sleeps in the kernel instead of spinning, and only
+     * the events of cards that could end the halt wake it up. Call `is_irq()` afterwards, the wake up may be spurious.
+     */
+    inline bool wait_events(const std::vector<fd>& extra = {}, int timeout_ms = -1) {
+        std::vector<pollfd> fds;
+
+        for (card* card : cards)
+            if (card != NO_CARD and card->get_event_fd() != -1)
+                fds.push_back({ card->get_event_fd(), POLLIN, 0 });
+
+        for (fd extra_fd : extra)
+            if (extra_fd != -1)
+                fds.push_back({ extra_fd, POLLIN, 0 });
+
+        if (fds.empty() and timeout_ms < 0)
+            return false;
+
+        if (::poll(fds.data(), fds.size(), timeout_ms) < 0 and errno != EINTR)
+            throw std::runtime_error("poll() failed");
+
+        poll_events();
+        return true;
+    }
+
     /**
      * @brief Returns a detailed map of the bus.
      * @return A std::string with details about the bus devices.
@@ -299,6 +429,22 @@ public:
         return ss.str();
     }
 
+    /// @brief Get the number of card slots on the bus.
+    static constexpr inline usize get_slot_count() { return MAX_BUS_CARDS; }
+
+    /**
+     * @brief Get the card in a slot.
+     * @param slot The slot number.
+     * @return The card, or nullptr if the slot is empty.
+     * @throws std::out_of_range if the slot is out of range.
+     */
+    inline card* get_card(usize slot) const {
+        if (slot >= MAX_BUS_CARDS)
+            throw std::out_of_range("slot out of range");
+
+        return cards[slot];
+    }
+
     /**
      * @brief Get in which slot a card is according to an address.
      * @returns The slot closest that accepts the address in its range, 255 if none.
@@ -311,6 +457,50 @@ public:
         return 255;
     }
 
+    /**
+     * @brief Get which slot answers an access, like `get_slot_by_adr()` but considering the IOR/IOW signal.
+     * @returns The slot of the card that answers the access, 255 if none.
+     */
+    inline u8 get_slot_by_access(u16 adr, bool io) const {
+        for (usize i = 0; i < MAX_BUS_CARDS; ++i)
+            if (cards[i] != NO_CARD and cards[i]->in_range(adr) and cards[i]->is_io() == io)
+                return i;
+
+        return 255;
+    }
+
+    /**
+     * @brief Attach a tap to observe bus accesses.
+     * @param tap The tap to attach, it's not owned by the bus.
+     * @throws std::invalid_argument if the tap is nullptr.
+     */
+    inline void attach_tap(bus_tap* tap) {
+        if (!tap)
+            throw std::invalid_argument("cannot attach nullptr tap");
+
+        if (std::find(taps.begin(), taps.end(), tap) == taps.end())
+            taps.push_back(tap);
+
+        refresh_taps();
+    }
+
+    /// @brief Detach a previously attached tap, does nothing if it wasn't attached.
+    inline void detach_tap(bus_tap* tap) {
+        taps.erase(std::remove(taps.begin(), taps.end(), tap), taps.end());
+        refresh_taps();
+    }
+
+    /// @brief Rebuild the per-page table of tap interests, to be called when any tap changes its interests.
+    inline void refresh_taps() {
+        for (usize io = 0; io < 2; ++io)
+            for (usize page = 0; page < 256; ++page) {
+                u8 interest = 0;
+                for (bus_tap* tap : taps)
+                    interest |= tap->page_interest(page, io);
+                tapped_pages[io][page] = interest;
+            }
+    }
+
     /**
      * @brief Clears all cards on the bus.
      *
@@ -323,7 +513,7 @@ public:
                 card->clear();
     }
 
-    bus() : cards({ NO_CARD }), ignore_conflicts({ false }) {}
+    bus() : cards({ NO_CARD }), ignore_conflicts({ false }), tapped_pages() {}
 };
 
 #endif
\ No newline at end of file
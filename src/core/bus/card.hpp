@@ -2,13 +2,17 @@
 #define CARD_HPP_
 
 #include <array>
+#include <cstdio>
 #include <cstring>
 #include <vector>
+#include <stdexcept>
 
 #include "typedef.hpp"
+#include "arena.hpp"
 #include "pty.hpp"
 #include "util.hpp"
 #include "defines.hpp"
+#include "probes.hpp"
 
 /**
  * @brief Holds information that can be used to identify a card.
@@ -27,6 +31,22 @@ struct card_identify {
     card_identify(u16 start_adr, usize adr_range, const char* name, const char* detail) : start_adr(start_adr), adr_range(adr_range), name(name), detail(detail) {};
 };
 
+/**
+ * @brief An interrupt controller, that cards can have their IRQ line wired to instead of the bus.
+ * @see `card::route_irq()`
+ */
+class irq_controller {
+public:
+    /**
+     * @brief Follow the IRQ line of a card wired to a level.
+     * @param level The level the card is wired to.
+     * @param raised Whether the card raises its line, or clears it.
+     */
+    virtual void set_level(u8 level, bool raised) = 0;
+
+    virtual ~irq_controller() = default;
+};
+
 /**
  * @brief Base class for all cards.
  *
@@ -38,6 +58,8 @@ class card {
 protected:
     bool write_locked = false;
     bool irq_raised = false;
+    irq_controller* controller = nullptr;
+    u8 controller_level = 0;
 
 public:
     /// @name Commonly used methods.
@@ -56,8 +78,30 @@ public:
     /// @warning Always use this before calling `get_irq()`.
     bool is_irq() const { return irq_raised; }
 
-    /// @brief Raise or clear the IRQ trigger.
-    void raise_irq(bool value) { irq_raised = value; }
+    /// @brief Raise or clear the IRQ trigger, or the level of the controller the card is routed to.
+    void raise_irq(bool value) {
+        BUDDY_PROBE1(irq_raise, value);
+
+        if (controller)
+            controller->set_level(controller_level, value);
+        else
+            irq_raised = value;
+    }
+
+    /**
+     * @brief Wire the IRQ line of the card to a level of an interrupt controller, the controller then interrupts the
+     * CPU in its place.
+     * @param to The controller, or null to interrupt the CPU directly again.
+     * @param level The level to request on the controller.
+     */
+    void route_irq(irq_controller* to, u8 level) {
+        const bool raised = irq_raised;
+        raise_irq(false);
+
+        controller = to;
+        controller_level = level;
+        raise_irq(raised);
+    }
 
     /// \}
     /// @name Abstract methods.
@@ -110,6 +154,20 @@ public:
     /// @brief Clears the card data or configuration.
     virtual void clear() = 0;
 
+    /// \}
+    /// @name Host event methods, for cards that raise IRQs on events from the host.
+    /// \{
+
+    /**
+     * @brief Get a file descriptor that becomes readable on a host event that would raise the IRQ of the card.
+     * @returns The file descriptor, or -1 if no event can raise the IRQ right now.
+     * @note Used to sleep while the CPU waits for an interrupt, see `bus::wait_events()`.
+     */
+    virtual fd get_event_fd() { return -1; }
+
+    /// @brief Check for host events, and raise the IRQ of the card accordingly.
+    virtual void poll_events() {}
+
     /// \}
 
     virtual ~card() = default;
@@ -138,7 +196,10 @@ class data_card : public card {
 private:
     const u16 start_adr;
     const usize capacity;
-    std::vector<u8> data;
+    std::vector<u8> owned;
+    u8* data;
+    const u8 fill;
+    const u8 bias;
 
     /*static constexpr usize next_pow2_to_v(usize v) {
         usize pw = 1;
@@ -148,6 +209,11 @@ private:
     }*/
 
 public:
+    /// @brief Zero filled memory the card uses instead of allocating its own, from `machine_arena::allocate_pages()`.
+    struct external_storage {
+        u8* data;
+    };
+
     /**
      * @brief Construct a card with a fixed capacity and simple one byte fill.
      * @param start_adr The starting address of the card.
@@ -156,9 +222,25 @@ public:
      * @param lock Whether the card should be write-locked after construction.
      */
     data_card(u16 start_adr, usize capacity, u8 fill = BAD_U8, bool lock = construct_then_write_lock) 
-        : start_adr(start_adr), capacity(capacity) { 
+        : start_adr(start_adr), capacity(capacity), fill(fill), bias(0) { 
+
+        owned.resize(capacity, fill);
+        data = owned.data();
+        this->write_locked = lock;
+    }
+
+    /**
+     * @brief Construct a card on external memory, reading as a one byte fill without writing to the memory.
+     * @param start_adr The starting address of the card.
+     * @param capacity The size in bytes of the card starting from the start address.
+     * @param storage At least `capacity` bytes of zero filled memory, which must outlive the card.
+     * @param fill The byte the card reads as until written, default is BAD_U8.
+     * @param lock Whether the card should be write-locked after construction.
+     * @note Bytes are stored XORed with the fill, so that untouched memory (such as lazily mapped pages) stays zero.
+     */
+    data_card(u16 start_adr, usize capacity, external_storage storage, u8 fill = BAD_U8, bool lock = construct_then_write_lock)
+        : start_adr(start_adr), capacity(capacity), data(storage.data), fill(fill), bias(fill) {
 
-        data.resize(capacity, fill);
         this->write_locked = lock;
     }
     
@@ -177,18 +259,28 @@ public:
             (capacity == 0)
                 ? static_cast<usize>(std::distance(begin, end))
                 : capacity
-            ) {
+            ),
+          fill(BAD_U8),
+          bias(0) {
 
         static_assert(std::is_same_v<typename std::iterator_traits<T>::value_type, u8>, "Iterator value type must be u8.");
 
         if (static_cast<usize>(std::distance(begin, end)) > this->capacity)
             throw std::out_of_range("Binary data exceeds card capacity.");
 
-        data.resize(this->capacity, BAD_U8);
-        std::copy(begin, end, data.begin());
+        owned.resize(this->capacity, BAD_U8);
+        std::copy(begin, end, owned.begin());
+        data = owned.data();
         this->write_locked = lock;
     }
 
+    data_card(const data_card&) = delete;
+    data_card& operator=(const data_card&) = delete;
+
+    /// @brief Get the host memory backing an address of a card on external storage, nullptr if the card owns its memory.
+    /// @note Bytes in external storage are XORed with the fill byte.
+    u8* get_host_address(u16 adr) const { return owned.empty() ? data + (adr - start_adr) : nullptr; }
+
     /// @brief Check if an address on the bus is in the card's range.
     bool in_range(u16 adr) const override { return adr >= start_adr and adr < (start_adr + capacity); }
 
@@ -196,24 +288,30 @@ public:
     card_identify identify() override { return { start_adr, capacity, (this->write_locked ? "rom area" : "ram area") }; }
 
     /// @brief Read a byte from the data card.
-    u8 read(u16 adr) override { return data[adr - start_adr]; }
+    u8 read(u16 adr) override { return data[adr - start_adr] ^ bias; }
 
     /// @brief Write a byte to the data card.
     void write(u16 adr, u8 byte) override {
         if (!this->write_locked)
-            data[adr - start_adr] = byte;
+            data[adr - start_adr] = byte ^ bias;
     }
 
     /// @brief Write a byte to the data card regardless of write lock.
-    void write_force(u16 adr, u8 byte) override { data[adr - start_adr] = byte; }
+    void write_force(u16 adr, u8 byte) override { data[adr - start_adr] = byte ^ bias; }
 
     /// @brief Check if the card is an I/O card.
     bool is_io() const override { return false; }
 
-    /// @brief Clear the data card.
+    /// @brief Clear the data card, back to its fill byte.
+    /// @note External storage reads as the fill once zero, its pages are given back rather than written.
     void clear() override {
-        if (!this->write_locked)
-            data.clear();
+        if (this->write_locked)
+            return;
+
+        if (owned.empty())
+            machine_arena::zero_pages(data, capacity);
+        else
+            std::memset(data, fill, capacity);
     }
 
     /// @name Unused methods.
@@ -250,12 +348,17 @@ constexpr static usize SERIAL_BASE_CLOCK = 19200;
  * @brief A card that emulates a 6850 ACIA.
  * @param start_adr The starting address of the card.
  * @param base_clock The base clock speed of the UART (it can be further divided), default is SERIAL_BASE_CLOCK.
+ * @param ring If not null, the I/O ring the pseudo-terminal is served through, see `pty::attach()`.
  *
  * This card handles interaction with a pseudo-terminal connected to the card UART. Emulation follows the Motorola 6850 ACIA
  * (Asynchronous Communications Interface Adapter) specifications, but quite simplified. The card has 4 I/O addresses that
  * correspond to the TX_DATA (write-only), RX_DATA (read-only), CONTROL (write-only) and STATUS (read-only) registers of the
  * UART. The card is also able to trigger IRQ according to different conditions.
  *
+ * Setting bit 7 of CONTROL enables receive interrupts: the IRQ is raised while a received byte waits in RX_DATA, and
+ * delivered as `RST 7`, or on a level of the controller the card is routed to (see `route_irq()`). Besides status
+ * reads, input is latched by `poll_events()`, so a halted program can be woken up.
+ *
  * @note The state of I/O devices is updated upon each read or write operation, instead of running a refresh cycle as previously done.
  * @par
  * @note To mimic the partial address decode behavior, while the IN and OUT instructions of the 8080 duplicate the argument byte on
@@ -307,18 +410,43 @@ private:
     constexpr bool RTS() const { return rts; }
     constexpr void RTS(bool value) { rts = value; }
 
+    /// @brief Latch a received byte if the data register is free, then update the IRQ.
+    void receive() {
+        if (!RDRF() and serial.poll()) {
+            RX_DATA(serial.getch());
+            RDRF(true);
+            BUDDY_PROBE2(serial_rx, start_adr, RX_DATA());
+        }
+
+        update_irq();
+    }
+
+    /// @brief Raise the IRQ while a received byte waits and receive interrupts are enabled.
+    void update_irq() {
+        IRQ((CONTROL() & 0b10000000) and RDRF());
+        raise_irq(IRQ());
+    }
+
     void reset() {
         registers.fill(0x00);
         divide_by = 4;
         serial.set_baud_rate(base_clock >> divide_by);
-        CONTROL(0b10010101);
+        // Receive interrupts stay disabled until the program enables them, an unexpected RST 7 would crash it.
+        CONTROL(0b00010101);
         TDRE(true);
         RTS(true);
+        update_irq();
     }
 
 public:
-    serial_card(u16 start_adr, usize base_clock = SERIAL_BASE_CLOCK) 
-        : start_adr(start_adr), base_clock(base_clock) { serial.open(); reset(); }
+    serial_card(u16 start_adr, usize base_clock = SERIAL_BASE_CLOCK, io_ring* ring = nullptr) 
+        : start_adr(start_adr), base_clock(base_clock) {
+
+        serial.open();
+        if (ring)
+            serial.attach(*ring);
+        reset();
+    }
 
     /// @brief Check if an address on the bus is in the card's range.
     bool in_range(u16 adr) const override { return (adr & 0xFF) >= start_adr and (adr & 0xFF) < (start_adr + SERIAL_IO_ADDRESSES); }
@@ -337,16 +465,19 @@ public:
 
     /// @brief Read a byte from the serial registers.
     /// @returns The byte read from the serial registers, or BAD_U8 if the address is invalid (which should be prevented by `in_range()`).
+    /// @note Reading the received data frees the data register, like on the 6850.
     u8 read(u16 adr) override {
-        if (!RDRF() and serial.poll()) {
-            RX_DATA(serial.getch());
-            RDRF(true);
-        }
+        receive();
 
         if ((adr & 0xFF) == start_adr)
             return STATUS();
-        else if ((adr & 0xFF) == start_adr + 1)
-            return RX_DATA();
+
+        else if ((adr & 0xFF) == start_adr + 1) {
+            const u8 data = RX_DATA();
+            RDRF(false);
+            update_irq();
+            return data;
+        }
 
         return BAD_U8;
     }
@@ -383,14 +514,10 @@ public:
                 case 0b01000000: RTS(false); break;
                 case 0b01100000: RTS(true); serial.send_break(); break;
             }
-            // Interrupt Enable bit (TODO: probably wrong behavior)
-            switch (byte & 0b10000000) {
-                //     I.......
-                case 0b00000000: IRQ(false); break;
-                case 0b10000000: IRQ(true); break;
-            }
-
+            // Receive Interrupt Enable bit, the IRQ follows RDRF while it's set
+            //     I.......
             CONTROL(byte);
+            update_irq();
         }
 
         else if ((adr & 0xFF) == start_adr + 1) {
@@ -399,6 +526,7 @@ public:
         }
 
         if (!TDRE()) {
+            BUDDY_PROBE2(serial_tx, start_adr, TX_DATA());
             serial.putch(TX_DATA());
             TDRE(true);
         }
@@ -410,11 +538,193 @@ public:
     /// @brief Clear the serial card state and configuration.
     void clear() override { reset(); }
 
+    /// @brief Get the `RST 7` the floating data bus reads as, as no controller puts an instruction on it.
+    std::array<u8, 3> get_irq() override { return { 0b11111111, 0x00, 0x00 }; }
+
+    /// @name Host event methods.
+    /// \{
+
+    /// @brief Get the file descriptor signalling input on the pseudo-terminal, while it would raise the IRQ.
+    fd get_event_fd() override { return ((CONTROL() & 0b10000000) and !RDRF()) ? serial.get_event_fd() : -1; }
+
+    /// @brief Latch received input and raise the IRQ, without the program reading the status register.
+    void poll_events() override { receive(); }
+
+    /// \}
+    /// @name Unused methods.
+    /// \{
+
+    void write_force(u16 adr, u8 byte) override { write(adr, byte); }
+
+    /// \}
+};
+
+/// @brief The number of I/O addresses of the vectored interrupt controller.
+constexpr static u16 VI_IO_ADDRESSES = 2;
+
+/// @brief The number of interrupt levels of the vectored interrupt controller.
+constexpr static u8 VI_LEVELS = 8;
+
+/// @brief Commands written to the second port of the vectored interrupt controller.
+enum class vi_command : u8 {
+    CLEAR_PENDING = 0x20, ENABLE = 0x40, END_OF_INTERRUPT = 0x80
+};
+
+/**
+ * @brief A card that emulates an 8 level vectored priority interrupt controller, in the style of the Altair 88-VI.
+ * @param start_adr The first of the two ports of the card.
+ *
+ * Devices request interrupts on one of 8 levels, either wired through `card::route_irq()` or with `request()`. Level
+ * 0 has the highest priority and is delivered as `RST 7`, down to level 7 as `RST 0`. A request is delivered when its
+ * level is not masked, the controller is enabled, and no level of the same or higher priority is in service.
+ * Acknowledging it (`get_irq()`) moves the level from pending to in service, until the program writes an end of
+ * interrupt.
+ *
+ * Ports:
+ *  - `start_adr`: reads the pending requests (bit n for level n), writes the mask (a set bit masks its level).
+ *  - `start_adr + 1`: reads the current level (the highest in service, 0xFF if none), writes a `vi_command`:
+ *    `END_OF_INTERRUPT` ends the current level, `ENABLE` enables the controller if bit 0 is set (disables it
+ *    otherwise), and `CLEAR_PENDING` drops all the pending requests.
+ *
+ * @note The controller starts enabled, with no level masked.
+ * @warning Out of range addresses are not checked, they should be checked by the bus instead, to avoid calling in_range() twice.
+ */
+class vi_card : public card, public irq_controller {
+private:
+    constexpr static usize MAX_VI_DETAIL_LENGTH = 64;
+    constexpr static u8 NO_LEVEL = 0xFF;
+
+    const u16 start_adr;
+
+    u8 pending;
+    u8 mask;
+    u8 in_service;
+    bool enabled;
+    char detail[MAX_VI_DETAIL_LENGTH];
+
+    /// @brief Get the highest priority level in a set of levels, NO_LEVEL if empty.
+    static constexpr u8 highest(u8 levels) {
+        for (u8 level = 0; level < VI_LEVELS; ++level)
+            if (levels & (1 << level))
+                return level;
+
+        return NO_LEVEL;
+    }
+
+    /// @brief Get the level to deliver next, NO_LEVEL if none.
+    constexpr u8 deliverable() const {
+        const u8 level = highest(pending & ~mask);
+        return (enabled and level < highest(in_service)) ? level : NO_LEVEL;
+    }
+
+    void update() { raise_irq(deliverable() != NO_LEVEL); }
+
+public:
+    /// @name Interrupt line methods.
+    /// \{
+
+    /**
+     * @brief Request an interrupt on a level, it stays pending until acknowledged or cleared.
+     * @throw `std::out_of_range` if the level is not below VI_LEVELS.
+     */
+    void request(u8 level) {
+        if (level >= VI_LEVELS)
+            throw std::out_of_range("Vectored interrupt level out of range.");
+
+        pending |= 1 << level;
+        update();
+    }
+
+    /// @brief Withdraw a pending request on a level.
+    void cancel(u8 level) {
+        pending &= ~(1 << level);
+        update();
+    }
+
+    /// @brief Get the highest level in service, 0xFF if none.
+    u8 get_current_level() const { return highest(in_service); }
+
+    /// @brief Request or withdraw a level, following the IRQ line of a card wired to it.
+    void set_level(u8 level, bool raised) override {
+        if (raised)
+            request(level);
+        else
+            cancel(level);
+    }
+
+    /// \}
+
+    vi_card(u16 start_adr) : start_adr(start_adr) { clear(); }
+
+    /// @brief Check if an address on the bus is in the card's range.
+    bool in_range(u16 adr) const override { return (adr & 0xFF) >= start_adr and (adr & 0xFF) < (start_adr + VI_IO_ADDRESSES); }
+
+    /// @brief Get information about the controller.
+    /// @note The detail contains the pending, mask and in service registers (hex) and whether it is enabled.
+    card_identify identify() override {
+        std::snprintf(
+            detail, sizeof(detail),
+            "pending: %s, mask: %s, in service: %s%s",
+            util::to_hex_s(static_cast<usize>(pending), 2).c_str(), util::to_hex_s(static_cast<usize>(mask), 2).c_str(),
+            util::to_hex_s(static_cast<usize>(in_service), 2).c_str(), enabled ? "" : ", disabled"
+        );
+
+        return { start_adr, VI_IO_ADDRESSES, "vectored interrupts", detail };
+    }
+
+    /// @brief Read the pending requests or the current level.
+    u8 read(u16 adr) override { return ((adr & 0xFF) == start_adr) ? pending : get_current_level(); }
+
+    /// @brief Write the mask or a command.
+    void write(u16 adr, u8 byte) override {
+        if ((adr & 0xFF) == start_adr)
+            mask = byte;
+
+        else if (byte & static_cast<u8>(vi_command::END_OF_INTERRUPT)) {
+            const u8 current = get_current_level();
+            if (current != NO_LEVEL)
+                in_service &= ~(1 << current);
+        }
+
+        else if (byte & static_cast<u8>(vi_command::ENABLE))
+            enabled = byte & 0x01;
+
+        else if (byte & static_cast<u8>(vi_command::CLEAR_PENDING))
+            pending = 0;
+
+        update();
+    }
+
+    /// @brief Acknowledge the highest priority deliverable request, and get its `RST` instruction.
+    /// @note This method should be called after `is_irq()` returns true.
+    std::array<u8, 3> get_irq() override {
+        const u8 level = deliverable();
+        if (level == NO_LEVEL)
+            return { BAD_U8, BAD_U8, BAD_U8 };
+
+        pending &= ~(1 << level);
+        in_service |= 1 << level;
+        update();
+
+        return { static_cast<u8>(0b11000111 | ((VI_LEVELS - 1 - level) << 3)), 0x00, 0x00 };
+    }
+
+    /// @brief Check if the card is an I/O card.
+    bool is_io() const override { return true; }
+
+    /// @brief Reset the controller, enabled with nothing pending, masked or in service.
+    void clear() override {
+        pending = 0;
+        mask = 0;
+        in_service = 0;
+        enabled = true;
+        update();
+    }
+
     /// @name Unused methods.
     /// \{
 
     void write_force(u16 adr, u8 byte) override { write(adr, byte); }
-    std::array<u8, 3> get_irq() override { return { BAD_U8, BAD_U8, BAD_U8 }; }
 
     /// \}
 };
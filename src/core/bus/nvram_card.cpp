@@ -0,0 +1,134 @@
+#include "nvram_card.hpp"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+nvram_card::nvram_card(u16 start_adr, const std::string& path, usize capacity, usize sync_interval_ms)
+    : start_adr(start_adr), capacity(capacity), path(path), data(nullptr), syncs(0),
+      interval(sync_interval_ms), stopping(false) {
+
+    file = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (file < 0)
+        throw std::runtime_error("Could not open NVRAM file: " + path);
+
+    struct stat info;
+    if (fstat(file, &info) < 0) {
+        ::close(file);
+        throw std::runtime_error("Could not read the size of NVRAM file: " + path);
+    }
+
+    if (this->capacity == 0)
+        this->capacity = info.st_size;
+
+    if (this->capacity == 0) {
+        ::close(file);
+        throw std::runtime_error("NVRAM file is empty, give the card a range to create it: " + path);
+    }
+
+    if (start_adr + this->capacity > 65536) {
+        ::close(file);
+        throw std::out_of_range("NVRAM card exceeds the address space.");
+    }
+
+    if (static_cast<usize>(info.st_size) < this->capacity and ftruncate(file, this->capacity) < 0) {
+        ::close(file);
+        throw std::runtime_error("Could not extend NVRAM file: " + path);
+    }
+
+    void* mapped = mmap(nullptr, this->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    if (mapped == MAP_FAILED) {
+        ::close(file);
+        throw std::runtime_error("Could not map NVRAM file: " + path);
+    }
+
+    data = static_cast<u8*>(mapped);
+
+    // msync() works on whole host pages, the mapping starts on one.
+    page_shift = __builtin_ctzl(static_cast<usize>(sysconf(_SC_PAGESIZE)));
+    page_count = ((this->capacity - 1) >> page_shift) + 1;
+    dirty = std::make_unique<std::atomic<u8>[]>(page_count);
+    for (usize page = 0; page < page_count; ++page)
+        dirty[page].store(0, std::memory_order_relaxed);
+
+    if (sync_interval_ms > 0)
+        syncer = std::thread(&nvram_card::sync_loop, this);
+}
+
+nvram_card::~nvram_card() {
+    if (syncer.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+
+        wake.notify_all();
+        syncer.join();
+    }
+
+    // Whatever is left dirty is still in the page cache, the kernel writes it back on its own.
+    try {
+        flush();
+    } catch (const std::runtime_error&) {}
+
+    munmap(data, capacity);
+    ::close(file);
+}
+
+usize nvram_card::flush() {
+    std::lock_guard<std::mutex> guard(sync_lock);
+    usize synced = 0;
+
+    for (usize page = 0; page < page_count;) {
+        if (!dirty[page].exchange(0, std::memory_order_acquire)) {
+            ++page;
+            continue;
+        }
+
+        // Adjacent dirty pages are written back together.
+        usize end = page + 1;
+        while (end < page_count and dirty[end].exchange(0, std::memory_order_acquire))
+            ++end;
+
+        const usize from = page << page_shift;
+        const usize to = std::min(capacity, end << page_shift);
+
+        if (msync(data + from, to - from, MS_SYNC) < 0) {
+            for (usize i = page; i < end; ++i)
+                dirty[i].store(1, std::memory_order_relaxed);
+            throw std::runtime_error("msync() failed for NVRAM file: " + path);
+        }
+
+        synced += end - page;
+        page = end;
+    }
+
+    if (synced > 0)
+        syncs.fetch_add(1, std::memory_order_relaxed);
+
+    return synced;
+}
+
+usize nvram_card::get_dirty_pages() const {
+    usize count = 0;
+    for (usize page = 0; page < page_count; ++page)
+        count += dirty[page].load(std::memory_order_relaxed);
+    return count;
+}
+
+void nvram_card::sync_loop() {
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (!wake.wait_for(guard, interval, [this] { return stopping; })) {
+        guard.unlock();
+
+        // A failed write-back keeps its pages dirty, the next interval tries again.
+        try {
+            flush();
+        } catch (const std::runtime_error&) {}
+
+        guard.lock();
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef NVRAM_CARD_HPP_
+#define NVRAM_CARD_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <stdexcept>
+#include <condition_variable>
+
+#include "card.hpp"
+#include "typedef.hpp"
+
+/// @brief The default number of milliseconds between two write-backs of an NVRAM card.
+constexpr static usize NVRAM_DEFAULT_SYNC_MS = 1000;
+
+/**
+ * @brief A card of battery-backed RAM, kept in a host file across runs of the emulator.
+ *
+ * The card memory is a shared mapping of the file, so reads and writes go straight to the page cache, and the
+ * contents outlive the emulator even when it's killed. Writes only mark their host page dirty. A background thread
+ * writes the dirty pages back with `msync()` every sync interval, coalescing adjacent pages into one call, so that a
+ * crash of the host loses at most one interval of writes. The remaining dirty pages are written back on destruction.
+ *
+ * A new file, or one shorter than the card, is extended with zero bytes. With no capacity given, the card takes the
+ * size of the existing file.
+ *
+ * @note Like the battery-backed boards, `clear()` keeps the contents. Several machines given the same file share the
+ * same memory.
+ * @warning Out of range addresses are not checked, they should be checked by the bus instead, to avoid calling in_range() twice.
+ */
+class nvram_card : public card {
+private:
+    const u16 start_adr;
+    usize capacity;
+    std::string path;
+    fd file;
+    u8* data;
+
+    usize page_shift;
+    usize page_count;
+    std::unique_ptr<std::atomic<u8>[]> dirty;
+    std::mutex sync_lock;
+    std::atomic<u64> syncs;
+
+    std::chrono::milliseconds interval;
+    std::thread syncer;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool stopping;
+
+    void sync_loop();
+
+public:
+    /**
+     * @brief Write the dirty pages back to the file now.
+     * @return The number of host pages written back.
+     * @throw `std::runtime_error` if `msync()` failed, the pages stay dirty.
+     */
+    usize flush();
+
+    /// @brief Get the number of host pages written to since they were last written back.
+    usize get_dirty_pages() const;
+
+    /// @brief Get the number of write-backs that wrote any page so far.
+    u64 get_syncs() const { return syncs.load(std::memory_order_relaxed); }
+
+    /// @brief Get the path of the file backing the card.
+    const std::string& get_path() const { return path; }
+
+    /// @brief Check if an address on the bus is in the card's range.
+    bool in_range(u16 adr) const override { return adr >= start_adr and adr < (start_adr + capacity); }
+
+    /// @brief Get information about the card.
+    /// @note The detail is the path of the backing file.
+    card_identify identify() override { return { start_adr, capacity, "nvram area", path.c_str() }; }
+
+    /// @brief Read a byte from the card.
+    u8 read(u16 adr) override { return data[adr - start_adr]; }
+
+    /// @brief Write a byte to the card.
+    void write(u16 adr, u8 byte) override {
+        if (!this->write_locked)
+            write_force(adr, byte);
+    }
+
+    /// @brief Write a byte to the card regardless of write lock, marking its host page dirty.
+    void write_force(u16 adr, u8 byte) override {
+        const usize offset = adr - start_adr;
+        data[offset] = byte;
+        dirty[offset >> page_shift].store(1, std::memory_order_relaxed);
+    }
+
+    /// @brief Check if the card is an I/O card.
+    bool is_io() const override { return false; }
+
+    /// @brief Keep the contents, as the battery does.
+    void clear() override {}
+
+    /// @name Unused methods.
+    /// \{
+
+    std::array<u8, 3> get_irq() override { return { BAD_U8, BAD_U8, BAD_U8 }; }
+
+    /// \}
+
+    /**
+     * @brief Map the backing file, creating it if needed, and start the write-back thread.
+     * @param start_adr The starting address of the card.
+     * @param path The path of the backing file.
+     * @param capacity The size in bytes of the card, 0 to take the size of the existing file.
+     * @param sync_interval_ms The number of milliseconds between two write-backs, 0 to only write back on destruction.
+     * @throw `std::runtime_error` if the file could not be opened, sized or mapped, or if it is empty and no capacity
+     * was given.
+     * @throw `std::out_of_range` if the card doesn't fit in the address space.
+     */
+    nvram_card(u16 start_adr, const std::string& path, usize capacity = 0, usize sync_interval_ms = NVRAM_DEFAULT_SYNC_MS);
+
+    /// @brief Stop the write-back thread, write back the dirty pages and unmap the file.
+    ~nvram_card() override;
+
+    nvram_card(const nvram_card&) = delete;
+    nvram_card& operator=(const nvram_card&) = delete;
+};
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef PAGE_POOL_HPP_
+#define PAGE_POOL_HPP_
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+
+#include "typedef.hpp"
+#include "card.hpp"
+#include "defines.hpp"
+
+/// @brief The size in bytes of a deduplicated memory page.
+constexpr static usize POOL_PAGE_SIZE = 256;
+
+/**
+ * @brief A hash indexed pool of immutable memory pages, shared between any number of cards.
+ *
+ * Interning a page returns the pooled page with the same contents, adding it if there is none, and takes a reference
+ * to it. Pages are freed when their last reference is released. All methods are thread safe, so that cards of machines
+ * running on different threads can share one pool.
+ */
+class page_pool {
+private:
+    struct page {
+        std::array<u8, POOL_PAGE_SIZE> data;
+        u64 hash;
+        usize refs;
+    };
+
+    std::mutex lock;
+    std::unordered_multimap<u64, std::unique_ptr<page>> index;
+    usize refs;
+
+    static u64 hash_of(const u8* data) {
+        return std::hash<std::string_view>()(std::string_view(reinterpret_cast<const char*>(data), POOL_PAGE_SIZE));
+    }
+
+    static page* page_of(const u8* data) {
+        // The data is the first member of the page, so its address is the page's.
+        return reinterpret_cast<page*>(const_cast<u8*>(data));
+    }
+
+public:
+    /**
+     * @brief Get a pooled page with the given contents, and take a reference to it.
+     * @param data The contents, `POOL_PAGE_SIZE` bytes.
+     * @return The contents of the pooled page, valid until released.
+     */
+    const u8* intern(const u8* data) {
+        const u64 hash = hash_of(data);
+        std::lock_guard<std::mutex> guard(lock);
+
+        auto [first, last] = index.equal_range(hash);
+        for (auto it = first; it != last; ++it)
+            if (std::memcmp(it->second->data.data(), data, POOL_PAGE_SIZE) == 0) {
+                ++it->second->refs;
+                ++refs;
+                return it->second->data.data();
+            }
+
+        std::unique_ptr<page> added = std::make_unique<page>();
+        std::memcpy(added->data.data(), data, POOL_PAGE_SIZE);
+        added->hash = hash;
+        added->refs = 1;
+        ++refs;
+
+        return index.emplace(hash, std::move(added))->second->data.data();
+    }
+
+    /// @brief Take another reference to a pooled page, released like the ones taken by `intern()`.
+    const u8* retain(const u8* data) {
+        std::lock_guard<std::mutex> guard(lock);
+        ++page_of(data)->refs;
+        ++refs;
+        return data;
+    }
+
+    /// @brief Release a reference taken by `intern()`, freeing the page if it was the last one.
+    void release(const u8* data) {
+        page* released = page_of(data);
+        std::lock_guard<std::mutex> guard(lock);
+
+        --refs;
+        if (--released->refs != 0)
+            return;
+
+        auto [first, last] = index.equal_range(released->hash);
+        for (auto it = first; it != last; ++it)
+            if (it->second.get() == released) {
+                index.erase(it);
+                return;
+            }
+    }
+
+    /// @brief Get the number of distinct pages in the pool.
+    usize get_page_count() {
+        std::lock_guard<std::mutex> guard(lock);
+        return index.size();
+    }
+
+    /// @brief Get the number of references to pooled pages, the pages there would be without sharing.
+    usize get_ref_count() {
+        std::lock_guard<std::mutex> guard(lock);
+        return refs;
+    }
+
+    page_pool() : refs(0) {}
+
+    page_pool(const page_pool&) = delete;
+    page_pool& operator=(const page_pool&) = delete;
+};
+
+/**
+ * @brief A RAM card whose pages are shared copy-on-write through a `page_pool`.
+ *
+ * All pages start out interned in the pool. Writing to a shared page first copies it into a private page owned by the
+ * card, and marks it dirty. `dedup()` is meant to be called periodically: private pages that were not written since
+ * the previous call are interned again, so that the card only holds privately what keeps changing or is unique to it.
+ *
+ * @note Reads cost an extra indirection through the page table compared to `ram_card`.
+ * @warning The card itself is not thread safe, `dedup()` must not run concurrently with accesses to the card.
+ * @see page_pool
+ */
+class paged_ram_card : public card {
+private:
+    struct page_slot {
+        u8* data;
+        bool shared;
+        bool dirty;
+    };
+
+    const u16 start_adr;
+    const usize capacity;
+    page_pool& pool;
+    std::vector<page_slot> slots;
+
+    void share(page_slot& slot) {
+        const u8* pooled = pool.intern(slot.data);
+        delete[] slot.data;
+        slot = { const_cast<u8*>(pooled), true, false };
+    }
+
+    u8* writable(usize offset) {
+        page_slot& slot = slots[offset / POOL_PAGE_SIZE];
+
+        if (slot.shared) {
+            u8* copy = new u8[POOL_PAGE_SIZE];
+            std::memcpy(copy, slot.data, POOL_PAGE_SIZE);
+            pool.release(slot.data);
+            slot.data = copy;
+            slot.shared = false;
+        }
+
+        slot.dirty = true;
+        return slot.data + offset % POOL_PAGE_SIZE;
+    }
+
+    void fill_from(const u8* begin, usize size, u8 fill) {
+        for (usize i = 0; i < slots.size(); ++i) {
+            u8* data = new u8[POOL_PAGE_SIZE];
+            std::memset(data, fill, POOL_PAGE_SIZE);
+
+            if (i * POOL_PAGE_SIZE < size)
+                std::memcpy(data, begin + i * POOL_PAGE_SIZE, std::min(POOL_PAGE_SIZE, size - i * POOL_PAGE_SIZE));
+
+            slots[i] = { data, false, false };
+            share(slots[i]);
+        }
+    }
+
+    void release_all() {
+        for (page_slot& slot : slots)
+            if (slot.shared)
+                pool.release(slot.data);
+            else
+                delete[] slot.data;
+    }
+
+public:
+    /**
+     * @brief Construct a card with a fixed capacity, filled with a byte and optionally some initial data.
+     * @param start_adr The starting address of the card.
+     * @param capacity The size in bytes of the card starting from the start address.
+     * @param pool The pool to share pages through, it must outlive the card.
+     * @param init The data to copy at the start of the card.
+     * @param fill The byte to fill the rest of the card with, default is BAD_U8.
+     * @throw `std::out_of_range` if the data exceeds the capacity.
+     */
+    paged_ram_card(u16 start_adr, usize capacity, page_pool& pool, const std::vector<u8>& init = {}, u8 fill = BAD_U8)
+        : start_adr(start_adr),
+          capacity((capacity == 0) ? init.size() : capacity),
+          pool(pool),
+          slots((this->capacity + POOL_PAGE_SIZE - 1) / POOL_PAGE_SIZE) {
+
+        if (init.size() > this->capacity)
+            throw std::out_of_range("Binary data exceeds card capacity.");
+
+        fill_from(init.data(), init.size(), fill);
+    }
+
+    ~paged_ram_card() override { release_all(); }
+
+    paged_ram_card(const paged_ram_card&) = delete;
+    paged_ram_card& operator=(const paged_ram_card&) = delete;
+
+    /// @name Deduplication methods.
+    /// \{
+
+    /**
+     * @brief Share private pages left unwritten since the previous call, and start tracking writes anew.
+     * @return The number of pages shared.
+     */
+    usize dedup() {
+        usize count = 0;
+
+        for (page_slot& slot : slots) {
+            if (slot.shared)
+                continue;
+
+            if (slot.dirty) {
+                slot.dirty = false;
+                continue;
+            }
+
+            share(slot);
+            ++count;
+        }
+
+        return count;
+    }
+
+    /**
+     * @brief Get the current contents of the card as pooled pages, which stay valid (and unchanged) until released.
+     * @return One page per `POOL_PAGE_SIZE` bytes of the card, each to be given back with `page_pool::release()`.
+     *
+     * Private pages are interned first, so that the next write to them copies them again: the cost of a frozen view
+     * is one page copy on the first write to each page, paid by the writer only if it writes.
+     */
+    std::vector<const u8*> freeze() {
+        std::vector<const u8*> frozen;
+        frozen.reserve(slots.size());
+
+        for (page_slot& slot : slots) {
+            if (!slot.shared)
+                share(slot);
+
+            frozen.push_back(pool.retain(slot.data));
+        }
+
+        return frozen;
+    }
+
+    /// @brief Get the pool the card shares its pages through.
+    page_pool& get_pool() const { return pool; }
+
+    /// @brief Get the number of pages held privately by this card.
+    usize get_private_pages() const {
+        usize count = 0;
+        for (const page_slot& slot : slots)
+            count += !slot.shared;
+        return count;
+    }
+
+    /// @brief Get the number of pages of the card.
+    usize get_page_count() const { return slots.size(); }
+
+    /// \}
+
+    /// @brief Check if an address on the bus is in the card's range.
+    bool in_range(u16 adr) const override { return adr >= start_adr and adr < (start_adr + capacity); }
+
+    /// @brief Get information about the card.
+    card_identify identify() override { return { start_adr, capacity, "ram area", "paged" }; }
+
+    /// @brief Read a byte from the card.
+    u8 read(u16 adr) override {
+        const usize offset = adr - start_adr;
+        return slots[offset / POOL_PAGE_SIZE].data[offset % POOL_PAGE_SIZE];
+    }
+
+    /// @brief Write a byte to the card, copying the page first if it is shared.
+    void write(u16 adr, u8 byte) override {
+        if (!this->write_locked)
+            write_force(adr, byte);
+    }
+
+    /// @brief Write a byte to the card regardless of write lock.
+    void write_force(u16 adr, u8 byte) override {
+        const usize offset = adr - start_adr;
+        const page_slot& slot = slots[offset / POOL_PAGE_SIZE];
+
+        // Rewriting the same value leaves a shared page shared.
+        if (slot.shared and slot.data[offset % POOL_PAGE_SIZE] == byte)
+            return;
+
+        *writable(offset) = byte;
+    }
+
+    /// @brief Check if the card is an I/O card.
+    bool is_io() const override { return false; }
+
+    /// @brief Clear the card, filling it with BAD_U8.
+    void clear() override {
+        if (this->write_locked)
+            return;
+
+        release_all();
+        fill_from(nullptr, 0, BAD_U8);
+    }
+
+    /// @name Unused methods.
+    /// \{
+
+    std::array<u8, 3> get_irq() override { return { BAD_U8, BAD_U8, BAD_U8 }; }
+
+    /// \}
+};
+
+#endif
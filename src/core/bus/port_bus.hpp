@@ -0,0 +1,112 @@
+#ifndef PORT_BUS_HPP_
+#define PORT_BUS_HPP_
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "typedef.hpp"
+#include "card.hpp"
+#include "util.hpp"
+#include "probes.hpp"
+
+/**
+ * @brief A flat memory array with a table of I/O port handlers, for running programs that use ports at full speed.
+ *
+ * Memory is a plain `std::array<u8, 65536>`, indexed directly by the CPU just like the flat array interface, so
+ * memory accesses cost nothing more. I/O cards (such as `serial_card`) are attached to the ports they answer on, and
+ * `IN`/`OUT` go straight through a 256 entry table to them, instead of searching the slots like `bus` does.
+ *
+ * Use it as `cpu<port_bus&> cpu(ports);`.
+ *
+ * @note Memory cards don't apply here, load memory through the CPU or `operator[]`. Cards are not owned.
+ */
+class port_bus {
+private:
+    std::array<u8, 65536> memory;
+    std::array<card*, 256> ports;
+    std::vector<card*> cards;
+
+    /// @brief The address an 8080 puts on the bus for a port, the port number duplicated on both halves.
+    static constexpr u16 port_adr(u8 port) { return port | (port << 8); }
+
+public:
+    /// @name Memory methods, as a flat array.
+    /// \{
+
+    inline u8& operator[](usize adr) { return memory[adr]; }
+    inline const u8& operator[](usize adr) const { return memory[adr]; }
+    constexpr usize size() const { return memory.size(); }
+
+    /// \}
+    /// @name I/O methods.
+    /// \{
+
+    /**
+     * @brief Attach an I/O card to every port it answers on.
+     * @param io_card The card, it must outlive the bus or be detached first.
+     * @throw `std::invalid_argument` if the card isn't an I/O card, or answers on a port already taken.
+     */
+    void attach(card* io_card) {
+        if (!io_card or !io_card->is_io())
+            throw std::invalid_argument("Only I/O cards can be attached to ports.");
+
+        for (usize port = 0; port < ports.size(); ++port)
+            if (io_card->in_range(port_adr(port)) and ports[port])
+                throw std::invalid_argument("Port " + util::to_hex_s(port, 2) + " is already taken by another card.");
+
+        for (usize port = 0; port < ports.size(); ++port)
+            if (io_card->in_range(port_adr(port)))
+                ports[port] = io_card;
+
+        cards.push_back(io_card);
+    }
+
+    /// @brief Detach an I/O card from all its ports.
+    void detach(card* io_card) {
+        std::replace(ports.begin(), ports.end(), io_card, static_cast<card*>(nullptr));
+        cards.erase(std::remove(cards.begin(), cards.end(), io_card), cards.end());
+    }
+
+    /// @brief Read a port, BAD_U8 if no card answers on it.
+    inline u8 read_port(u8 port) {
+        const u8 byte = ports[port] ? ports[port]->read(port_adr(port)) : BAD_U8;
+        BUDDY_PROBE2(io_read, port, byte);
+        return byte;
+    }
+
+    /// @brief Write a port, ignored if no card answers on it.
+    inline void write_port(u8 port, u8 byte) {
+        if (ports[port])
+            ports[port]->write(port_adr(port), byte);
+        BUDDY_PROBE2(io_write, port, byte);
+    }
+
+    /// @brief Check if any attached card has an IRQ raised.
+    inline bool is_irq() const {
+        for (const card* c : cards)
+            if (c->is_irq())
+                return true;
+
+        return false;
+    }
+
+    /**
+     * @brief Gets the IRQ instruction of the first attached card with an IRQ raised, see `bus::get_irq()`.
+     * @throws std::runtime_error if no IRQ is raised.
+     */
+    inline std::array<u8, 3> get_irq() {
+        for (card* c : cards)
+            if (c->is_irq())
+                return c->get_irq();
+
+        throw std::runtime_error("tried get_irq() while none was raised");
+    }
+
+    /// \}
+
+    port_bus() : memory(), ports() {}
+};
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef AOT_HPP_
+#define AOT_HPP_
+
+#include <array>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "bus.hpp"
+#include "card.hpp"
+#include "write_guard.hpp"
+#include "typedef.hpp"
+
+template <class bus_iface>
+class cpu;
+
+/// @brief A recompiled basic block, runs all its instructions and leaves PC at the next one to execute.
+using aot_fn = void (*)(cpu<bus&>&);
+
+/// @brief A basic block of a recompiled image, `len` bytes long starting at `start`.
+struct aot_block {
+    u16 start;
+    u16 len;
+    aot_fn fn;
+};
+
+/// @brief A ROM image recompiled by the `aotgen` tool, along with the bytes it was compiled from.
+struct aot_image {
+    const char* name;
+    u16 load_adr;
+    const u8* data;
+    usize size;
+    const aot_block* blocks;
+    usize block_count;
+};
+
+/// @brief Get the images compiled into the emulator at build time, see `AOT_ROMS` in the CMake files.
+const std::vector<const aot_image*>& aot_builtin_images();
+
+/**
+ * @brief Dispatch table from PC to recompiled blocks.
+ *
+ * Blocks are only installed if every byte they were compiled from is on the bus unchanged, on a write locked card,
+ * so that the recompiled code can never go stale. With write guarding on, blocks on RAM cards backed by page aligned
+ * external storage (see `machine_arena`) are installed too: their host pages are write protected through
+ * `write_guard`, and the first write to one uninstalls the blocks on it, so stores pay nothing until code is modified.
+ * Anything else (other RAM, code the recompiler did not discover, jumps into the middle of a block) is left to the
+ * interpreter.
+ *
+ * Lookups go through a per 256 byte page table, pages without blocks cost no memory.
+ *
+ * @note A block that writes into its own code runs to its end as compiled, the change is seen from the next block on.
+ */
+class aot_table {
+private:
+    using page_table = std::array<aot_fn, 256>;
+
+    std::array<std::unique_ptr<page_table>, 256> pages;
+    std::vector<const aot_block*> bound;
+    usize installed;
+    usize invalidated;
+
+    /// @brief Get the RAM card storage a byte can be guarded through, nullptr if there is none.
+    static u8* guardable(card* c, u16 adr) {
+        ram_card* ram = dynamic_cast<ram_card*>(c);
+        if (!ram or !ram->get_host_address(adr))
+            return nullptr;
+
+        // The whole card storage must be page aligned, or protecting it would catch writes to its neighbours.
+        const u8* base = ram->get_host_address(c->identify().start_adr);
+        if (reinterpret_cast<uintptr_t>(base) % write_guard::get_page_size() != 0)
+            return nullptr;
+
+        return ram->get_host_address(adr);
+    }
+
+    static bool is_bindable(const bus& cardbus, const aot_image& image, const aot_block& block, bool guard_ram) {
+        for (usize i = 0; i < block.len; ++i) {
+            const u16 adr = block.start + i;
+            const u8 slot = cardbus.get_slot_by_access(adr, false);
+
+            if (slot == 255)
+                return false;
+
+            card* c = cardbus.get_card(slot);
+            if (!c->is_w_locked() and !(guard_ram and guardable(c, adr)))
+                return false;
+
+            if (cardbus.peek(adr) != image.data[adr - image.load_adr])
+                return false;
+        }
+
+        return true;
+    }
+
+    /// @brief Write protect the RAM a block was compiled from, in one go so that a failure leaves nothing protected.
+    bool guard(const bus& cardbus, const aot_block& block) {
+        card* ram = nullptr;
+        u16 first = 0;
+        u16 last = 0;
+
+        for (usize i = 0; i < block.len; ++i) {
+            const u16 adr = block.start + i;
+            card* c = cardbus.get_card(cardbus.get_slot_by_access(adr, false));
+
+            if (c->is_w_locked())
+                continue;
+
+            // Blocks spanning two RAM cards are left to the interpreter, their storage isn't contiguous.
+            if (ram and (c != ram or adr != last + 1))
+                return false;
+
+            if (!ram)
+                first = adr;
+
+            ram = c;
+            last = adr;
+        }
+
+        return !ram or write_guard::protect(guardable(ram, first), first, last - first + 1, &aot_table::on_write, this);
+    }
+
+    /// @brief Uninstall the blocks overlapping written guest memory, called from the SIGSEGV handler.
+    static void on_write(void* ctx, u32 begin, u32 end) {
+        aot_table& table = *static_cast<aot_table*>(ctx);
+
+        for (const aot_block* block : table.bound) {
+            page_table* page = table.pages[block->start >> 8].get();
+
+            const bool overlaps = block->start < end and block->start + block->len > begin;
+
+            if (overlaps and (*page)[block->start & 0xFF] == block->fn) {
+                (*page)[block->start & 0xFF] = nullptr;
+                --table.installed;
+                ++table.invalidated;
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief Install the blocks of an image that match what is on the bus.
+     * @param image The recompiled image.
+     * @param cardbus The bus the blocks would run against.
+     * @param guard_ram Whether to also install blocks on RAM, write protecting it, see `write_guard`.
+     * @return The number of blocks installed.
+     */
+    usize bind(const aot_image& image, const bus& cardbus, bool guard_ram = false) {
+        usize count = 0;
+
+        // Grown up front, so that the fault handler never walks the list while it reallocates.
+        bound.reserve(bound.size() + image.block_count);
+
+        for (usize i = 0; i < image.block_count; ++i) {
+            const aot_block& block = image.blocks[i];
+
+            // Binding again only installs what is missing, such as blocks uninstalled by a write since.
+            if (find(block.start) == block.fn)
+                continue;
+
+            if (!is_bindable(cardbus, image, block, guard_ram) or !guard(cardbus, block))
+                continue;
+
+            std::unique_ptr<page_table>& page = pages[block.start >> 8];
+            if (!page)
+                page = std::make_unique<page_table>();
+
+            (*page)[block.start & 0xFF] = block.fn;
+            if (std::find(bound.begin(), bound.end(), &block) == bound.end())
+                bound.push_back(&block);
+            ++count;
+        }
+
+        installed += count;
+        return count;
+    }
+
+    /// @brief Get the block starting at an address, or nullptr to interpret.
+    inline aot_fn find(u16 pc) const {
+        const page_table* page = pages[pc >> 8].get();
+        return page ? (*page)[pc & 0xFF] : nullptr;
+    }
+
+    /// @brief Get the number of installed blocks.
+    usize get_installed() const { return installed; }
+
+    /// @brief Get the number of blocks uninstalled because their code was written to.
+    usize get_invalidated() const { return invalidated; }
+
+    aot_table() : pages(), installed(0), invalidated(0) {}
+
+    /// @brief Unprotect the RAM guarded for this table.
+    ~aot_table() { write_guard::release(this); }
+
+    aot_table(const aot_table&) = delete;
+    aot_table& operator=(const aot_table&) = delete;
+};
+
+#endif
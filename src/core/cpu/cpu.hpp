@@ -6,11 +6,19 @@
 #include <vector>
 #include <iostream>
 #include <stdexcept>
+#include <type_traits>
 
 #include "cpu_state.hpp"
 #include "typedef.hpp"
 #include "util.hpp"
 #include "bus.hpp"
+#include "port_bus.hpp"
+#include "trace_ring.hpp"
+#include "branch_trace.hpp"
+#include "guest_profiler.hpp"
+#include "coverage.hpp"
+#include "aot.hpp"
+#include "probes.hpp"
 #include "defines.hpp"
 
 /**
@@ -25,7 +33,9 @@
  * @note The class is completely defined in this header to allow templating the class to determine what bus interface
  * `bus_iface` to use. For example, you can:
  * - `cpu<bus&> cpu(cardbus);` or `cpu<> cpu(cardbus);` to create a standard CPU that interacts with a bus, or
- * - `cpu<std::array<u8, 65536>> cpu;` to instead have an empty array as a bus, for max performance!
+ * - `cpu<std::array<u8, 65536>> cpu;` to instead have an empty array as a bus, for max performance! or
+ * - `cpu<port_bus&> cpu(ports);` for flat array memory with I/O cards attached to a port table, so that programs
+ *   using ports (such as console I/O through a `serial_card`) still run at flat array speed.
  */
 template <class bus_iface = bus&>
 class cpu {
@@ -38,6 +48,15 @@ private:
     bool interrupts_enabled;
     
     util::print_helper printer;
+    trace_ring* tracer;
+    branch_trace* btrace;
+    guest_profiler* profiler;
+    coverage* cov;
+    const aot_table* aot;
+
+    #ifdef BUDDY_USDT_AVAILABLE
+    u64 probe_retired = 0;
+    #endif
 
     /* ~~~~~~~~~~~~~~~ vvv ~~~~~~~~~~~~~~ fetch ~~~~~~~~~~~~~~ vvv ~~~~~~~~~~~~~~~ */
 
@@ -46,6 +65,10 @@ private:
 
     u8 ext_op[2];
     bool ext_op_idx;
+    bool ext_fetching;
+
+    /// @brief Whether the address space has ports, with memory still a flat array.
+    static constexpr bool is_port_bus = std::is_same_v<bus_iface, port_bus&>;
     u8 fetch_ext() { bool idx = ext_op_idx; ext_op_idx = !ext_op_idx; return ext_op[idx]; }
     u16 fetch2_ext() { u16 lo = fetch_ext(); u16 hi = fetch_ext(); return (hi << 8) | lo; }
 
@@ -53,7 +76,10 @@ private:
     u16 (cpu::*fetch2_ptr)() = &cpu::fetch2_default;
 
     inline void set_fetch_ext(bool use_ext) {
-        if constexpr (!std::is_same_v<bus_iface, bus&>) {
+        if constexpr (is_port_bus) {
+            // A predictable branch in fetch() instead of an indirect call, to keep flat array speed.
+            ext_fetching = use_ext;
+        } else if constexpr (!std::is_same_v<bus_iface, bus&>) {
             if (use_ext)
                 throw std::runtime_error("Cannot use external fetch with non-bus interface.");
             else
@@ -65,14 +91,18 @@ private:
     }
 
     inline u8 fetch() {
-        if constexpr (!std::is_same_v<bus_iface, bus&>)
+        if constexpr (is_port_bus)
+            return ext_fetching ? fetch_ext() : fetch_default();
+        else if constexpr (!std::is_same_v<bus_iface, bus&>)
             return fetch_default();
         else
             return (this->*fetch_ptr)();
     }
 
     inline u16 fetch2() { 
-        if constexpr (!std::is_same_v<bus_iface, bus&>)
+        if constexpr (is_port_bus)
+            return ext_fetching ? fetch2_ext() : fetch2_default();
+        else if constexpr (!std::is_same_v<bus_iface, bus&>)
             return fetch2_default();
         else
             return (this->*fetch2_ptr)();
@@ -166,6 +196,66 @@ private:
         #endif
     }
 
+    /// @brief Read memory for debugging purposes, without the read being seen by bus taps.
+    inline u8 peek(u16 adr) {
+        if constexpr (std::is_same_v<bus_iface, bus&>)
+            return cardbus.peek(adr);
+        else
+            return cardbus[adr];
+    }
+
+    void trace_next() {
+        const u16 pc = state.PC();
+        const u8 opcode = peek(pc);
+        const usize len = util::get_opcode_len(opcode);
+
+        tracer->push(state, opcode,
+            (len > 1) ? peek(static_cast<u16>(pc + 1)) : 0,
+            (len > 2) ? peek(static_cast<u16>(pc + 2)) : 0,
+            interrupts_enabled ? static_cast<u8>(trace_status::INTE) : 0);
+    }
+
+    void cover_next() {
+        const u16 pc = state.PC();
+
+        cov->mark_instruction(pc, util::get_opcode_len(peek(pc)));
+    }
+
+    void branch_trace_next() {
+        const u16 pc = state.PC();
+
+        // Code written since it was last recorded goes in the trace before it runs.
+        btrace->fetch(pc, [this](u16 adr) { return peek(adr); });
+        const u8 opcode = peek(pc);
+
+        if (profiler)
+            profile_next();
+        else
+            execute(fetch());
+
+        btrace->retire(pc, opcode, state.PC(), state.A());
+    }
+
+    void profile_next() {
+        const u16 pc = state.PC();
+        const u16 sp = state.SP();
+        const u8 opcode = fetch();
+
+        execute(opcode);
+        profiler->retire(pc, sp, opcode, state);
+    }
+
+    inline bool run_aot() {
+        if constexpr (std::is_same_v<bus_iface, bus&>) {
+            if (const aot_fn block = aot->find(state.PC())) {
+                block(*this);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
     bool resolve_flag_cond(u8 cc) {
         switch (cc) {
             case 0b000: return !state.get_flag(cpu_flags::Z);
@@ -232,6 +322,9 @@ private:
             #endif
             
             RETURN();
+
+            if (profiler)
+                profiler->unwind(state.PC());
         }
     }
 
@@ -340,7 +433,7 @@ private:
 
     inline void _MOV_TO_M(cpu_registers8 src) { cardbus[state.HL()] = state.get_register8(src); }
 
-    inline void HLT() { halted = true; }
+    inline void HLT() { halted = true; BUDDY_PROBE1(halt, state.PC()); }
 
     inline void _ALU(cpu_registers8 src, u8 alu, bool is_immediate) {
         u16 a = state.A();
@@ -418,7 +511,9 @@ private:
     inline void CALL() { u16 adr = fetch2(); PUSH(cpu_registers16::PC); state.PC(adr); }
 
     inline void OUT() { 
-        if constexpr (!std::is_same_v<bus_iface, bus&>)
+        if constexpr (is_port_bus)
+            cardbus.write_port(fetch(), state.A());
+        else if constexpr (!std::is_same_v<bus_iface, bus&>)
             throw std::runtime_error("OUT instruction can only be used with a bus interface.");
         else {
             u16 port = fetch(); port |= (port << 8); cardbus.write(port, state.A(), true);
@@ -426,7 +521,9 @@ private:
     }
 
     inline void IN() {
-        if constexpr (!std::is_same_v<bus_iface, bus&>)
+        if constexpr (is_port_bus)
+            state.A(cardbus.read_port(fetch()));
+        else if constexpr (!std::is_same_v<bus_iface, bus&>)
             throw std::runtime_error("IN instruction can only be used with a bus interface.");
         else {
             u16 port = fetch(); port |= (port << 8); state.A(cardbus.read(port, true));
@@ -479,7 +576,21 @@ public:
                 return;
             if (do_handle_bdos)
                 handle_bdos();
-            execute(fetch());
+            if (cov)
+                cover_next();
+            if (tracer)
+                trace_next();
+            if (btrace)
+                branch_trace_next();
+            else if (profiler)
+                profile_next();
+            else if (!aot or !run_aot())
+                execute(fetch());
+
+            #ifdef BUDDY_USDT_AVAILABLE
+            if ((++probe_retired & (BUDDY_PROBE_INSN_BATCH - 1)) == 0)
+                BUDDY_PROBE2(insn_batch, probe_retired, state.PC());
+            #endif
         }
     }
 
@@ -496,6 +607,7 @@ public:
     void execute(u8 opcode, u8 operand1, u8 operand2 = 0) {
         ext_op[0] = operand1;
         ext_op[1] = operand2;
+        ext_op_idx = false;
         set_fetch_ext(true);
         execute(opcode);
         set_fetch_ext(false);
@@ -934,10 +1046,28 @@ public:
     /// @param pc The new PC value.
     void set_pc(u16 pc) { state.PC(pc); }
 
+    /// @brief Get the PC of the CPU.
+    /// @return The current PC value.
+    u16 get_pc() const { return state.PC(); }
+
     /// @brief Check if the CPU is halted.
     /// @return True if the CPU is halted, false otherwise.
     bool is_halted() const { return halted; }
 
+    /// @brief Check if the CPU accepts interrupts.
+    /// @return True if interrupts are enabled, false otherwise.
+    bool is_interrupt_enabled() const { return interrupts_enabled; }
+
+    /// @brief Set whether the CPU is halted, like when restoring a snapshot.
+    void set_halted(bool value) { halted = value; }
+
+    /// @brief Set whether the CPU accepts interrupts, like when restoring a snapshot.
+    void set_interrupt_enabled(bool value) { interrupts_enabled = value; }
+
+    /// @brief Get the address space the CPU is interacting with.
+    /// @return A reference to the bus, or to the internal array when not using a bus interface.
+    std::remove_reference_t<bus_iface>& get_adr_space() { return cardbus; }
+
     /// @brief Reset the CPU.
     void clear() {
         state = cpu_state();
@@ -962,23 +1092,109 @@ public:
     /// @param filename The name of the file to print to.
     void set_pseudo_bdos_redirect(const char* filename) { printer.set(filename); }
 
+    /// @brief Redirect pseudo BDOS print routines to a string, appending to it.
+    /// @param buffer The string to print to, it must outlive the redirection.
+    void set_pseudo_bdos_redirect(std::string& buffer) { printer.set(buffer); }
+
     /// @brief Redirect pseudo BDOS print routines back to stdout.
     void reset_pseudo_bdos_redirect() { printer.reset(); }
 
+    /// \}
+    /// @name Trace and profiling related methods.
+    /// \{
+
+    /**
+     * @brief Record each executed instruction into a ring buffer.
+     * @param ring The ring buffer to record into, or nullptr to stop recording.
+     *
+     * Unlike `ENABLE_TRACE` builds, this is always compiled in and can be toggled at runtime. While no ring is set,
+     * the cost is a single pointer check per step.
+     */
+    void set_trace_ring(trace_ring* ring) { tracer = ring; }
+
+    /**
+     * @brief Record the control flow of each executed instruction and interrupt into a branch trace.
+     * @param trace The branch trace, or nullptr to stop recording.
+     */
+    void set_branch_trace(branch_trace* trace) { btrace = trace; }
+
+    /**
+     * @brief Hand each executed instruction and interrupt entry to a guest profiler.
+     * @param prof The profiler, or nullptr to stop profiling.
+     */
+    void set_profiler(guest_profiler* prof) { profiler = prof; }
+
+    /**
+     * @brief Mark the address of each executed opcode and its operands in a coverage recorder.
+     * @param recorder The recorder, or nullptr to stop recording.
+     */
+    void set_coverage(coverage* recorder) { cov = recorder; }
+
+    /**
+     * @brief Run recompiled blocks instead of interpreting, wherever the table has one for PC.
+     * @param table The dispatch table, or nullptr to always interpret.
+     * @note A whole block runs as a single step and skips the fetch cycles, so don't combine this with tracing,
+     * profiling, coverage, bus capture or the debugger.
+     */
+    void set_aot(const aot_table* table) { aot = table; }
+
+    /// \}
+    /// @name Recompiled code methods.
+    /// \{
+
+    /// @brief Get the live CPU state, recompiled blocks work on it directly.
+    inline cpu_state& aot_state() { return state; }
+
+    /// @brief Get the bus interface, recompiled blocks access memory through it.
+    inline bus_iface& aot_bus() { return cardbus; }
+
+    /**
+     * @brief Execute an instruction that was decoded ahead of time.
+     * @param next_pc The address right after the instruction, PC is set to it before executing like after a fetch.
+     * @param opcode The opcode to execute.
+     * @param operand1 The first operand, if any.
+     * @param operand2 The second operand, if any.
+     */
+    inline void aot_execute(u16 next_pc, u8 opcode, u8 operand1 = 0, u8 operand2 = 0) {
+        state.set_register16(cpu_registers16::PC, next_pc);
+        execute(opcode, operand1, operand2);
+    }
+
     /// \}
     /// @name Interrupt related methods.
     /// \{
 
-    /// @brief Call an interrupt and push PC, then disable interrupts.
-    /// @param inst The interrupt instruction (with optional operands) to execute out of place.
-    /// @todo This allows any instruction and any retrieval of arguments, but I'm not sure if that happens other than on `CALL`.
+    /**
+     * @brief Accept an interrupt, running the instruction put on the bus, then disable interrupts.
+     * @param inst The interrupt instruction (with optional operands) to execute out of place.
+     *
+     * Like on the 8080, PC is only pushed by the instruction itself (`RST` or `CALL`). `RST n`, by far the most common,
+     * is delivered directly without going through the out of place execution.
+     *
+     * An interrupt also ends a halt, PC already points past the `HLT`, which is where the handler returns to.
+     */
     void interrupt(std::array<u8, 3> inst) {
         if (!interrupts_enabled)
             return;
 
         interrupts_enabled = false;
-        PUSH(cpu_registers16::PC);
-        execute(inst[0], inst[1], inst[2]);
+        halted = false;
+
+        if (tracer)
+            tracer->push(state, inst[0], inst[1], inst[2], static_cast<u8>(trace_status::INTERRUPT));
+
+        const u16 ret = state.PC();
+        BUDDY_PROBE2(interrupt, ret, inst[0]);
+
+        if ((inst[0] & 0b11000111) == 0b11000111)
+            RST((inst[0] >> 3) & 0b111);
+        else
+            execute(inst[0], inst[1], inst[2]);
+
+        if (profiler)
+            profiler->interrupt(ret, state.PC());
+        if (btrace)
+            btrace->interrupt(ret, state.PC());
     }
 
     /// \}
@@ -991,7 +1207,13 @@ public:
           do_handle_bdos(false), 
           interrupts_enabled(true), 
           printer(std::cout), 
-          ext_op_idx(false) {}
+          tracer(nullptr),
+          btrace(nullptr),
+          profiler(nullptr),
+          cov(nullptr),
+          aot(nullptr),
+          ext_op_idx(false),
+          ext_fetching(false) {}
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,356 @@
+#ifndef CPU_BATCH_HPP_
+#define CPU_BATCH_HPP_
+
+#include <array>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+
+#include "cpu.hpp"
+#include "cpu_state.hpp"
+#include "typedef.hpp"
+#include "util.hpp"
+
+/**
+ * @brief Runs many flat memory CPUs on the same program, executing each instruction across all the lanes at that PC.
+ *
+ * Each lane is a `cpu<std::array<u8, 65536>>` that owns the memory, while the register files of all lanes are kept in
+ * structure-of-arrays form: one array per register, indexed by lane. Every step picks the lowest PC among the running
+ * lanes (so that lanes that took different branches meet again as soon as possible), and lanes at that PC whose
+ * instruction bytes match execute it together.
+ *
+ * Moves, immediates, 16 bit increments, INR/DCR, register and immediate ALU operations and jumps run as branch free
+ * masked loops over all the lanes, which the compiler turns into vector code with as many lanes per instruction as
+ * the target's vector width allows. ALU operations get a loop each, with immediates broadcast to an array, so that
+ * no loop picks its operation or operand per lane. Everything else (memory and stack accesses, I/O, rotates, DAA,
+ * and pseudo BDOS calls) runs on the lane's own CPU, one lane at a time.
+ *
+ * @note Configure the lanes (load programs, redirect pseudo BDOS output) through `lane()` between calls to `run()`.
+ * @par
+ * @note A lane stuck in a loop below the others delays them until it leaves or halts.
+ */
+class cpu_batch {
+public:
+    using lane_cpu = cpu<std::array<u8, 65536>>;
+
+private:
+    /// @brief Register files, indexed like the opcode register fields, with F in place of M.
+    static constexpr usize REG_B = 0, REG_H = 4, REG_L = 5, REG_F = 6, REG_A = 7;
+
+    std::vector<std::unique_ptr<lane_cpu>> lanes;
+    std::array<std::vector<u8>, 8> r8;
+    std::vector<u16> sp;
+    std::vector<u16> pc;
+    std::vector<u8> halted;
+    std::vector<u8> mask;
+    std::vector<u8> imm;
+    bool do_handle_bdos;
+
+    u64 vector_lane_steps;
+    u64 scalar_lane_steps;
+
+    static constexpr u8 szp(u8 value) {
+        u8 parity = value ^ (value >> 4);
+        parity ^= parity >> 2;
+        parity ^= parity >> 1;
+
+        return (value ? 0 : static_cast<u8>(cpu_flags::Z)) | (value & static_cast<u8>(cpu_flags::S))
+             | ((parity & 1) ? 0 : static_cast<u8>(cpu_flags::P));
+    }
+
+    /// @brief Clean up a flags byte like `cpu_state` does, bits 3 and 5 always clear and bit 1 always set.
+    static constexpr u8 fix_flags(u8 flags) { return (flags & 0xD7) | 0x02; }
+
+    static constexpr bool is_bdos_adr(u16 adr) { return adr == 0x0000 or adr == 0x0005; }
+
+    void gather(usize i) {
+        const cpu_state s = lanes[i]->save_state();
+
+        for (usize reg = 0; reg < 8; ++reg)
+            if (reg != REG_F)
+                r8[reg][i] = s.get_register8(cpu_reg8_decode[reg]);
+
+        r8[REG_F][i] = s.get_register8(cpu_registers8::F);
+        sp[i] = s.SP();
+        pc[i] = s.PC();
+        halted[i] = lanes[i]->is_halted();
+    }
+
+    void scatter(usize i) {
+        cpu_state s;
+
+        for (usize reg = 0; reg < 8; ++reg)
+            if (reg != REG_F)
+                s.set_register8(cpu_reg8_decode[reg], r8[reg][i]);
+
+        s.set_register8(cpu_registers8::F, r8[REG_F][i]);
+        s.SP(sp[i]);
+        s.PC(pc[i]);
+        lanes[i]->load_state(s);
+    }
+
+    void step_scalar(usize i) {
+        scatter(i);
+        lanes[i]->step();
+        gather(i);
+        ++scalar_lane_steps;
+    }
+
+    /// @brief Run an ALU operation on A and a source register (or the broadcast immediate) across the masked lanes.
+    template <u8 alu>
+    void alu_lanes(const u8* with) {
+        const usize n = lanes.size();
+        const u8* m = mask.data();
+        u8* a = r8[REG_A].data();
+        u8* f = r8[REG_F].data();
+
+        for (usize i = 0; i < n; ++i) {
+            const u16 lhs = a[i];
+            const u16 rhs = with[i];
+            const u16 carry = f[i] & static_cast<u8>(cpu_flags::C);
+            u16 result;
+            bool ac;
+
+            if constexpr (alu == 0b000) {
+                result = lhs + rhs;
+                ac = ((lhs & 0x0F) + (rhs & 0x0F)) > 0x0F;
+            } else if constexpr (alu == 0b001) {
+                result = lhs + rhs + carry;
+                ac = ((lhs & 0x0F) + (rhs & 0x0F) + carry) > 0x0F;
+            } else if constexpr (alu == 0b010 or alu == 0b111) {
+                result = lhs - rhs;
+                ac = (lhs & 0x0F) >= (rhs & 0x0F);
+            } else if constexpr (alu == 0b011) {
+                result = lhs - rhs - carry;
+                ac = (lhs & 0x0F) >= (rhs & 0x0F);
+            } else if constexpr (alu == 0b100) {
+                result = lhs & rhs;
+                ac = (lhs | rhs) & 0x08;
+            } else if constexpr (alu == 0b101) {
+                result = lhs ^ rhs;
+                ac = false;
+            } else {
+                result = lhs | rhs;
+                ac = false;
+            }
+
+            const u8 flags = szp(static_cast<u8>(result)) | ((result & 0x100) ? static_cast<u8>(cpu_flags::C) : 0)
+                           | (ac ? static_cast<u8>(cpu_flags::AC) : 0);
+            f[i] = m[i] ? fix_flags(flags) : f[i];
+
+            // CMP only sets the flags.
+            if constexpr (alu != 0b111)
+                a[i] = m[i] ? static_cast<u8>(result) : a[i];
+        }
+    }
+
+    /// @brief Execute an instruction across the masked lanes, false if it has no vector implementation.
+    bool step_vector(u16 at, u8 op, u8 b1, u8 b2) {
+        const usize n = lanes.size();
+        const u8* m = mask.data();
+        const u16 next = at + util::get_opcode_len(op);
+        const u8 dst = (op >> 3) & 7, src = op & 7;
+
+        if (op == 0x00) {
+            // NOP, only PC moves.
+        } else if ((op & 0xC0) == 0x40 and dst != 6 and src != 6) {
+            u8* d = r8[dst].data();
+            const u8* s = r8[src].data();
+
+            // A blend rather than a select, so that the source is loaded for every lane and the loop has no branch.
+            for (usize i = 0; i < n; ++i) {
+                const u8 keep = m[i] - 1;
+                d[i] = (s[i] & ~keep) | (d[i] & keep);
+            }
+        } else if ((op & 0xC7) == 0x06 and dst != 6) {
+            u8* d = r8[dst].data();
+            for (usize i = 0; i < n; ++i)
+                d[i] = m[i] ? b1 : d[i];
+        } else if ((op & 0xCF) == 0x01 or (op & 0xCF) == 0x03 or (op & 0xCF) == 0x0B) {
+            const usize rp = (op >> 4) & 3;
+            const u16 imm = b1 | b2 << 8;
+            const u16 delta = (op & 0x08) ? 0xFFFF : 1;
+            const bool is_lxi = (op & 0x0F) == 0x01;
+
+            if (rp == 3) {
+                u16* s = sp.data();
+                for (usize i = 0; i < n; ++i)
+                    s[i] = m[i] ? static_cast<u16>(is_lxi ? imm : s[i] + delta) : s[i];
+            } else {
+                u8* hi = r8[rp * 2].data();
+                u8* lo = r8[rp * 2 + 1].data();
+                for (usize i = 0; i < n; ++i) {
+                    const u16 value = is_lxi ? imm : static_cast<u16>((hi[i] << 8 | lo[i]) + delta);
+                    hi[i] = m[i] ? static_cast<u8>(value >> 8) : hi[i];
+                    lo[i] = m[i] ? static_cast<u8>(value) : lo[i];
+                }
+            }
+        } else if (((op & 0xC7) == 0x04 or (op & 0xC7) == 0x05) and dst != 6) {
+            const bool is_inr = (op & 0x07) == 0x04;
+            u8* d = r8[dst].data();
+            u8* f = r8[REG_F].data();
+
+            for (usize i = 0; i < n; ++i) {
+                const u8 value = is_inr ? d[i] + 1 : d[i] - 1;
+                const bool ac = is_inr ? ((value ^ (value - 1)) & 0x10) : (~(value ^ (value + 1)) & 0x10);
+                const u8 flags = (f[i] & static_cast<u8>(cpu_flags::C)) | szp(value)
+                               | (ac ? static_cast<u8>(cpu_flags::AC) : 0);
+                d[i] = m[i] ? value : d[i];
+                f[i] = m[i] ? fix_flags(flags) : f[i];
+            }
+        } else if (((op & 0xC0) == 0x80 and src != 6) or (op & 0xC7) == 0xC6) {
+            const bool is_imm = (op & 0xC0) == 0xC0;
+            if (is_imm)
+                std::fill(imm.begin(), imm.end(), b1);
+
+            // One loop per operation, so that none of them branches per lane.
+            const u8* with = is_imm ? imm.data() : r8[src].data();
+            switch (dst) {
+                case 0b000: alu_lanes<0b000>(with); break;
+                case 0b001: alu_lanes<0b001>(with); break;
+                case 0b010: alu_lanes<0b010>(with); break;
+                case 0b011: alu_lanes<0b011>(with); break;
+                case 0b100: alu_lanes<0b100>(with); break;
+                case 0b101: alu_lanes<0b101>(with); break;
+                case 0b110: alu_lanes<0b110>(with); break;
+                default: alu_lanes<0b111>(with); break;
+            }
+        } else if (op == 0xC3 or (op & 0xC7) == 0xC2) {
+            static constexpr u8 COND_FLAG[4] = {
+                static_cast<u8>(cpu_flags::Z), static_cast<u8>(cpu_flags::C),
+                static_cast<u8>(cpu_flags::P), static_cast<u8>(cpu_flags::S)
+            };
+
+            const u16 target = b1 | b2 << 8;
+            const u8 flag = COND_FLAG[dst >> 1];
+            const bool want = dst & 1;
+            const bool always = op == 0xC3;
+            const u8* f = r8[REG_F].data();
+            u16* p = pc.data();
+
+            for (usize i = 0; i < n; ++i) {
+                const bool taken = always or (static_cast<bool>(f[i] & flag) == want);
+                p[i] = m[i] ? (taken ? target : next) : p[i];
+            }
+
+            vector_lane_steps += count_mask();
+            return true;
+        } else {
+            return false;
+        }
+
+        u16* p = pc.data();
+        for (usize i = 0; i < n; ++i)
+            p[i] = m[i] ? next : p[i];
+
+        vector_lane_steps += count_mask();
+        return true;
+    }
+
+    usize count_mask() const {
+        usize count = 0;
+        for (u8 bit : mask)
+            count += bit;
+        return count;
+    }
+
+public:
+    /// @brief Get a lane's CPU, to load programs or inspect memory and state between runs.
+    lane_cpu& lane(usize i) { return *lanes.at(i); }
+
+    /// @brief Get the number of lanes.
+    usize size() const { return lanes.size(); }
+
+    /// @brief Set whether all the lanes resolve BDOS calls internally, see `cpu::do_pseudo_bdos()`.
+    void do_pseudo_bdos(bool should) {
+        do_handle_bdos = should;
+        for (std::unique_ptr<lane_cpu>& c : lanes)
+            c->do_pseudo_bdos(should);
+    }
+
+    /**
+     * @brief Execute instructions until all the lanes halt, or for a maximum number of steps.
+     * @param max_steps The maximum number of steps, each one executing a single instruction on one or more lanes.
+     * @return The number of steps executed.
+     */
+    usize run(usize max_steps = static_cast<usize>(-1)) {
+        const usize n = lanes.size();
+        usize steps = 0;
+
+        for (usize i = 0; i < n; ++i)
+            gather(i);
+
+        for (; steps < max_steps; ++steps) {
+            u16 at = 0xFFFF;
+            usize first = n;
+
+            for (usize i = 0; i < n; ++i)
+                if (!halted[i] and (first == n or pc[i] < at)) {
+                    at = pc[i];
+                    first = i;
+                }
+
+            if (first == n)
+                break;
+
+            const std::array<u8, 65536>& mem = lanes[first]->get_adr_space();
+            const u8 op = mem[at];
+            const usize len = util::get_opcode_len(op);
+            const u8 b1 = (len > 1) ? mem[static_cast<u16>(at + 1)] : 0;
+            const u8 b2 = (len > 2) ? mem[static_cast<u16>(at + 2)] : 0;
+
+            for (usize i = 0; i < n; ++i)
+                mask[i] = !halted[i] and pc[i] == at;
+
+            // Lanes whose code differs at this PC (self modified, or loaded differently) can't share the instruction.
+            for (usize i = first + 1; i < n; ++i)
+                if (mask[i]) {
+                    const std::array<u8, 65536>& other = lanes[i]->get_adr_space();
+                    if (other[at] != op or (len > 1 and other[static_cast<u16>(at + 1)] != b1)
+                        or (len > 2 and other[static_cast<u16>(at + 2)] != b2)) {
+                        mask[i] = 0;
+                        step_scalar(i);
+                    }
+                }
+
+            if ((do_handle_bdos and is_bdos_adr(at)) or !step_vector(at, op, b1, b2))
+                for (usize i = 0; i < n; ++i)
+                    if (mask[i])
+                        step_scalar(i);
+        }
+
+        for (usize i = 0; i < n; ++i)
+            scatter(i);
+
+        return steps;
+    }
+
+    /// @brief Get the number of lane instructions executed in vector form.
+    u64 get_vector_lane_steps() const { return vector_lane_steps; }
+
+    /// @brief Get the number of lane instructions executed one lane at a time.
+    u64 get_scalar_lane_steps() const { return scalar_lane_steps; }
+
+    /**
+     * @brief Construct a batch of lanes with zeroed memory and registers.
+     * @param lane_count The number of lanes.
+     * @throw `std::invalid_argument` if the lane count is zero.
+     */
+    cpu_batch(usize lane_count)
+        : sp(lane_count), pc(lane_count), halted(lane_count), mask(lane_count), imm(lane_count),
+          do_handle_bdos(false), vector_lane_steps(0), scalar_lane_steps(0) {
+
+        if (lane_count == 0)
+            throw std::invalid_argument("A CPU batch needs at least one lane.");
+
+        for (std::vector<u8>& reg : r8)
+            reg.resize(lane_count);
+
+        lanes.reserve(lane_count);
+        for (usize i = 0; i < lane_count; ++i)
+            lanes.push_back(std::make_unique<lane_cpu>(std::array<u8, 65536> {}));
+    }
+};
+
+#endif
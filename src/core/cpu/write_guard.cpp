@@ -0,0 +1,134 @@
+#include "write_guard.hpp"
+
+#include <array>
+#include <atomic>
+#include <csignal>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace {
+
+struct guarded_page {
+    u8* page;
+    i32 guest;
+    write_guard::invalidate_fn fn;
+    void* ctx;
+};
+
+constexpr usize MAX_GUARDED_PAGES = 256;
+
+std::array<guarded_page, MAX_GUARDED_PAGES> guarded {};
+std::atomic<usize> faults { 0 };
+struct sigaction previous {};
+bool installed = false;
+
+void unprotect(u8* page) { mprotect(page, write_guard::get_page_size(), PROT_READ | PROT_WRITE); }
+
+bool is_guarded(u8* page, const void* ctx = nullptr) {
+    for (const guarded_page& entry : guarded)
+        if (entry.page == page and (!ctx or entry.ctx == ctx))
+            return true;
+    return false;
+}
+
+void on_fault(int sig, siginfo_t* info, void* uctx) {
+    const usize size = write_guard::get_page_size();
+    u8* page = reinterpret_cast<u8*>(reinterpret_cast<uintptr_t>(info->si_addr) & ~(size - 1));
+    bool handled = false;
+
+    for (guarded_page& entry : guarded)
+        if (entry.page and entry.page == page) {
+            if (!handled)
+                unprotect(page);
+
+            const i32 begin = entry.guest < 0 ? 0 : entry.guest;
+            const i32 past = entry.guest + static_cast<i32>(size);
+            const i32 end = past > 0x10000 ? 0x10000 : past;
+            entry.fn(entry.ctx, begin, end);
+            entry.page = nullptr;
+            handled = true;
+        }
+
+    if (handled) {
+        faults.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Not ours: let whoever was there before handle it, or crash the usual way when the store is retried.
+    if (previous.sa_flags & SA_SIGINFO)
+        previous.sa_sigaction(sig, info, uctx);
+    else if (previous.sa_handler != SIG_DFL and previous.sa_handler != SIG_IGN)
+        previous.sa_handler(sig);
+    else
+        sigaction(SIGSEGV, &previous, nullptr);
+}
+
+}
+
+usize write_guard::get_page_size() {
+    static const usize size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+bool write_guard::protect(u8* host, u16 guest, usize size, invalidate_fn fn, void* ctx) {
+    const usize page_size = get_page_size();
+    u8* first = reinterpret_cast<u8*>(reinterpret_cast<uintptr_t>(host) & ~(page_size - 1));
+    u8* last = reinterpret_cast<u8*>(reinterpret_cast<uintptr_t>(host + size - 1) & ~(page_size - 1));
+
+    usize free_entries = 0;
+    for (const guarded_page& entry : guarded)
+        free_entries += !entry.page;
+
+    if (size == 0 or free_entries < static_cast<usize>((last - first) / page_size + 1))
+        return false;
+
+    if (!installed) {
+        struct sigaction action {};
+        action.sa_sigaction = on_fault;
+        action.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&action.sa_mask);
+
+        if (sigaction(SIGSEGV, &action, &previous) < 0)
+            return false;
+
+        installed = true;
+    }
+
+    // Pages are all protected before any is registered, so that a failure leaves none of them guarded.
+    for (u8* page = first; page <= last; page += page_size) {
+        if (is_guarded(page) or mprotect(page, page_size, PROT_READ) == 0)
+            continue;
+
+        for (u8* done = first; done < page; done += page_size)
+            if (!is_guarded(done))
+                unprotect(done);
+
+        return false;
+    }
+
+    for (u8* page = first; page <= last; page += page_size) {
+        if (is_guarded(page, ctx))
+            continue;
+
+        for (guarded_page& entry : guarded)
+            if (!entry.page) {
+                entry = { page, static_cast<i32>(guest) - static_cast<i32>(host - page), fn, ctx };
+                break;
+            }
+    }
+
+    return true;
+}
+
+void write_guard::release(void* ctx) {
+    for (guarded_page& entry : guarded)
+        if (entry.page and entry.ctx == ctx) {
+            u8* page = entry.page;
+            entry.page = nullptr;
+
+            if (!is_guarded(page))
+                unprotect(page);
+        }
+}
+
+usize write_guard::get_fault_count() { return faults.load(std::memory_order_relaxed); }
@@ -0,0 +1,46 @@
+#ifndef WRITE_GUARD_HPP_
+#define WRITE_GUARD_HPP_
+
+#include "typedef.hpp"
+
+/**
+ * @brief Detects writes to guest code through host page protection, so that stores themselves check nothing.
+ *
+ * Host pages backing guest code are made read only. The first write to one of them faults, and a SIGSEGV handler
+ * makes the page writable again and calls the invalidation callback registered with it, with the guest address range
+ * the page backs, before the faulting store is retried. Faults on addresses that aren't guarded go to the previously
+ * installed handler, or crash as usual.
+ *
+ * @note Callbacks run in a signal handler: they must only do async signal safe work, such as clearing table entries.
+ * @par
+ * @note Only memory that is page aligned and owned by nothing else (such as `machine_arena::allocate_pages()`) can be
+ * guarded, since everything else in a protected page would fault too.
+ * @warning Registration isn't thread safe, guard pages before running the code that writes to them.
+ */
+class write_guard {
+public:
+    /// @brief Called on the first write to a guarded page, with the guest addresses [begin, end) it backs.
+    using invalidate_fn = void (*)(void* ctx, u32 begin, u32 end);
+
+    /**
+     * @brief Write protect the host pages backing some guest memory.
+     * @param host The host address backing `guest`.
+     * @param guest The first guest address to guard.
+     * @param size The number of bytes to guard, whole host pages around them are protected.
+     * @param fn The callback on the first write to each page.
+     * @param ctx The context passed to the callback, also used to `release()` the pages.
+     * @return False if the memory can't be guarded (not page aligned storage, or too many guarded pages).
+     */
+    static bool protect(u8* host, u16 guest, usize size, invalidate_fn fn, void* ctx);
+
+    /// @brief Unprotect and forget all the pages guarded with a context.
+    static void release(void* ctx);
+
+    /// @brief Get the number of writes caught since the process started.
+    static usize get_fault_count();
+
+    /// @brief Get the size of a host page.
+    static usize get_page_size();
+};
+
+#endif
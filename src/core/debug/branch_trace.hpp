@@ -0,0 +1,574 @@
+#ifndef BRANCH_TRACE_HPP_
+#define BRANCH_TRACE_HPP_
+
+#include <array>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+#include <functional>
+
+#include "bus.hpp"
+#include "util.hpp"
+#include "typedef.hpp"
+
+/// @brief One instruction of a path rebuilt from a branch trace.
+struct branch_step {
+    u16 pc;
+    u8 opcode;
+    /// @brief The bytes following the opcode in memory when it ran, whether the instruction uses them or not.
+    u8 op1;
+    u8 op2;
+    /// @brief The byte read by an `IN` instruction, zero for others.
+    u8 input;
+    /// @brief Whether an interrupt was taken right before this instruction.
+    bool interrupted;
+};
+
+/**
+ * @brief A compressed record of the control flow of a run, from which the exact path can be rebuilt offline.
+ *
+ * In the spirit of Intel PT, only what can't be known by reading the code is recorded, as a stream of packets:
+ *  - one bit per conditional jump, call or return, whether it was taken, packed six to a byte,
+ *  - one more bit per return, set if it went back right after the matching call (both sides keep a call stack of the
+ *    last `STACK_DEPTH` return addresses), otherwise followed by the target address,
+ *  - the target address of each `PCHL`,
+ *  - the byte read by each `IN`,
+ *  - interrupts and other jumps the code didn't make (pseudo BDOS calls, debugger PC changes) with their target and
+ *    the number of instructions since the previous one,
+ *  - like the sideband of Intel PT, the contents of a 256 byte page of memory the first time execution enters it after
+ *    it was written to, with the number of instructions since the previous packet of this kind.
+ *
+ * Everything else (straight line code, direct jumps, calls and restarts) costs nothing, so a run costs a little over
+ * one bit per branch. The decoder walks a copy of memory from the start of the run, updated by the page packets, and
+ * reads the stream each time it reaches an instruction the code alone doesn't decide.
+ *
+ * Packets start with a header byte: `1nnnnnnn` for branch bits, the highest set bit of `n` marking the end of the
+ * bits below it, oldest first, or one of `packet` followed by its payload (u16 little endian addresses, varint
+ * counts).
+ *
+ * @note Writes are only known through `mark_written()`, which `branch_trace_tap` calls for a bus. Without it (on a flat
+ * array CPU), the decoder sees memory as it was at the start, and code changed or loaded by the run can't be rebuilt.
+ */
+class branch_trace {
+public:
+    /// @brief The depth of the call stacks used to compress returns.
+    static constexpr usize STACK_DEPTH = 64;
+
+private:
+    static constexpr char MAGIC[4] = { 'B', '8', 'B', 'T' };
+    static constexpr u16 VERSION = 2;
+    static constexpr usize TNT_BITS = 6;
+
+    enum packet : u8 {
+        TIP = 0x01, INPUT = 0x02, INTERRUPT = 0x03, RESYNC = 0x04, END = 0x05, PAGE = 0x06
+    };
+
+    enum class flow : u8 {
+        NONE, JUMP, COND_JUMP, CALL, COND_CALL, RET, COND_RET, RST, PCHL, IN
+    };
+
+    /// @brief The same stack of return addresses on both sides, dropping the oldest ones past its depth.
+    struct call_stack {
+        std::array<u16, STACK_DEPTH> entries {};
+        usize top = 0;
+        usize depth = 0;
+
+        inline void push(u16 adr) {
+            entries[top++ % STACK_DEPTH] = adr;
+            depth += depth < STACK_DEPTH;
+        }
+
+        inline bool pop(u16& adr) {
+            if (depth == 0)
+                return false;
+
+            adr = entries[--top % STACK_DEPTH];
+            --depth;
+            return true;
+        }
+
+        inline void clear() { depth = 0; }
+    };
+
+    /// @brief How each opcode changes the flow of execution.
+    static constexpr std::array<flow, 256> FLOW = []() {
+        std::array<flow, 256> table {};
+
+        for (usize op = 0; op < 256; ++op) {
+            if ((op & 0b11000111) == 0b11000010) table[op] = flow::COND_JUMP;
+            else if ((op & 0b11000111) == 0b11000100) table[op] = flow::COND_CALL;
+            else if ((op & 0b11000111) == 0b11000000) table[op] = flow::COND_RET;
+            else if ((op & 0b11000111) == 0b11000111) table[op] = flow::RST;
+        }
+
+        table[0xC3] = flow::JUMP;
+        table[0xCD] = flow::CALL;
+        table[0xC9] = flow::RET;
+        table[0xE9] = flow::PCHL;
+        table[0xDB] = flow::IN;
+        return table;
+    }();
+
+    std::vector<u8> stream;
+    std::array<u64, 4> written;
+    call_stack calls;
+    u8 tnt;
+    usize tnt_count;
+    i32 expected;
+    u64 since_async;
+    u64 instructions;
+
+    inline void put_bit(bool bit) {
+        tnt |= bit << tnt_count;
+        if (++tnt_count == TNT_BITS)
+            flush();
+    }
+
+    inline void put_u16(u16 value) {
+        stream.push_back(value & 0xFF);
+        stream.push_back(value >> 8);
+    }
+
+    inline void put_varint(u64 value) {
+        while (value >= 0x80) {
+            stream.push_back(static_cast<u8>(value) | 0x80);
+            value >>= 7;
+        }
+        stream.push_back(static_cast<u8>(value));
+    }
+
+    void put_async(packet type, u16 target) {
+        stream.push_back(type);
+        put_varint(since_async);
+        put_u16(target);
+        since_async = 0;
+    }
+
+    void put_return(u16 target) {
+        u16 top;
+        const bool matched = calls.pop(top) and top == target;
+
+        put_bit(matched);
+        if (!matched) {
+            flush();
+            stream.push_back(TIP);
+            put_u16(target);
+        }
+    }
+
+    template <class read_fn>
+    void put_page(u8 page, const read_fn& read) {
+        stream.push_back(PAGE);
+        put_varint(since_async);
+        stream.push_back(page);
+
+        for (usize i = 0; i < 256; ++i)
+            stream.push_back(read(static_cast<u16>(page << 8 | i)));
+
+        written[page >> 6] &= ~(1ULL << (page & 63));
+        since_async = 0;
+    }
+
+    inline bool is_written(u8 page) const { return written[page >> 6] & (1ULL << (page & 63)); }
+
+public:
+    /// @name Encoding methods.
+    /// \{
+
+    /// @brief Note a write to memory, the page it's in is recorded again before any instruction is run from it.
+    inline void mark_written(u16 adr) { written[adr >> 14] |= 1ULL << ((adr >> 8) & 63); }
+
+    /**
+     * @brief Record the pages an instruction is about to be fetched from, if they were written since last recorded.
+     * @param pc The address of the instruction, before it runs.
+     * @param read Reads a byte of memory, without side effects.
+     */
+    template <class read_fn>
+    inline void fetch(u16 pc, const read_fn& read) {
+        const u8 first = pc >> 8, last = static_cast<u16>(pc + 2) >> 8;
+
+        if (is_written(first))
+            put_page(first, read);
+        if (last != first and is_written(last))
+            put_page(last, read);
+    }
+
+    /**
+     * @brief Record a retired instruction.
+     * @param pc The address it was fetched from.
+     * @param opcode The opcode.
+     * @param next The PC after it ran.
+     * @param a The accumulator after it ran, the byte read by an `IN`.
+     */
+    inline void retire(u16 pc, u8 opcode, u16 next, u8 a) {
+        if (pc != expected) {
+            put_async(RESYNC, pc);
+            calls.clear();
+        }
+
+        ++since_async;
+        ++instructions;
+        expected = next;
+
+        switch (FLOW[opcode]) {
+            case flow::NONE:
+            case flow::JUMP:
+                return;
+
+            case flow::COND_JUMP:
+                put_bit(next != static_cast<u16>(pc + 3));
+                return;
+
+            case flow::COND_CALL:
+                put_bit(next != static_cast<u16>(pc + 3));
+                if (next != static_cast<u16>(pc + 3))
+                    calls.push(pc + 3);
+                return;
+
+            case flow::CALL:
+                calls.push(pc + 3);
+                return;
+
+            case flow::RST:
+                calls.push(pc + 1);
+                return;
+
+            case flow::COND_RET:
+                put_bit(next != static_cast<u16>(pc + 1));
+                if (next != static_cast<u16>(pc + 1))
+                    put_return(next);
+                return;
+
+            case flow::RET:
+                put_return(next);
+                return;
+
+            case flow::PCHL:
+                flush();
+                stream.push_back(TIP);
+                put_u16(next);
+                return;
+
+            case flow::IN:
+                flush();
+                stream.push_back(INPUT);
+                stream.push_back(a);
+                return;
+        }
+    }
+
+    /**
+     * @brief Record an interrupt, taken between two instructions.
+     * @param ret The PC pushed by the interrupt.
+     * @param target The PC the interrupt went to.
+     */
+    void interrupt(u16 ret, u16 target) {
+        put_async(INTERRUPT, target);
+        calls.push(ret);
+        expected = target;
+    }
+
+    /// @brief Write out the pending branch bits, the stream so far is then complete.
+    void flush() {
+        if (tnt_count == 0)
+            return;
+
+        stream.push_back(0x80 | (1 << tnt_count) | tnt);
+        tnt = 0;
+        tnt_count = 0;
+    }
+
+    /// @brief Mark the end of the run, after which the decoder stops.
+    void finish() {
+        flush();
+        stream.push_back(END);
+        put_varint(since_async);
+        since_async = 0;
+        expected = -1;
+    }
+
+    /// @brief Get the stream recorded so far, call `flush()` or `finish()` first.
+    const std::vector<u8>& get_stream() const { return stream; }
+
+    /// @brief Get the number of instructions recorded.
+    u64 get_instructions() const { return instructions; }
+
+    /// @brief Forget everything recorded, the next instruction starts a new stream.
+    void clear() {
+        stream.clear();
+        written.fill(0);
+        calls.clear();
+        tnt = 0;
+        tnt_count = 0;
+        expected = -1;
+        since_async = 0;
+        instructions = 0;
+    }
+
+    /**
+     * @brief Write the trace to a file, after the memory it runs on.
+     * @param filename The path of the file to write.
+     * @param image The 64 KB of memory at the start of the run.
+     * @throw `std::runtime_error` if the file could not be written.
+     * @note Call `finish()` first.
+     */
+    void save(const char* filename, const std::vector<u8>& image) const {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+
+        if (!file.is_open())
+            throw std::runtime_error("Could not open branch trace file: " + std::string(filename));
+
+        file.write(MAGIC, sizeof(MAGIC));
+        file.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+        file.write(reinterpret_cast<const char*>(image.data()), 65536);
+        file.write(reinterpret_cast<const char*>(stream.data()), stream.size());
+
+        if (image.size() != 65536 or file.fail())
+            throw std::runtime_error("Failed to write branch trace file: " + std::string(filename));
+    }
+
+    /**
+     * @brief Read back a file written by `save()`.
+     * @param filename The path of the file to read.
+     * @param image Where to store the memory at the start of the run.
+     * @return The stream.
+     * @throw `std::runtime_error` if the file can't be read or is not a branch trace.
+     */
+    static std::vector<u8> load(const char* filename, std::vector<u8>& image) {
+        std::ifstream file(filename, std::ios::binary);
+        char magic[4];
+        u16 version;
+
+        if (!file.is_open())
+            throw std::runtime_error("Could not open branch trace file: " + std::string(filename));
+
+        file.read(magic, sizeof(magic));
+        file.read(reinterpret_cast<char*>(&version), sizeof(version));
+
+        if (!file or std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+            throw std::runtime_error("Not a branch trace file: " + std::string(filename));
+
+        if (version != VERSION)
+            throw std::runtime_error("Unsupported branch trace version.");
+
+        image.resize(65536);
+        file.read(reinterpret_cast<char*>(image.data()), image.size());
+
+        if (!file)
+            throw std::runtime_error("Branch trace file is truncated: " + std::string(filename));
+
+        return std::vector<u8>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    /// \}
+    /// @name Decoding methods.
+    /// \{
+
+    /**
+     * @brief Rebuild the path of a run.
+     * @param stream The stream, ending with `finish()`.
+     * @param image The 64 KB of memory at the start of the run.
+     * @param fn Called for each instruction of the path, in order.
+     * @return The number of instructions of the path.
+     * @throw `std::runtime_error` if the stream is corrupted or doesn't match the memory, naming the address.
+     */
+    static u64 decode(
+        const std::vector<u8>& stream, const std::vector<u8>& image, const std::function<void(const branch_step&)>& fn
+    ) {
+        if (image.size() != 65536)
+            throw std::invalid_argument("A branch trace decodes on 64 KB of memory.");
+
+        // Page packets update a copy, the image stays as it was at the start.
+        std::vector<u8> memory = image;
+        u16 pc = 0;
+
+        // Branch bits, addresses and inputs are read in order from one cursor, interrupts and resyncs from another.
+        usize sync = 0, async = 0;
+        u8 bits = 0;
+        usize bit_count = 0;
+
+        auto fail = [&]() -> void {
+            throw std::runtime_error("Branch trace does not match the memory at " + util::to_hex_s(pc) + ".");
+        };
+
+        auto get = [&](usize& at) -> u8 {
+            if (at >= stream.size())
+                throw std::runtime_error("Branch trace is truncated.");
+            return stream[at++];
+        };
+
+        auto get_u16 = [&](usize& at) -> u16 { const u8 lo = get(at); return lo | (get(at) << 8); };
+
+        auto get_varint = [&](usize& at) -> u64 {
+            u64 value = 0;
+            for (usize shift = 0; shift < 64; shift += 7) {
+                const u8 byte = get(at);
+                value |= static_cast<u64>(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                    return value;
+            }
+            throw std::runtime_error("Branch trace is corrupted.");
+        };
+
+        // Skip to the next packet of the given kind, sync (branch bits, TIP, INPUT) or async.
+        auto next_packet = [&](usize& at, bool want_async) -> u8 {
+            while (true) {
+                const u8 header = get(at);
+                const bool is_async = header == INTERRUPT or header == RESYNC or header == END or header == PAGE;
+
+                if (is_async == want_async)
+                    return header;
+
+                if (header & 0x80)
+                    continue;
+                else if (header == TIP)
+                    at += 2;
+                else if (header == INPUT)
+                    at += 1;
+                else if (header == INTERRUPT or header == RESYNC)
+                    get_varint(at), at += 2;
+                else if (header == END)
+                    get_varint(at);
+                else if (header == PAGE)
+                    get_varint(at), at += 257;
+                else
+                    throw std::runtime_error("Branch trace is corrupted.");
+            }
+        };
+
+        auto get_bit = [&]() -> bool {
+            if (bit_count == 0) {
+                const u8 header = next_packet(sync, false);
+                if (!(header & 0x80) or (header & 0x7F) == 0)
+                    fail();
+
+                bit_count = 6;
+                while (!((header >> bit_count) & 1))
+                    --bit_count;
+                bits = header & ((1 << bit_count) - 1);
+            }
+
+            const bool bit = bits & 1;
+            bits >>= 1;
+            --bit_count;
+            return bit;
+        };
+
+        auto get_sync = [&](packet type) -> u16 {
+            if (bit_count != 0 or next_packet(sync, false) != type)
+                fail();
+            return type == TIP ? get_u16(sync) : get(sync);
+        };
+
+        call_stack calls;
+        u8 async_type = next_packet(async, true);
+        u64 async_count = get_varint(async);
+        u64 walked = 0, total = 0;
+        bool started = false, interrupted = false;
+
+        while (true) {
+            while (walked == async_count) {
+                if (async_type == END)
+                    return total;
+
+                if (async_type == PAGE) {
+                    const u8 page = get(async);
+                    for (usize i = 0; i < 256; ++i)
+                        memory[page << 8 | i] = get(async);
+                } else {
+                    const u16 target = get_u16(async);
+                    if (async_type == INTERRUPT) {
+                        calls.push(pc);
+                        interrupted = true;
+                    } else
+                        calls.clear();
+
+                    pc = target;
+                    started = true;
+                }
+
+                walked = 0;
+                async_type = next_packet(async, true);
+                async_count = get_varint(async);
+            }
+
+            if (!started)
+                fail();
+
+            const u8 opcode = memory[pc];
+            const u8 op1 = memory[static_cast<u16>(pc + 1)], op2 = memory[static_cast<u16>(pc + 2)];
+            const u16 fallthrough = pc + util::get_opcode_len(opcode);
+            const u16 direct = op1 | (op2 << 8);
+            u16 next = fallthrough;
+            u8 input = 0;
+
+            auto do_return = [&]() {
+                u16 top;
+                const bool popped = calls.pop(top);
+
+                if (get_bit()) {
+                    if (!popped)
+                        fail();
+                    next = top;
+                } else
+                    next = get_sync(TIP);
+            };
+
+            switch (FLOW[opcode]) {
+                case flow::NONE: break;
+                case flow::JUMP: next = direct; break;
+                case flow::COND_JUMP: if (get_bit()) next = direct; break;
+                case flow::CALL: calls.push(fallthrough); next = direct; break;
+                case flow::COND_CALL:
+                    if (get_bit()) {
+                        calls.push(fallthrough);
+                        next = direct;
+                    }
+                    break;
+                case flow::RST: calls.push(fallthrough); next = opcode & 0b00111000; break;
+                case flow::COND_RET: if (get_bit()) do_return(); break;
+                case flow::RET: do_return(); break;
+                case flow::PCHL: next = get_sync(TIP); break;
+                case flow::IN: input = get_sync(INPUT); break;
+            }
+
+            fn({ pc, opcode, op1, op2, input, interrupted });
+            interrupted = false;
+            pc = next;
+            ++walked;
+            ++total;
+        }
+    }
+
+    /// \}
+
+    branch_trace() : written(), tnt(0), tnt_count(0), expected(-1), since_async(0), instructions(0) {}
+};
+
+/// @brief Tells a branch trace which memory is written on a bus, so that code run from it is recorded, see `fetch()`.
+class branch_trace_tap : public bus_tap {
+private:
+    bus& cardbus;
+    branch_trace& trace;
+
+public:
+    /// @brief Get the interest of the tap, every write to memory, forced or not.
+    u8 page_interest(u8, bool io) const override {
+        return io ? 0 : static_cast<u8>(bus_access::WRITE) | static_cast<u8>(bus_access::FORCED_WRITE);
+    }
+
+    /// @brief Mark the page written to.
+    void on_access(u16 adr, u8, bool, bus_access) override { trace.mark_written(adr); }
+
+    /// @brief Attach to a bus, on behalf of a trace.
+    branch_trace_tap(bus& cardbus, branch_trace& trace) : cardbus(cardbus), trace(trace) { cardbus.attach_tap(this); }
+
+    ~branch_trace_tap() override { cardbus.detach_tap(this); }
+
+    branch_trace_tap(const branch_trace_tap&) = delete;
+    branch_trace_tap& operator=(const branch_trace_tap&) = delete;
+};
+
+#endif
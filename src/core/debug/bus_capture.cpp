@@ -0,0 +1,280 @@
+#include "bus_capture.hpp"
+
+#include <cstring>
+#include <sstream>
+
+#include "util.hpp"
+
+bus_capture::bus_capture(bus& cardbus, const char* filename, const std::vector<capture_range>& ranges)
+    : cardbus(&cardbus), ranges(ranges), file(filename, std::ios::binary | std::ios::trunc), prev_adr(0xFFFF),
+      prev_slot(NO_SLOT), fetch_pc(0), fetch_len(0), captured(0), dropped(0), back_full(false), stopping(false) {
+
+    if (!file.is_open())
+        throw std::runtime_error("Could not open bus capture file: " + std::string(filename));
+
+    bus_capture_header header {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    front.reserve(BLOCK_SIZE + 8);
+    back.reserve(BLOCK_SIZE + 8);
+    reset_block();
+
+    writer = std::thread(&bus_capture::writer_loop, this);
+    cardbus.attach_tap(this);
+}
+
+void bus_capture::close() {
+    if (!writer.joinable())
+        return;
+
+    cardbus->detach_tap(this);
+
+    if (!front.empty() or front_block.dropped)
+        swap_buffers(true);
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+
+    wake.notify_all();
+    writer.join();
+    file.close();
+}
+
+bool bus_capture::in_ranges(u16 adr, bool io) const {
+    const u16 at = io ? (adr & 0xFF) : adr;
+
+    for (const capture_range& range : ranges)
+        if (range.io == io and at >= range.start and at <= range.end)
+            return true;
+
+    return false;
+}
+
+void bus_capture::reset_block() {
+    front_block = { 0, 0, captured, 0 };
+    prev_adr = 0xFFFF;
+    prev_slot = NO_SLOT;
+}
+
+void bus_capture::encode(u16 adr, u8 data, u8 status, u8 slot) {
+    u8 tag = status;
+    const i16 delta = static_cast<i16>(static_cast<u16>(adr - prev_adr));
+
+    if (slot != prev_slot)
+        tag |= SLOT_FOLLOWS;
+
+    if (delta == 1)
+        tag |= ADR_SEQ;
+    else if (delta == 0)
+        tag |= ADR_SAME;
+    else if (delta >= -128 and delta <= 127)
+        tag |= ADR_REL8;
+    else
+        tag |= ADR_ABS;
+
+    front.push_back(tag);
+
+    if (tag & SLOT_FOLLOWS)
+        front.push_back(slot);
+
+    if ((tag & ADR_MASK) == ADR_REL8)
+        front.push_back(static_cast<u8>(delta));
+    else if ((tag & ADR_MASK) == ADR_ABS) {
+        front.push_back(adr & 0xFF);
+        front.push_back(adr >> 8);
+    }
+
+    front.push_back(data);
+
+    prev_adr = adr;
+    prev_slot = slot;
+    ++front_block.records;
+    ++captured;
+
+    if (front.size() >= BLOCK_SIZE)
+        swap_buffers(false);
+}
+
+void bus_capture::swap_buffers(bool wait) {
+    std::unique_lock<std::mutex> guard(lock);
+
+    if (wait)
+        wake.wait(guard, [this] { return !back_full; });
+
+    if (back_full) {
+        // The writer is behind: rather than blocking the CPU thread, lose this block and say so in the next one.
+        const u64 lost = front_block.dropped + front_block.records;
+        dropped += front_block.records;
+        front.clear();
+        reset_block();
+        front_block.dropped = lost;
+        return;
+    }
+
+    front_block.size = static_cast<u32>(front.size());
+    back_block = front_block;
+    std::swap(front, back);
+    back_full = true;
+
+    front.clear();
+    reset_block();
+    guard.unlock();
+    wake.notify_all();
+}
+
+void bus_capture::writer_loop() {
+    std::unique_lock<std::mutex> guard(lock);
+
+    while (true) {
+        wake.wait(guard, [this] { return back_full or stopping; });
+
+        if (!back_full)
+            return;
+
+        guard.unlock();
+        file.write(reinterpret_cast<const char*>(&back_block), sizeof(back_block));
+        file.write(reinterpret_cast<const char*>(back.data()), back.size());
+        file.flush();
+        guard.lock();
+
+        back.clear();
+        back_full = false;
+        wake.notify_all();
+    }
+}
+
+u8 bus_capture::page_interest(u8 page, bool io) const {
+    static constexpr u8 ALL = static_cast<u8>(bus_access::READ) | static_cast<u8>(bus_access::WRITE);
+
+    if (ranges.empty())
+        return ALL;
+
+    for (const capture_range& range : ranges) {
+        if (range.io != io)
+            continue;
+
+        if (io ? (page >= range.start and page <= range.end) : (page >= (range.start >> 8) and page <= (range.end >> 8)))
+            return ALL;
+    }
+
+    return 0;
+}
+
+void bus_capture::on_access(u16 adr, u8 byte, bool io, bus_access kind) {
+    u8 status = (io ? static_cast<u8>(bus_cycle_status::IO) : 0)
+              | (kind == bus_access::WRITE ? static_cast<u8>(bus_cycle_status::WRITE) : 0);
+
+    if (!io and kind == bus_access::READ) {
+        if (fetch_len == 0 and adr == fetch_pc) {
+            status |= static_cast<u8>(bus_cycle_status::FETCH) | static_cast<u8>(bus_cycle_status::OPCODE);
+            fetch_len = util::get_opcode_len(byte);
+        } else if (adr != fetch_pc and static_cast<u16>(adr - fetch_pc) < fetch_len) {
+            status |= static_cast<u8>(bus_cycle_status::FETCH);
+        }
+    }
+
+    if (!ranges.empty() and !in_ranges(adr, io))
+        return;
+
+    encode(adr, byte, status, cardbus->get_slot_by_access(adr, io));
+}
+
+std::vector<capture_range> bus_capture::parse_filter(const std::string& filter) {
+    std::vector<capture_range> out;
+    std::stringstream ss(filter);
+    std::string item;
+
+    while (std::getline(ss, item, ',')) {
+        if (item.empty())
+            continue;
+
+        const usize colon = item.find(':');
+        if (colon == std::string::npos)
+            throw std::invalid_argument("Bus capture filter ranges must start with mem: or io:");
+
+        const std::string kind = item.substr(0, colon);
+        if (kind != "mem" and kind != "io")
+            throw std::invalid_argument("Bus capture filter ranges must start with mem: or io:");
+
+        const std::string span = item.substr(colon + 1);
+        const usize dash = span.find('-');
+
+        try {
+            const unsigned long start = std::stoul(span.substr(0, dash), nullptr, 16);
+            const unsigned long end = (dash == std::string::npos) ? start : std::stoul(span.substr(dash + 1), nullptr, 16);
+            const unsigned long limit = (kind == "io") ? 0xFF : 0xFFFF;
+
+            if (start > end or end > limit)
+                throw std::invalid_argument("");
+
+            out.push_back({ static_cast<u16>(start), static_cast<u16>(end), kind == "io" });
+        } catch (const std::logic_error&) {
+            throw std::invalid_argument("Invalid bus capture filter range: " + item);
+        }
+    }
+
+    return out;
+}
+
+std::vector<bus_cycle> bus_capture::read(const char* filename, u64& dropped) {
+    std::ifstream in(filename, std::ios::binary);
+
+    if (!in.is_open())
+        throw std::runtime_error("Could not open bus capture file: " + std::string(filename));
+
+    bus_capture_header header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!in or std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+        throw std::runtime_error("Not a bus capture file: " + std::string(filename));
+
+    if (header.version != VERSION)
+        throw std::runtime_error("Unsupported bus capture version.");
+
+    std::vector<bus_cycle> out;
+    std::vector<u8> data;
+    bus_capture_block block;
+    dropped = 0;
+
+    while (in.read(reinterpret_cast<char*>(&block), sizeof(block))) {
+        data.resize(block.size);
+        in.read(reinterpret_cast<char*>(data.data()), data.size());
+
+        if (static_cast<usize>(in.gcount()) != data.size())
+            throw std::runtime_error("Bus capture file is truncated: " + std::string(filename));
+
+        dropped += block.dropped;
+
+        u16 adr = 0xFFFF;
+        u8 slot = NO_SLOT;
+        usize at = 0;
+
+        const auto next = [&]() -> u8 {
+            if (at >= data.size())
+                throw std::runtime_error("Bus capture block is corrupted.");
+            return data[at++];
+        };
+
+        for (u32 i = 0; i < block.records; ++i) {
+            const u8 tag = next();
+
+            if (tag & SLOT_FOLLOWS)
+                slot = next();
+
+            switch (tag & ADR_MASK) {
+                case ADR_SEQ: ++adr; break;
+                case ADR_SAME: break;
+                case ADR_REL8: adr += static_cast<i8>(next()); break;
+                default: adr = next(); adr |= next() << 8; break;
+            }
+
+            out.push_back({ block.first_index + i, adr, next(), static_cast<u8>(tag & 0x0F), slot });
+        }
+    }
+
+    return out;
+}
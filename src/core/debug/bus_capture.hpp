@@ -0,0 +1,172 @@
+#ifndef BUS_CAPTURE_HPP_
+#define BUS_CAPTURE_HPP_
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+
+#include "bus.hpp"
+#include "typedef.hpp"
+
+/// @brief Bitmasks of the status of a captured bus cycle.
+enum class bus_cycle_status : u8 {
+    IO = 0x01, WRITE = 0x02, FETCH = 0x04, OPCODE = 0x08
+};
+
+/// @brief A single decoded bus cycle, `slot` being the answering card slot or 255 if none answered.
+struct bus_cycle {
+    u64 index;
+    u16 adr;
+    u8 data;
+    u8 status;
+    u8 slot;
+};
+
+/// @brief An address or port range to capture, inclusive on both ends.
+struct capture_range {
+    u16 start;
+    u16 end;
+    bool io;
+};
+
+/// @brief Header of a capture file, followed by blocks.
+struct bus_capture_header {
+    char magic[4];
+    u16 version;
+    u16 reserved;
+    u64 reserved2;
+};
+
+/// @brief Header of a block of delta encoded cycles, each block can be decoded on its own.
+struct bus_capture_block {
+    u32 size;
+    u32 records;
+    u64 first_index;
+    u64 dropped;
+};
+
+/**
+ * @brief A logic analyzer for the bus, streaming every bus cycle into a compact capture file.
+ *
+ * Registered as a `bus_tap`, it records the address, data, memory or I/O, read or write, fetch or data status and the
+ * slot of the answering card of each cycle. The emulator tells where each instruction starts with `begin_instruction()`,
+ * so that opcode and operand fetches can be told apart from data reads.
+ *
+ * Cycles are delta encoded into the front of a double buffer: a tag byte holds the status bits and how the address is
+ * encoded (next after the previous one, same as the previous one, 8 bit signed delta, or absolute), then come the slot
+ * (only if it changed), the address bytes if any, and the data byte. Sequential fetches take 2 bytes each. Once the
+ * front buffer fills up it's swapped with the back buffer, which a background thread writes to disk, so the CPU thread
+ * never waits on I/O. If the writer falls behind, the full front block is dropped and its cycles are counted in the
+ * header of the next block instead.
+ *
+ * Only the configured ranges are captured, and the bus only calls into the capture on pages that overlap them.
+ */
+class bus_capture : public bus_tap {
+private:
+    static constexpr char MAGIC[4] = { 'B', '8', 'B', 'C' };
+    static constexpr u16 VERSION = 1;
+    static constexpr usize BLOCK_SIZE = 1 << 20;
+    static constexpr u8 NO_SLOT = 255;
+
+    /// @brief Bits of the tag byte above the status bits.
+    enum tag_bits : u8 {
+        SLOT_FOLLOWS = 0x10, ADR_SEQ = 0x00, ADR_SAME = 0x20, ADR_REL8 = 0x40, ADR_ABS = 0x60, ADR_MASK = 0x60
+    };
+
+    bus* cardbus;
+    std::vector<capture_range> ranges;
+
+    std::ofstream file;
+    std::vector<u8> front;
+    std::vector<u8> back;
+    bus_capture_block front_block;
+    bus_capture_block back_block;
+    u16 prev_adr;
+    u8 prev_slot;
+
+    u16 fetch_pc;
+    usize fetch_len;
+
+    u64 captured;
+    u64 dropped;
+
+    std::thread writer;
+    std::mutex lock;
+    std::condition_variable wake;
+    bool back_full;
+    bool stopping;
+
+    bool in_ranges(u16 adr, bool io) const;
+    void encode(u16 adr, u8 data, u8 status, u8 slot);
+    void reset_block();
+    void swap_buffers(bool wait);
+    void writer_loop();
+
+public:
+    /**
+     * @brief Mark the start of an instruction, so that the next read at PC is taken as the opcode fetch.
+     * @param pc The PC of the instruction about to be executed.
+     */
+    inline void begin_instruction(u16 pc) {
+        fetch_pc = pc;
+        fetch_len = 0;
+    }
+
+    /// @brief Get the number of cycles captured so far, written or not.
+    u64 get_captured() const { return captured; }
+
+    /// @brief Get the number of cycles dropped because the writer fell behind.
+    u64 get_dropped() const { return dropped; }
+
+    /**
+     * @brief Flush the buffered cycles and close the file, waiting for the writer.
+     *
+     * Called on destruction, calling it earlier lets the file be read back while the capture still exists.
+     */
+    void close();
+
+    /**
+     * @brief Parse a filter, like `mem:F800-FFFF,io:10-11,io:20`.
+     * @param filter Comma separated ranges, each `mem:` or `io:` followed by a hex address or an inclusive hex range.
+     * @return The ranges, empty if the filter is empty.
+     * @throw `std::invalid_argument` on a malformed filter.
+     */
+    static std::vector<capture_range> parse_filter(const std::string& filter);
+
+    /**
+     * @brief Read back a capture file.
+     * @param filename The path of the file to read.
+     * @param dropped Where to store the total number of dropped cycles.
+     * @return The decoded cycles, in order.
+     * @throw `std::runtime_error` if the file can't be read or is not a bus capture.
+     */
+    static std::vector<bus_cycle> read(const char* filename, u64& dropped);
+
+    /// @name Bus tap methods.
+    /// \{
+
+    u8 page_interest(u8 page, bool io) const override;
+    void on_access(u16 adr, u8 byte, bool io, bus_access kind) override;
+
+    /// \}
+
+    /**
+     * @brief Construct a capture and start its writer thread.
+     * @param cardbus The bus to capture.
+     * @param filename The path of the capture file to write.
+     * @param ranges The ranges to capture, everything if empty.
+     * @throw `std::runtime_error` if the file could not be opened.
+     */
+    bus_capture(bus& cardbus, const char* filename, const std::vector<capture_range>& ranges = {});
+
+    ~bus_capture() { close(); }
+
+    bus_capture(const bus_capture&) = delete;
+    bus_capture& operator=(const bus_capture&) = delete;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef COVERAGE_HPP_
+#define COVERAGE_HPP_
+
+#include <array>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+#include "bus.hpp"
+#include "typedef.hpp"
+#include "util.hpp"
+
+/// @brief Enumerates the coverage bitmaps, each having one bit per address.
+enum class coverage_kind {
+    OPCODE, OPERAND, DATA
+};
+
+/**
+ * @brief Address coverage recorder, one bit per address in three 64K bitmaps.
+ *
+ * The CPU marks the address of every executed opcode and of its operand bytes. Data reads and writes are seen by
+ * registering as a `bus_tap`, reads of the bytes of the instruction being executed are fetches and are not counted as
+ * data. Without a bus (like on a flat array address space) only opcode and operand coverage is recorded.
+ *
+ * The report maps coverage onto each memory card of the bus, in the same order and notation as `bus_map_s()`, and an
+ * assembler listing can be annotated with a marker per addressed line, telling which routines ran and which never did.
+ */
+class coverage : public bus_tap {
+private:
+    static constexpr usize WORDS = 65536 / 64;
+
+    using bitmap = std::array<u64, WORDS>;
+
+    bus* cardbus;
+    std::array<bitmap, 3> bits;
+    u16 fetch_start;
+    u8 fetch_len;
+
+    static constexpr void set_bit(bitmap& map, u16 adr) { map[adr >> 6] |= (1ULL << (adr & 63)); }
+
+    static std::string percent(usize count, usize range) {
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(1) << (range ? 100.0 * count / range : 0.0) << "%";
+        return ss.str();
+    }
+
+public:
+    /// @name Run loop methods, called by the CPU.
+    /// \{
+
+    /**
+     * @brief Mark an instruction about to be executed.
+     * @param pc The address of the opcode.
+     * @param len The length of the instruction, opcode included.
+     */
+    inline void mark_instruction(u16 pc, usize len) {
+        set_bit(bits[static_cast<usize>(coverage_kind::OPCODE)], pc);
+        for (usize i = 1; i < len; ++i)
+            set_bit(bits[static_cast<usize>(coverage_kind::OPERAND)], static_cast<u16>(pc + i));
+
+        fetch_start = pc;
+        fetch_len = len;
+    }
+
+    /// \}
+    /// @name Query methods.
+    /// \{
+
+    /// @brief Check if an address is covered in a bitmap.
+    bool test(coverage_kind kind, u16 adr) const {
+        return (bits[static_cast<usize>(kind)][adr >> 6] >> (adr & 63)) & 1;
+    }
+
+    /// @brief Count the covered addresses in a bitmap, in the range [start, start + range).
+    usize count(coverage_kind kind, u16 start = 0, usize range = 65536) const {
+        usize total = 0;
+        for (usize i = 0; i < range and start + i < 65536; ++i)
+            total += test(kind, static_cast<u16>(start + i));
+        return total;
+    }
+
+    /// @brief Forget all coverage.
+    void clear() {
+        for (bitmap& map : bits)
+            map.fill(0);
+    }
+
+    /// \}
+    /// @name Report methods.
+    /// \{
+
+    /**
+     * @brief Get the coverage of each memory card on the bus.
+     * @return A std::string with one line per memory card, in slot order.
+     * @throw `std::logic_error` if the recorder was constructed without a bus.
+     */
+    std::string card_report() const {
+        if (!cardbus)
+            throw std::logic_error("Coverage card report needs a bus.");
+
+        std::stringstream ss;
+
+        for (usize slot = 0; slot < bus::get_slot_count(); ++slot) {
+            card* c = cardbus->get_card(slot);
+            if (!c or c->is_io())
+                continue;
+
+            const card_identify ident = c->identify();
+            const usize exec = count(coverage_kind::OPCODE, ident.start_adr, ident.adr_range);
+            const usize operand = count(coverage_kind::OPERAND, ident.start_adr, ident.adr_range);
+            const usize data = count(coverage_kind::DATA, ident.start_adr, ident.adr_range);
+
+            ss << "Slot " << std::setw(2) << slot << ": "
+               << util::to_hex_s(ident.start_adr, 4) << "/" << ident.adr_range << " " << ident.name << ": "
+               << exec << " opcodes, " << operand << " operands (" << percent(exec + operand, ident.adr_range)
+               << " code), " << data << " data (" << percent(data, ident.adr_range) << ")\n";
+        }
+
+        return ss.str();
+    }
+
+    /**
+     * @brief Annotate an assembler listing with coverage.
+     * @param filename The listing, with lines starting by a 4 digit hex address and a tab (like `cpudiag.lst`).
+     * @return The listing, each addressed line prefixed by `X ` if its opcode was executed, `d ` if only read as operand or
+     * accessed as data, `- ` if never touched, and other lines prefixed by two spaces.
+     * @throw `std::runtime_error` if the file could not be opened.
+     */
+    std::string annotate_listing(const std::string& filename) const {
+        std::ifstream file(filename);
+
+        if (!file.is_open())
+            throw std::runtime_error("Could not open listing file: " + filename);
+
+        std::string line, out;
+
+        while (std::getline(file, line)) {
+            const bool addressed = line.size() > 4 and line[4] == '\t'
+                and line.find_first_not_of("0123456789ABCDEFabcdef") == 4;
+
+            if (!addressed) {
+                out += "  " + line + "\n";
+                continue;
+            }
+
+            const u16 adr = static_cast<u16>(std::stoul(line.substr(0, 4), nullptr, 16));
+
+            if (test(coverage_kind::OPCODE, adr))
+                out += "X ";
+            else if (test(coverage_kind::DATA, adr) or test(coverage_kind::OPERAND, adr))
+                out += "d ";
+            else
+                out += "- ";
+
+            out += line + "\n";
+        }
+
+        return out;
+    }
+
+    /// \}
+    /// @name Bus tap methods.
+    /// \{
+
+    u8 page_interest(u8, bool io) const override {
+        return io ? 0 : static_cast<u8>(bus_access::READ) | static_cast<u8>(bus_access::WRITE);
+    }
+
+    void on_access(u16 adr, u8, bool, bus_access kind) override {
+        if (kind == bus_access::READ and static_cast<u16>(adr - fetch_start) < fetch_len)
+            return;
+
+        set_bit(bits[static_cast<usize>(coverage_kind::DATA)], adr);
+    }
+
+    /// \}
+
+    /**
+     * @brief Construct a coverage recorder.
+     * @param cardbus The bus to record data accesses and report cards from, or nullptr for code coverage only.
+     */
+    coverage(bus* cardbus = nullptr) : cardbus(cardbus), bits(), fetch_start(0), fetch_len(0) {
+        if (cardbus)
+            cardbus->attach_tap(this);
+    }
+
+    ~coverage() {
+        if (cardbus)
+            cardbus->detach_tap(this);
+    }
+
+    coverage(const coverage&) = delete;
+    coverage& operator=(const coverage&) = delete;
+};
+
+#endif
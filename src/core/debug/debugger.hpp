@@ -0,0 +1,355 @@
+#ifndef DEBUGGER_HPP_
+#define DEBUGGER_HPP_
+
+#include <array>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+
+#include "cpu_state.hpp"
+#include "bus.hpp"
+#include "typedef.hpp"
+
+/// @brief Enumerates the reasons the debugger can stop the machine for.
+enum class debug_event_kind {
+    NONE, BREAKPOINT, WATCH_READ, WATCH_WRITE, PORT_READ, PORT_WRITE, HALTED
+};
+
+/// @brief Describes why the machine stopped at `pc`, with `adr` and `byte` only meaningful for watchpoints.
+struct debug_event {
+    debug_event_kind kind;
+    u16 pc;
+    u16 adr;
+    u8 byte;
+};
+
+/// @brief Enumerates the comparisons available to conditional breakpoints.
+enum class debug_compare {
+    EQ, NE, LT, LE, GT, GE
+};
+
+/**
+ * @brief A condition on the value of a register, for conditional breakpoints.
+ *
+ * The condition can test either an 8 bit register or a 16 bit register pair against a value.
+ */
+struct debug_condition {
+    bool is_pair;
+    cpu_registers8 reg;
+    cpu_registers16 pair;
+    debug_compare cmp;
+    u16 value;
+
+    /// @brief Check if the condition holds on a CPU state.
+    bool test(const cpu_state& state) const {
+        u16 current = is_pair ? state.get_register16(pair) : state.get_register8(reg);
+
+        switch (cmp) {
+            case debug_compare::EQ: return current == value;
+            case debug_compare::NE: return current != value;
+            case debug_compare::LT: return current < value;
+            case debug_compare::LE: return current <= value;
+            case debug_compare::GT: return current > value;
+            case debug_compare::GE: return current >= value;
+            default: return false;
+        }
+    }
+
+    debug_condition(cpu_registers8 reg, debug_compare cmp, u8 value)
+        : is_pair(false), reg(reg), pair(cpu_registers16::AF), cmp(cmp), value(value) {}
+
+    debug_condition(cpu_registers16 pair, debug_compare cmp, u16 value)
+        : is_pair(true), reg(cpu_registers8::A), pair(pair), cmp(cmp), value(value) {}
+};
+
+/**
+ * @brief Breakpoint and watchpoint engine based on address bitmaps.
+ *
+ * Execution breakpoints live in a 64K bit bitmap, tested before each instruction with a single load, shift and mask.
+ * Conditional breakpoints set the same bit, and their conditions are only evaluated when the bit is hit. Memory and
+ * port watchpoints are kept in their own bitmaps, and the debugger registers itself as a `bus_tap` so that the bus only
+ * calls into it on pages that hold a watched address: unwatched pages pay for a page table lookup and nothing more.
+ *
+ * A watchpoint hit is latched during the access and reported before the next instruction, after the accessing
+ * instruction completed, like the hardware watchpoints of most debuggers.
+ *
+ * Usage from the run loop is:
+ * ```
+ * if (dbg.check(pc) and dbg.confirm(pc, state))
+ *     stop with dbg.event()
+ * ```
+ * and `resume(pc)` must be called when resuming after a stop, so that a breakpoint at the resume address is stepped over.
+ */
+class debugger : public bus_tap {
+private:
+    static constexpr usize ADR_WORDS = 65536 / 64;
+    static constexpr usize PORT_WORDS = 256 / 64;
+
+    using adr_bitmap = std::array<u64, ADR_WORDS>;
+    using port_bitmap = std::array<u64, PORT_WORDS>;
+
+    bus* cardbus;
+
+    adr_bitmap exec_bits;
+    adr_bitmap unconditional_bits;
+    adr_bitmap read_bits;
+    adr_bitmap write_bits;
+    port_bitmap port_read_bits;
+    port_bitmap port_write_bits;
+    std::unordered_map<u16, std::vector<debug_condition>> conditions;
+
+    bool watch_hit;
+    bool skip_once;
+    debug_event last_event;
+
+    template <usize N>
+    static constexpr bool test_bit(const std::array<u64, N>& bits, usize i) { return (bits[i >> 6] >> (i & 63)) & 1; }
+
+    template <usize N>
+    static constexpr void set_bit(std::array<u64, N>& bits, usize i, bool value) {
+        if (value)
+            bits[i >> 6] |= (1ULL << (i & 63));
+        else
+            bits[i >> 6] &= ~(1ULL << (i & 63));
+    }
+
+    static constexpr bool any_in_page(const adr_bitmap& bits, u8 page) {
+        const usize first = page * 4;
+        return bits[first] | bits[first + 1] | bits[first + 2] | bits[first + 3];
+    }
+
+    void refresh_exec_bit(u16 adr) {
+        set_bit(exec_bits, adr, test_bit(unconditional_bits, adr) or conditions.count(adr));
+    }
+
+    void refresh_bus() {
+        if (cardbus)
+            cardbus->refresh_taps();
+    }
+
+public:
+    /// @name Breakpoint methods.
+    /// \{
+
+    /// @brief Set an unconditional execution breakpoint.
+    void add_breakpoint(u16 adr) {
+        set_bit(unconditional_bits, adr, true);
+        refresh_exec_bit(adr);
+    }
+
+    /// @brief Set a breakpoint that only stops if the condition holds, multiple conditions on one address are OR'ed.
+    void add_breakpoint(u16 adr, const debug_condition& cond) {
+        conditions[adr].push_back(cond);
+        refresh_exec_bit(adr);
+    }
+
+    /// @brief Remove the breakpoint (and all its conditions) at an address.
+    void remove_breakpoint(u16 adr) {
+        set_bit(unconditional_bits, adr, false);
+        conditions.erase(adr);
+        refresh_exec_bit(adr);
+    }
+
+    /// @brief Check if there is any breakpoint at an address.
+    bool has_breakpoint(u16 adr) const { return test_bit(exec_bits, adr); }
+
+    /// \}
+    /// @name Watchpoint methods.
+    /// \{
+
+    /**
+     * @brief Watch a range of memory for reads, writes or both.
+     * @param adr The first address to watch.
+     * @param len The number of bytes to watch, wrapping around the address space.
+     * @param access A mask of `bus_access` bits.
+     */
+    void add_watchpoint(u16 adr, usize len, u8 access) {
+        for (usize i = 0; i < len; ++i) {
+            const u16 at = static_cast<u16>(adr + i);
+            if (access & static_cast<u8>(bus_access::READ))
+                set_bit(read_bits, at, true);
+            if (access & static_cast<u8>(bus_access::WRITE))
+                set_bit(write_bits, at, true);
+        }
+
+        refresh_bus();
+    }
+
+    /// @brief Stop watching a range of memory for the given kinds of access.
+    void remove_watchpoint(u16 adr, usize len, u8 access = static_cast<u8>(bus_access::READ) | static_cast<u8>(bus_access::WRITE)) {
+        for (usize i = 0; i < len; ++i) {
+            const u16 at = static_cast<u16>(adr + i);
+            if (access & static_cast<u8>(bus_access::READ))
+                set_bit(read_bits, at, false);
+            if (access & static_cast<u8>(bus_access::WRITE))
+                set_bit(write_bits, at, false);
+        }
+
+        refresh_bus();
+    }
+
+    /// @brief Watch an I/O port for `IN` (read), `OUT` (write) or both.
+    void add_port_watchpoint(u8 port, u8 access) {
+        if (access & static_cast<u8>(bus_access::READ))
+            set_bit(port_read_bits, port, true);
+        if (access & static_cast<u8>(bus_access::WRITE))
+            set_bit(port_write_bits, port, true);
+
+        refresh_bus();
+    }
+
+    /// @brief Stop watching an I/O port for the given kinds of access.
+    void remove_port_watchpoint(u8 port, u8 access = static_cast<u8>(bus_access::READ) | static_cast<u8>(bus_access::WRITE)) {
+        if (access & static_cast<u8>(bus_access::READ))
+            set_bit(port_read_bits, port, false);
+        if (access & static_cast<u8>(bus_access::WRITE))
+            set_bit(port_write_bits, port, false);
+
+        refresh_bus();
+    }
+
+    /// \}
+    /// @name Run loop methods.
+    /// \{
+
+    /**
+     * @brief Fast check, before executing the instruction at PC, if the machine might have to stop.
+     * @param pc The PC of the instruction about to be executed.
+     * @return True if `confirm()` has to be called.
+     */
+    inline bool check(u16 pc) const { return test_bit(exec_bits, pc) or watch_hit; }
+
+    /**
+     * @brief Evaluate skipping, conditions and watch hits after `check()` returned true.
+     * @param pc The PC of the instruction about to be executed.
+     * @param state The current CPU state, to evaluate conditions on.
+     * @return True if the machine has to stop, the reason is then available from `event()`.
+     */
+    bool confirm(u16 pc, const cpu_state& state) {
+        if (watch_hit) {
+            watch_hit = false;
+            skip_once = false;
+            last_event.pc = pc;
+            return true;
+        }
+
+        if (skip_once) {
+            skip_once = false;
+            return false;
+        }
+
+        bool hit = test_bit(unconditional_bits, pc);
+
+        if (!hit) {
+            auto it = conditions.find(pc);
+            if (it != conditions.end())
+                for (const debug_condition& cond : it->second)
+                    if ((hit = cond.test(state)))
+                        break;
+        }
+
+        if (hit)
+            last_event = { debug_event_kind::BREAKPOINT, pc, pc, 0 };
+
+        return hit;
+    }
+
+    /**
+     * @brief Prepare to resume execution at an address, stepping over a breakpoint there if any.
+     * @param pc The PC execution will resume from.
+     */
+    void resume(u16 pc) {
+        skip_once = test_bit(exec_bits, pc);
+        watch_hit = false;
+    }
+
+    /// @brief Get the reason of the last stop.
+    const debug_event& event() const { return last_event; }
+
+    /// \}
+
+    /// @brief Check if any breakpoint or watchpoint is set.
+    bool is_active() const {
+        for (usize i = 0; i < ADR_WORDS; ++i)
+            if (exec_bits[i] or read_bits[i] or write_bits[i])
+                return true;
+
+        for (usize i = 0; i < PORT_WORDS; ++i)
+            if (port_read_bits[i] or port_write_bits[i])
+                return true;
+
+        return false;
+    }
+
+    /// @brief Remove all breakpoints and watchpoints.
+    void clear() {
+        exec_bits.fill(0);
+        unconditional_bits.fill(0);
+        read_bits.fill(0);
+        write_bits.fill(0);
+        port_read_bits.fill(0);
+        port_write_bits.fill(0);
+        conditions.clear();
+        watch_hit = false;
+        skip_once = false;
+        refresh_bus();
+    }
+
+    /// @name Bus tap methods.
+    /// \{
+
+    u8 page_interest(u8 page, bool io) const override {
+        if (io)
+            return (test_bit(port_read_bits, page) ? static_cast<u8>(bus_access::READ) : 0)
+                 | (test_bit(port_write_bits, page) ? static_cast<u8>(bus_access::WRITE) : 0);
+
+        return (any_in_page(read_bits, page) ? static_cast<u8>(bus_access::READ) : 0)
+             | (any_in_page(write_bits, page) ? static_cast<u8>(bus_access::WRITE) : 0);
+    }
+
+    void on_access(u16 adr, u8 byte, bool io, bus_access kind) override {
+        if (watch_hit)
+            return;
+
+        const bool is_read = kind == bus_access::READ;
+        bool hit;
+
+        if (io)
+            hit = test_bit(is_read ? port_read_bits : port_write_bits, adr & 0xFF);
+        else
+            hit = test_bit(is_read ? read_bits : write_bits, adr);
+
+        if (!hit)
+            return;
+
+        watch_hit = true;
+        last_event.kind = io ? (is_read ? debug_event_kind::PORT_READ : debug_event_kind::PORT_WRITE)
+                             : (is_read ? debug_event_kind::WATCH_READ : debug_event_kind::WATCH_WRITE);
+        last_event.adr = io ? (adr & 0xFF) : adr;
+        last_event.byte = byte;
+    }
+
+    /// \}
+
+    /**
+     * @brief Construct a debugger.
+     * @param cardbus The bus to watch accesses on, or nullptr for breakpoints only (like on a flat array address space).
+     */
+    debugger(bus* cardbus = nullptr)
+        : cardbus(cardbus), exec_bits(), unconditional_bits(), read_bits(), write_bits(), port_read_bits(),
+          port_write_bits(), watch_hit(false), skip_once(false), last_event({ debug_event_kind::NONE, 0, 0, 0 }) {
+
+        if (cardbus)
+            cardbus->attach_tap(this);
+    }
+
+    ~debugger() {
+        if (cardbus)
+            cardbus->detach_tap(this);
+    }
+
+    debugger(const debugger&) = delete;
+    debugger& operator=(const debugger&) = delete;
+};
+
+#endif
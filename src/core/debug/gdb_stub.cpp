@@ -0,0 +1,444 @@
+#include "gdb_stub.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+static constexpr const char* HEX_DIGITS = "0123456789abcdef";
+
+static u8 from_hex(char c) {
+    if (c >= '0' and c <= '9') return c - '0';
+    if (c >= 'a' and c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' and c <= 'F') return c - 'A' + 10;
+    throw std::invalid_argument("invalid hex digit in gdb packet");
+}
+
+static void append_hex8(std::string& out, u8 byte) {
+    out += HEX_DIGITS[byte >> 4];
+    out += HEX_DIGITS[byte & 0x0F];
+}
+
+static void append_hex16_le(std::string& out, u16 value) {
+    append_hex8(out, value & 0xFF);
+    append_hex8(out, value >> 8);
+}
+
+static u16 parse_hex16_le(const std::string& s, usize at) {
+    return (from_hex(s.at(at)) << 4 | from_hex(s.at(at + 1))) | (from_hex(s.at(at + 2)) << 4 | from_hex(s.at(at + 3))) << 8;
+}
+
+static u16 register_at(const cpu_state& state, usize reg) {
+    return state.get_register16(static_cast<cpu_registers16>(reg));
+}
+
+void gdb_stub::listen(const std::string& where) {
+    close();
+
+    bool is_port = !where.empty() and where.find_first_not_of("0123456789") == std::string::npos;
+
+    if (is_port) {
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0)
+            throw std::runtime_error("socket() failed");
+
+        int reuse = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        sockaddr_in adr {};
+        adr.sin_family = AF_INET;
+        adr.sin_port = htons(static_cast<u16>(std::stoul(where)));
+        adr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&adr), sizeof(adr)) < 0)
+            throw std::runtime_error("bind() failed for gdb port " + where);
+    } else {
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0)
+            throw std::runtime_error("socket() failed");
+
+        sockaddr_un adr {};
+        adr.sun_family = AF_UNIX;
+
+        if (where.size() >= sizeof(adr.sun_path))
+            throw std::invalid_argument("gdb socket path is too long");
+
+        std::strncpy(adr.sun_path, where.c_str(), sizeof(adr.sun_path) - 1);
+        ::unlink(where.c_str());
+
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&adr), sizeof(adr)) < 0)
+            throw std::runtime_error("bind() failed for gdb socket " + where);
+
+        unix_path = where;
+    }
+
+    if (::listen(listen_fd, 1) < 0)
+        throw std::runtime_error("listen() failed");
+}
+
+void gdb_stub::poll_io() {
+    if (client_fd == -1) {
+        if (listen_fd == -1)
+            return;
+
+        client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            client_fd = -1;
+            return;
+        }
+
+        int nodelay = 1;
+        setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+        // A freshly attached client expects the machine to be stopped, it will ask why with '?'.
+        stop_pending = true;
+        awaiting_stop_reply = false;
+        last_signal = gdb_signal::TRAP;
+        last_event.kind = debug_event_kind::NONE;
+        return;
+    }
+
+    char buffer[64];
+    isize amount;
+
+    while ((amount = recv(client_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+        if (std::memchr(buffer, 0x03, amount)) {
+            stop_pending = true;
+            last_signal = gdb_signal::INT;
+            last_event.kind = debug_event_kind::NONE;
+        }
+
+    if (amount == 0 or (amount < 0 and errno != EAGAIN and errno != EWOULDBLOCK))
+        drop_client();
+}
+
+void gdb_stub::drop_client() {
+    if (client_fd != -1) {
+        ::close(client_fd);
+        client_fd = -1;
+    }
+
+    for (const client_point& point : client_points)
+        set_point(point, false);
+
+    client_points.clear();
+    stop_pending = false;
+    awaiting_stop_reply = false;
+}
+
+bool gdb_stub::read_packet(std::string& packet) {
+    char c;
+
+    while (true) {
+        packet.clear();
+
+        do {
+            if (recv(client_fd, &c, 1, 0) != 1)
+                return false;
+        } while (c != '$');
+
+        u8 sum = 0;
+        while (true) {
+            if (recv(client_fd, &c, 1, 0) != 1)
+                return false;
+            if (c == '#')
+                break;
+            if (packet.size() >= MAX_PACKET)
+                return false;
+            packet += c;
+            sum += static_cast<u8>(c);
+        }
+
+        char check[2];
+        if (recv(client_fd, check, 2, MSG_WAITALL) != 2)
+            return false;
+
+        u8 expected;
+        try {
+            expected = (from_hex(check[0]) << 4) | from_hex(check[1]);
+        } catch (const std::invalid_argument&) {
+            expected = ~sum;
+        }
+
+        if (expected == sum) {
+            send_raw("+", 1);
+            return true;
+        }
+
+        send_raw("-", 1);
+    }
+}
+
+void gdb_stub::send_raw(const char* data, usize size) {
+    usize total_wr = 0;
+    while (total_wr < size) {
+        isize wr_amount = send(client_fd, data + total_wr, size - total_wr, MSG_NOSIGNAL);
+        if (wr_amount < 0)
+            throw std::runtime_error("send() failed");
+        total_wr += wr_amount;
+    }
+}
+
+void gdb_stub::send_packet(const std::string& data) {
+    std::string framed = "$" + data + "#";
+    u8 sum = 0;
+
+    for (char c : data)
+        sum += static_cast<u8>(c);
+
+    append_hex8(framed, sum);
+    send_raw(framed.data(), framed.size());
+}
+
+std::string gdb_stub::stop_reply() const {
+    std::string reply = "T";
+    append_hex8(reply, static_cast<u8>(last_signal));
+
+    const char* watch_kind = nullptr;
+    switch (last_event.kind) {
+        case debug_event_kind::WATCH_WRITE: watch_kind = "watch"; break;
+        case debug_event_kind::WATCH_READ: watch_kind = "rwatch"; break;
+        default: break;
+    }
+
+    if (watch_kind) {
+        reply += watch_kind;
+        reply += ':';
+        append_hex8(reply, last_event.adr >> 8);
+        append_hex8(reply, last_event.adr & 0xFF);
+        reply += ';';
+    }
+
+    return reply;
+}
+
+void gdb_stub::set_point(const client_point& point, bool insert) {
+    static constexpr u8 READ = static_cast<u8>(bus_access::READ);
+    static constexpr u8 WRITE = static_cast<u8>(bus_access::WRITE);
+
+    if (point.type == '0' or point.type == '1') {
+        if (insert)
+            dbg.add_breakpoint(point.adr);
+        else
+            dbg.remove_breakpoint(point.adr);
+        return;
+    }
+
+    const u8 access = (point.type == '2') ? WRITE : (point.type == '3') ? READ : READ | WRITE;
+
+    if (insert)
+        dbg.add_watchpoint(point.adr, point.len, access);
+    else
+        dbg.remove_watchpoint(point.adr, point.len, access);
+}
+
+std::string gdb_stub::handle_breakpoint(const std::string& packet) {
+    // Ztype,addr,kind: 0/1 are software/hardware breakpoints (the same thing here), 2/3/4 are write/read/access watchpoints.
+    if (packet.size() < 4 or packet[1] < '0' or packet[1] > '4' or packet[2] != ',')
+        return "";
+
+    usize comma = packet.find(',', 3);
+    if (comma == std::string::npos)
+        return "E01";
+
+    client_point point { packet[1], static_cast<u16>(std::stoul(packet.substr(3, comma - 3), nullptr, 16)), 1 };
+    if (point.type >= '2')
+        point.len = std::stoul(packet.substr(comma + 1), nullptr, 16);
+
+    const bool insert = packet[0] == 'Z';
+    auto it = client_points.begin();
+
+    while (it != client_points.end() and !(it->type == point.type and it->adr == point.adr and it->len == point.len))
+        ++it;
+
+    if (insert and it == client_points.end()) {
+        client_points.push_back(point);
+        set_point(point, true);
+    } else if (!insert and it != client_points.end()) {
+        client_points.erase(it);
+        set_point(point, false);
+    }
+
+    return "OK";
+}
+
+std::string gdb_stub::handle_packet(const std::string& packet, bool& resume) {
+    std::string reply;
+    cpu_state state = processor.save_state();
+
+    switch (packet.empty() ? '\0' : packet[0]) {
+        case '?':
+            return stop_reply();
+
+        case 'g':
+            for (usize reg = 0; reg < REGISTER_COUNT; ++reg)
+                append_hex16_le(reply, register_at(state, reg));
+            return reply;
+
+        case 'G':
+            if (packet.size() < 1 + REGISTER_COUNT * 4)
+                return "E01";
+            for (usize reg = 0; reg < REGISTER_COUNT; ++reg)
+                state.set_register16(static_cast<cpu_registers16>(reg), parse_hex16_le(packet, 1 + reg * 4));
+            processor.load_state(state);
+            return "OK";
+
+        case 'p': {
+            usize reg = std::stoul(packet.substr(1), nullptr, 16);
+            if (reg >= REGISTER_COUNT)
+                return "E01";
+            append_hex16_le(reply, register_at(state, reg));
+            return reply;
+        }
+
+        case 'P': {
+            usize eq = packet.find('=');
+            if (eq == std::string::npos)
+                return "E01";
+            usize reg = std::stoul(packet.substr(1, eq - 1), nullptr, 16);
+            if (reg >= REGISTER_COUNT or packet.size() < eq + 5)
+                return "E01";
+            state.set_register16(static_cast<cpu_registers16>(reg), parse_hex16_le(packet, eq + 1));
+            processor.load_state(state);
+            return "OK";
+        }
+
+        case 'm': {
+            usize comma = packet.find(',');
+            if (comma == std::string::npos)
+                return "E01";
+            usize adr = std::stoul(packet.substr(1, comma - 1), nullptr, 16);
+            usize len = std::stoul(packet.substr(comma + 1), nullptr, 16);
+            for (usize i = 0; i < len and i < MAX_PACKET / 2; ++i)
+                append_hex8(reply, cardbus.peek(static_cast<u16>(adr + i)));
+            return reply;
+        }
+
+        case 'M': {
+            usize comma = packet.find(',');
+            usize colon = packet.find(':');
+            if (comma == std::string::npos or colon == std::string::npos)
+                return "E01";
+            usize adr = std::stoul(packet.substr(1, comma - 1), nullptr, 16);
+            usize len = std::stoul(packet.substr(comma + 1, colon - comma - 1), nullptr, 16);
+            if (packet.size() < colon + 1 + len * 2)
+                return "E01";
+            for (usize i = 0; i < len; ++i)
+                cardbus.write_force(static_cast<u16>(adr + i), (from_hex(packet[colon + 1 + i * 2]) << 4) | from_hex(packet[colon + 2 + i * 2]));
+            return "OK";
+        }
+
+        case 'c':
+        case 's':
+            if (packet.size() > 1)
+                processor.set_pc(static_cast<u16>(std::stoul(packet.substr(1), nullptr, 16)));
+            // Stepping is stopping again right before the next instruction.
+            stop_pending = packet[0] == 's';
+            last_signal = gdb_signal::TRAP;
+            last_event.kind = debug_event_kind::NONE;
+            awaiting_stop_reply = true;
+            resume = true;
+            return "";
+
+        case 'Z':
+        case 'z':
+            return handle_breakpoint(packet);
+
+        case 'H':
+            return "OK";
+
+        case 'k':
+            resume = true;
+            drop_client();
+            return "";
+
+        case 'D':
+            send_packet("OK");
+            resume = true;
+            drop_client();
+            return "";
+
+        case 'q':
+            if (packet.rfind("qSupported", 0) == 0)
+                return "PacketSize=" + std::to_string(MAX_PACKET);
+            if (packet == "qAttached")
+                return "1";
+            if (packet == "qC")
+                return "QC1";
+            if (packet == "qfThreadInfo")
+                return "m1";
+            if (packet == "qsThreadInfo")
+                return "l";
+            return "";
+
+        default:
+            return "";
+    }
+}
+
+void gdb_stub::serve() {
+    stop_pending = false;
+
+    if (client_fd == -1)
+        return;
+
+    if (awaiting_stop_reply) {
+        awaiting_stop_reply = false;
+        send_packet(stop_reply());
+    }
+
+    std::string packet;
+
+    while (read_packet(packet)) {
+        bool resume = false;
+        std::string reply;
+
+        try {
+            reply = handle_packet(packet, resume);
+        } catch (const std::logic_error&) {
+            reply = "E01";
+        }
+
+        if (resume)
+            return;
+
+        send_packet(reply);
+    }
+
+    drop_client();
+}
+
+void gdb_stub::report_halt() {
+    if (client_fd == -1)
+        return;
+
+    last_signal = gdb_signal::TRAP;
+    last_event.kind = debug_event_kind::NONE;
+    awaiting_stop_reply = true;
+    serve();
+
+    if (client_fd != -1) {
+        send_packet("W00");
+        drop_client();
+    }
+}
+
+void gdb_stub::close() {
+    drop_client();
+
+    if (listen_fd != -1) {
+        ::close(listen_fd);
+        listen_fd = -1;
+    }
+
+    if (!unix_path.empty()) {
+        ::unlink(unix_path.c_str());
+        unix_path.clear();
+    }
+}
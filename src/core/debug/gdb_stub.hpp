@@ -0,0 +1,148 @@
+#ifndef GDB_STUB_HPP_
+#define GDB_STUB_HPP_
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "debugger.hpp"
+#include "typedef.hpp"
+
+/// @brief Enumerates the signals reported to GDB on stop.
+enum class gdb_signal : u8 {
+    INT = 2, TRAP = 5
+};
+
+/**
+ * @brief A GDB remote serial protocol server for the emulated 8080.
+ *
+ * This class listens on a loopback TCP port or a UNIX domain socket, and lets a GDB compatible client attach to
+ * a running machine at any time. Supported are register and memory read/write (through the bus, memory writes
+ * also reach write-locked ROM), breakpoints and watchpoints, single-step, continue and interrupt (Ctrl-C).
+ *
+ * The stub does not run the CPU by itself. The emulator calls `needs_attention()` before each step, and when it
+ * returns true it calls `serve()`, which blocks while the machine is stopped and returns once the client resumes it.
+ * Breakpoints and watchpoints are delegated to a `debugger`, whose stops are handed back with `report()`. The per-step
+ * cost of the stub itself is a countdown and a flag check, while the sockets are only polled every `POLL_INTERVAL` steps.
+ *
+ * Registers are exposed as six 16 bit little endian values, in order: AF, BC, DE, HL, SP, PC.
+ *
+ * @note Only one client at a time is served. Killing from the client only detaches, the machine keeps running, and
+ * any breakpoint or watchpoint the client left behind is removed.
+ */
+class gdb_stub {
+private:
+    static constexpr usize POLL_INTERVAL = 4096;
+    static constexpr usize MAX_PACKET = 4096;
+    static constexpr usize REGISTER_COUNT = 6;
+
+    /// @brief A breakpoint or watchpoint set by the client, as received in a `Z` packet.
+    struct client_point {
+        char type;
+        u16 adr;
+        usize len;
+    };
+
+    cpu<bus&>& processor;
+    bus& cardbus;
+    debugger& dbg;
+
+    fd listen_fd;
+    fd client_fd;
+    std::string unix_path;
+
+    usize poll_countdown;
+    bool stop_pending;
+    bool awaiting_stop_reply;
+    gdb_signal last_signal;
+    debug_event last_event;
+
+    std::vector<client_point> client_points;
+
+    void poll_io();
+    void drop_client();
+    bool read_packet(std::string& packet);
+    void send_packet(const std::string& data);
+    void send_raw(const char* data, usize size);
+    std::string stop_reply() const;
+    std::string handle_packet(const std::string& packet, bool& resume);
+    std::string handle_breakpoint(const std::string& packet);
+    void set_point(const client_point& point, bool insert);
+
+public:
+    /**
+     * @brief Start listening for a client.
+     * @param where A TCP port number to listen on (loopback only), or the path of a UNIX domain socket.
+     * @throw `std::runtime_error` if the socket could not be set up.
+     */
+    void listen(const std::string& where);
+
+    /**
+     * @brief Check if the machine should stop and be served to the client before the next step.
+     * @return True if `serve()` should be called before stepping.
+     */
+    inline bool needs_attention() {
+        if (--poll_countdown == 0) {
+            poll_countdown = POLL_INTERVAL;
+            poll_io();
+        }
+
+        return stop_pending;
+    }
+
+    /**
+     * @brief Check the sockets now, while the machine is not stepping, such as when it waits for an interrupt.
+     * @return True if `serve()` should be called.
+     */
+    inline bool poll_now() {
+        poll_io();
+        return stop_pending;
+    }
+
+    /// @brief Get the socket to wait on for the client, the listening one while none is attached, -1 if not listening.
+    fd get_event_fd() const { return (client_fd != -1) ? client_fd : listen_fd; }
+
+    /**
+     * @brief Stop the machine for the client because of a debugger event.
+     * @param event The breakpoint or watchpoint that was hit.
+     *
+     * The next call to `needs_attention()` returns true.
+     */
+    void report(const debug_event& event) {
+        stop_pending = true;
+        last_signal = gdb_signal::TRAP;
+        last_event = event;
+    }
+
+    /**
+     * @brief Serve the client while the machine is stopped.
+     * @throw `std::runtime_error` on socket errors other than the client going away.
+     *
+     * Returns once the client continues or steps the machine, or detaches.
+     */
+    void serve();
+
+    /**
+     * @brief Tell the client the machine halted, and let it inspect the final state.
+     *
+     * Called by the emulator when the CPU halts. If the client resumes a halted machine, it is told the program exited.
+     */
+    void report_halt();
+
+    /// @brief Check if a client is attached.
+    bool is_attached() const { return client_fd != -1; }
+
+    /// @brief Stop listening and drop the client, if any.
+    void close();
+
+    gdb_stub(cpu<bus&>& processor, bus& cardbus, debugger& dbg)
+        : processor(processor), cardbus(cardbus), dbg(dbg), listen_fd(-1), client_fd(-1), poll_countdown(POLL_INTERVAL),
+          stop_pending(false), awaiting_stop_reply(false), last_signal(gdb_signal::TRAP),
+          last_event({ debug_event_kind::NONE, 0, 0, 0 }) {}
+
+    ~gdb_stub() { close(); }
+};
+
+#endif
@@ -0,0 +1,318 @@
+#ifndef GUEST_PROFILER_HPP_
+#define GUEST_PROFILER_HPP_
+
+#include <map>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cctype>
+#include <stdexcept>
+
+#include "cpu_state.hpp"
+#include "typedef.hpp"
+#include "util.hpp"
+
+/// @brief A frame of the shadow call stack: the address that was called, and the address it will return to.
+struct profiler_frame {
+    u16 entry;
+    u16 ret;
+};
+
+/**
+ * @brief A sampling profiler for the guest program, as opposed to `build.sh --perf-report` profiling the host.
+ *
+ * The CPU hands each retired instruction to the profiler, which counts 8080 clock cycles and keeps a shadow call stack
+ * by watching `CALL`, `RST` and `RET` (taken, conditional ones included) and interrupt entries. Every `interval` cycles
+ * the current stack is sampled, at function granularity. Returns are matched against the return addresses on the shadow
+ * stack, so code that drops frames (like jumping back to a main loop after fixing up SP) unwinds to the right caller.
+ *
+ * Samples are written out as collapsed stacks, one `frame;frame;frame count` line per distinct stack, which is the
+ * input format of flamegraph tools (`flamegraph.pl`, speedscope, inferno...). Called addresses are named after the
+ * nearest preceding symbol, if symbols were loaded from a `.sym` or `.lst` file. The outermost frame is the code that
+ * made the first call, which without symbols is just named `[root]`.
+ */
+class guest_profiler {
+private:
+    static constexpr usize MAX_DEPTH = 256;
+
+    u64 interval;
+    u64 cycles;
+    u64 next_sample;
+    u64 sample_count;
+
+    std::vector<profiler_frame> stack;
+    std::map<std::vector<u16>, u64> samples;
+    std::map<u16, std::string> symbols;
+
+    static constexpr bool is_call(u8 opcode) {
+        return opcode == 0xCD or (opcode & 0b11000111) == 0b11000100 or (opcode & 0b11000111) == 0b11000111;
+    }
+
+    static constexpr bool is_conditional(u8 opcode) {
+        return (opcode & 0b11000111) == 0b11000100 or (opcode & 0b11000111) == 0b11000000;
+    }
+
+    static constexpr bool is_return(u8 opcode) {
+        return opcode == 0xC9 or (opcode & 0b11000111) == 0b11000000;
+    }
+
+    void enter(u16 entry, u16 ret) {
+        if (stack.size() < MAX_DEPTH)
+            stack.push_back({ entry, ret });
+    }
+
+    /// @brief Record the stack as the root code address (the outermost call site, or PC), then each called entry.
+    void sample(u16 pc) {
+        std::vector<u16> key;
+        key.reserve(stack.size() + 1);
+
+        key.push_back(stack.empty() ? pc : static_cast<u16>(stack.front().ret - 1));
+        for (const profiler_frame& frame : stack)
+            key.push_back(frame.entry);
+
+        ++samples[key];
+        ++sample_count;
+    }
+
+    static bool is_hex(const std::string& s) {
+        if (s.empty() or s.size() > 5)
+            return false;
+
+        for (usize i = 0; i < s.size(); ++i)
+            if (!std::isxdigit(static_cast<unsigned char>(s[i])) and !(i == s.size() - 1 and (s[i] == 'H' or s[i] == 'h')))
+                return false;
+
+        return true;
+    }
+
+    static bool is_identifier(const std::string& s) {
+        if (s.empty() or std::isdigit(static_cast<unsigned char>(s[0])))
+            return false;
+
+        for (char c : s)
+            if (!std::isalnum(static_cast<unsigned char>(c)) and c != '_' and c != '.' and c != '?' and c != '$')
+                return false;
+
+        return true;
+    }
+
+    /// @brief Parse a listing line like `0145	D5              MSG:	PUSH	D`, where the label is the last word before ':'.
+    void parse_lst_line(const std::string& line) {
+        if (line.size() < 5 or line[4] != '\t' or !is_hex(line.substr(0, 4)))
+            return;
+
+        const usize colon = line.find(':', 5);
+        if (colon == std::string::npos)
+            return;
+
+        const std::string before = line.substr(5, colon - 5);
+        if (before.find_first_of(";'\"") != std::string::npos)
+            return;
+
+        const usize start = before.find_last_of(" \t");
+        const std::string label = (start == std::string::npos) ? before : before.substr(start + 1);
+
+        if (is_identifier(label))
+            symbols.emplace(static_cast<u16>(std::stoul(line.substr(0, 4), nullptr, 16)), label);
+    }
+
+    /// @brief Parse a symbol line, either `ADDR NAME` or `NAME ADDR`, with an optional trailing 'H' on the address.
+    void parse_sym_line(const std::string& line) {
+        std::istringstream words(line);
+        std::string first, second;
+
+        while (words >> first >> second) {
+            if (is_hex(first) and is_identifier(second))
+                symbols.emplace(static_cast<u16>(std::stoul(first, nullptr, 16)), second);
+            else if (is_identifier(first) and is_hex(second))
+                symbols.emplace(static_cast<u16>(std::stoul(second, nullptr, 16)), first);
+            else
+                return;
+        }
+    }
+
+public:
+    /// @name Run loop methods, called by the CPU.
+    /// \{
+
+    /**
+     * @brief Account for an executed instruction.
+     * @param pc The PC the instruction was fetched from.
+     * @param sp The SP before execution.
+     * @param opcode The opcode of the instruction.
+     * @param after The CPU state after execution.
+     */
+    inline void retire(u16 pc, u16 sp, u8 opcode, const cpu_state& after) {
+        cycles += util::get_opcode_cycles(opcode);
+
+        if (is_call(opcode) and after.SP() == static_cast<u16>(sp - 2)) {
+            cycles += is_conditional(opcode) ? 6 : 0;
+            enter(after.PC(), static_cast<u16>(pc + util::get_opcode_len(opcode)));
+        } else if (is_return(opcode) and after.SP() == static_cast<u16>(sp + 2)) {
+            cycles += is_conditional(opcode) ? 6 : 0;
+            unwind(after.PC());
+        }
+
+        if (cycles >= next_sample) {
+            next_sample = cycles + interval;
+            sample(after.PC());
+        }
+    }
+
+    /**
+     * @brief Account for an interrupt entry.
+     * @param ret The PC the interrupt will return to.
+     * @param handler The PC of the interrupt handler.
+     */
+    void interrupt(u16 ret, u16 handler) {
+        cycles += 11;
+        enter(handler, ret);
+    }
+
+    /**
+     * @brief Account for a return to an address that was not made by a `RET` instruction, like pseudo BDOS calls.
+     * @param to The address returned to.
+     *
+     * Frames are popped up to the one that would return to the address. If there is none, the stack was manipulated
+     * by the guest and only the top frame is dropped.
+     */
+    void unwind(u16 to) {
+        for (usize i = stack.size(); i > 0; --i)
+            if (stack[i - 1].ret == to) {
+                stack.resize(i - 1);
+                return;
+            }
+
+        if (!stack.empty())
+            stack.pop_back();
+    }
+
+    /// \}
+    /// @name Symbol methods.
+    /// \{
+
+    /**
+     * @brief Load symbols from a file.
+     * @param filename A `.lst` assembler listing (labels on addressed lines), or a symbol table of address/name pairs.
+     * @return The number of symbols known after loading.
+     * @throw `std::runtime_error` if the file could not be opened.
+     */
+    usize load_symbols(const std::string& filename) {
+        std::ifstream file(filename);
+
+        if (!file.is_open())
+            throw std::runtime_error("Could not open symbol file: " + filename);
+
+        const bool is_listing = filename.size() >= 4 and filename.compare(filename.size() - 4, 4, ".lst") == 0;
+        std::string line;
+
+        while (std::getline(file, line)) {
+            if (!line.empty() and line.back() == '\r')
+                line.pop_back();
+
+            if (is_listing)
+                parse_lst_line(line);
+            else
+                parse_sym_line(line);
+        }
+
+        return symbols.size();
+    }
+
+    /// @brief Add a single symbol.
+    void add_symbol(u16 adr, const std::string& name) { symbols[adr] = name; }
+
+    /// @brief Get the name of the nearest symbol at or before an address, or the address itself in hex.
+    std::string symbolize(u16 adr) const {
+        auto it = symbols.upper_bound(adr);
+
+        if (it != symbols.begin())
+            return std::prev(it)->second;
+
+        char hex[7];
+        std::snprintf(hex, sizeof(hex), "0x%04X", static_cast<unsigned>(adr));
+        return hex;
+    }
+
+    /// \}
+    /// @name Output methods.
+    /// \{
+
+    /// @brief Get the number of samples taken.
+    u64 get_sample_count() const { return sample_count; }
+
+    /// @brief Get the number of 8080 clock cycles accounted for.
+    u64 get_cycles() const { return cycles; }
+
+    /// @brief Get the current depth of the shadow call stack.
+    usize get_depth() const { return stack.size(); }
+
+    /**
+     * @brief Write the samples as collapsed stacks, outermost frame first.
+     * @param out The stream to write to.
+     *
+     * Stacks that become the same after symbolization are merged.
+     */
+    void write_collapsed(std::ostream& out) const {
+        std::map<std::string, u64> collapsed;
+
+        for (const auto& [key, count] : samples) {
+            std::string line = (symbols.empty() or symbols.begin()->first > key[0]) ? "[root]" : symbolize(key[0]);
+
+            for (usize i = 1; i < key.size(); ++i) {
+                line += ';';
+                line += symbolize(key[i]);
+            }
+
+            collapsed[line] += count;
+        }
+
+        for (const auto& [line, count] : collapsed)
+            out << line << ' ' << count << '\n';
+    }
+
+    /**
+     * @brief Write the samples as collapsed stacks to a file.
+     * @param filename The path of the file to write.
+     * @throw `std::runtime_error` if the file could not be written.
+     */
+    void dump(const char* filename) const {
+        std::ofstream file(filename, std::ios::trunc);
+
+        if (!file.is_open())
+            throw std::runtime_error("Could not open profile output file: " + std::string(filename));
+
+        write_collapsed(file);
+
+        if (file.fail())
+            throw std::runtime_error("Failed to write profile output file: " + std::string(filename));
+    }
+
+    /// @brief Forget all samples and the shadow stack, keeping symbols.
+    void clear() {
+        cycles = 0;
+        next_sample = interval;
+        sample_count = 0;
+        stack.clear();
+        samples.clear();
+    }
+
+    /// \}
+
+    /**
+     * @brief Construct a profiler.
+     * @param interval The number of 8080 clock cycles between samples.
+     * @throw `std::invalid_argument` if interval is zero.
+     */
+    guest_profiler(u64 interval) : interval(interval), cycles(0), next_sample(interval), sample_count(0) {
+        if (interval == 0)
+            throw std::invalid_argument("Profiler sampling interval must be greater than 0.");
+
+        stack.reserve(MAX_DEPTH);
+    }
+};
+
+#endif
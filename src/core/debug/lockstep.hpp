@@ -0,0 +1,220 @@
+#ifndef LOCKSTEP_HPP_
+#define LOCKSTEP_HPP_
+
+#include <string>
+#include <cstdio>
+#include <stdexcept>
+#include <type_traits>
+
+#include "bus.hpp"
+#include "cpu_state.hpp"
+#include "typedef.hpp"
+#include "util.hpp"
+
+/**
+ * @brief Describes the first point where two engines running in lockstep stopped agreeing.
+ *
+ * The state of both engines is captured right after the instruction (or block of instructions) that caused the
+ * mismatch, while the PC and opcode are the ones of the last instruction that was executed before comparing.
+ */
+struct lockstep_divergence {
+    u64 step;
+    u16 pc;
+    u8 opcode;
+    bool in_memory;
+    cpu_state reference;
+    cpu_state candidate;
+    bool reference_halted;
+    bool candidate_halted;
+    u64 reference_digest;
+    u64 candidate_digest;
+
+    /**
+     * @brief Get a compact, human readable report of the divergence.
+     * @return A multi-line std::string with the PC, opcode and both states side by side.
+     */
+    std::string report() const {
+        static constexpr usize MAX_LINE = 128;
+        char line[MAX_LINE];
+        std::string out;
+
+        std::snprintf(line, MAX_LINE, "lockstep divergence in %s after step %llu, pc %04X, opcode %02X (%s)\n",
+            in_memory ? "memory" : "registers", static_cast<unsigned long long>(step),
+            static_cast<unsigned>(pc), static_cast<unsigned>(opcode), util::get_opcode_str(opcode));
+        out += line;
+        out += "           AF   BC   DE   HL   SP   PC   HLT  MEM\n";
+
+        const auto state_line = [&](const char* name, const cpu_state& s, bool halted, u64 digest) {
+            std::snprintf(line, MAX_LINE, "%-9s  %04X %04X %04X %04X %04X %04X %-4s %016llX\n", name,
+                static_cast<unsigned>(s.AF()), static_cast<unsigned>(s.BC()), static_cast<unsigned>(s.DE()),
+                static_cast<unsigned>(s.HL()), static_cast<unsigned>(s.SP()), static_cast<unsigned>(s.PC()),
+                halted ? "yes" : "no", static_cast<unsigned long long>(digest));
+            out += line;
+        };
+
+        state_line("reference", reference, reference_halted, reference_digest);
+        state_line("candidate", candidate, candidate_halted, candidate_digest);
+
+        return out;
+    }
+};
+
+/**
+ * @brief Runs two CPU engines side by side on the same program, checking that they agree.
+ * @param reference_engine The engine taken as ground truth, usually a plain `cpu<>` or `cpu<std::array<u8, 65536>>`.
+ * @param candidate_engine The engine being validated, which has to provide the same stepping and state API.
+ *
+ * This class is meant to validate any fast path against the reference interpreter. Both engines are stepped one
+ * instruction at a time and their register files (plus the halted status) are compared every `reg_interval` steps.
+ * Memory is compared through a 64 bit FNV-1a digest of the whole memory address space every `mem_interval` steps and
+ * whenever an engine halts, since hashing 64 KiB on every instruction would defeat the point.
+ *
+ * On the first mismatch both engines are left untouched for inspection, `step()` and `run()` return false and the
+ * details are available through `divergence()`.
+ *
+ * @note Engines must not share their address space: for bus-backed configurations, give each engine its own bus and
+ * cards. I/O cards that depend on the outside world (like `serial_card`) will naturally make the engines diverge.
+ * @par
+ * @note The digest and the opcode fetch peek at memory, so bus taps don't see them and I/O cards aren't read.
+ */
+template <class reference_engine, class candidate_engine>
+class lockstep {
+private:
+    static constexpr u64 FNV_OFFSET_BASIS = 0xCBF29CE484222325ULL;
+    static constexpr u64 FNV_PRIME = 0x00000100000001B3ULL;
+
+    reference_engine& ref;
+    candidate_engine& cand;
+    usize reg_interval;
+    usize mem_interval;
+    u64 steps_done;
+    bool has_diverged;
+    lockstep_divergence diverged_at;
+
+    /// @brief Read a byte of an engine's address space without going through the bus taps.
+    template <class engine>
+    static u8 peek(engine& e, u16 adr) {
+        auto& space = e.get_adr_space();
+
+        if constexpr (std::is_same_v<std::decay_t<decltype(space)>, bus>)
+            return space.peek(adr);
+        else
+            return static_cast<u8>(space[adr]);
+    }
+
+    template <class engine>
+    static u64 digest(engine& e) {
+        u64 hash = FNV_OFFSET_BASIS;
+
+        for (usize adr = 0; adr < 65536; ++adr) {
+            hash ^= peek(e, static_cast<u16>(adr));
+            hash *= FNV_PRIME;
+        }
+
+        return hash;
+    }
+
+    bool compare(u16 pc, u8 opcode, bool check_registers, bool check_memory) {
+        const cpu_state ref_state = ref.save_state();
+        const cpu_state cand_state = cand.save_state();
+        const bool regs_match = !check_registers
+            or (ref_state.registers == cand_state.registers and ref.is_halted() == cand.is_halted());
+        u64 ref_digest = 0;
+        u64 cand_digest = 0;
+
+        if (regs_match and check_memory) {
+            ref_digest = digest(ref);
+            cand_digest = digest(cand);
+        }
+
+        if (regs_match and ref_digest == cand_digest)
+            return true;
+
+        has_diverged = true;
+        diverged_at = {
+            steps_done, pc, opcode, regs_match, ref_state, cand_state,
+            ref.is_halted(), cand.is_halted(), ref_digest, cand_digest
+        };
+
+        return false;
+    }
+
+public:
+    /**
+     * @brief Step both engines, comparing them at the configured intervals.
+     * @param steps The number of instructions to step both engines by.
+     * @return False if the engines diverged (now or earlier), true otherwise.
+     *
+     * Stepping stops early, returning true, once both engines agree on being halted.
+     */
+    bool step(usize steps = 1) {
+        for (usize i = 0; i < steps; ++i) {
+            if (has_diverged)
+                return false;
+
+            if (ref.is_halted() and cand.is_halted())
+                return true;
+
+            const u16 pc = ref.save_state().PC();
+            const u8 opcode = peek(ref, pc);
+
+            ref.step();
+            cand.step();
+            ++steps_done;
+
+            // Both intervals are checked on their own, a memory-only step still compares the digests.
+            const bool any_halted = ref.is_halted() or cand.is_halted();
+            const bool check_registers = steps_done % reg_interval == 0 or any_halted;
+            const bool check_memory = steps_done % mem_interval == 0 or any_halted;
+
+            if ((check_registers or check_memory) and !compare(pc, opcode, check_registers, check_memory))
+                return false;
+        }
+
+        return !has_diverged;
+    }
+
+    /**
+     * @brief Run both engines until they halt, diverge, or a step limit is reached.
+     * @param max_steps The maximum number of steps to run for, zero for no limit.
+     * @return False if the engines diverged, true otherwise.
+     */
+    bool run(u64 max_steps = 0) {
+        while (!(ref.is_halted() and cand.is_halted()) and (max_steps == 0 or steps_done < max_steps))
+            if (!step())
+                return false;
+
+        return true;
+    }
+
+    /**
+     * @brief Set how often registers and memory are compared.
+     * @param every_reg Compare registers every this many steps (1 means every instruction).
+     * @param every_mem Compare memory digests every this many steps.
+     * @throw `std::invalid_argument` if any interval is zero.
+     */
+    void set_compare_interval(usize every_reg, usize every_mem) {
+        if (every_reg == 0 or every_mem == 0)
+            throw std::invalid_argument("Lockstep compare intervals must be greater than 0.");
+
+        reg_interval = every_reg;
+        mem_interval = every_mem;
+    }
+
+    /// @brief Check if the engines diverged.
+    bool diverged() const { return has_diverged; }
+
+    /// @brief Get the divergence details, only meaningful if `diverged()` is true.
+    const lockstep_divergence& divergence() const { return diverged_at; }
+
+    /// @brief Get the number of steps both engines went through in lockstep.
+    u64 steps() const { return steps_done; }
+
+    lockstep(reference_engine& ref, candidate_engine& cand, usize every_reg = 1, usize every_mem = 4096)
+        : ref(ref), cand(cand), reg_interval(1), mem_interval(1), steps_done(0), has_diverged(false), diverged_at() {
+
+        set_compare_interval(every_reg, every_mem);
+    }
+};
+
+#endif
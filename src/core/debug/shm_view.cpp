@@ -0,0 +1,143 @@
+#include "shm_view.hpp"
+
+#include <new>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static constexpr char SHM_VIEW_MAGIC[4] = { 'B', '8', 'S', 'V' };
+static constexpr u16 SHM_VIEW_VERSION = 1;
+static constexpr usize SHM_VIEW_MAX_RETRIES = 1 << 20;
+
+shm_view::shm_view(bus& cardbus, const std::string& name, usize interval)
+    : cardbus(cardbus), name(name), view(nullptr), interval(interval), countdown(interval), steps(0) {
+
+    if (interval == 0)
+        throw std::invalid_argument("Shared memory view interval must be greater than 0.");
+
+    fd shm = shm_open(name.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (shm < 0)
+        throw std::runtime_error("shm_open() failed for " + name);
+
+    if (ftruncate(shm, sizeof(shm_view_layout)) < 0) {
+        ::close(shm);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("ftruncate() failed for " + name);
+    }
+
+    void* mapped = mmap(nullptr, sizeof(shm_view_layout), PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    ::close(shm);
+
+    if (mapped == MAP_FAILED) {
+        shm_unlink(name.c_str());
+        throw std::runtime_error("mmap() failed for " + name);
+    }
+
+    view = new (mapped) shm_view_layout();
+    std::memcpy(view->magic, SHM_VIEW_MAGIC, sizeof(SHM_VIEW_MAGIC));
+    view->version = SHM_VIEW_VERSION;
+    view->page_size = 256;
+    view->seq.store(0, std::memory_order_relaxed);
+
+    dirty.fill(~0ULL);
+    publish(cpu_state(), 0);
+
+    cardbus.attach_tap(this);
+}
+
+shm_view::~shm_view() {
+    cardbus.detach_tap(this);
+    munmap(view, sizeof(shm_view_layout));
+    shm_unlink(name.c_str());
+}
+
+void shm_view::publish(const cpu_state& state, u8 status) {
+    const u32 seq = view->seq.load(std::memory_order_relaxed);
+    view->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    shm_view_state& out = view->state;
+    out.af = state.AF();
+    out.bc = state.BC();
+    out.de = state.DE();
+    out.hl = state.HL();
+    out.sp = state.SP();
+    out.pc = state.PC();
+    out.address = state.PC();
+    out.data = cardbus.peek(state.PC());
+    out.status = status;
+    out.steps = steps;
+    ++out.publishes;
+
+    for (usize word = 0; word < dirty.size(); ++word)
+        while (dirty[word]) {
+            const usize page = word * 64 + __builtin_ctzll(dirty[word]);
+            dirty[word] &= dirty[word] - 1;
+
+            for (usize i = 0; i < 256; ++i)
+                view->memory[page * 256 + i] = cardbus.peek(static_cast<u16>(page * 256 + i));
+
+            ++view->page_versions[page];
+        }
+
+    view->seq.store(seq + 2, std::memory_order_release);
+}
+
+shm_view_reader::shm_view_reader(const std::string& name) : view(nullptr) {
+    fd shm = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (shm < 0)
+        throw std::runtime_error("No machine view found at " + name);
+
+    void* mapped = mmap(nullptr, sizeof(shm_view_layout), PROT_READ, MAP_SHARED, shm, 0);
+    ::close(shm);
+
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error("mmap() failed for " + name);
+
+    view = static_cast<const shm_view_layout*>(mapped);
+
+    if (std::memcmp(view->magic, SHM_VIEW_MAGIC, sizeof(SHM_VIEW_MAGIC)) != 0 or view->version != SHM_VIEW_VERSION) {
+        munmap(const_cast<shm_view_layout*>(view), sizeof(shm_view_layout));
+        throw std::runtime_error("Not a machine view, or an unsupported version: " + name);
+    }
+}
+
+shm_view_reader::~shm_view_reader() {
+    munmap(const_cast<shm_view_layout*>(view), sizeof(shm_view_layout));
+}
+
+/// @brief Run a copy under the seqlock until it's consistent.
+template <class copy_fn>
+static void seqlock_read(const shm_view_layout* view, copy_fn copy) {
+    for (usize tries = 0; tries < SHM_VIEW_MAX_RETRIES; ++tries) {
+        const u32 before = view->seq.load(std::memory_order_acquire);
+
+        if (before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        copy();
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (view->seq.load(std::memory_order_relaxed) == before)
+            return;
+    }
+
+    throw std::runtime_error("Machine view is stuck mid-update, the emulator might have crashed.");
+}
+
+shm_view_state shm_view_reader::read_state() const {
+    shm_view_state out;
+    seqlock_read(view, [&] { std::memcpy(&out, &view->state, sizeof(out)); });
+    return out;
+}
+
+void shm_view_reader::read_memory(u16 adr, usize len, u8* out) const {
+    if (adr + len > view->memory.size())
+        len = view->memory.size() - adr;
+
+    seqlock_read(view, [&] { std::memcpy(out, view->memory.data() + adr, len); });
+}
@@ -0,0 +1,158 @@
+#ifndef SHM_VIEW_HPP_
+#define SHM_VIEW_HPP_
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <stdexcept>
+
+#include "cpu_state.hpp"
+#include "bus.hpp"
+#include "typedef.hpp"
+
+/// @brief Bitmasks of the status byte of a published machine state.
+enum class shm_view_status : u8 {
+    HALTED = 0x01, INTE = 0x02, IRQ = 0x04
+};
+
+/**
+ * @brief Registers, status and counters of the machine at the time of a publish.
+ *
+ * The address and data fields are what a front panel shows on its LEDs: the PC and the byte it points to.
+ */
+struct shm_view_state {
+    u16 af;
+    u16 bc;
+    u16 de;
+    u16 hl;
+    u16 sp;
+    u16 pc;
+    u16 address;
+    u8 data;
+    u8 status;
+    u64 steps;
+    u64 publishes;
+};
+
+/**
+ * @brief Layout of the shared memory segment.
+ *
+ * `seq` is a seqlock sequence number, odd while the emulator is writing. Each page of `memory` has a version that
+ * is bumped when the page is republished, so readers can also skip unchanged pages.
+ */
+struct shm_view_layout {
+    char magic[4];
+    u16 version;
+    u16 page_size;
+    std::atomic<u32> seq;
+    u32 reserved;
+    shm_view_state state;
+    std::array<u64, 256> page_versions;
+    std::array<u8, 65536> memory;
+};
+
+static_assert(std::atomic<u32>::is_always_lock_free, "The seqlock needs a lock-free 32 bit atomic in shared memory.");
+
+/**
+ * @brief Publishes the machine state and memory in a POSIX shared memory segment, for external monitors.
+ *
+ * The emulator calls `tick()` every step, and every `interval` steps the registers, status and counters are copied
+ * into the segment along with the memory pages written since the last publish. Dirty pages are tracked by registering
+ * as a `bus_tap` for memory writes, forced ones included. Writing is wrapped in a seqlock: the emulator never waits on
+ * readers, and readers retry until they get a consistent copy (see `shm_view_reader`).
+ */
+class shm_view : public bus_tap {
+private:
+    bus& cardbus;
+    std::string name;
+    shm_view_layout* view;
+    usize interval;
+    usize countdown;
+    u64 steps;
+    std::array<u64, 4> dirty;
+
+public:
+    /**
+     * @brief Count a step, and tell if it's time to publish.
+     * @return True if `publish()` should be called.
+     */
+    inline bool tick() {
+        ++steps;
+
+        if (--countdown)
+            return false;
+
+        countdown = interval;
+        return true;
+    }
+
+    /**
+     * @brief Publish the state and the dirty memory pages.
+     * @param state The current CPU state.
+     * @param status The status bits, see `shm_view_status`.
+     */
+    void publish(const cpu_state& state, u8 status);
+
+    /// @brief Get the name of the shared memory segment.
+    const std::string& get_name() const { return name; }
+
+    /// @name Bus tap methods.
+    /// \{
+
+    // Forced writes too, or ROMs loaded and debugger writes made after the first publish would never show.
+    u8 page_interest(u8, bool io) const override {
+        return io ? 0 : static_cast<u8>(bus_access::WRITE) | static_cast<u8>(bus_access::FORCED_WRITE);
+    }
+
+    void on_access(u16 adr, u8, bool, bus_access) override { dirty[adr >> 14] |= 1ULL << ((adr >> 8) & 63); }
+
+    /// \}
+
+    /**
+     * @brief Create the shared memory segment and publish an initial state with all memory.
+     * @param cardbus The bus to publish memory from.
+     * @param name The name of the segment, like `/buddy8800`.
+     * @param interval The number of steps between publishes.
+     * @throw `std::invalid_argument` if interval is zero.
+     * @throw `std::runtime_error` if the segment could not be created.
+     */
+    shm_view(bus& cardbus, const std::string& name, usize interval);
+
+    /// @brief Unmap and unlink the shared memory segment.
+    ~shm_view();
+
+    shm_view(const shm_view&) = delete;
+    shm_view& operator=(const shm_view&) = delete;
+};
+
+/// @brief Reads consistent snapshots from a segment published by `shm_view`, without ever blocking the emulator.
+class shm_view_reader {
+private:
+    const shm_view_layout* view;
+
+public:
+    /// @brief Get a consistent copy of the state.
+    shm_view_state read_state() const;
+
+    /**
+     * @brief Get a consistent copy of a memory range.
+     * @param adr The first address to copy.
+     * @param len The number of bytes to copy, not going past the end of the address space.
+     * @param out Where to copy to, at least `len` bytes.
+     */
+    void read_memory(u16 adr, usize len, u8* out) const;
+
+    /**
+     * @brief Open a segment for reading.
+     * @param name The name of the segment, like `/buddy8800`.
+     * @throw `std::runtime_error` if the segment does not exist or is not a machine view.
+     */
+    shm_view_reader(const std::string& name);
+
+    ~shm_view_reader();
+
+    shm_view_reader(const shm_view_reader&) = delete;
+    shm_view_reader& operator=(const shm_view_reader&) = delete;
+};
+
+#endif
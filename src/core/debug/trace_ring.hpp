@@ -0,0 +1,183 @@
+#ifndef TRACE_RING_HPP_
+#define TRACE_RING_HPP_
+
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+
+#include "cpu_state.hpp"
+#include "typedef.hpp"
+
+/// @brief Bitmasks of the status byte of a trace record.
+enum class trace_status {
+    INTE = 0x01, INTERRUPT = 0x02
+};
+
+/**
+ * @brief A fixed-size record of a single executed instruction.
+ *
+ * Holds the PC the instruction was fetched from, the opcode and up to two operands (unused operands are zero), plus
+ * the register file right before execution. The status byte tells if interrupts were enabled and if the instruction
+ * was placed on the bus by an interrupting device instead of being fetched from memory.
+ */
+struct trace_record {
+    u16 pc;
+    u8 opcode;
+    u8 op1;
+    u8 op2;
+    u8 a;
+    u8 f;
+    u8 status;
+    u16 bc;
+    u16 de;
+    u16 hl;
+    u16 sp;
+};
+
+static_assert(sizeof(trace_record) == 16, "Trace records are expected to be 16 bytes.");
+
+/// @brief Header of a binary trace dump, followed by `count` records from oldest to newest.
+struct trace_dump_header {
+    char magic[4];
+    u16 version;
+    u16 record_size;
+    u32 reserved;
+    u64 total;
+    u64 count;
+};
+
+/**
+ * @brief An in-memory ring buffer of executed instruction records.
+ *
+ * This is the always-compiled counterpart of the `ENABLE_TRACE` builds: instead of printing every instruction, the
+ * CPU appends a 16 byte `trace_record` to a power of two sized ring, overwriting the oldest records. The buffer can
+ * then be dumped to a binary file on demand (or when something goes wrong) and decoded offline by the `tracedump`
+ * tool, giving the last N instructions before the event at close to no cost while running.
+ *
+ * @note The dump uses the host byte order, it's meant to be read back on the same kind of host.
+ */
+class trace_ring {
+private:
+    static constexpr char MAGIC[4] = { 'B', '8', 'T', 'R' };
+    static constexpr u16 VERSION = 1;
+
+    std::vector<trace_record> records;
+    usize mask;
+    u64 head;
+
+public:
+    /**
+     * @brief Append a record for an instruction about to be executed.
+     * @param state The CPU state before execution.
+     * @param opcode The opcode of the instruction.
+     * @param op1 The first operand, or zero.
+     * @param op2 The second operand, or zero.
+     * @param status The status bits, see `trace_status`.
+     */
+    inline void push(const cpu_state& state, u8 opcode, u8 op1, u8 op2, u8 status) {
+        records[head++ & mask] = {
+            state.PC(), opcode, op1, op2, state.A(), state.F(), status,
+            state.BC(), state.DE(), state.HL(), state.SP()
+        };
+    }
+
+    /// @brief Get the number of records currently held, at most `capacity()`.
+    usize size() const { return (head < records.size()) ? head : records.size(); }
+
+    /// @brief Get the maximum number of records held.
+    usize capacity() const { return records.size(); }
+
+    /// @brief Get the number of records pushed since construction or the last `clear()`.
+    u64 total() const { return head; }
+
+    /**
+     * @brief Get a record by age.
+     * @param i The index of the record, 0 being the oldest still held.
+     * @throw `std::out_of_range` if the index is not less than `size()`.
+     */
+    const trace_record& at(usize i) const {
+        if (i >= size())
+            throw std::out_of_range("Trace record index out of range.");
+
+        return records[(head - size() + i) & mask];
+    }
+
+    /// @brief Forget all held records.
+    void clear() { head = 0; }
+
+    /**
+     * @brief Dump the held records to a binary file, from oldest to newest.
+     * @param filename The path of the file to write.
+     * @throw `std::runtime_error` if the file could not be written.
+     */
+    void dump(const char* filename) const {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+
+        if (!file.is_open())
+            throw std::runtime_error("Could not open trace dump file: " + std::string(filename));
+
+        trace_dump_header header {};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.record_size = sizeof(trace_record);
+        header.total = head;
+        header.count = size();
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (usize i = 0; i < size(); ++i)
+            file.write(reinterpret_cast<const char*>(&at(i)), sizeof(trace_record));
+
+        if (file.fail())
+            throw std::runtime_error("Failed to write trace dump file: " + std::string(filename));
+    }
+
+    /**
+     * @brief Read back a binary dump written by `dump()`.
+     * @param filename The path of the file to read.
+     * @param header Where to store the header of the dump.
+     * @return The records from oldest to newest.
+     * @throw `std::runtime_error` if the file can't be read or is not a trace dump.
+     */
+    static std::vector<trace_record> read_dump(const char* filename, trace_dump_header& header) {
+        std::ifstream file(filename, std::ios::binary);
+
+        if (!file.is_open())
+            throw std::runtime_error("Could not open trace dump file: " + std::string(filename));
+
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+        if (!file or std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+            throw std::runtime_error("Not a trace dump file: " + std::string(filename));
+
+        if (header.version != VERSION or header.record_size != sizeof(trace_record))
+            throw std::runtime_error("Unsupported trace dump version or record size.");
+
+        std::vector<trace_record> out(header.count);
+        file.read(reinterpret_cast<char*>(out.data()), out.size() * sizeof(trace_record));
+
+        if (static_cast<usize>(file.gcount()) != out.size() * sizeof(trace_record))
+            throw std::runtime_error("Trace dump file is truncated: " + std::string(filename));
+
+        return out;
+    }
+
+    /**
+     * @brief Construct a ring buffer.
+     * @param capacity The number of records to hold, rounded up to the next power of two.
+     * @throw `std::invalid_argument` if capacity is zero.
+     */
+    trace_ring(usize capacity) : mask(0), head(0) {
+        if (capacity == 0)
+            throw std::invalid_argument("Trace ring capacity must be greater than 0.");
+
+        usize pow2 = 1;
+        while (pow2 < capacity)
+            pow2 <<= 1;
+
+        records.resize(pow2);
+        mask = pow2 - 1;
+    }
+};
+
+#endif
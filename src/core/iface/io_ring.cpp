@@ -0,0 +1,200 @@
+#include "io_ring.hpp"
+
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+static_assert(alignof(io_client) >= io_client::MAX_OPS, "Client pointers must leave room for the operation.");
+
+static int io_uring_setup(u32 entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(fd ring_fd, u32 to_submit, u32 min_complete, u32 flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static inline u32 load_acquire(const u32* at) { return __atomic_load_n(at, __ATOMIC_ACQUIRE); }
+static inline void store_release(u32* at, u32 value) { __atomic_store_n(at, value, __ATOMIC_RELEASE); }
+
+static inline u32* ring_field(void* map, u32 offset) {
+    return reinterpret_cast<u32*>(static_cast<u8*>(map) + offset);
+}
+
+bool io_ring::is_supported() {
+    io_uring_params params {};
+    const fd probe = io_uring_setup(1, &params);
+
+    if (probe < 0)
+        return false;
+
+    ::close(probe);
+    return true;
+}
+
+io_ring::io_ring(u32 entries)
+    : sq_map(MAP_FAILED), cq_map(MAP_FAILED), sqes(nullptr), queued(0), in_flight(0), enters(0), completed(0) {
+
+    io_uring_params params {};
+    ring_fd = io_uring_setup(entries, &params);
+
+    if (ring_fd < 0)
+        throw std::runtime_error("io_uring_setup() failed");
+
+    this->entries = params.sq_entries;
+    sq_map_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+    cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    // Recent kernels map both rings with a single mapping, as long as it covers the larger one.
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sq_map_size = cq_map_size = std::max(sq_map_size, cq_map_size);
+
+    sq_map = mmap(nullptr, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) {
+        ::close(ring_fd);
+        throw std::runtime_error("mmap() of the io_uring submission ring failed");
+    }
+
+    cq_map = (params.features & IORING_FEAT_SINGLE_MMAP) ? sq_map
+        : mmap(nullptr, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+
+    void* sqes_map = (cq_map == MAP_FAILED) ? MAP_FAILED
+        : mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+
+    if (sqes_map == MAP_FAILED) {
+        if (cq_map != MAP_FAILED and cq_map != sq_map)
+            munmap(cq_map, cq_map_size);
+        munmap(sq_map, sq_map_size);
+        ::close(ring_fd);
+        throw std::runtime_error("mmap() of the io_uring queues failed");
+    }
+
+    sqes = static_cast<io_uring_sqe*>(sqes_map);
+
+    sq_head = ring_field(sq_map, params.sq_off.head);
+    sq_tail = ring_field(sq_map, params.sq_off.tail);
+    sq_array = ring_field(sq_map, params.sq_off.array);
+    sq_mask = *ring_field(sq_map, params.sq_off.ring_mask);
+
+    cq_head = ring_field(cq_map, params.cq_off.head);
+    cq_tail = ring_field(cq_map, params.cq_off.tail);
+    cqes = reinterpret_cast<io_uring_cqe*>(static_cast<u8*>(cq_map) + params.cq_off.cqes);
+    cq_mask = *ring_field(cq_map, params.cq_off.ring_mask);
+}
+
+io_ring::~io_ring() {
+    munmap(sqes, sqes_size);
+    if (cq_map != sq_map)
+        munmap(cq_map, cq_map_size);
+    munmap(sq_map, sq_map_size);
+    ::close(ring_fd);
+}
+
+io_uring_sqe* io_ring::next_sqe() {
+    // Without a kernel polling thread, the kernel only consumes entries inside io_uring_enter().
+    if (*sq_tail - load_acquire(sq_head) >= entries)
+        submit();
+
+    if (*sq_tail - load_acquire(sq_head) >= entries)
+        throw std::runtime_error("The io_uring submission queue is full.");
+
+    const u32 index = *sq_tail & sq_mask;
+    io_uring_sqe* sqe = &sqes[index];
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+    sq_array[index] = index;
+    return sqe;
+}
+
+void io_ring::queue(u8 opcode, io_client* client, u8 op, fd file, u64 adr, u32 size, u64 offset) {
+    if (op >= io_client::MAX_OPS)
+        throw std::invalid_argument("Invalid io_ring operation number.");
+
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = opcode;
+    sqe->fd = file;
+    sqe->addr = adr;
+    sqe->len = size;
+    sqe->off = offset;
+    // Clients are polymorphic and thus aligned past MAX_OPS, the low bits of the pointer carry the operation.
+    sqe->user_data = reinterpret_cast<u64>(client) | op;
+
+    store_release(sq_tail, *sq_tail + 1);
+    ++queued;
+    ++in_flight;
+}
+
+void io_ring::read(io_client* client, u8 op, fd file, void* data, u32 size, u64 offset) {
+    queue(IORING_OP_READ, client, op, file, reinterpret_cast<u64>(data), size, offset);
+}
+
+void io_ring::write(io_client* client, u8 op, fd file, const void* data, u32 size, u64 offset) {
+    queue(IORING_OP_WRITE, client, op, file, reinterpret_cast<u64>(data), size, offset);
+}
+
+void io_ring::cancel(io_client* client, u8 op) {
+    io_uring_sqe* sqe = next_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<u64>(client) | op;
+    // The completion of the cancellation itself has no client.
+    sqe->user_data = 0;
+
+    store_release(sq_tail, *sq_tail + 1);
+    ++queued;
+    ++in_flight;
+}
+
+void io_ring::add_client(io_client* client) {
+    if (std::find(clients.begin(), clients.end(), client) == clients.end())
+        clients.push_back(client);
+}
+
+void io_ring::remove_client(io_client* client) {
+    clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
+}
+
+usize io_ring::submit(u32 wait_for) {
+    for (io_client* client : clients)
+        client->on_submit();
+
+    if (queued == 0 and wait_for == 0)
+        return 0;
+
+    ++enters;
+    const int submitted = io_uring_enter(ring_fd, queued, wait_for, wait_for ? IORING_ENTER_GETEVENTS : 0);
+
+    if (submitted < 0) {
+        // Interrupted, or out of resources until some completions are reaped, the requests stay queued.
+        if (errno == EINTR or errno == EAGAIN or errno == EBUSY)
+            return 0;
+        throw std::runtime_error("io_uring_enter() failed");
+    }
+
+    queued -= submitted;
+    return submitted;
+}
+
+usize io_ring::complete() {
+    u32 head = *cq_head;
+    const u32 tail = load_acquire(cq_tail);
+    usize count = 0;
+
+    while (head != tail) {
+        const io_uring_cqe cqe = cqes[head & cq_mask];
+        store_release(cq_head, ++head);
+        --in_flight;
+        ++count;
+
+        io_client* client = reinterpret_cast<io_client*>(cqe.user_data & ~static_cast<u64>(io_client::MAX_OPS - 1));
+        if (client)
+            client->on_complete(cqe.user_data & (io_client::MAX_OPS - 1), cqe.res);
+    }
+
+    completed += count;
+    return count;
+}
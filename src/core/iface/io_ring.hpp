@@ -0,0 +1,194 @@
+#ifndef IO_RING_HPP_
+#define IO_RING_HPP_
+
+#include <vector>
+#include <stdexcept>
+
+#include "typedef.hpp"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/// @brief The default number of submission queue entries of an I/O ring.
+constexpr static u32 IO_RING_DEFAULT_ENTRIES = 64;
+
+/// @brief The offset to pass for streams (pipes, terminals, sockets) and to use the current file position.
+constexpr static u64 IO_RING_NO_OFFSET = ~static_cast<u64>(0);
+
+/**
+ * @brief A device that has requests on an `io_ring`, and gets told when they complete.
+ *
+ * Each request carries a small operation number, so that a device can have a read and a write in flight at once and
+ * tell their completions apart. A device registered with `io_ring::add_client()` is also told right before each
+ * submission, to queue what it gathered since the previous one.
+ */
+class io_client {
+public:
+    /// @brief The number of operation numbers available to a client, from 0.
+    static constexpr u8 MAX_OPS = 8;
+
+    /**
+     * @brief Handle a completed request.
+     * @param op The operation number the request was queued with.
+     * @param result What the matching system call would have returned, or minus the `errno` value on failure.
+     */
+    virtual void on_complete(u8 op, i32 result) = 0;
+
+    /// @brief Queue the requests gathered since the previous submission, called by `io_ring::submit()`.
+    virtual void on_submit() {}
+
+    virtual ~io_client() = default;
+};
+
+/**
+ * @brief An asynchronous I/O queue shared by the devices of a machine, over Linux io_uring.
+ *
+ * Devices queue their reads and writes in the submission ring, which is memory shared with the kernel, so queueing is
+ * not a system call. The owner of the machine calls `submit()` once per scheduling quantum, handing everything that was
+ * queued by every device to the kernel in a single system call, and nothing at all when nothing was queued. Completions
+ * are written by the kernel into the completion ring, which `complete()` reads without a system call and dispatches to
+ * the devices.
+ *
+ * A device that waits on input (a terminal with no key pressed yet) thus keeps one read in flight, and costs nothing
+ * until the input comes.
+ *
+ * The system calls are made directly, liburing is not needed. Use `is_supported()` first, as kernels before 5.6, or
+ * with io_uring disabled, can't create rings.
+ *
+ * @warning A ring and its clients must be used from a single thread, and every request must complete, or be cancelled
+ * and waited for, before its client or buffer goes away.
+ */
+class io_ring {
+private:
+    fd ring_fd;
+    u32 entries;
+
+    void* sq_map;
+    usize sq_map_size;
+    void* cq_map;
+    usize cq_map_size;
+    io_uring_sqe* sqes;
+    usize sqes_size;
+
+    u32* sq_head;
+    u32* sq_tail;
+    u32* sq_array;
+    u32 sq_mask;
+
+    u32* cq_head;
+    u32* cq_tail;
+    io_uring_cqe* cqes;
+    u32 cq_mask;
+
+    std::vector<io_client*> clients;
+    u32 queued;
+    usize in_flight;
+    u64 enters;
+    u64 completed;
+
+    io_uring_sqe* next_sqe();
+    void queue(u8 opcode, io_client* client, u8 op, fd file, u64 adr, u32 size, u64 offset);
+
+public:
+    /// @brief Check whether the running kernel lets this process create io_uring instances.
+    static bool is_supported();
+
+    /// @name Request methods, the requests are queued until the next `submit()`.
+    /// \{
+
+    /**
+     * @brief Queue a read.
+     * @param client The device to notify, with `op`, once the read completes.
+     * @param op The operation number, below `io_client::MAX_OPS`.
+     * @param file The file descriptor to read.
+     * @param data Where to read to, it must stay valid until the read completes.
+     * @param size The maximum number of bytes to read.
+     * @param offset Where to read in the file, `IO_RING_NO_OFFSET` for streams.
+     * @throw `std::runtime_error` if the kernel refused the requests already queued, to make room.
+     */
+    void read(io_client* client, u8 op, fd file, void* data, u32 size, u64 offset = IO_RING_NO_OFFSET);
+
+    /**
+     * @brief Queue a write.
+     * @param client The device to notify, with `op`, once the write completes.
+     * @param op The operation number, below `io_client::MAX_OPS`.
+     * @param file The file descriptor to write.
+     * @param data What to write, it must stay valid and unchanged until the write completes.
+     * @param size The number of bytes to write, a completion may report less than that.
+     * @param offset Where to write in the file, `IO_RING_NO_OFFSET` for streams.
+     * @throw `std::runtime_error` if the kernel refused the requests already queued, to make room.
+     */
+    void write(io_client* client, u8 op, fd file, const void* data, u32 size, u64 offset = IO_RING_NO_OFFSET);
+
+    /**
+     * @brief Queue the cancellation of a request in flight.
+     * @param client The device that queued the request.
+     * @param op The operation number of the request.
+     *
+     * The cancelled request still completes, with `-ECANCELED` unless it completed first.
+     */
+    void cancel(io_client* client, u8 op);
+
+    /// @brief Register a client to be told before each submission, see `io_client::on_submit()`.
+    void add_client(io_client* client);
+
+    /// @brief Unregister a client.
+    void remove_client(io_client* client);
+
+    /// \}
+    /// @name Completion methods.
+    /// \{
+
+    /**
+     * @brief Let the registered clients queue their gathered requests, then hand the queued requests to the kernel.
+     * @param wait_for The number of completions to wait for, 0 not to block.
+     * @return The number of requests submitted.
+     * @throw `std::runtime_error` if `io_uring_enter()` failed.
+     * @note Without queued requests and with nothing to wait for, no system call is made.
+     */
+    usize submit(u32 wait_for = 0);
+
+    /**
+     * @brief Dispatch the completions the kernel posted so far to their clients, without a system call.
+     * @return The number of completions dispatched.
+     */
+    usize complete();
+
+    /// @brief Submit the queued requests, block until at least one completion is posted and dispatch it.
+    void wait() {
+        submit(1);
+        complete();
+    }
+
+    /// \}
+
+    /// @brief Get the file descriptor of the ring, readable while completions wait to be dispatched.
+    fd get_fd() const { return ring_fd; }
+
+    /// @brief Get the number of requests queued and not yet submitted.
+    u32 get_queued() const { return queued; }
+
+    /// @brief Get the number of requests submitted or queued, and not completed yet.
+    usize get_in_flight() const { return in_flight; }
+
+    /// @brief Get the number of `io_uring_enter()` system calls made so far.
+    u64 get_enters() const { return enters; }
+
+    /// @brief Get the number of completions dispatched so far.
+    u64 get_completed() const { return completed; }
+
+    /**
+     * @brief Create the ring and map its queues.
+     * @param entries The number of submission queue entries, the kernel rounds it up to a power of two.
+     * @throw `std::runtime_error` if the ring could not be created, see `is_supported()`.
+     */
+    explicit io_ring(u32 entries = IO_RING_DEFAULT_ENTRIES);
+
+    /// @brief Unmap the queues and close the ring, requests still in flight are cancelled by the kernel.
+    ~io_ring();
+
+    io_ring(const io_ring&) = delete;
+    io_ring& operator=(const io_ring&) = delete;
+};
+
+#endif
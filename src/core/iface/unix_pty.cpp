@@ -1,5 +1,7 @@
 #include "unix_pty.hpp"
 
+#include <cerrno>
+
 void pty::open() {
     master_fd = posix_openpt(O_RDWR | O_NOCTTY);
     if (master_fd < 0)
@@ -32,11 +34,21 @@ const char* pty::name() const {
     return slave_device_name;
 }
 
-void pty::send(const char* data) const {
+void pty::send(const char* data) {
     send(data, std::strlen(data));
 }
 
-void pty::send(const char* data, usize size) const {
+void pty::send(const char* data, usize size) {
+    if (ring) {
+        if (tx_failed) {
+            tx_failed = false;
+            throw std::runtime_error("write() failed");
+        }
+
+        tx_queue.insert(tx_queue.end(), data, data + size);
+        return;
+    }
+
     usize total_wr = 0;
     while (total_wr < size) {
         isize wr_amount = write(master_fd, data + total_wr, size - total_wr);
@@ -51,7 +63,26 @@ void pty::send_break() const {
         throw std::runtime_error("tcsendbreak() failed");
 }
 
-char pty::getch() const {
+char pty::getch() {
+    if (ring) {
+        while (rx_pos == rx_len and !rx_failed) {
+            arm_read();
+            ring->wait();
+        }
+
+        if (rx_failed) {
+            rx_failed = false;
+            throw std::runtime_error("read() failed");
+        }
+
+        const char c = rx[rx_pos++];
+        if (rx_pos == rx_len)
+            arm_read();
+        if (echo_received_back)
+            putch(c);
+        return c;
+    }
+
     char c;
     isize recv_amount = read(master_fd, &c, 1);
     if (recv_amount != 1)
@@ -61,12 +92,29 @@ char pty::getch() const {
     return c;
 }
 
-void pty::putch(char c) const {
+void pty::putch(char c) {
+    if (ring) {
+        send(&c, 1);
+        return;
+    }
+
     if (write(master_fd, &c, 1) < 0)
         throw std::runtime_error("write() failed");
 }
 
-bool pty::poll() const {
+bool pty::poll() {
+    if (ring) {
+        if (rx_pos == rx_len and !rx_failed) {
+            // Only the first poll after the buffer drained submits, to get the next read in flight.
+            arm_read();
+            if (ring->get_queued() > 0)
+                ring->submit();
+            ring->complete();
+        }
+
+        return rx_pos < rx_len or rx_failed;
+    }
+
     epoll_event event;
     int is_event = static_cast<bool>(epoll_wait(epoll_fd, &event, 1, 0));
 
@@ -76,7 +124,7 @@ bool pty::poll() const {
     return is_event > 0;
 }
 
-void pty::recv(char* data, usize max, char terminator) const {
+void pty::recv(char* data, usize max, char terminator) {
     if (max == 0)
         throw std::invalid_argument("recv() buffer max must be greater than 0");
 
@@ -87,6 +135,15 @@ void pty::recv(char* data, usize max, char terminator) const {
 
     usize total_recv = 0;
 
+    // The input buffer already holds whatever a read() would return, getch() only drains it.
+    if (ring) {
+        while ((total_recv == 0 or data[total_recv - 1] != terminator) and total_recv < max - 1)
+            data[total_recv++] = getch();
+
+        data[total_recv] = '\0';
+        return;
+    }
+
     while ((total_recv == 0 or data[total_recv - 1] != terminator) and total_recv < max - 1) {
         isize recv_amount = read(master_fd, data + total_recv, max - total_recv - 1);
 
@@ -160,7 +217,96 @@ void pty::set_echo_received_back(bool should) {
     echo_received_back = should;
 }
 
+void pty::arm_read() {
+    if (rx_pending)
+        return;
+
+    rx_pos = rx_len = 0;
+    ring->read(this, RX_OP, master_fd, rx.data(), rx.size());
+    rx_pending = true;
+}
+
+void pty::start_write() {
+    if (tx_pending or tx_queue.empty())
+        return;
+
+    // The bytes in flight must not move until the write completes, new bytes go to the other buffer meanwhile.
+    tx_flight.swap(tx_queue);
+    tx_queue.clear();
+    tx_done = 0;
+    ring->write(this, TX_OP, master_fd, tx_flight.data(), tx_flight.size());
+    tx_pending = true;
+}
+
+void pty::on_complete(u8 op, i32 result) {
+    if (op == RX_OP) {
+        rx_pending = false;
+
+        // An interrupted read is simply armed again by the next poll() or getch().
+        if (result > 0)
+            rx_len = result;
+        else if (result != -ECANCELED and result != -EINTR)
+            rx_failed = true;
+
+        return;
+    }
+
+    tx_pending = false;
+
+    if (result == -EINTR)
+        result = 0;
+
+    if (result < 0) {
+        tx_failed = true;
+        tx_flight.clear();
+        return;
+    }
+
+    tx_done += result;
+    if (tx_done < tx_flight.size()) {
+        ring->write(this, TX_OP, master_fd, tx_flight.data() + tx_done, tx_flight.size() - tx_done);
+        tx_pending = true;
+        return;
+    }
+
+    tx_flight.clear();
+}
+
+void pty::attach(io_ring& io) {
+    if (master_fd < 0)
+        throw std::runtime_error("The PTY interface must be open to attach it to an I/O ring.");
+
+    detach();
+    ring = &io;
+    ring->add_client(this);
+    arm_read();
+}
+
+void pty::detach() {
+    if (!ring)
+        return;
+
+    // Each submission starts writing what was queued meanwhile, until everything is out.
+    while (tx_pending or !tx_queue.empty())
+        ring->wait();
+
+    // Only cancelled once the output is out, the kernel may interrupt a write it runs on the same worker.
+    if (rx_pending)
+        ring->cancel(this, RX_OP);
+
+    while (rx_pending)
+        ring->wait();
+
+    ring->remove_client(this);
+    ring = nullptr;
+    rx_pos = rx_len = 0;
+    rx_failed = tx_failed = false;
+    tx_queue.clear();
+}
+
 void pty::close() {
+    detach();
+
     if (master_fd != -1) {
         ::close(master_fd);
         master_fd = -1;
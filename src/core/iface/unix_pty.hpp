@@ -1,6 +1,8 @@
 #ifndef UNIX_PTY_HPP_
 #define UNIX_PTY_HPP_
 
+#include <array>
+#include <vector>
 #include <stdexcept>
 #include <fcntl.h>
 #include <unistd.h>
@@ -8,6 +10,7 @@
 #include <cstring>
 #include <sys/epoll.h>
 
+#include "io_ring.hpp"
 #include "typedef.hpp"
 
 /// @brief Enumerates all possible parity modes of the serial device.
@@ -24,9 +27,13 @@ enum class pty_parity : u32 {
  * is supposed to be provided to the user or a process to interact with, thus the name() method
  * is available to retrieve the slave device name, but no further handling is done by this class.
  *
+ * Once attached to an `io_ring`, the master side is served asynchronously instead: a read stays in flight into an input
+ * buffer, which `poll()` and `getch()` consume without system calls, and sent bytes are gathered into one write per
+ * submission of the ring.
+ *
  * @todo On breaking the application while running, if anything is connected to the slave fd, the PTY is never closed.
  */
-class pty {
+class pty : public io_client {
 private:
     static constexpr usize MAX_SLAVE_DEVICE_NAME = 64;
 
@@ -37,12 +44,31 @@ private:
 
     static constexpr u32 DEFAULT_BREAK_DURATION  = 0; /// Will default to the termios.h default value
 
+    static constexpr usize RING_BUFFER_SIZE      = 256;
+    static constexpr u8 RX_OP                    = 0;
+    static constexpr u8 TX_OP                    = 1;
+
     fd master_fd;
     fd epoll_fd;
     char slave_device_name[MAX_SLAVE_DEVICE_NAME];
 
     bool echo_received_back;
 
+    io_ring* ring;
+    std::array<char, RING_BUFFER_SIZE> rx;
+    usize rx_pos;
+    usize rx_len;
+    bool rx_pending;
+    bool rx_failed;
+    std::vector<char> tx_queue;
+    std::vector<char> tx_flight;
+    usize tx_done;
+    bool tx_pending;
+    bool tx_failed;
+
+    void arm_read();
+    void start_write();
+
 public:
     /**
      * @brief Open the PTY interface.
@@ -76,7 +102,7 @@ public:
      *
      * @warning This method will block until all bytes of data are sent.
      */
-    void send(const char* data) const;
+    void send(const char* data);
 
     /**
      * @brief Send data to the PTY interface master side.
@@ -87,9 +113,10 @@ public:
      * This method sends data to the PTY interface master side. The slave side will be able to receive
      * this data in order. It uses the `write()` system call to send the data to the master file descriptor.
      *
-     * @warning This method will block until `size` bytes are sent.
+     * @warning This method will block until `size` bytes are sent, unless attached to an `io_ring`, where they are
+     * queued instead.
      */
-    void send(const char* data, usize size) const;
+    void send(const char* data, usize size);
 
     /**
      * @brief Send a break signal to the PTY interface master side.
@@ -113,7 +140,7 @@ public:
      *
      * @warning This method will block until a byte is read.
      */
-    char getch() const;
+    char getch();
 
     /**
      * @brief Send a single byte to the PTY interface master side.
@@ -122,9 +149,10 @@ public:
      *
      * This method sends a single byte/char to the PTY interface master side. It uses the `write()` system call.
      *
-     * @warning This method will block until the byte is sent.
+     * @warning This method will block until the byte is sent, unless attached to an `io_ring`, where it is queued and
+     * written on a following `io_ring::submit()`.
      */
-    void putch(char c) const;
+    void putch(char c);
 
     /**
      * @brief Check if there is data available to be read from the PTY interface master side.
@@ -132,9 +160,10 @@ public:
      * @throw `std::runtime_error` if the PTY interface had an error.
      *
      * This method polls the PTY interface master side to check if there is data available to be read.
-     * It's handling the master PTY fd internally using `epoll`.
+     * It's handling the master PTY fd internally using `epoll`, or when attached to an `io_ring`, by checking the input
+     * buffer and the completions already posted, without a system call.
      */
-    bool poll() const;
+    bool poll();
 
     /**
      * @brief Receive data from the PTY interface master side.
@@ -152,7 +181,7 @@ public:
      * @note If `max` is 1, the method is a wrapper to `getch()` and will not null-terminate the buffer.
      * @warning This method will block until `max - 1` bytes are read or the terminator character is found.
      */
-    void recv(char* data, usize max, char terminator = '\r') const;
+    void recv(char* data, usize max, char terminator = '\r');
 
     /**
      * @brief Setup the PTY interface with custom configuration.
@@ -183,12 +212,50 @@ public:
      */
     void set_echo_received_back(bool should);
 
-    
+    /**
+     * @brief Serve the master side through an I/O ring, instead of a system call per operation.
+     * @param io The ring, it must outlive the PTY interface or `detach()` must be called first.
+     * @throw `std::runtime_error` if the PTY interface is not open.
+     *
+     * The owner of the ring is expected to call `io_ring::submit()` regularly, once per scheduling quantum, which is
+     * when queued output reaches the slave side. Blocking methods such as `getch()` submit on their own.
+     */
+    void attach(io_ring& io);
+
+    /**
+     * @brief Go back to system calls, after writing the queued output.
+     * @note Input already received but not read yet is dropped.
+     */
+    void detach();
+
+    /**
+     * @brief Get the file descriptor to wait on for input, with `poll()` or `epoll`.
+     * @return The master file descriptor, or the ring's when attached to an `io_ring`, whose completions bring input.
+     * @note When attached, call `poll()` first, so that a read is in flight.
+     */
+    fd get_event_fd() const { return ring ? ring->get_fd() : master_fd; }
+
+    /// @brief Check whether the PTY interface is served through an I/O ring.
+    bool is_attached() const { return ring != nullptr; }
+
+    /// @name I/O ring client methods.
+    /// \{
+
+    void on_complete(u8 op, i32 result) override;
+    void on_submit() override { start_write(); }
+
+    /// \}
+
     /// @brief Close the PTY interface and free the PTY master file descriptor.
     void close();
 
-    pty() : master_fd(-1), epoll_fd(-1), echo_received_back(false) {};
+    pty()
+        : master_fd(-1), epoll_fd(-1), echo_received_back(false), ring(nullptr), rx_pos(0), rx_len(0),
+          rx_pending(false), rx_failed(false), tx_done(0), tx_pending(false), tx_failed(false) {};
     ~pty() { close(); }
+
+    pty(const pty&) = delete;
+    pty& operator=(const pty&) = delete;
 };
 
 #endif
@@ -0,0 +1,532 @@
+#ifndef SNAPSHOT_HPP_
+#define SNAPSHOT_HPP_
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <istream>
+#include <ostream>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "page_pool.hpp"
+#include "cpu_state.hpp"
+#include "typedef.hpp"
+
+/// @brief The contents of one memory card at the time of a snapshot.
+struct snapshot_region {
+    u8 slot;
+    u16 start;
+    std::vector<u8> data;
+};
+
+/**
+ * @brief A point-in-time copy of a machine: CPU registers, halt and interrupt enable status, and all memory cards.
+ *
+ * Memory is copied card by card rather than as a flat address space, so that ROM contents (and RAM shadowed by other
+ * cards) are kept too, and restoring writes each card directly, write lock or not. I/O cards are not part of a
+ * snapshot, they keep their current state on restore.
+ *
+ * Snapshots can only be restored on a machine with the same memory cards in the same slots.
+ */
+struct machine_snapshot {
+    static constexpr char MAGIC[4] = { 'B', '8', 'S', 'N' };
+    static constexpr u16 VERSION = 1;
+
+    cpu_state state;
+    bool halted;
+    bool interrupts_enabled;
+    std::vector<snapshot_region> regions;
+
+    /**
+     * @brief Take a snapshot of a machine.
+     * @param processor The CPU of the machine.
+     * @param cardbus The bus of the machine.
+     */
+    static machine_snapshot capture(const cpu<bus&>& processor, const bus& cardbus) {
+        machine_snapshot snap;
+        snap.state = processor.save_state();
+        snap.halted = processor.is_halted();
+        snap.interrupts_enabled = processor.is_interrupt_enabled();
+
+        for (usize slot = 0; slot < bus::get_slot_count(); ++slot) {
+            card* c = cardbus.get_card(slot);
+            if (!c or c->is_io())
+                continue;
+
+            const card_identify ident = c->identify();
+            snapshot_region region { static_cast<u8>(slot), ident.start_adr, std::vector<u8>(ident.adr_range) };
+
+            for (usize i = 0; i < ident.adr_range; ++i)
+                region.data[i] = c->read(static_cast<u16>(ident.start_adr + i));
+
+            snap.regions.push_back(std::move(region));
+        }
+
+        return snap;
+    }
+
+    /**
+     * @brief Restore this snapshot onto a machine.
+     * @param processor The CPU of the machine.
+     * @param cardbus The bus of the machine.
+     * @throw `std::runtime_error` if the memory cards of the machine don't match the ones of the snapshot.
+     */
+    void restore(cpu<bus&>& processor, bus& cardbus) const {
+        for (const snapshot_region& region : regions) {
+            card* c = cardbus.get_card(region.slot);
+            if (!c or c->is_io() or c->identify().start_adr != region.start or c->identify().adr_range != region.data.size())
+                throw std::runtime_error("Snapshot does not match the memory cards of the machine.");
+        }
+
+        for (const snapshot_region& region : regions) {
+            card* c = cardbus.get_card(region.slot);
+            for (usize i = 0; i < region.data.size(); ++i)
+                c->write_force(static_cast<u16>(region.start + i), region.data[i]);
+        }
+
+        processor.load_state(state);
+        processor.set_halted(halted);
+        processor.set_interrupt_enabled(interrupts_enabled);
+    }
+
+    /**
+     * @brief Write the snapshot to a binary file.
+     * @param filename The path of the file to write.
+     * @throw `std::runtime_error` if the file could not be written.
+     */
+    void save(const char* filename) const {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+
+        if (!file.is_open())
+            throw std::runtime_error("Could not open snapshot file: " + std::string(filename));
+
+        write(file);
+
+        if (file.fail())
+            throw std::runtime_error("Failed to write snapshot file: " + std::string(filename));
+    }
+
+    /**
+     * @brief Read a snapshot written by `save()`.
+     * @param filename The path of the file to read.
+     * @throw `std::runtime_error` if the file can't be read or is not a snapshot.
+     */
+    static machine_snapshot load(const char* filename) {
+        std::ifstream file(filename, std::ios::binary);
+
+        if (!file.is_open())
+            throw std::runtime_error("Could not open snapshot file: " + std::string(filename));
+
+        return read(file, filename);
+    }
+
+    /// @brief Write the snapshot to a stream, in the format of `save()`.
+    void write(std::ostream& file) const {
+        write_header(file);
+
+        for (const snapshot_region& region : regions) {
+            const u32 size = region.data.size();
+            file.write(reinterpret_cast<const char*>(&region.slot), sizeof(region.slot));
+            file.write(reinterpret_cast<const char*>(&region.start), sizeof(region.start));
+            file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            file.write(reinterpret_cast<const char*>(region.data.data()), size);
+        }
+    }
+
+    /**
+     * @brief Read a snapshot written by `write()` from a stream.
+     * @param file The stream.
+     * @param filename The name of the stream, for errors.
+     * @throw `std::runtime_error` if the stream is not a snapshot or is truncated.
+     */
+    static machine_snapshot read(std::istream& file, const std::string& filename) {
+        machine_snapshot snap;
+        const u16 region_count = snap.read_header(file, filename);
+
+        for (u16 i = 0; i < region_count; ++i) {
+            snapshot_region region;
+            u32 size;
+
+            file.read(reinterpret_cast<char*>(&region.slot), sizeof(region.slot));
+            file.read(reinterpret_cast<char*>(&region.start), sizeof(region.start));
+            file.read(reinterpret_cast<char*>(&size), sizeof(size));
+
+            if (!file or size > 65536)
+                throw std::runtime_error("Snapshot file is corrupted: " + filename);
+
+            region.data.resize(size);
+            file.read(reinterpret_cast<char*>(region.data.data()), size);
+            snap.regions.push_back(std::move(region));
+        }
+
+        if (!file)
+            throw std::runtime_error("Snapshot file is truncated: " + filename);
+
+        return snap;
+    }
+
+private:
+    /// @brief Registers as AF, BC, DE, HL, SP, PC, then status bits and the number of regions.
+    void write_header(std::ostream& file) const {
+        file.write(MAGIC, sizeof(MAGIC));
+        file.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+
+        for (usize reg = 0; reg < 6; ++reg) {
+            const u16 value = state.get_register16(static_cast<cpu_registers16>(reg));
+            file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+        const u8 status = (halted ? 1 : 0) | (interrupts_enabled ? 2 : 0);
+        const u16 region_count = regions.size();
+        file.write(reinterpret_cast<const char*>(&status), sizeof(status));
+        file.write(reinterpret_cast<const char*>(&region_count), sizeof(region_count));
+    }
+
+    u16 read_header(std::istream& file, const std::string& filename) {
+        char magic[4];
+        u16 version;
+
+        file.read(magic, sizeof(magic));
+        file.read(reinterpret_cast<char*>(&version), sizeof(version));
+
+        if (!file or std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+            throw std::runtime_error("Not a snapshot file: " + filename);
+
+        if (version != VERSION)
+            throw std::runtime_error("Unsupported snapshot version.");
+
+        for (usize reg = 0; reg < 6; ++reg) {
+            u16 value;
+            file.read(reinterpret_cast<char*>(&value), sizeof(value));
+            state.set_register16(static_cast<cpu_registers16>(reg), value);
+        }
+
+        u8 status;
+        u16 region_count;
+        file.read(reinterpret_cast<char*>(&status), sizeof(status));
+        file.read(reinterpret_cast<char*>(&region_count), sizeof(region_count));
+
+        if (!file)
+            throw std::runtime_error("Snapshot file is truncated: " + filename);
+
+        halted = status & 1;
+        interrupts_enabled = status & 2;
+        return region_count;
+    }
+};
+
+/// @brief The granularity of snapshot deltas, the same as the pages of `paged_ram_card` so that they can be compared.
+constexpr static usize DELTA_PAGE_SIZE = POOL_PAGE_SIZE;
+
+/// @brief A page of a snapshot region that changed, in a `snapshot_delta`.
+struct delta_page {
+    u8 region;
+    u16 offset;
+    std::vector<u8> data;
+};
+
+/**
+ * @brief The difference between two snapshots of the same machine: the CPU status of the newer one, and the memory
+ * pages that changed since the older one, its parent.
+ */
+struct snapshot_delta {
+    static constexpr char MAGIC = 'D';
+
+    cpu_state state;
+    bool halted;
+    bool interrupts_enabled;
+    std::vector<delta_page> pages;
+
+    /**
+     * @brief Compare two snapshots by content.
+     * @param parent The older snapshot.
+     * @param child The newer snapshot.
+     * @throw `std::invalid_argument` if the snapshots have different memory cards.
+     */
+    static snapshot_delta diff(const machine_snapshot& parent, const machine_snapshot& child) {
+        if (parent.regions.size() != child.regions.size())
+            throw std::invalid_argument("Snapshots don't have the same memory cards.");
+
+        snapshot_delta delta { child.state, child.halted, child.interrupts_enabled, {} };
+
+        for (usize r = 0; r < child.regions.size(); ++r) {
+            const snapshot_region& before = parent.regions[r];
+            const snapshot_region& after = child.regions[r];
+
+            if (before.slot != after.slot or before.start != after.start or before.data.size() != after.data.size())
+                throw std::invalid_argument("Snapshots don't have the same memory cards.");
+
+            // memcmp is vectorized by the C library, and pages mostly compare equal.
+            for (usize at = 0; at < after.data.size(); at += DELTA_PAGE_SIZE) {
+                const usize size = std::min(DELTA_PAGE_SIZE, after.data.size() - at);
+
+                if (std::memcmp(before.data.data() + at, after.data.data() + at, size) != 0)
+                    delta.pages.push_back({
+                        static_cast<u8>(r), static_cast<u16>(at),
+                        std::vector<u8>(after.data.begin() + at, after.data.begin() + at + size)
+                    });
+            }
+        }
+
+        return delta;
+    }
+
+    /**
+     * @brief Turn a snapshot of the parent into a snapshot of the child.
+     * @throw `std::invalid_argument` if the snapshot doesn't have the memory cards the delta was taken on.
+     */
+    void apply(machine_snapshot& snap) const {
+        for (const delta_page& page : pages) {
+            if (page.region >= snap.regions.size() or page.offset + page.data.size() > snap.regions[page.region].data.size())
+                throw std::invalid_argument("Snapshot delta does not match the snapshot.");
+
+            std::copy(page.data.begin(), page.data.end(), snap.regions[page.region].data.begin() + page.offset);
+        }
+
+        snap.state = state;
+        snap.halted = halted;
+        snap.interrupts_enabled = interrupts_enabled;
+    }
+
+    /// @brief Get the number of bytes of memory held by the delta.
+    usize get_size() const {
+        usize size = 0;
+        for (const delta_page& page : pages)
+            size += page.data.size();
+        return size;
+    }
+
+    /// @brief Write the delta to a stream: the magic byte, registers, status, then each page as region, offset, size, data.
+    void write(std::ostream& file) const {
+        file.write(&MAGIC, sizeof(MAGIC));
+
+        for (usize reg = 0; reg < 6; ++reg) {
+            const u16 value = state.get_register16(static_cast<cpu_registers16>(reg));
+            file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+
+        const u8 status = (halted ? 1 : 0) | (interrupts_enabled ? 2 : 0);
+        const u32 page_count = pages.size();
+        file.write(reinterpret_cast<const char*>(&status), sizeof(status));
+        file.write(reinterpret_cast<const char*>(&page_count), sizeof(page_count));
+
+        for (const delta_page& page : pages) {
+            const u16 size = page.data.size();
+            file.write(reinterpret_cast<const char*>(&page.region), sizeof(page.region));
+            file.write(reinterpret_cast<const char*>(&page.offset), sizeof(page.offset));
+            file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+            file.write(reinterpret_cast<const char*>(page.data.data()), size);
+        }
+    }
+
+    /**
+     * @brief Read a delta written by `write()`.
+     * @throw `std::runtime_error` if the stream doesn't hold a whole delta.
+     */
+    static snapshot_delta read(std::istream& file, const std::string& filename) {
+        snapshot_delta delta;
+        char magic;
+        u8 status;
+        u32 page_count;
+
+        file.read(&magic, sizeof(magic));
+        if (!file or magic != MAGIC)
+            throw std::runtime_error("Not a snapshot delta: " + filename);
+
+        for (usize reg = 0; reg < 6; ++reg) {
+            u16 value;
+            file.read(reinterpret_cast<char*>(&value), sizeof(value));
+            delta.state.set_register16(static_cast<cpu_registers16>(reg), value);
+        }
+
+        file.read(reinterpret_cast<char*>(&status), sizeof(status));
+        file.read(reinterpret_cast<char*>(&page_count), sizeof(page_count));
+
+        if (!file or page_count > 65536)
+            throw std::runtime_error("Snapshot delta is truncated: " + filename);
+
+        delta.halted = status & 1;
+        delta.interrupts_enabled = status & 2;
+        delta.pages.resize(page_count);
+
+        for (delta_page& page : delta.pages) {
+            u16 size;
+            file.read(reinterpret_cast<char*>(&page.region), sizeof(page.region));
+            file.read(reinterpret_cast<char*>(&page.offset), sizeof(page.offset));
+            file.read(reinterpret_cast<char*>(&size), sizeof(size));
+
+            if (!file or size > DELTA_PAGE_SIZE)
+                throw std::runtime_error("Snapshot delta is truncated: " + filename);
+
+            page.data.resize(size);
+            file.read(reinterpret_cast<char*>(page.data.data()), size);
+        }
+
+        if (!file)
+            throw std::runtime_error("Snapshot delta is truncated: " + filename);
+
+        return delta;
+    }
+};
+
+/**
+ * @brief A snapshot taken in two parts: a freeze that only pins memory, and a resolve that copies it later.
+ *
+ * Freezing copies the CPU status and takes a reference to every page of `paged_ram_card`s, which is a few
+ * microseconds per card (the pages written since the last freeze are hashed into the pool). The machine can then keep
+ * running: the frozen pages are immutable, the machine's next write to each one copies it first. Resolving copies the
+ * frozen pages into a `machine_snapshot`, and can run on any thread without holding the machine. Other memory cards
+ * are copied during the freeze.
+ */
+class deferred_snapshot {
+private:
+    struct frozen_region {
+        u8 slot;
+        u16 start;
+        usize size;
+        page_pool* pool;
+        std::vector<const u8*> pages;
+        std::vector<u8> data;
+    };
+
+    cpu_state state;
+    bool halted;
+    bool interrupts_enabled;
+    std::vector<frozen_region> regions;
+
+    void release() {
+        for (frozen_region& region : regions)
+            for (const u8* page : region.pages)
+                region.pool->release(page);
+
+        regions.clear();
+    }
+
+    deferred_snapshot() = default;
+
+public:
+    /**
+     * @brief Freeze the state of a machine.
+     * @param processor The CPU of the machine.
+     * @param cardbus The bus of the machine.
+     * @note Only the freeze needs exclusive access to the machine.
+     */
+    static deferred_snapshot freeze(const cpu<bus&>& processor, const bus& cardbus) {
+        deferred_snapshot frozen;
+        frozen.state = processor.save_state();
+        frozen.halted = processor.is_halted();
+        frozen.interrupts_enabled = processor.is_interrupt_enabled();
+
+        for (usize slot = 0; slot < bus::get_slot_count(); ++slot) {
+            card* c = cardbus.get_card(slot);
+            if (!c or c->is_io())
+                continue;
+
+            const card_identify ident = c->identify();
+            frozen_region region { static_cast<u8>(slot), ident.start_adr, ident.adr_range, nullptr, {}, {} };
+
+            if (paged_ram_card* paged = dynamic_cast<paged_ram_card*>(c)) {
+                region.pool = &paged->get_pool();
+                region.pages = paged->freeze();
+            } else {
+                region.data.resize(ident.adr_range);
+                for (usize i = 0; i < ident.adr_range; ++i)
+                    region.data[i] = c->read(static_cast<u16>(ident.start_adr + i));
+            }
+
+            frozen.regions.push_back(std::move(region));
+        }
+
+        return frozen;
+    }
+
+    /// @brief Copy the frozen state into a snapshot.
+    machine_snapshot resolve() const {
+        machine_snapshot snap;
+        snap.state = state;
+        snap.halted = halted;
+        snap.interrupts_enabled = interrupts_enabled;
+
+        for (const frozen_region& region : regions) {
+            snapshot_region copy { region.slot, region.start, region.data };
+
+            if (region.pool) {
+                copy.data.resize(region.size);
+                for (usize i = 0; i < region.pages.size(); ++i)
+                    std::memcpy(
+                        copy.data.data() + i * POOL_PAGE_SIZE, region.pages[i],
+                        std::min(POOL_PAGE_SIZE, region.size - i * POOL_PAGE_SIZE)
+                    );
+            }
+
+            snap.regions.push_back(std::move(copy));
+        }
+
+        return snap;
+    }
+
+    /**
+     * @brief Get the pages that changed since an older freeze of the same machine.
+     * @param parent The older freeze.
+     * @throw `std::invalid_argument` if the freezes have different memory cards.
+     *
+     * Pages of `paged_ram_card`s are compared by address: both freezes hold references to pages of the same pool, in
+     * which equal contents are the same page, so only pages written since the parent are copied and nothing is
+     * compared byte by byte. Other memory cards are compared by content.
+     */
+    snapshot_delta diff(const deferred_snapshot& parent) const {
+        if (parent.regions.size() != regions.size())
+            throw std::invalid_argument("Snapshots don't have the same memory cards.");
+
+        snapshot_delta delta { state, halted, interrupts_enabled, {} };
+
+        for (usize r = 0; r < regions.size(); ++r) {
+            const frozen_region& before = parent.regions[r];
+            const frozen_region& after = regions[r];
+
+            if (before.slot != after.slot or before.start != after.start or before.size != after.size
+                or before.pool != after.pool)
+                throw std::invalid_argument("Snapshots don't have the same memory cards.");
+
+            for (usize at = 0, page = 0; at < after.size; at += DELTA_PAGE_SIZE, ++page) {
+                const usize size = std::min(DELTA_PAGE_SIZE, after.size - at);
+                const u8* now = after.pool ? after.pages[page] : after.data.data() + at;
+                const u8* then = before.pool ? before.pages[page] : before.data.data() + at;
+
+                if (after.pool ? now != then : std::memcmp(now, then, size) != 0)
+                    delta.pages.push_back({ static_cast<u8>(r), static_cast<u16>(at), std::vector<u8>(now, now + size) });
+            }
+        }
+
+        return delta;
+    }
+
+    deferred_snapshot(deferred_snapshot&& other) noexcept
+        : state(other.state), halted(other.halted), interrupts_enabled(other.interrupts_enabled),
+          regions(std::move(other.regions)) { other.regions.clear(); }
+
+    deferred_snapshot& operator=(deferred_snapshot&& other) noexcept {
+        if (this != &other) {
+            release();
+            state = other.state;
+            halted = other.halted;
+            interrupts_enabled = other.interrupts_enabled;
+            regions = std::move(other.regions);
+            other.regions.clear();
+        }
+
+        return *this;
+    }
+
+    deferred_snapshot(const deferred_snapshot&) = delete;
+    deferred_snapshot& operator=(const deferred_snapshot&) = delete;
+
+    /// @brief Give the frozen pages back to their pools.
+    ~deferred_snapshot() { release(); }
+};
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef SNAPSHOT_CHAIN_HPP_
+#define SNAPSHOT_CHAIN_HPP_
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "snapshot.hpp"
+#include "typedef.hpp"
+
+/// @brief The default number of deltas a snapshot chain holds before compacting.
+constexpr static usize CHAIN_DEFAULT_DELTAS = 64;
+
+/**
+ * @brief A timeline of checkpoints of one machine: a full snapshot, then one `snapshot_delta` per checkpoint.
+ *
+ * Each checkpoint freezes the machine (see `deferred_snapshot`) and only keeps the pages that changed since the
+ * previous one, so frequent checkpoints cost the memory the machine actually wrote, and with `paged_ram_card`s no
+ * comparison at all. Checkpoints are numbered from 0 in the order they were taken, and any checkpoint still in the
+ * chain can be rebuilt as a full snapshot, to rewind the machine.
+ *
+ * Once the chain holds more than `max_deltas` deltas, it is compacted: the oldest deltas are folded into the full
+ * snapshot, so that half of them remain, and the checkpoints before are dropped.
+ *
+ * Optionally the chain is also kept in a journal file, to recover the machine after a crash: the full snapshot is
+ * written on the first checkpoint and on compaction, each delta is appended to it as it is taken.
+ */
+class snapshot_chain {
+private:
+    static constexpr char MAGIC[4] = { 'B', '8', 'S', 'C' };
+    static constexpr u16 VERSION = 1;
+
+    machine_snapshot base;
+    std::vector<snapshot_delta> deltas;
+    std::optional<deferred_snapshot> head;
+    usize first;
+    usize last_size;
+    usize max_deltas;
+    std::string journal;
+    std::ofstream journal_file;
+
+    void rewrite_journal() {
+        if (journal.empty())
+            return;
+
+        const std::string temp = journal + ".tmp";
+        journal_file.close();
+
+        {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            file.write(MAGIC, sizeof(MAGIC));
+            file.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+            base.write(file);
+
+            for (const snapshot_delta& delta : deltas)
+                delta.write(file);
+
+            if (!file.is_open() or file.fail())
+                throw std::runtime_error("Failed to write snapshot journal: " + temp);
+        }
+
+        if (std::rename(temp.c_str(), journal.c_str()) != 0)
+            throw std::runtime_error("Failed to write snapshot journal: " + journal);
+
+        journal_file.open(journal, std::ios::binary | std::ios::app);
+    }
+
+public:
+    /**
+     * @brief Take a checkpoint of a machine.
+     * @param processor The CPU of the machine.
+     * @param cardbus The bus of the machine.
+     * @return The number of the checkpoint.
+     * @throw `std::invalid_argument` if the memory cards of the machine changed since the previous checkpoint.
+     * @throw `std::runtime_error` if the journal could not be written.
+     */
+    usize checkpoint(const cpu<bus&>& processor, const bus& cardbus) {
+        deferred_snapshot frozen = deferred_snapshot::freeze(processor, cardbus);
+
+        if (!head) {
+            base = frozen.resolve();
+            head.emplace(std::move(frozen));
+            last_size = 0;
+            for (const snapshot_region& region : base.regions)
+                last_size += region.data.size();
+
+            rewrite_journal();
+            return first;
+        }
+
+        deltas.push_back(frozen.diff(*head));
+        head = std::move(frozen);
+        last_size = deltas.back().get_size();
+
+        if (journal_file.is_open()) {
+            deltas.back().write(journal_file);
+            journal_file.flush();
+
+            if (journal_file.fail())
+                throw std::runtime_error("Failed to write snapshot journal: " + journal);
+        }
+
+        if (deltas.size() > max_deltas)
+            compact(max_deltas / 2);
+
+        return get_last();
+    }
+
+    /**
+     * @brief Fold the oldest deltas into the full snapshot, dropping their checkpoints.
+     * @param keep The number of deltas to keep.
+     */
+    void compact(usize keep = 0) {
+        if (deltas.size() <= keep)
+            return;
+
+        const usize folded = deltas.size() - keep;
+        for (usize i = 0; i < folded; ++i)
+            deltas[i].apply(base);
+
+        deltas.erase(deltas.begin(), deltas.begin() + folded);
+        first += folded;
+        rewrite_journal();
+    }
+
+    /**
+     * @brief Rebuild a checkpoint as a full snapshot.
+     * @param number The number of the checkpoint.
+     * @throw `std::out_of_range` if the checkpoint was compacted away or not taken yet.
+     */
+    machine_snapshot get(usize number) const {
+        if (!head or number < first or number > get_last())
+            throw std::out_of_range("No checkpoint " + std::to_string(number) + " in the snapshot chain.");
+
+        machine_snapshot snap = base;
+        for (usize i = 0; i < number - first; ++i)
+            deltas[i].apply(snap);
+
+        return snap;
+    }
+
+    /// @brief Check whether no checkpoint was taken yet.
+    bool empty() const { return !head.has_value(); }
+
+    /// @brief Get the number of the oldest checkpoint in the chain.
+    usize get_first() const { return first; }
+
+    /// @brief Get the number of the latest checkpoint.
+    usize get_last() const { return first + deltas.size(); }
+
+    /// @brief Get the number of bytes of memory copied by the latest checkpoint, all of it for the first one.
+    usize get_last_size() const { return last_size; }
+
+    /// @brief Get the number of bytes of memory held by the deltas.
+    usize get_delta_size() const {
+        usize size = 0;
+        for (const snapshot_delta& delta : deltas)
+            size += delta.get_size();
+        return size;
+    }
+
+    /**
+     * @brief Rebuild the latest checkpoint of a journal, after a crash.
+     * @param journal The path of the journal.
+     * @throw `std::runtime_error` if the journal can't be read or doesn't start with a full snapshot.
+     * @note A delta cut short by the crash is ignored, the checkpoint before it is returned.
+     */
+    static machine_snapshot recover(const std::string& journal) {
+        std::ifstream file(journal, std::ios::binary);
+        char magic[4];
+        u16 version;
+
+        if (!file.is_open())
+            throw std::runtime_error("Could not open snapshot journal: " + journal);
+
+        file.read(magic, sizeof(magic));
+        file.read(reinterpret_cast<char*>(&version), sizeof(version));
+
+        if (!file or std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+            throw std::runtime_error("Not a snapshot journal: " + journal);
+
+        if (version != VERSION)
+            throw std::runtime_error("Unsupported snapshot journal version.");
+
+        machine_snapshot snap = machine_snapshot::read(file, journal);
+
+        while (file.peek() != std::ifstream::traits_type::eof()) {
+            snapshot_delta delta;
+
+            try {
+                delta = snapshot_delta::read(file, journal);
+            } catch (const std::runtime_error&) {
+                break;
+            }
+
+            delta.apply(snap);
+        }
+
+        return snap;
+    }
+
+    /**
+     * @brief Construct an empty chain.
+     * @param max_deltas The number of deltas to hold before compacting, at least 1.
+     * @param journal The path of the journal file, empty to keep the chain in memory only.
+     * @throw `std::invalid_argument` if `max_deltas` is zero.
+     */
+    snapshot_chain(usize max_deltas = CHAIN_DEFAULT_DELTAS, const std::string& journal = "")
+        : first(0), last_size(0), max_deltas(max_deltas), journal(journal) {
+
+        if (max_deltas == 0)
+            throw std::invalid_argument("A snapshot chain needs room for at least one delta.");
+    }
+
+    snapshot_chain(const snapshot_chain&) = delete;
+    snapshot_chain& operator=(const snapshot_chain&) = delete;
+};
+
+#endif
@@ -0,0 +1,418 @@
+#ifndef SNAPSHOT_STORE_HPP_
+#define SNAPSHOT_STORE_HPP_
+
+#include <set>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <random>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <filesystem>
+#include <functional>
+
+#include "lz.hpp"
+#include "snapshot.hpp"
+#include "typedef.hpp"
+
+/// @brief The size of the pages snapshots are split into in a snapshot store, the last page of a region may be shorter.
+constexpr static usize STORE_PAGE_SIZE = 4096;
+
+/**
+ * @brief A directory of snapshots, stored as pages keyed by their contents so that each distinct page is stored once.
+ *
+ * Snapshots of machines booted from the same images are mostly identical, so the memory of each region is split into
+ * `STORE_PAGE_SIZE` pages, and each page is written compressed (see `lz`) to a file named by a 128 bit hash of its
+ * contents, unless a file with that name already exists. A manifest per snapshot holds the CPU status and the page
+ * keys of each region, so a snapshot costs its manifest plus the pages no other snapshot has.
+ *
+ * The layout of the directory is:
+ *  - `manifests/<name>.b8m`, the manifests, written in full to a temporary file then renamed into place.
+ *  - `pages/<2 hex digits>/<30 hex digits>`, the pages, likewise renamed into place so that a page file is never seen
+ *    half written.
+ *
+ * Pages are hashed, compressed and written (or read and decompressed) in parallel, over up to one thread per core.
+ *
+ * @note Any number of processes can put and get snapshots at once, but `collect()` must not run concurrently with
+ * `put()`, since it could delete a page a snapshot being put was counting on.
+ */
+class snapshot_store {
+public:
+    /// @brief The key of a page, a 128 bit hash of its contents.
+    using page_key = std::array<u64, 2>;
+
+private:
+    static constexpr char MAGIC[4] = { 'B', '8', 'S', 'M' };
+    static constexpr u16 VERSION = 1;
+    static constexpr usize MAX_THREADS = 16;
+
+    struct manifest_region {
+        u8 slot;
+        u16 start;
+        u32 size;
+        std::vector<page_key> pages;
+    };
+
+    std::filesystem::path root;
+
+    static inline u64 rotl(u64 value, int by) { return (value << by) | (value >> (64 - by)); }
+
+    static inline u64 finalize(u64 value) {
+        value ^= value >> 33;
+        value *= 0xFF51AFD7ED558CCDull;
+        value ^= value >> 33;
+        value *= 0xC4CEB9FE1A85EC53ull;
+        return value ^ (value >> 33);
+    }
+
+    /// @brief Two independently mixed lanes over 8 byte words, not cryptographic but stable across hosts and builds.
+    static page_key hash_page(const u8* data, usize size) {
+        u64 a = 0x9E3779B97F4A7C15ull ^ size, b = 0xD6E8FEB86659FD93ull + size;
+
+        for (usize i = 0; i < size; i += 8) {
+            u64 word = 0;
+            std::memcpy(&word, data + i, std::min<usize>(8, size - i));
+
+            a = rotl(a ^ (word * 0x87C37B91114253D5ull), 31) * 0x4CF5AD432745937Full;
+            b = rotl(b + (word * 0x52DCE729ull), 27) * 0x9E3779B97F4A7C15ull + a;
+        }
+
+        a = finalize(a + b);
+        b = finalize(b ^ a);
+        return { a, b };
+    }
+
+    static std::string to_hex(const page_key& key) {
+        static constexpr char DIGITS[] = "0123456789abcdef";
+        std::string hex(32, '0');
+
+        for (usize i = 0; i < 32; ++i)
+            hex[i] = DIGITS[(key[i / 16] >> (60 - 4 * (i % 16))) & 0xF];
+
+        return hex;
+    }
+
+    std::filesystem::path page_path(const page_key& key) const {
+        const std::string hex = to_hex(key);
+        return root / "pages" / hex.substr(0, 2) / hex.substr(2);
+    }
+
+    std::filesystem::path manifest_path(const std::string& name) const {
+        if (name.empty() or name == "." or name == ".." or name.find_first_of("/\\") != std::string::npos)
+            throw std::invalid_argument("Invalid snapshot name: " + name);
+
+        return root / "manifests" / (name + ".b8m");
+    }
+
+    /// @brief Write a file under a temporary name then rename it, so it's never seen partially written.
+    static void write_file(const std::filesystem::path& path, const std::string& contents) {
+        // Unique per thread, in any process, so concurrent writers of the same page don't share a temporary file.
+        thread_local const u64 tag = (static_cast<u64>(std::random_device()()) << 32) | std::random_device()();
+        std::filesystem::path temp = path;
+        temp += ".tmp." + std::to_string(tag);
+
+        {
+            std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+            file.write(contents.data(), contents.size());
+
+            if (!file.is_open() or file.fail())
+                throw std::runtime_error("Failed to write snapshot store file: " + temp.string());
+        }
+
+        std::error_code error;
+        std::filesystem::rename(temp, path, error);
+
+        if (error) {
+            std::filesystem::remove(temp, error);
+            throw std::runtime_error("Failed to write snapshot store file: " + path.string());
+        }
+    }
+
+    static std::string read_file(const std::filesystem::path& path) {
+        std::ifstream file(path, std::ios::binary);
+
+        if (!file.is_open())
+            throw std::runtime_error("Could not open snapshot store file: " + path.string());
+
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    /// @brief Run `fn(i)` for each i in [0, count) over a few threads, rethrowing the first exception.
+    static void parallel_for(usize count, const std::function<void(usize)>& fn) {
+        const usize thread_count = std::min<usize>({ count, MAX_THREADS, std::max(1u, std::thread::hardware_concurrency()) });
+        std::atomic<usize> next { 0 };
+        std::exception_ptr failure;
+        std::mutex failure_lock;
+
+        auto work = [&]() {
+            for (usize i = next++; i < count; i = next++)
+                try {
+                    fn(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> guard(failure_lock);
+                    if (!failure)
+                        failure = std::current_exception();
+                    next = count;
+                }
+        };
+
+        std::vector<std::thread> threads;
+        for (usize t = 1; t < thread_count; ++t)
+            threads.emplace_back(work);
+
+        work();
+
+        for (std::thread& thread : threads)
+            thread.join();
+
+        if (failure)
+            std::rethrow_exception(failure);
+    }
+
+    template <typename T>
+    static void put_value(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    static T get_value(const std::string& in, usize& at, const std::string& name) {
+        T value;
+        if (at + sizeof(value) > in.size())
+            throw std::runtime_error("Snapshot manifest is truncated: " + name);
+
+        std::memcpy(&value, in.data() + at, sizeof(value));
+        at += sizeof(value);
+        return value;
+    }
+
+    std::vector<manifest_region> read_manifest(const std::string& name, machine_snapshot* snap) const {
+        const std::string in = read_file(manifest_path(name));
+        usize at = 0;
+
+        if (in.size() < sizeof(MAGIC) or std::memcmp(in.data(), MAGIC, sizeof(MAGIC)) != 0)
+            throw std::runtime_error("Not a snapshot manifest: " + name);
+
+        at += sizeof(MAGIC);
+        if (get_value<u16>(in, at, name) != VERSION)
+            throw std::runtime_error("Unsupported snapshot manifest version.");
+
+        for (usize reg = 0; reg < 6; ++reg) {
+            const u16 value = get_value<u16>(in, at, name);
+            if (snap)
+                snap->state.set_register16(static_cast<cpu_registers16>(reg), value);
+        }
+
+        const u8 status = get_value<u8>(in, at, name);
+        if (snap) {
+            snap->halted = status & 1;
+            snap->interrupts_enabled = status & 2;
+        }
+
+        std::vector<manifest_region> regions(get_value<u16>(in, at, name));
+
+        for (manifest_region& region : regions) {
+            region.slot = get_value<u8>(in, at, name);
+            region.start = get_value<u16>(in, at, name);
+            region.size = get_value<u32>(in, at, name);
+
+            if (region.size > 65536)
+                throw std::runtime_error("Snapshot manifest is corrupted: " + name);
+
+            region.pages.resize((region.size + STORE_PAGE_SIZE - 1) / STORE_PAGE_SIZE);
+            for (page_key& key : region.pages)
+                key = { get_value<u64>(in, at, name), get_value<u64>(in, at, name) };
+        }
+
+        return regions;
+    }
+
+public:
+    /**
+     * @brief Store a snapshot, writing only the pages the store doesn't have yet.
+     * @param name The name of the snapshot, replacing any snapshot of the same name.
+     * @param snap The snapshot.
+     * @return The number of pages written, the others were already stored.
+     * @throw `std::invalid_argument` if the name contains a path separator.
+     * @throw `std::runtime_error` if a file could not be written.
+     */
+    usize put(const std::string& name, const machine_snapshot& snap) {
+        struct page_ref {
+            const u8* data;
+            usize size;
+            page_key key;
+        };
+
+        const std::filesystem::path manifest = manifest_path(name);
+        std::vector<page_ref> pages;
+
+        for (const snapshot_region& region : snap.regions)
+            for (usize at = 0; at < region.data.size(); at += STORE_PAGE_SIZE)
+                pages.push_back({ region.data.data() + at, std::min(STORE_PAGE_SIZE, region.data.size() - at), {} });
+
+        std::atomic<usize> written { 0 };
+
+        parallel_for(pages.size(), [&](usize i) {
+            page_ref& page = pages[i];
+            page.key = hash_page(page.data, page.size);
+
+            const std::filesystem::path path = page_path(page.key);
+            if (std::filesystem::exists(path))
+                return;
+
+            const std::vector<u8> packed = lz::compress(page.data, page.size);
+            std::filesystem::create_directories(path.parent_path());
+            write_file(path, std::string(packed.begin(), packed.end()));
+            ++written;
+        });
+
+        std::string out(MAGIC, sizeof(MAGIC));
+        put_value(out, VERSION);
+
+        for (usize reg = 0; reg < 6; ++reg)
+            put_value(out, snap.state.get_register16(static_cast<cpu_registers16>(reg)));
+
+        put_value(out, static_cast<u8>((snap.halted ? 1 : 0) | (snap.interrupts_enabled ? 2 : 0)));
+        put_value(out, static_cast<u16>(snap.regions.size()));
+
+        usize page = 0;
+        for (const snapshot_region& region : snap.regions) {
+            put_value(out, region.slot);
+            put_value(out, region.start);
+            put_value(out, static_cast<u32>(region.data.size()));
+
+            for (usize at = 0; at < region.data.size(); at += STORE_PAGE_SIZE, ++page) {
+                put_value(out, pages[page].key[0]);
+                put_value(out, pages[page].key[1]);
+            }
+        }
+
+        write_file(manifest, out);
+        return written;
+    }
+
+    /**
+     * @brief Load a snapshot.
+     * @param name The name it was stored under.
+     * @throw `std::runtime_error` if it doesn't exist, or a manifest or page is missing or corrupted.
+     */
+    machine_snapshot get(const std::string& name) const {
+        struct page_ref {
+            u8* data;
+            usize size;
+            const page_key* key;
+        };
+
+        machine_snapshot snap;
+        const std::vector<manifest_region> regions = read_manifest(name, &snap);
+        std::vector<page_ref> pages;
+
+        snap.regions.reserve(regions.size());
+        for (const manifest_region& region : regions) {
+            snap.regions.push_back({ region.slot, region.start, std::vector<u8>(region.size) });
+            u8* data = snap.regions.back().data.data();
+
+            for (usize i = 0; i < region.pages.size(); ++i)
+                pages.push_back({
+                    data + i * STORE_PAGE_SIZE, std::min<usize>(STORE_PAGE_SIZE, region.size - i * STORE_PAGE_SIZE),
+                    &region.pages[i]
+                });
+        }
+
+        parallel_for(pages.size(), [&](usize i) {
+            const page_ref& page = pages[i];
+            const std::string packed = read_file(page_path(*page.key));
+
+            try {
+                lz::decompress(reinterpret_cast<const u8*>(packed.data()), packed.size(), page.data, page.size);
+            } catch (const std::runtime_error&) {
+                throw std::runtime_error("Snapshot store page is corrupted: " + page_path(*page.key).string());
+            }
+
+            if (hash_page(page.data, page.size) != *page.key)
+                throw std::runtime_error("Snapshot store page is corrupted: " + page_path(*page.key).string());
+        });
+
+        return snap;
+    }
+
+    /// @brief Check whether a snapshot is stored under a name.
+    bool contains(const std::string& name) const { return std::filesystem::exists(manifest_path(name)); }
+
+    /// @brief Get the names of all stored snapshots, sorted.
+    std::vector<std::string> list() const {
+        std::set<std::string> names;
+
+        for (const auto& entry : std::filesystem::directory_iterator(root / "manifests"))
+            if (entry.path().extension() == ".b8m")
+                names.insert(entry.path().stem().string());
+
+        return std::vector<std::string>(names.begin(), names.end());
+    }
+
+    /// @brief Remove a snapshot, its pages stay until `collect()`.
+    /// @return False if there was no snapshot by that name.
+    bool remove(const std::string& name) { return std::filesystem::remove(manifest_path(name)); }
+
+    /**
+     * @brief Delete the pages no stored snapshot refers to anymore.
+     * @return The number of pages deleted.
+     * @warning Must not run while a snapshot is being put, see the class notes.
+     */
+    usize collect() {
+        std::set<std::string> live;
+
+        for (const std::string& name : list())
+            for (const manifest_region& region : read_manifest(name, nullptr))
+                for (const page_key& key : region.pages)
+                    live.insert(page_path(key).string());
+
+        usize deleted = 0;
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(root / "pages"))
+            if (entry.is_regular_file() and !live.count(entry.path().string()))
+                deleted += std::filesystem::remove(entry.path());
+
+        return deleted;
+    }
+
+    /// @brief Get the number of distinct pages stored.
+    usize get_page_count() const {
+        usize count = 0;
+
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(root / "pages"))
+            count += entry.is_regular_file();
+
+        return count;
+    }
+
+    /// @brief Get the number of bytes in the files of the store, manifests and pages.
+    usize get_disk_usage() const {
+        usize bytes = 0;
+
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(root))
+            if (entry.is_regular_file())
+                bytes += entry.file_size();
+
+        return bytes;
+    }
+
+    /**
+     * @brief Open a snapshot store, creating its directory if needed.
+     * @param root The path of the directory.
+     * @throw `std::runtime_error` if the directory could not be created.
+     */
+    snapshot_store(const std::filesystem::path& root) : root(root) {
+        std::error_code error;
+        std::filesystem::create_directories(root / "manifests", error);
+        std::filesystem::create_directories(root / "pages", error);
+
+        if (!std::filesystem::is_directory(root / "manifests") or !std::filesystem::is_directory(root / "pages"))
+            throw std::runtime_error("Could not create snapshot store: " + root.string());
+    }
+};
+
+#endif
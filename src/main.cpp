@@ -1,7 +1,31 @@
+#include <string>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+#include <algorithm>
+
 #include "ux.hpp"
+#include "daemon.hpp"
 #include "util.hpp"
 
 int main(int argc, char** argv) {
+    // buddy8800 --daemon <socket> [workers] [store] runs a fleet of machines controlled through the socket instead.
+    if (argc >= 3 and std::string(argv[1]) == "--daemon") {
+        usize workers = std::max(1u, std::thread::hardware_concurrency());
+
+        if (argc > 3) {
+            char* end = nullptr;
+            workers = std::strtoul(argv[3], &end, 10);
+
+            if (end == argv[3] or *end != '\0' or argv[3][0] == '-' or workers == 0)
+                throw std::invalid_argument("Invalid number of daemon workers. Provide a positive integer.");
+        }
+
+        machine_daemon daemon(argv[2], workers, argc > 4 ? argv[4] : "");
+        daemon.serve();
+        return 0;
+    }
+
     terminal_ux ux((util::get_absolute_dir() + "/config.toml").c_str());
     return ux.main(argc, argv);
-}
+}
\ No newline at end of file
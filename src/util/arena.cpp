@@ -0,0 +1,72 @@
+#include "arena.hpp"
+
+#include <vector>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static usize page_size() {
+    static const usize size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+machine_arena::machine_arena(usize reserve)
+    : base(nullptr), reserve((reserve + page_size() - 1) & ~(page_size() - 1)), front(0), back(this->reserve) {
+
+    // MAP_NORESERVE: the whole arena is address space only, pages are committed by the kernel on first write.
+    void* mapped = mmap(nullptr, this->reserve, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error("mmap() failed for machine arena");
+
+    base = static_cast<u8*>(mapped);
+}
+
+machine_arena::~machine_arena() { munmap(base, reserve); }
+
+u8* machine_arena::allocate_pages(usize size) {
+    size = (size + page_size() - 1) & ~(page_size() - 1);
+
+    if (size > back or back - size < front)
+        throw std::runtime_error("Machine arena is full.");
+
+    back -= size;
+    return base + back;
+}
+
+void machine_arena::zero_pages(u8* data, usize size) {
+    const usize mask = page_size() - 1;
+    u8* first = reinterpret_cast<u8*>((reinterpret_cast<uintptr_t>(data) + mask) & ~mask);
+    u8* last = reinterpret_cast<u8*>(reinterpret_cast<uintptr_t>(data + size) & ~mask);
+
+    if (first >= last) {
+        std::memset(data, 0, size);
+        return;
+    }
+
+    std::memset(data, 0, first - data);
+    std::memset(last, 0, data + size - last);
+
+    // Pages in use get a store first, so that write protected ones (see `write_guard`) fault as a memset would.
+    std::vector<unsigned char> pages((last - first) / page_size());
+    const bool known = mincore(first, last - first, pages.data()) == 0;
+
+    for (usize i = 0; i < pages.size(); ++i)
+        if (!known or (pages[i] & 1))
+            *reinterpret_cast<volatile u8*>(first + i * page_size()) = 0;
+
+    if (madvise(first, last - first, MADV_DONTNEED) < 0)
+        std::memset(first, 0, last - first);
+}
+
+usize machine_arena::get_resident() const {
+    std::vector<unsigned char> pages(reserve / page_size());
+
+    if (mincore(base, reserve, pages.data()) < 0)
+        throw std::runtime_error("mincore() failed for machine arena");
+
+    usize count = 0;
+    for (unsigned char page : pages)
+        count += page & 1;
+
+    return count * page_size();
+}
@@ -0,0 +1,101 @@
+#ifndef ARENA_HPP_
+#define ARENA_HPP_
+
+#include <new>
+#include <utility>
+#include <stdexcept>
+
+#include "typedef.hpp"
+
+/// @brief The alignment of objects placed in a machine arena, to keep unrelated objects off each other's cache lines.
+constexpr static usize ARENA_ALIGN = 64;
+
+/// @brief The default size of the address space reserved by a machine arena.
+constexpr static usize ARENA_DEFAULT_RESERVE = 4 << 20;
+
+/**
+ * @brief A contiguous block of memory holding a whole machine: the emulator or daemon machine object (with the CPU and
+ * bus), its cards, and the memory of its data cards.
+ *
+ * The arena reserves anonymous address space up front without committing it, so memory only costs something once it
+ * is touched. Objects are placed from the start of the arena, cache line aligned, in construction order, so the
+ * machine object, then the card objects, end up next to each other. Bulk card memory is placed page aligned from the
+ * end of the arena, where it stays zero and unbacked until written.
+ *
+ * @note The arena never frees or destroys anything until it is destroyed itself, owners of objects placed in it call
+ * their destructors.
+ * @warning Objects placed in the arena must not outlive it.
+ */
+class machine_arena {
+private:
+    u8* base;
+    usize reserve;
+    usize front;
+    usize back;
+
+public:
+    /**
+     * @brief Allocate cache line aligned memory for objects from the start of the arena.
+     * @param size The number of bytes.
+     * @param align The alignment, at least `ARENA_ALIGN`.
+     * @throw `std::runtime_error` if the arena is full.
+     */
+    void* allocate(usize size, usize align = ARENA_ALIGN) {
+        if (align < ARENA_ALIGN)
+            align = ARENA_ALIGN;
+
+        const usize at = (front + align - 1) & ~(align - 1);
+        if (at + size > back)
+            throw std::runtime_error("Machine arena is full.");
+
+        front = at + size;
+        return base + at;
+    }
+
+    /**
+     * @brief Allocate page aligned, zero filled memory from the end of the arena, only backed once touched.
+     * @param size The number of bytes.
+     * @throw `std::runtime_error` if the arena is full.
+     */
+    u8* allocate_pages(usize size);
+
+    /**
+     * @brief Zero memory handed out by `allocate_pages()`, giving its whole pages back to the kernel.
+     * @param data The first byte to zero.
+     * @param size The number of bytes.
+     *
+     * Whole pages are released with `madvise(MADV_DONTNEED)`, so they read as zero again without being backed, only the
+     * partial pages at both ends are written to.
+     */
+    static void zero_pages(u8* data, usize size);
+
+    /// @brief Construct an object in the arena, the caller is responsible for calling its destructor.
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    /// @brief Check whether some memory is inside the arena.
+    bool owns(const void* ptr) const { return ptr >= base and ptr < base + reserve; }
+
+    /// @brief Get the number of bytes handed out, objects and bulk memory.
+    usize get_used() const { return front + (reserve - back); }
+
+    /// @brief Get the number of bytes of the arena mapped in, counting pages only ever read (mapped to the zero page).
+    usize get_resident() const;
+
+    /**
+     * @brief Reserve the address space of a new arena.
+     * @param reserve The size of the arena, rounded up to whole pages.
+     * @throw `std::runtime_error` if the address space could not be reserved.
+     */
+    machine_arena(usize reserve = ARENA_DEFAULT_RESERVE);
+
+    /// @brief Release the arena, without running any destructors.
+    ~machine_arena();
+
+    machine_arena(const machine_arena&) = delete;
+    machine_arena& operator=(const machine_arena&) = delete;
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef LZ_HPP_
+#define LZ_HPP_
+
+#include <array>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+
+#include "typedef.hpp"
+
+/**
+ * @brief A small, fast LZ77 compressor for memory images, in the spirit of LZ4.
+ *
+ * The stream is a sequence of blocks, each a literal run followed by a match:
+ *  - a varint literal count, then that many literal bytes,
+ *  - a varint match length minus `MIN_MATCH` (absent after the last literals), then a u16 little endian distance.
+ *
+ * Matches are found through a hash table of the last position of each 4 byte sequence, and may overlap their own
+ * output, so runs of a repeated byte (zeroed memory, fill bytes) compress to a few bytes.
+ */
+class lz {
+private:
+    static constexpr usize MIN_MATCH = 4;
+    static constexpr usize MAX_DISTANCE = 0xFFFF;
+    static constexpr usize HASH_BITS = 12;
+
+    static inline u32 read32(const u8* at) {
+        u32 value;
+        std::memcpy(&value, at, sizeof(value));
+        return value;
+    }
+
+    static inline usize hash(u32 value) { return (value * 2654435761u) >> (32 - HASH_BITS); }
+
+    static inline void put_varint(std::vector<u8>& out, usize value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<u8>(value) | 0x80);
+            value >>= 7;
+        }
+        out.push_back(static_cast<u8>(value));
+    }
+
+    static inline usize get_varint(const u8*& in, const u8* end) {
+        usize value = 0;
+
+        for (usize shift = 0; shift < 8 * sizeof(usize); shift += 7) {
+            if (in == end)
+                throw std::runtime_error("Compressed data is truncated.");
+
+            const u8 byte = *in++;
+            value |= static_cast<usize>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+
+        throw std::runtime_error("Compressed data is corrupted.");
+    }
+
+    static inline void put_literals(std::vector<u8>& out, const u8* from, usize count) {
+        put_varint(out, count);
+        out.insert(out.end(), from, from + count);
+    }
+
+public:
+    /**
+     * @brief Compress a block of data.
+     * @param data The data.
+     * @param size The size of the data in bytes.
+     * @return The compressed stream.
+     */
+    static std::vector<u8> compress(const u8* data, usize size) {
+        std::vector<u8> out;
+        std::array<u32, 1 << HASH_BITS> last {};
+        out.reserve(size / 2 + 16);
+
+        usize anchor = 0, pos = 0;
+
+        while (pos + MIN_MATCH <= size) {
+            const u32 seq = read32(data + pos);
+            const usize slot = hash(seq);
+            const usize candidate = last[slot];
+            last[slot] = pos + 1;
+
+            // Positions are stored plus one, so that zero means empty.
+            if (candidate == 0 or pos - (candidate - 1) > MAX_DISTANCE or read32(data + candidate - 1) != seq) {
+                ++pos;
+                continue;
+            }
+
+            const usize from = candidate - 1;
+            usize len = MIN_MATCH;
+            while (pos + len < size and data[from + len] == data[pos + len])
+                ++len;
+
+            put_literals(out, data + anchor, pos - anchor);
+            put_varint(out, len - MIN_MATCH);
+            const u16 distance = pos - from;
+            out.push_back(distance & 0xFF);
+            out.push_back(distance >> 8);
+
+            pos += len;
+            anchor = pos;
+        }
+
+        put_literals(out, data + anchor, size - anchor);
+        return out;
+    }
+
+    /**
+     * @brief Decompress a stream written by `compress()`.
+     * @param in The compressed stream.
+     * @param in_size The size of the stream in bytes.
+     * @param out Where to write the data.
+     * @param out_size The size of the data, as given to `compress()`.
+     * @throw `std::runtime_error` if the stream is corrupted or doesn't decompress to exactly `out_size` bytes.
+     */
+    static void decompress(const u8* in, usize in_size, u8* out, usize out_size) {
+        const u8* end = in + in_size;
+        usize pos = 0;
+
+        while (true) {
+            const usize literals = get_varint(in, end);
+            if (literals > static_cast<usize>(end - in) or literals > out_size - pos)
+                throw std::runtime_error("Compressed data is corrupted.");
+
+            // out may be null for empty data, memcpy() must not see it even for 0 bytes.
+            if (literals > 0)
+                std::memcpy(out + pos, in, literals);
+            in += literals;
+            pos += literals;
+
+            if (in == end)
+                break;
+
+            const usize len = get_varint(in, end) + MIN_MATCH;
+            if (end - in < 2)
+                throw std::runtime_error("Compressed data is truncated.");
+
+            const usize distance = in[0] | (in[1] << 8);
+            in += 2;
+
+            if (distance == 0 or distance > pos or len > out_size - pos)
+                throw std::runtime_error("Compressed data is corrupted.");
+
+            // Byte by byte, matches can overlap the bytes they produce.
+            for (usize i = 0; i < len; ++i, ++pos)
+                out[pos] = out[pos - distance];
+        }
+
+        if (pos != out_size)
+            throw std::runtime_error("Compressed data is corrupted.");
+    }
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef PROBES_HPP_
+#define PROBES_HPP_
+
+/**
+ * @file probes.hpp
+ * @brief Static tracepoints (USDT/SDT) under the `buddy8800` provider.
+ *
+ * With `ENABLE_USDT` defined and `<sys/sdt.h>` available (usually from the systemtap-sdt-dev(el) package), each probe
+ * compiles to a single NOP plus an ELF note, which bpftrace, `perf probe` and friends patch into a trap only while
+ * attached. Otherwise the probes compile to nothing and their arguments are not evaluated.
+ *
+ * | Probe            | Arguments                                    |
+ * |------------------|----------------------------------------------|
+ * | `insn_batch`     | instructions retired so far, PC              |
+ * | `io_read`        | port, byte                                   |
+ * | `io_write`       | port, byte                                   |
+ * | `serial_rx`      | card base port, byte                         |
+ * | `serial_tx`      | card base port, byte                         |
+ * | `irq_raise`      | raised (1) or cleared (0)                    |
+ * | `irq_ack`        | instruction put on the bus, first operand    |
+ * | `interrupt`      | return PC, instruction                       |
+ * | `halt`           | PC                                           |
+ *
+ * For example: `bpftrace -e 'usdt:bin/buddy8800:buddy8800:io_write { @[arg0] = count(); }'`.
+ */
+
+#if defined(ENABLE_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define BUDDY_USDT_AVAILABLE
+#endif
+#endif
+
+#ifdef BUDDY_USDT_AVAILABLE
+#define BUDDY_PROBE1(name, a1) DTRACE_PROBE1(buddy8800, name, a1)
+#define BUDDY_PROBE2(name, a1, a2) DTRACE_PROBE2(buddy8800, name, a1, a2)
+#else
+#define BUDDY_PROBE1(name, a1) ((void)sizeof(a1))
+#define BUDDY_PROBE2(name, a1, a2) ((void)sizeof(a1), (void)sizeof(a2))
+#endif
+
+/// @brief Number of retired instructions between two `insn_batch` probes, must be a power of two.
+#define BUDDY_PROBE_INSN_BATCH 65536
+
+#endif
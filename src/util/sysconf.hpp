@@ -3,11 +3,17 @@
 
 #include <vector>
 #include <string>
+#include <memory>
+#include <utility>
 #include <stdexcept>
 #include <toml.hpp>
 
 #include "bus.hpp"
 #include "card.hpp"
+#include "page_pool.hpp"
+#include "nvram_card.hpp"
+#include "arena.hpp"
+#include "io_ring.hpp"
 #include "typedef.hpp"
 
 /**
@@ -23,11 +29,54 @@
 class system_config {
 private:
     bus cardbus;
+    std::unique_ptr<io_ring> ring;
     std::vector<card*> cards;
+    vi_card* controller = nullptr;
+    machine_arena* arena;
     u16 start_pc;
     bool do_pseudo_bdos;
+    usize trace_ring_size;
+    std::string trace_dump_to;
+    std::string gdb_listen;
+    usize profile_interval;
+    std::string profile_symbols;
+    std::string profile_to;
+    std::string coverage_to;
+    std::string coverage_listing;
+    std::string capture_to;
+    std::string branch_trace_to;
+    std::string capture_filter;
+    std::string shm_name;
+    usize shm_interval;
+    bool aot_enabled;
+    bool aot_write_protect;
+    usize io_quantum;
+    bool idle_on_halt;
 
-    inline card* create_card(const std::string& type, u16 at, usize range, const std::string& load) {
+    template <typename T, typename... Args>
+    inline T* new_card(Args&&... args) {
+        return arena ? arena->create<T>(std::forward<Args>(args)...) : new T(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    inline T* new_data_card(u16 at, usize range, const std::vector<u8>& load) {
+        if (!arena)
+            return load.empty() ? new T(at, range) : new T(at, load.begin(), load.end(), range);
+
+        if (load.size() > range and range != 0)
+            throw std::out_of_range("Binary data exceeds card capacity.");
+
+        const usize capacity = (range == 0) ? load.size() : range;
+        T* cardptr = arena->create<T>(at, capacity, typename T::external_storage { arena->allocate_pages(capacity) });
+
+        // Only the loaded bytes are touched, the rest of the card stays unbacked until the program writes to it.
+        for (usize i = 0; i < load.size(); ++i)
+            cardptr->write_force(at + i, load[i]);
+
+        return cardptr;
+    }
+
+    inline card* create_card(const toml::value& config, const std::string& type, u16 at, usize range, const std::string& load, page_pool* pool) {
         card* cardptr = nullptr;
         std::ifstream load_file;
         std::vector<u8> load_file_vec;
@@ -35,6 +84,9 @@ private:
         if (load.empty() and range == 0 and (type == "ram" or type == "rom"))
             throw std::runtime_error("Config has data card with no range or load. You need at least one of the two.");
 
+        if (!load.empty() and type == "nvram")
+            throw std::runtime_error("Config has nvram card with a load file. Its contents come from its own file.");
+
         if (!load.empty()) {
             load_file = std::ifstream(load, std::ios::binary);
 
@@ -47,20 +99,30 @@ private:
                 throw std::runtime_error("File is empty or could not be read: " + std::string(load));
         }
 
-        if (type == "ram")
-            if (load.empty())
-                cardptr = new ram_card(at, range);
-            else
-                cardptr = new ram_card(at, load_file_vec.begin(), load_file_vec.end(), range);
+        if (type == "ram" and pool)
+            cardptr = new_card<paged_ram_card>(at, range, *pool, load_file_vec);
+
+        else if (type == "ram")
+            cardptr = new_data_card<ram_card>(at, range, load_file_vec);
 
         else if (type == "rom")
-            if (load.empty())
-                cardptr = new rom_card(at, range);
-            else
-                cardptr = new rom_card(at, load_file_vec.begin(), load_file_vec.end(), range);
+            cardptr = new_data_card<rom_card>(at, range, load_file_vec);
+
+        else if (type == "nvram")
+            cardptr = new_card<nvram_card>(
+                at, toml::find<std::string>(config, "file"), range,
+                toml::find_or<usize>(config, "sync_interval", NVRAM_DEFAULT_SYNC_MS)
+            );
 
         else if (type == "serial")
-            cardptr = new serial_card(at);
+            cardptr = new_card<serial_card>(at, SERIAL_BASE_CLOCK, ring.get());
+
+        else if (type == "vi") {
+            vi_card* vi = new_card<vi_card>(at);
+            if (!controller)
+                controller = vi;
+            cardptr = vi;
+        }
 
         else
             throw std::runtime_error("Config has unknown card type: " + type);
@@ -76,30 +138,84 @@ private:
 public:
     /// @brief Construct a new system config object by reading a TOML configuration file.
     /// @param filename The path to the file.
-    system_config(const char* filename) {
+    /// @param pool If not null, RAM cards share their pages copy-on-write through this pool, see `paged_ram_card`.
+    /// @param arena If not null, cards and their memory are placed in this arena, which must outlive the config.
+    system_config(const char* filename, page_pool* pool = nullptr, machine_arena* arena = nullptr) : arena(arena) {
         auto parser = toml::parse(filename);
         auto emulator = toml::find<toml::value>(parser, "emulator");
         auto cards = toml::find<std::vector<toml::value>>(parser, "card");
 
+        // Without kernel support, devices silently keep using a system call per operation.
+        if (toml::find_or<bool>(emulator, "io_uring", false) and io_ring::is_supported())
+            ring = std::make_unique<io_ring>();
+
+        // Cards wired to an interrupt level, by index, routed once the controller is known wherever it is listed.
+        std::vector<std::pair<usize, u8>> routes;
+
         for (const auto& card : cards) {
+            const int level = toml::find_or<int>(card, "vi_level", -1);
+            if (level != -1 and (level < 0 or level >= VI_LEVELS))
+                throw std::runtime_error("Config has vi_level out of range, it must be in [0, " + std::to_string(VI_LEVELS - 1) + "].");
+
+            if (level != -1)
+                routes.push_back({ this->cards.size(), static_cast<u8>(level) });
+
             insert_card(
                 create_card(
+                    card,
                     toml::find<std::string>(card, "type"),
                     toml::find<u16>(card, "at"),
                     toml::find_or<usize>(card, "range", 0),
-                    toml::find_or<std::string>(card, "load", "")
+                    toml::find_or<std::string>(card, "load", ""),
+                    pool
                 ),
                 toml::find<usize>(card, "slot"),
                 toml::find_or<bool>(card, "let_collide", false)
             );
         }
 
+        for (const auto& [index, level] : routes) {
+            if (!controller)
+                throw std::runtime_error("Config has a card with a vi_level, but no vi card to route it to.");
+            if (this->cards[index] == controller)
+                throw std::runtime_error("Config routes the vi card to itself.");
+
+            this->cards[index]->route_irq(controller, level);
+        }
+
         start_pc = toml::find_or<u16>(emulator, "start_with_pc_at", 0);
         do_pseudo_bdos = toml::find_or<bool>(emulator, "pseudo_bdos_enabled", false);
+        trace_ring_size = toml::find_or<usize>(emulator, "trace_ring_size", 0);
+        trace_dump_to = toml::find_or<std::string>(emulator, "trace_dump_to", "trace.bin");
+        gdb_listen = toml::find_or<std::string>(emulator, "gdb_listen", "");
+        profile_interval = toml::find_or<usize>(emulator, "profile_interval", 0);
+        profile_symbols = toml::find_or<std::string>(emulator, "profile_symbols", "");
+        profile_to = toml::find_or<std::string>(emulator, "profile_to", "profile.folded");
+        coverage_to = toml::find_or<std::string>(emulator, "coverage_to", "");
+        coverage_listing = toml::find_or<std::string>(emulator, "coverage_listing", "");
+        capture_to = toml::find_or<std::string>(emulator, "capture_to", "");
+        branch_trace_to = toml::find_or<std::string>(emulator, "branch_trace_to", "");
+        capture_filter = toml::find_or<std::string>(emulator, "capture_filter", "");
+        shm_name = toml::find_or<std::string>(emulator, "shm_name", "");
+        shm_interval = toml::find_or<usize>(emulator, "shm_interval", 10000);
+        aot_enabled = toml::find_or<bool>(emulator, "aot_enabled", true);
+        aot_write_protect = toml::find_or<bool>(emulator, "aot_write_protect", false);
+        io_quantum = toml::find_or<usize>(emulator, "io_quantum", 4096);
+        idle_on_halt = toml::find_or<bool>(emulator, "idle_on_halt", false);
+
+        if (io_quantum == 0)
+            throw std::runtime_error("Config has io_quantum set to 0, it needs at least one step.");
     }
 
     /// @brief Free all memory on destruction.
-    ~system_config() { for (card* card : cards) delete card; }
+    /// @note Cards are destroyed first, so that their requests on the I/O ring complete while it still exists.
+    ~system_config() {
+        for (card* card : cards)
+            if (arena)
+                card->~card();
+            else
+                delete card;
+    }
 
     /// @brief Get a const reference to the vector of card pointers.
     inline const std::vector<card*>& get_cards_vec() const { return cards; }
@@ -112,6 +228,60 @@ public:
 
     /// @brief Get the starting value of PC.
     inline u16 get_start_pc() const { return start_pc; }
+
+    /// @brief Get the number of records of the execution trace ring buffer, 0 if disabled.
+    inline usize get_trace_ring_size() const { return trace_ring_size; }
+
+    /// @brief Get the path the execution trace ring buffer is dumped to.
+    inline const std::string& get_trace_dump_to() const { return trace_dump_to; }
+
+    /// @brief Get the TCP port or UNIX socket path the GDB stub listens on, empty if disabled.
+    inline const std::string& get_gdb_listen() const { return gdb_listen; }
+
+    /// @brief Get the number of 8080 clock cycles between guest profiler samples, 0 if disabled.
+    inline usize get_profile_interval() const { return profile_interval; }
+
+    /// @brief Get the path of the symbol file for the guest profiler, empty if none.
+    inline const std::string& get_profile_symbols() const { return profile_symbols; }
+
+    /// @brief Get the path the guest profiler collapsed stacks are written to.
+    inline const std::string& get_profile_to() const { return profile_to; }
+
+    /// @brief Get the path the coverage report is written to, empty if coverage is disabled.
+    inline const std::string& get_coverage_to() const { return coverage_to; }
+
+    /// @brief Get the path of the listing to annotate in the coverage report, empty if none.
+    inline const std::string& get_coverage_listing() const { return coverage_listing; }
+
+    /// @brief Get the path bus cycles are captured to, empty if capture is disabled.
+    inline const std::string& get_capture_to() const { return capture_to; }
+
+    /// @brief Get the path the branch trace of the run is written to, empty if branch tracing is disabled.
+    inline const std::string& get_branch_trace_to() const { return branch_trace_to; }
+
+    /// @brief Get the address and port ranges to capture, empty to capture everything.
+    inline const std::string& get_capture_filter() const { return capture_filter; }
+
+    /// @brief Get the name of the shared memory segment the machine state is published to, empty if disabled.
+    inline const std::string& get_shm_name() const { return shm_name; }
+
+    /// @brief Get the number of steps between two publishes of the machine state.
+    inline usize get_shm_interval() const { return shm_interval; }
+
+    /// @brief Get whether ROM code recompiled at build time runs instead of being interpreted.
+    inline bool get_aot_enabled() const { return aot_enabled; }
+
+    /// @brief Get whether recompiled code also runs from RAM, write protected by the host MMU.
+    inline bool get_aot_write_protect() const { return aot_write_protect; }
+
+    /// @brief Get the I/O ring the devices are served through, null if io_uring is disabled or not supported.
+    inline io_ring* get_io_ring() { return ring.get(); }
+
+    /// @brief Get the number of steps between two submissions of the I/O ring, and two checks for host events.
+    inline usize get_io_quantum() const { return io_quantum; }
+
+    /// @brief Get whether HLT with interrupts enabled waits for an interrupt, instead of ending the run.
+    inline bool get_idle_on_halt() const { return idle_on_halt; }
 };
 
 #endif
\ No newline at end of file
@@ -5,6 +5,8 @@
 #include <fstream>
 #include <string>
 #include <iomanip>
+#include <sstream>
+#include <type_traits>
 
 #include "typedef.hpp"
 
@@ -24,23 +26,35 @@ public:
      * It can be useful in context of tests, where some specific output might be useful to be redirected
      * to a text file rather than stdout.
      *
-     * The temporary redirected destination is set(), then reset() to go back to the default destination.
+     * The temporary redirected destination is set(), then reset() to go back to the default destination. It can be a
+     * file, or a string in memory that output is appended to, so that tests running in parallel don't share a file.
      */
     class print_helper {
     private:
         std::ostream& by_default;
         std::ofstream file_redirect;
+        std::string* memory_redirect;
 
     public:
         /// @brief Set a redirection to file.
         void set(const char* filename) {
+            reset();
             file_redirect = std::ofstream(filename, std::ios::binary | std::ios::trunc);
             if (!file_redirect.is_open())
                 throw std::invalid_argument("Could not open file for printer.");
         }
 
+        /// @brief Set a redirection to a string, output is appended to it until reset().
+        /// @param buffer The string, it must outlive the redirection.
+        void set(std::string& buffer) {
+            reset();
+            memory_redirect = &buffer;
+        }
+
         /// @brief Reset and fallback to default destination.
         void reset() {
+            memory_redirect = nullptr;
+
             if (file_redirect.is_open()) {
                 file_redirect.flush();
                 file_redirect.close();
@@ -50,7 +64,16 @@ public:
         /// @brief Print data to the set destination.
         template <typename T>
         void print(const T& data) {
-            if (file_redirect.is_open()) {
+            if (memory_redirect) {
+                // Characters, the common case for BDOS output, skip formatting.
+                if constexpr (std::is_same_v<T, char> or std::is_same_v<T, u8>)
+                    memory_redirect->push_back(static_cast<char>(data));
+                else {
+                    std::ostringstream formatted;
+                    formatted << data;
+                    memory_redirect->append(formatted.str());
+                }
+            } else if (file_redirect.is_open()) {
                 file_redirect << data;
                 if (file_redirect.fail())
                     throw std::runtime_error("Failed to write to file.");
@@ -65,7 +88,7 @@ public:
             return *this;
         }
 
-        print_helper(std::ostream& by_default) : by_default(by_default) {}
+        print_helper(std::ostream& by_default) : by_default(by_default), memory_redirect(nullptr) {}
         ~print_helper() { if (file_redirect.is_open()) reset(); }
     };
 
@@ -355,6 +378,71 @@ public:
             default: return "UNKNOWN"; break;
         }
     }
+
+    /// @brief Get the length in bytes of an instruction, counting the opcode and its operands.
+    constexpr static usize get_opcode_len(u8 opcode) {
+        if ((opcode & 0b11001111) == 0b00000001   // LXI
+            or (opcode & 0b11000111) == 0b11000010 // Jcc
+            or (opcode & 0b11000111) == 0b11000100 // Ccc
+            or opcode == 0x22 or opcode == 0x2A or opcode == 0x32 or opcode == 0x3A
+            or opcode == 0xC3 or opcode == 0xCD)
+            return 3;
+
+        if ((opcode & 0b11000111) == 0b00000110    // MVI
+            or (opcode & 0b11000111) == 0b11000110 // ALU immediate
+            or opcode == 0xD3 or opcode == 0xDB)
+            return 2;
+
+        return 1;
+    }
+
+    /**
+     * @brief Get the number of clock cycles (states) an instruction takes on the 8080.
+     * @note Conditional calls and returns are given as not taken, add 6 cycles when they are taken.
+     */
+    constexpr static usize get_opcode_cycles(u8 opcode) {
+        const u8 dst = (opcode >> 3) & 0b111;
+        const u8 src = opcode & 0b111;
+
+        switch (opcode >> 6) {
+            case 0b01: // MOV, HLT
+                if (opcode == 0x76)
+                    return 7;
+                return (dst == 0b110 or src == 0b110) ? 7 : 5;
+
+            case 0b10: // ALU register
+                return (src == 0b110) ? 7 : 4;
+
+            case 0b00:
+                switch (src) {
+                    case 0b001: return 10; // LXI, DAD
+                    case 0b010: // STAX, LDAX, SHLD, LHLD, STA, LDA
+                        if (opcode == 0x22 or opcode == 0x2A)
+                            return 16;
+                        return (opcode == 0x32 or opcode == 0x3A) ? 13 : 7;
+                    case 0b011: return 5; // INX, DCX
+                    case 0b100:
+                    case 0b101: return (dst == 0b110) ? 10 : 5; // INR, DCR
+                    case 0b110: return (dst == 0b110) ? 10 : 7; // MVI
+                    default: return 4; // NOP, rotates, DAA, CMA, STC, CMC
+                }
+
+            default:
+                switch (src) {
+                    case 0b000: return 5; // Rcc
+                    case 0b001: return (opcode == 0xE9 or opcode == 0xF9) ? 5 : 10; // POP, RET, PCHL, SPHL
+                    case 0b010: return 10; // Jcc
+                    case 0b011: // JMP, OUT, IN, XTHL, XCHG, DI, EI
+                        if (opcode == 0xE3)
+                            return 18;
+                        return (opcode == 0xEB or opcode == 0xF3 or opcode == 0xFB) ? 4 : 10;
+                    case 0b100: return 11; // Ccc
+                    case 0b101: return (dst & 1) ? 17 : 11; // CALL, PUSH
+                    case 0b110: return 7; // ALU immediate
+                    default: return 11; // RST
+                }
+        }
+    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,482 @@
+#include "daemon.hpp"
+
+#include <array>
+#include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "util.hpp"
+
+static const char* state_name(machine_state state) {
+    switch (state) {
+        case machine_state::PAUSED: return "paused";
+        case machine_state::RUNNING: return "running";
+        case machine_state::HALTED: return "halted";
+        default: return "faulted";
+    }
+}
+
+machine::machine(usize id, const std::string& config_filename, page_pool& pool, machine_arena* arena)
+    : id(id),
+      conf(config_filename.c_str(), &pool, arena),
+      processor(conf.get_bus(), conf.get_start_pc() == 0x0000),
+      state(machine_state::PAUSED),
+      steps(0) {
+
+    processor.do_pseudo_bdos(conf.get_do_pseudo_bdos());
+    processor.set_pc(conf.get_start_pc());
+}
+
+void machine::restore(const machine_snapshot& snap) {
+    snap.restore(processor, conf.get_bus());
+    fault.clear();
+
+    if (processor.is_halted())
+        state = machine_state::HALTED;
+    else if (state != machine_state::RUNNING)
+        state = machine_state::PAUSED;
+}
+
+usize machine::run(usize count) {
+    usize done = 0;
+
+    try {
+        while (done < count and !processor.is_halted()) {
+            processor.step();
+            if (processor.is_interrupt_enabled() and conf.get_bus().is_irq())
+                processor.interrupt(conf.get_bus().get_irq());
+            ++done;
+        }
+    } catch (const std::exception& e) {
+        state = machine_state::FAULTED;
+        fault = e.what();
+    }
+
+    steps += done;
+
+    // A slice is the scheduling quantum, the I/O the machine queued during it is submitted at once.
+    if (io_ring* ring = conf.get_io_ring()) {
+        ring->submit();
+        ring->complete();
+    }
+
+    if (processor.is_halted() and state != machine_state::FAULTED)
+        state = machine_state::HALTED;
+
+    return done;
+}
+
+void machine::dedup() {
+    for (card* c : conf.get_cards_vec())
+        if (paged_ram_card* ram = dynamic_cast<paged_ram_card*>(c))
+            ram->dedup();
+}
+
+std::pair<usize, usize> machine::get_page_usage() const {
+    std::pair<usize, usize> usage { 0, 0 };
+
+    for (card* c : conf.get_cards_vec())
+        if (const paged_ram_card* ram = dynamic_cast<const paged_ram_card*>(c)) {
+            usage.first += ram->get_private_pages();
+            usage.second += ram->get_page_count();
+        }
+
+    return usage;
+}
+
+machine_daemon::machine_daemon(const std::string& socket_path, usize worker_count, const std::string& store_path)
+    : socket_path(socket_path), listen_fd(-1), worker_count(worker_count), next_id(1), stopping(false) {
+
+    if (worker_count == 0)
+        throw std::invalid_argument("The daemon needs at least one worker thread.");
+
+    if (!store_path.empty())
+        store = std::make_unique<snapshot_store>(store_path);
+
+    if (!socket_path.empty()) {
+        sockaddr_un adr {};
+        adr.sun_family = AF_UNIX;
+
+        if (socket_path.size() >= sizeof(adr.sun_path))
+            throw std::invalid_argument("Daemon socket path is too long.");
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0)
+            throw std::runtime_error("socket() failed");
+
+        std::strncpy(adr.sun_path, socket_path.c_str(), sizeof(adr.sun_path) - 1);
+        ::unlink(socket_path.c_str());
+
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&adr), sizeof(adr)) < 0 or ::listen(listen_fd, 8) < 0) {
+            ::close(listen_fd);
+            throw std::runtime_error("Could not listen on daemon socket " + socket_path);
+        }
+    }
+
+    for (usize i = 0; i < worker_count; ++i)
+        workers.emplace_back(&machine_daemon::worker_loop, this, i);
+
+    deduper = std::thread(&machine_daemon::dedup_loop, this);
+}
+
+machine_daemon::~machine_daemon() {
+    {
+        std::lock_guard<std::mutex> guard(fleet_lock);
+        stopping = true;
+    }
+
+    wake.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+    deduper.join();
+
+    if (listen_fd != -1) {
+        ::close(listen_fd);
+        ::unlink(socket_path.c_str());
+    }
+}
+
+bool machine_daemon::is_stopping() {
+    std::lock_guard<std::mutex> guard(fleet_lock);
+    return stopping;
+}
+
+void machine_daemon::notify_workers() {
+    // Taking the lock orders the state change before a worker that is about to wait rechecks for running machines.
+    { std::lock_guard<std::mutex> guard(fleet_lock); }
+    wake.notify_all();
+}
+
+void machine_daemon::worker_loop(usize worker) {
+    std::vector<std::shared_ptr<machine>> mine;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(fleet_lock);
+
+            wake.wait(guard, [&] {
+                mine.clear();
+                for (const auto& [id, m] : fleet)
+                    if (id % worker_count == worker and m->state == machine_state::RUNNING)
+                        mine.push_back(m);
+
+                return stopping or !mine.empty();
+            });
+
+            if (stopping)
+                return;
+        }
+
+        for (const std::shared_ptr<machine>& m : mine) {
+            std::lock_guard<std::mutex> guard(m->lock);
+            if (m->state == machine_state::RUNNING)
+                m->run(SLICE_STEPS);
+        }
+    }
+}
+
+void machine_daemon::dedup_loop() {
+    std::vector<std::shared_ptr<machine>> all;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(fleet_lock);
+
+            if (wake.wait_for(guard, DEDUP_INTERVAL, [&] { return stopping; }))
+                return;
+
+            all.clear();
+            for (const auto& [id, m] : fleet)
+                all.push_back(m);
+        }
+
+        // Pages written since the last pass are still changing, dedup() only shares them once they settle.
+        for (const std::shared_ptr<machine>& m : all) {
+            std::lock_guard<std::mutex> guard(m->lock);
+            m->dedup();
+        }
+    }
+}
+
+std::shared_ptr<machine> machine_daemon::find(const std::string& id) {
+    usize number;
+
+    try {
+        number = std::stoul(id);
+    } catch (const std::logic_error&) {
+        throw std::invalid_argument("Invalid machine id: " + id);
+    }
+
+    std::lock_guard<std::mutex> guard(fleet_lock);
+    auto found = fleet.find(number);
+
+    if (found == fleet.end())
+        throw std::out_of_range("No machine with id " + id);
+
+    return found->second;
+}
+
+std::string machine_daemon::command(const std::string& line) {
+    std::istringstream in(line);
+    std::string verb, id, arg;
+    in >> verb >> id >> arg;
+
+    try {
+        if (verb == "create") {
+            if (id.empty())
+                throw std::invalid_argument("Usage: create <config>");
+
+            usize new_id;
+            {
+                std::lock_guard<std::mutex> guard(fleet_lock);
+                new_id = next_id++;
+            }
+
+            // Loading the configuration may read ROM files, keep the fleet unlocked meanwhile.
+            std::unique_ptr<machine_arena> arena = std::make_unique<machine_arena>();
+            machine* placed = arena->create<machine>(new_id, id, pool, arena.get());
+
+            std::shared_ptr<machine> m(placed, [arena = arena.release()](machine* gone) {
+                gone->~machine();
+                delete arena;
+            });
+
+            std::lock_guard<std::mutex> guard(fleet_lock);
+            fleet[new_id] = std::move(m);
+            return "OK " + std::to_string(new_id);
+        }
+
+        if (verb == "list") {
+            std::lock_guard<std::mutex> guard(fleet_lock);
+            std::string out = "OK";
+
+            for (const auto& [mid, m] : fleet)
+                out += " " + std::to_string(mid) + ":" + state_name(m->state);
+
+            return out;
+        }
+
+        if (verb == "shutdown") {
+            {
+                std::lock_guard<std::mutex> guard(fleet_lock);
+                stopping = true;
+            }
+            wake.notify_all();
+            return "OK";
+        }
+
+        static const std::array<const char*, 13> MACHINE_VERBS = {
+            "destroy", "start", "pause", "step", "snapshot", "restore", "store", "load", "checkpoint", "rewind",
+            "serial", "stats", "memory"
+        };
+
+        if (std::find(MACHINE_VERBS.begin(), MACHINE_VERBS.end(), verb) == MACHINE_VERBS.end())
+            throw std::invalid_argument("Unknown command: " + verb);
+
+        std::shared_ptr<machine> m = find(id);
+
+        if (verb == "destroy") {
+            // A worker in the middle of a slice keeps its own reference, the machine goes away once it's done.
+            m->state = machine_state::PAUSED;
+            std::lock_guard<std::mutex> guard(fleet_lock);
+            fleet.erase(m->id);
+            return "OK";
+        }
+
+        std::unique_lock<std::mutex> guard(m->lock);
+
+        if (verb == "start") {
+            if (m->state == machine_state::HALTED or m->state == machine_state::FAULTED)
+                throw std::runtime_error("Machine is not runnable, restore a snapshot to resume it.");
+
+            m->state = machine_state::RUNNING;
+            guard.unlock();
+            notify_workers();
+            return "OK";
+        }
+
+        if (verb == "pause") {
+            if (m->state == machine_state::RUNNING)
+                m->state = machine_state::PAUSED;
+            return "OK";
+        }
+
+        if (verb == "step") {
+            if (m->state != machine_state::PAUSED)
+                throw std::runtime_error(
+                    std::string("Machine is ") + state_name(m->state) + ", only a paused machine can step."
+                );
+
+            usize count = 1;
+            if (!arg.empty())
+                try {
+                    count = std::stoul(arg, nullptr, 0);
+                } catch (const std::logic_error&) {
+                    throw std::invalid_argument("Invalid step count: " + arg);
+                }
+
+            // Stepping holds the machine and the control thread, longer runs go through start and pause.
+            if (count > SLICE_STEPS)
+                throw std::invalid_argument(
+                    "Step count over " + std::to_string(SLICE_STEPS) + ", use start and pause instead."
+                );
+
+            m->run(count);
+            return "OK " + util::to_hex_s(m->processor.get_pc());
+        }
+
+        if (verb == "snapshot" or verb == "restore" or verb == "store" or verb == "load") {
+            const bool stored = verb == "store" or verb == "load";
+
+            if (arg.empty())
+                throw std::invalid_argument("Usage: " + verb + " <id> " + (stored ? "<name>" : "<file>"));
+
+            if (stored and !store)
+                throw std::runtime_error("The daemon has no snapshot store.");
+
+            if (verb == "snapshot" or verb == "store") {
+                // The machine only stops for the freeze, copying and writing the snapshot run while it keeps going.
+                const deferred_snapshot frozen = deferred_snapshot::freeze(m->processor, m->conf.get_bus());
+                guard.unlock();
+
+                if (stored)
+                    return "OK pages_written=" + std::to_string(store->put(arg, frozen.resolve()));
+
+                frozen.resolve().save(arg.c_str());
+                return "OK";
+            }
+
+            // Reading the snapshot doesn't need the machine.
+            guard.unlock();
+            const machine_snapshot snap = stored ? store->get(arg) : machine_snapshot::load(arg.c_str());
+            guard.lock();
+
+            m->restore(snap);
+            return "OK";
+        }
+
+        if (verb == "checkpoint") {
+            const usize number = m->checkpoints.checkpoint(m->processor, m->conf.get_bus());
+            return "OK " + std::to_string(number) + " bytes=" + std::to_string(m->checkpoints.get_last_size());
+        }
+
+        if (verb == "rewind") {
+            usize number;
+            try {
+                number = std::stoul(arg);
+            } catch (const std::logic_error&) {
+                throw std::invalid_argument("Usage: rewind <id> <number>");
+            }
+
+            m->restore(m->checkpoints.get(number));
+            return "OK";
+        }
+
+        if (verb == "serial") {
+            std::string out = "OK";
+
+            for (usize slot = 0; slot < bus::get_slot_count(); ++slot) {
+                card* c = m->conf.get_bus().get_card(slot);
+                if (c and c->is_io())
+                    out += " slot " + std::to_string(slot) + " {" + c->identify().detail + "}";
+            }
+
+            return out;
+        }
+
+        if (verb == "stats") {
+            std::string out = "OK state=" + std::string(state_name(m->state))
+                            + " steps=" + std::to_string(m->steps)
+                            + " pc=" + util::to_hex_s(m->processor.get_pc());
+
+            if (m->state == machine_state::FAULTED)
+                out += " fault=" + m->fault;
+
+            return out;
+        }
+
+        if (verb == "memory") {
+            const auto [owned, total] = m->get_page_usage();
+
+            return "OK private=" + std::to_string(owned) + "/" + std::to_string(total)
+                 + " pool=" + std::to_string(pool.get_page_count())
+                 + " page_size=" + std::to_string(POOL_PAGE_SIZE);
+        }
+
+        return "OK";
+    } catch (const std::exception& e) {
+        return std::string("ERR ") + e.what();
+    }
+}
+
+void machine_daemon::serve() {
+    if (listen_fd == -1)
+        throw std::runtime_error("The daemon is not listening on a socket.");
+
+    std::vector<pollfd> fds { { listen_fd, POLLIN, 0 } };
+    std::vector<std::string> pending(1);
+
+    while (!is_stopping()) {
+        if (::poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("poll() failed on the daemon socket");
+        }
+
+        if (fds[0].revents & POLLIN) {
+            const fd client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0) {
+                fds.push_back({ client, POLLIN, 0 });
+                pending.emplace_back();
+            }
+        }
+
+        const auto drop = [&](usize i) {
+            ::close(fds[i].fd);
+            fds.erase(fds.begin() + i);
+            pending.erase(pending.begin() + i);
+        };
+
+        // Backwards, so that dropping a client does not skip the next one.
+        for (usize i = fds.size() - 1; i > 0; --i) {
+            if (!fds[i].revents)
+                continue;
+
+            char buffer[256];
+            const isize amount = recv(fds[i].fd, buffer, sizeof(buffer), 0);
+
+            if (amount <= 0) {
+                drop(i);
+                continue;
+            }
+
+            pending[i].append(buffer, amount);
+
+            usize newline;
+            while ((newline = pending[i].find('\n')) != std::string::npos) {
+                std::string request = pending[i].substr(0, newline);
+                pending[i].erase(0, newline + 1);
+
+                if (!request.empty() and request.back() == '\r')
+                    request.pop_back();
+
+                // A client that doesn't read its replies would block every other one, it's dropped once its socket
+                // buffer can't take a whole reply.
+                const std::string reply = command(request) + "\n";
+                if (send(fds[i].fd, reply.data(), reply.size(), MSG_DONTWAIT | MSG_NOSIGNAL)
+                    != static_cast<isize>(reply.size())) {
+                    drop(i);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (usize i = 1; i < fds.size(); ++i)
+        ::close(fds[i].fd);
+}
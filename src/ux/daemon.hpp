@@ -0,0 +1,165 @@
+#ifndef DAEMON_HPP_
+#define DAEMON_HPP_
+
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <condition_variable>
+
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "page_pool.hpp"
+#include "arena.hpp"
+#include "sysconf.hpp"
+#include "snapshot.hpp"
+#include "snapshot_store.hpp"
+#include "snapshot_chain.hpp"
+#include "typedef.hpp"
+
+/// @brief The run state of a machine in the daemon.
+enum class machine_state {
+    PAUSED, RUNNING, HALTED, FAULTED
+};
+
+/**
+ * @brief A machine managed by the daemon: its configuration, bus and CPU, and its run state.
+ *
+ * All access goes through `lock`, which workers hold for one slice of steps at a time. The state can also be read
+ * without the lock, by workers looking for running machines.
+ */
+struct machine {
+    const usize id;
+    system_config conf;
+    cpu<bus&> processor;
+
+    std::mutex lock;
+    std::atomic<machine_state> state;
+    u64 steps;
+    std::string fault;
+    snapshot_chain checkpoints;
+
+    /**
+     * @brief Run up to `count` steps, handling interrupts, until the CPU halts.
+     * @return The number of steps run.
+     * @note The caller holds `lock`, a failing step leaves the machine `FAULTED` instead of throwing.
+     */
+    usize run(usize count);
+
+    /**
+     * @brief Restore a snapshot, leaving the machine paused (or halted) unless it was running.
+     * @note The caller holds `lock`.
+     */
+    void restore(const machine_snapshot& snap);
+
+    /**
+     * @brief Share the RAM pages left unwritten since the previous call, see `paged_ram_card::dedup()`.
+     * @note The caller holds `lock`.
+     */
+    void dedup();
+
+    /// @brief Get the number of RAM pages held privately by the machine, and the total number of RAM pages.
+    /// @note The caller holds `lock`.
+    std::pair<usize, usize> get_page_usage() const;
+
+    /**
+     * @brief Construct a paused machine from a configuration file.
+     * @param id The id the daemon refers to the machine by.
+     * @param config_filename The path to the TOML configuration file.
+     * @param pool The pool the RAM cards of the machine share their pages through.
+     * @param arena If not null, the arena the machine was placed in, where its cards go too.
+     * @throw `std::runtime_error` or `toml::exception` on a bad configuration.
+     */
+    machine(usize id, const std::string& config_filename, page_pool& pool, machine_arena* arena = nullptr);
+};
+
+/**
+ * @brief Runs a fleet of machines in one process, controlled through a line based protocol on a UNIX domain socket.
+ *
+ * Each request is one line of words, each reply is one line starting with `OK` or `ERR`:
+ *
+ *  - `create <config>` loads a machine from a configuration file and replies with its id, the machine starts paused.
+ *  - `start <id>`, `pause <id>` and `step <id> [count]` control execution, `step` replies with the PC. A step count
+ *    is at most `SLICE_STEPS`, as stepping runs on the control thread.
+ *  - `snapshot <id> <file>` and `restore <id> <file>` save and restore a `machine_snapshot`. A snapshot only pauses
+ *    the machine to freeze it (see `deferred_snapshot`), the machine keeps running while the file is written.
+ *  - `store <id> <name>` and `load <id> <name>` do the same through the daemon's `snapshot_store`, if it has one.
+ *  - `checkpoint <id>` adds a checkpoint to the machine's `snapshot_chain` and replies with its number and the bytes
+ *    it holds, `rewind <id> <number>` restores one.
+ *  - `serial <id>` replies with the pseudo-terminals of the serial cards, any number of terminals can attach to them.
+ *  - `stats <id>` replies with the state, step count and PC, `list` with the state of each machine.
+ *  - `memory <id>` replies with the RAM pages private to the machine, out of its total, and the pages in the pool.
+ *  - `destroy <id>` removes a machine, `shutdown` stops the daemon.
+ *
+ * Running machines are spread over a fixed pool of worker threads by id, and each worker runs its machines round
+ * robin in slices of `SLICE_STEPS` steps, so that commands never wait long for a machine.
+ *
+ * The RAM of all machines is shared copy-on-write through one `page_pool`: machines booted from the same images start
+ * out sharing all their pages, and a background thread deduplicates pages again every `DEDUP_INTERVAL` once they stop
+ * changing, so that each machine only costs the memory it holds differently from the others. Everything else of a
+ * machine (CPU, bus, cards, ROM) lives in its own `machine_arena`.
+ */
+class machine_daemon {
+private:
+    static constexpr usize SLICE_STEPS = 10000;
+    static constexpr std::chrono::milliseconds DEDUP_INTERVAL { 1000 };
+
+    std::string socket_path;
+    fd listen_fd;
+
+    // Declared before the fleet, the pool must outlive the cards sharing its pages.
+    page_pool pool;
+    std::unique_ptr<snapshot_store> store;
+
+    std::mutex fleet_lock;
+    std::condition_variable wake;
+    std::map<usize, std::shared_ptr<machine>> fleet;
+    std::vector<std::thread> workers;
+    std::thread deduper;
+    usize worker_count;
+    usize next_id;
+    bool stopping;
+
+    std::shared_ptr<machine> find(const std::string& id);
+    void notify_workers();
+    void worker_loop(usize worker);
+    void dedup_loop();
+
+public:
+    /**
+     * @brief Execute one request line.
+     * @param line The request, without the newline.
+     * @return The reply, without the newline.
+     * @note Used by the socket loop, and directly in tests.
+     */
+    std::string command(const std::string& line);
+
+    /// @brief Accept clients and serve requests until a `shutdown` request.
+    void serve();
+
+    /// @brief Check whether a `shutdown` request was served.
+    bool is_stopping();
+
+    /**
+     * @brief Start the worker threads and listen on a UNIX domain socket.
+     * @param socket_path The path of the socket, empty to not listen (requests then only come from `command()`).
+     * @param worker_count The number of worker threads, at least one.
+     * @param store_path The directory of the snapshot store, empty to have none.
+     * @throw `std::invalid_argument` if `worker_count` is zero or the path is too long.
+     * @throw `std::runtime_error` if the socket or the snapshot store could not be created.
+     */
+    machine_daemon(const std::string& socket_path, usize worker_count, const std::string& store_path = "");
+
+    /// @brief Stop the workers, close the socket and remove its path.
+    ~machine_daemon();
+
+    machine_daemon(const machine_daemon&) = delete;
+    machine_daemon& operator=(const machine_daemon&) = delete;
+};
+
+#endif
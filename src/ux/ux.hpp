@@ -4,12 +4,27 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <memory>
+#include <csignal>
 #include <stdexcept>
 
 #include "cpu.hpp"
 #include "bus.hpp"
 #include "card.hpp"
 #include "sysconf.hpp"
+#include "trace_ring.hpp"
+#include "branch_trace.hpp"
+#include "guest_profiler.hpp"
+#include "coverage.hpp"
+#include "bus_capture.hpp"
+#include "shm_view.hpp"
+#include "debugger.hpp"
+#include "gdb_stub.hpp"
+#include "aot.hpp"
+#include "arena.hpp"
+
+/// @brief Set by SIGUSR1, the running emulator then dumps its trace ring buffer at the next I/O quantum.
+inline volatile std::sig_atomic_t trace_dump_requested = 0;
 
 class emulator {
 private:
@@ -17,6 +32,17 @@ private:
     bus& cardbus;
     cpu<bus&> processor;
     std::vector<u8> load_rom_vec;
+    debugger dbg;
+    std::unique_ptr<trace_ring> tracer;
+    std::unique_ptr<branch_trace> btrace;
+    std::unique_ptr<branch_trace_tap> btrace_tap;
+    std::vector<u8> btrace_image;
+    std::unique_ptr<guest_profiler> profiler;
+    std::unique_ptr<coverage> cov;
+    std::unique_ptr<bus_capture> capture;
+    std::unique_ptr<shm_view> view;
+    std::unique_ptr<gdb_stub> gdb;
+    std::unique_ptr<aot_table> aot;
 
 public:
     void setup(int argc, char** argv) {
@@ -40,26 +66,322 @@ public:
         }
 
         processor.set_pc(conf.get_start_pc());
+
+        // Loading may have changed ROM contents, only keep the blocks that still match.
+        if (aot)
+            bind_aot();
+
+        // Monitors see the loaded program before the run starts.
+        if (view)
+            publish_view();
+    }
+
+    /// @brief Install the recompiled ROM blocks that match the cards on the bus.
+    void bind_aot() {
+        aot = std::make_unique<aot_table>();
+
+        for (const aot_image* image : aot_builtin_images())
+            aot->bind(*image, cardbus, conf.get_aot_write_protect());
+    }
+
+    /**
+     * @brief Run the machine until it halts or a breakpoint or watchpoint is hit.
+     * @return Why the machine stopped, call `run()` again to resume after a breakpoint or watchpoint.
+     *
+     * When a GDB client is attached, breakpoints and watchpoints are reported to it instead of stopping the run.
+     */
+    debug_event run() {
+        dbg.resume(processor.get_pc());
+
+        // Recompiled blocks skip fetch cycles and run as a single step, so anything watching steps turns them off.
+        const bool use_aot = aot and !tracer and !btrace and !profiler and !cov and !capture and !gdb and !dbg.is_active();
+        processor.set_aot(use_aot ? aot.get() : nullptr);
+
+        // The decoder walks memory as it was when recording started, and the pages written since as they are recorded.
+        if (btrace and btrace_image.empty()) {
+            btrace_image.resize(65536);
+            for (usize adr = 0; adr < btrace_image.size(); ++adr)
+                btrace_image[adr] = cardbus.peek(adr);
+            btrace_tap = std::make_unique<branch_trace_tap>(cardbus, *btrace);
+            processor.set_branch_trace(btrace.get());
+        }
+
+        // Serial output queued on the ring reaches the host once per quantum, in a single system call.
+        io_ring* ring = conf.get_io_ring();
+        usize until_quantum = conf.get_io_quantum();
+
+        try {
+            while (!processor.is_halted() or wait_for_interrupt()) {
+                if (gdb and gdb->needs_attention()) {
+                    gdb->serve();
+                    dbg.resume(processor.get_pc());
+                }
+
+                const u16 pc = processor.get_pc();
+                if (dbg.check(pc) and dbg.confirm(pc, processor.save_state())) {
+                    // The instructions that led to the stop are what the trace is for.
+                    if (tracer)
+                        dump_trace();
+
+                    if (!(gdb and gdb->is_attached()))
+                        return dbg.event();
+
+                    gdb->report(dbg.event());
+                    continue;
+                }
+
+                if (capture)
+                    capture->begin_instruction(pc);
+
+                processor.step();
+
+                // Only acknowledge when the CPU takes it, a controller would otherwise count it as in service.
+                if (processor.is_interrupt_enabled() and cardbus.is_irq())
+                    processor.interrupt(cardbus.get_irq());
+
+                if (view and view->tick())
+                    publish_view();
+
+                if (--until_quantum == 0) {
+                    if (ring) {
+                        ring->submit();
+                        ring->complete();
+                    }
+
+                    // Input raises interrupts even while the program doesn't read the status of its cards.
+                    cardbus.poll_events();
+                    check_trace_request();
+                    until_quantum = conf.get_io_quantum();
+                }
+            }
+
+            if (ring)
+                ring->submit();
+
+            if (view)
+                publish_view();
+
+            if (gdb)
+                gdb->report_halt();
+        } catch (...) {
+            // Keep the last instructions before the crash around for offline decoding.
+            if (tracer)
+                dump_trace();
+            if (btrace)
+                dump_branch_trace();
+            if (profiler)
+                dump_profile();
+            if (cov)
+                dump_coverage();
+            throw;
+        }
+
+        if (tracer)
+            dump_trace();
+        if (btrace)
+            dump_branch_trace();
+        if (profiler)
+            dump_profile();
+        if (cov)
+            dump_coverage();
+
+        return { debug_event_kind::HALTED, processor.get_pc(), 0, 0 };
     }
 
-    void run() {
-        while (!processor.is_halted()) {
-            processor.step();
-            while (cardbus.is_irq())
+    /**
+     * @brief Sleep while the CPU is halted with interrupts enabled, until a card raises an interrupt, then take it.
+     * @return True if the run goes on, with the interrupt taken or for the GDB client, false if the halt ends the run.
+     *
+     * The halt ends the run, like for diagnostics, unless `idle_on_halt` is set. With it, `EI; HLT` waits in the
+     * kernel for input on the cards that could interrupt, so an idle interrupt driven guest costs no host CPU. A halt
+     * with interrupts disabled, or with no card able to interrupt, still ends the run.
+     */
+    bool wait_for_interrupt() {
+        if (!conf.get_idle_on_halt() or !processor.is_interrupt_enabled())
+            return false;
+
+        io_ring* ring = conf.get_io_ring();
+        std::vector<fd> extra;
+
+        if (view)
+            publish_view();
+
+        while (true) {
+            // A signal interrupts the sleep, the dump it asked for is taken right away.
+            check_trace_request();
+
+            // Output the program queued before halting must reach the host before sleeping.
+            if (ring) {
+                ring->submit();
+                ring->complete();
+            }
+
+            cardbus.poll_events();
+
+            if (cardbus.is_irq()) {
                 processor.interrupt(cardbus.get_irq());
+                return true;
+            }
+
+            if (gdb and gdb->poll_now())
+                return true;
+
+            extra.clear();
+            if (gdb)
+                extra.push_back(gdb->get_event_fd());
+
+            if (!cardbus.wait_events(extra))
+                return false;
         }
     }
 
-    std::string info() const { return cardbus.bus_map_s(); }
+    /// @brief Publish the machine state to the shared memory view.
+    void publish_view() {
+        view->publish(processor.save_state(),
+            (processor.is_halted() ? static_cast<u8>(shm_view_status::HALTED) : 0)
+            | (processor.is_interrupt_enabled() ? static_cast<u8>(shm_view_status::INTE) : 0)
+            | (cardbus.is_irq() ? static_cast<u8>(shm_view_status::IRQ) : 0));
+    }
+
+    /// @name Debugger methods, see `debugger` for details.
+    /// \{
+
+    void add_breakpoint(u16 adr) { dbg.add_breakpoint(adr); }
+    void add_breakpoint(u16 adr, const debug_condition& cond) { dbg.add_breakpoint(adr, cond); }
+    void remove_breakpoint(u16 adr) { dbg.remove_breakpoint(adr); }
+    void add_watchpoint(u16 adr, usize len, u8 access) { dbg.add_watchpoint(adr, len, access); }
+    void remove_watchpoint(u16 adr, usize len, u8 access) { dbg.remove_watchpoint(adr, len, access); }
+    void add_port_watchpoint(u8 port, u8 access) { dbg.add_port_watchpoint(port, access); }
+    void remove_port_watchpoint(u8 port, u8 access) { dbg.remove_port_watchpoint(port, access); }
 
-    emulator(const char* config_filename) 
-        : conf(config_filename), 
+    /// \}
+
+    /// @brief Toggle recording into the trace ring buffer, if one was configured.
+    void set_tracing(bool enabled) { processor.set_trace_ring((enabled and tracer) ? tracer.get() : nullptr); }
+
+    /// @brief Dump the trace ring buffer to the configured file.
+    /// @throw `std::runtime_error` if no trace ring buffer was configured, or on write failure.
+    void dump_trace() const {
+        if (!tracer)
+            throw std::runtime_error("No trace ring buffer configured, set trace_ring_size in the config file.");
+
+        tracer->dump(conf.get_trace_dump_to().c_str());
+    }
+
+    /// @brief Dump the trace ring buffer if SIGUSR1 asked for it since the last check.
+    void check_trace_request() {
+        if (tracer and trace_dump_requested) {
+            trace_dump_requested = 0;
+            dump_trace();
+        }
+    }
+
+    /// @brief Write the branch trace of the run so far, and the memory it started on, to the configured file.
+    /// @throw `std::runtime_error` if branch tracing was not configured, or on write failure.
+    void dump_branch_trace() {
+        if (!btrace)
+            throw std::runtime_error("No branch trace configured, set branch_trace_to in the config file.");
+
+        // Saved with an end marker, recording then carries on from the same point as a new run would.
+        branch_trace copy = *btrace;
+        copy.finish();
+        copy.save(conf.get_branch_trace_to().c_str(), btrace_image);
+    }
+
+    /// @brief Write the guest profiler samples to the configured file, as collapsed stacks.
+    /// @throw `std::runtime_error` if no profiler was configured, or on write failure.
+    void dump_profile() const {
+        if (!profiler)
+            throw std::runtime_error("No guest profiler configured, set profile_interval in the config file.");
+
+        profiler->dump(conf.get_profile_to().c_str());
+    }
+
+    /// @brief Write the coverage report, per card and optionally over a listing, to the configured file.
+    /// @throw `std::runtime_error` if coverage was not configured, or on write failure.
+    void dump_coverage() const {
+        if (!cov)
+            throw std::runtime_error("Coverage not configured, set coverage_to in the config file.");
+
+        std::ofstream file(conf.get_coverage_to(), std::ios::trunc);
+        if (!file.is_open())
+            throw std::runtime_error("Could not open coverage report file: " + conf.get_coverage_to());
+
+        file << cov->card_report();
+        if (!conf.get_coverage_listing().empty())
+            file << "\n" << cov->annotate_listing(conf.get_coverage_listing());
+
+        if (file.fail())
+            throw std::runtime_error("Failed to write coverage report file: " + conf.get_coverage_to());
+    }
+
+    std::string info() const {
+        std::string out = cardbus.bus_map_s();
+
+        if (aot)
+            out += "Recompiled ROM blocks: " + std::to_string(aot->get_installed())
+                 + (conf.get_aot_write_protect() ? " (RAM write protected)\n" : "\n");
+        if (gdb)
+            out += "GDB remote stub listening on: " + conf.get_gdb_listen() + "\n";
+
+        return out;
+    }
+
+    /**
+     * @brief Construct the emulator from a configuration file.
+     * @param config_filename The path to the TOML configuration file.
+     * @param arena If not null, the arena the emulator itself was placed in, where its cards and memory go too.
+     */
+    emulator(const char* config_filename, machine_arena* arena = nullptr) 
+        : conf(config_filename, nullptr, arena), 
           cardbus(conf.get_bus()), 
-          processor(cardbus, conf.get_start_pc() == 0x0000) {}
+          processor(cardbus, conf.get_start_pc() == 0x0000),
+          dbg(&cardbus) {
+
+        if (conf.get_trace_ring_size() > 0) {
+            tracer = std::make_unique<trace_ring>(conf.get_trace_ring_size());
+            set_tracing(true);
+
+            // `kill -USR1` dumps the trace of a running emulator, the flag is only checked between quanta.
+            std::signal(SIGUSR1, [](int) { trace_dump_requested = 1; });
+        }
+
+        if (!conf.get_branch_trace_to().empty())
+            btrace = std::make_unique<branch_trace>();
+
+        if (conf.get_profile_interval() > 0) {
+            profiler = std::make_unique<guest_profiler>(conf.get_profile_interval());
+            if (!conf.get_profile_symbols().empty())
+                profiler->load_symbols(conf.get_profile_symbols());
+            processor.set_profiler(profiler.get());
+        }
+
+        if (!conf.get_coverage_to().empty()) {
+            cov = std::make_unique<coverage>(&cardbus);
+            processor.set_coverage(cov.get());
+        }
+
+        if (!conf.get_capture_to().empty())
+            capture = std::make_unique<bus_capture>(
+                cardbus, conf.get_capture_to().c_str(), bus_capture::parse_filter(conf.get_capture_filter())
+            );
+
+        if (!conf.get_shm_name().empty())
+            view = std::make_unique<shm_view>(cardbus, conf.get_shm_name(), conf.get_shm_interval());
+
+        if (conf.get_aot_enabled())
+            bind_aot();
+
+        if (!conf.get_gdb_listen().empty()) {
+            gdb = std::make_unique<gdb_stub>(processor, cardbus, dbg);
+            gdb->listen(conf.get_gdb_listen());
+        }
+    }
 };
 
 struct terminal_ux {
-    emulator emu;
+    machine_arena arena;
+    emulator& emu;
 
     int main(int argc, char** argv) {
         std::cout << "\x1B[33;01m-:-:-:-:- emulator setup -:-:-:-:-\x1B[0m\n" << std::endl;
@@ -79,7 +401,13 @@ struct terminal_ux {
         return 0;
     }
 
-    terminal_ux(const char* config_filename) : emu(config_filename) {}
+    // The emulator goes first in the arena, so that the CPU and bus sit right before the cards and their memory.
+    terminal_ux(const char* config_filename) : arena(), emu(*arena.create<emulator>(config_filename, &arena)) {}
+
+    ~terminal_ux() { emu.~emulator(); }
+
+    terminal_ux(const terminal_ux&) = delete;
+    terminal_ux& operator=(const terminal_ux&) = delete;
 };
 
 #endif
\ No newline at end of file
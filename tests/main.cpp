@@ -2,4 +2,24 @@
 #include "test_cpu_state.hpp"
 #include "test_cpu.hpp"
 #include "test_pty.hpp"
-#include "test_data_cards.hpp"
\ No newline at end of file
+#include "test_data_cards.hpp"
+#include "test_lockstep.hpp"
+#include "test_trace_ring.hpp"
+#include "test_debugger.hpp"
+#include "test_profiler.hpp"
+#include "test_coverage.hpp"
+#include "test_bus_capture.hpp"
+#include "test_shm_view.hpp"
+#include "test_snapshot.hpp"
+#include "test_aot.hpp"
+#include "test_cpu_batch.hpp"
+#include "test_page_pool.hpp"
+#include "test_arena.hpp"
+#include "test_port_bus.hpp"
+#include "test_vi_card.hpp"
+#include "test_snapshot_store.hpp"
+#include "test_branch_trace.hpp"
+#include "test_io_ring.hpp"
+#include "test_idle.hpp"
+#include "test_nvram.hpp"
+#include "test_gdb_stub.hpp"
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "aot.hpp"
+#include "arena.hpp"
+
+TEST_CASE("Recompiled ROM blocks", "[aot]") {
+    for (const aot_image* image : aot_builtin_images()) {
+        bus aot_bus, ref_bus;
+        ram_card aot_ram(0x0000, 0xC000, 0x00), ref_ram(0x0000, 0xC000, 0x00);
+        rom_card aot_rom(image->load_adr, image->data, image->data + image->size);
+        rom_card ref_rom(image->load_adr, image->data, image->data + image->size);
+        aot_bus.insert(&aot_ram, 0);
+        aot_bus.insert(&aot_rom, 1);
+        ref_bus.insert(&ref_ram, 0);
+        ref_bus.insert(&ref_rom, 1);
+
+        aot_table table;
+        REQUIRE(table.bind(*image, aot_bus) == image->block_count);
+        REQUIRE(table.bind(*image, aot_bus) == 0);
+        REQUIRE(table.get_installed() == image->block_count);
+
+        SECTION("Blocks run in lockstep with the interpreter") {
+            cpu<bus&> aot_cpu(aot_bus), ref_cpu(ref_bus);
+            aot_cpu.set_pc(image->load_adr);
+            ref_cpu.set_pc(image->load_adr);
+            aot_cpu.set_aot(&table);
+
+            usize aot_steps = 0, ref_steps = 0;
+
+            for (usize i = 0; i < 5000 and !aot_cpu.is_halted(); ++i) {
+                aot_cpu.step();
+                ++aot_steps;
+
+                for (usize n = 0; n < 64 and ref_cpu.get_pc() != aot_cpu.get_pc(); ++n, ++ref_steps)
+                    ref_cpu.step();
+
+                REQUIRE(ref_cpu.save_state().registers == aot_cpu.save_state().registers);
+            }
+
+            REQUIRE(ref_steps > aot_steps);
+
+            for (usize adr = 0; adr < 0xC000; ++adr)
+                REQUIRE(aot_bus.peek(adr) == ref_bus.peek(adr));
+        }
+
+        SECTION("Blocks are not bound over RAM or changed contents") {
+            aot_rom.write_force(image->blocks[0].start, ~image->data[image->blocks[0].start - image->load_adr]);
+            aot_table changed;
+            REQUIRE(changed.bind(*image, aot_bus) == image->block_count - 1);
+            REQUIRE(changed.find(image->blocks[0].start) == nullptr);
+
+            aot_rom.w_unlock();
+            aot_table unlocked;
+            REQUIRE(unlocked.bind(*image, aot_bus) == 0);
+        }
+    
+        SECTION("Blocks on write protected RAM are dropped when written") {
+            machine_arena arena(1 << 20);
+            ram_card* guarded_ram = arena.create<ram_card>(
+                image->load_adr, image->size, ram_card::external_storage { arena.allocate_pages(image->size) }
+            );
+            for (usize i = 0; i < image->size; ++i)
+                guarded_ram->write_force(image->load_adr + i, image->data[i]);
+
+            bus guarded_bus;
+            guarded_bus.insert(guarded_ram, 0);
+
+            const aot_block& first = image->blocks[0];
+            usize faults = write_guard::get_fault_count();
+
+            {
+                aot_table table;
+                REQUIRE(table.bind(*image, guarded_bus) == 0);
+                REQUIRE(table.bind(*image, guarded_bus, true) == image->block_count);
+                REQUIRE(table.find(first.start) == first.fn);
+
+                guarded_bus.write(first.start, 0x00);
+                REQUIRE(write_guard::get_fault_count() == faults + 1);
+                REQUIRE(guarded_bus.peek(first.start) == 0x00);
+                REQUIRE(table.find(first.start) == nullptr);
+                REQUIRE(table.get_invalidated() > 0);
+                REQUIRE(table.get_installed() + table.get_invalidated() == image->block_count);
+
+                // The page is writable again, further stores don't fault.
+                guarded_bus.write(first.start + 1, 0x00);
+                REQUIRE(write_guard::get_fault_count() == faults + 1);
+
+                REQUIRE(table.bind(*image, guarded_bus, true) < image->block_count);
+
+                // Once the code is back, binding again installs the missing blocks only, each once.
+                guarded_bus.write(first.start, image->data[first.start - image->load_adr]);
+                guarded_bus.write(first.start + 1, image->data[first.start + 1 - image->load_adr]);
+
+                const usize missing = image->block_count - table.get_installed();
+                REQUIRE(table.bind(*image, guarded_bus, true) == missing);
+                REQUIRE(table.get_installed() == image->block_count);
+                REQUIRE(table.bind(*image, guarded_bus, true) == 0);
+                REQUIRE(table.get_installed() == image->block_count);
+                REQUIRE(table.find(first.start) == first.fn);
+
+                const usize refaults = write_guard::get_fault_count();
+                guarded_bus.write(first.start, 0x00);
+                REQUIRE(write_guard::get_fault_count() == refaults + 1);
+                REQUIRE(table.find(first.start) == nullptr);
+                faults = write_guard::get_fault_count();
+            }
+
+            // Destroying the table unprotects what it still guarded.
+            guarded_bus.write(image->load_adr + image->size - 1, 0x00);
+            REQUIRE(write_guard::get_fault_count() == faults);
+
+            guarded_ram->~ram_card();
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <stdexcept>
+#include <unistd.h>
+
+#include "typedef.hpp"
+#include "card.hpp"
+#include "arena.hpp"
+
+TEST_CASE("Machine arena layout", "[arena]") {
+    machine_arena arena(1 << 20);
+
+    SECTION("Objects are cache line aligned and packed from the start") {
+        u8* first = static_cast<u8*>(arena.allocate(10));
+        u8* second = static_cast<u8*>(arena.allocate(10));
+
+        REQUIRE(reinterpret_cast<uintptr_t>(first) % ARENA_ALIGN == 0);
+        REQUIRE(second == first + ARENA_ALIGN);
+        REQUIRE(arena.owns(second));
+        REQUIRE_THROWS_AS(arena.allocate(1 << 20), std::runtime_error);
+    }
+
+    SECTION("Card memory is only backed once written") {
+        const usize resident = arena.get_resident();
+        ram_card* ram = arena.create<ram_card>(0x0000, 65536, ram_card::external_storage { arena.allocate_pages(65536) });
+
+        REQUIRE(arena.owns(ram));
+        REQUIRE(arena.get_used() >= 65536);
+
+        const usize created_resident = arena.get_resident();
+        REQUIRE(created_resident - resident <= static_cast<usize>(sysconf(_SC_PAGESIZE)));
+
+        ram->write(0x8000, 0x12);
+        REQUIRE(arena.get_resident() - created_resident == static_cast<usize>(sysconf(_SC_PAGESIZE)));
+        REQUIRE(ram->read(0x8000) == 0x12);
+        REQUIRE(ram->read(0x8001) == BAD_U8);
+        REQUIRE(ram->read(0x0000) == BAD_U8);
+
+        ram->clear();
+        REQUIRE(ram->read(0x8000) == BAD_U8);
+
+        ram->~ram_card();
+    }
+
+    SECTION("Clearing card memory gives its pages back") {
+        const usize page = sysconf(_SC_PAGESIZE);
+        ram_card* ram = arena.create<ram_card>(
+            0x0000, 65536, ram_card::external_storage { arena.allocate_pages(65536) }
+        );
+        const usize resident = arena.get_resident();
+
+        for (usize adr = 0x4000; adr < 0x8000; adr += page)
+            ram->write(adr, 0x34);
+        REQUIRE(arena.get_resident() - resident == 0x4000);
+
+        ram->clear();
+        REQUIRE(arena.get_resident() <= resident);
+        REQUIRE(ram->read(0x4000) == BAD_U8);
+        REQUIRE(ram->read(0x7FFF) == BAD_U8);
+        REQUIRE(ram->read(0xC000) == BAD_U8);
+
+        ram->write(0x4000, 0x56);
+        REQUIRE(ram->read(0x4000) == 0x56);
+
+        ram->~ram_card();
+    }
+}
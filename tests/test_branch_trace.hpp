@@ -0,0 +1,194 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <unistd.h>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "card.hpp"
+#include "trace_ring.hpp"
+#include "branch_trace.hpp"
+#include "test_helpers.hpp"
+
+// Executed PCs as recorded by a trace ring, without the instructions placed on the bus by interrupts.
+static std::vector<u16> executed_pcs(const trace_ring& ring) {
+    std::vector<u16> pcs;
+
+    for (usize i = 0; i < ring.size(); ++i)
+        if (!(ring.at(i).status & static_cast<u8>(trace_status::INTERRUPT)))
+            pcs.push_back(ring.at(i).pc);
+
+    return pcs;
+}
+
+static void require_branch_trace_decodes(const char* program) {
+    const std::vector<u8> programv = read_bin(program);
+
+    std::unique_ptr<cpu_t> emu = std::make_unique<cpu_t>(std::array<u8, 65536> {0});
+    std::string output;
+    trace_ring ring(1 << 20);
+    branch_trace trace;
+
+    emu->load(programv.begin(), programv.end(), 0x100, true);
+    emu->do_pseudo_bdos(true);
+    emu->set_pseudo_bdos_redirect(output);
+
+    // The pseudo BDOS halts by writing a HLT over the reset jump, the decoder still finds the same PCs.
+    const std::vector<u8> image(emu->get_adr_space().begin(), emu->get_adr_space().end());
+
+    emu->set_trace_ring(&ring);
+    emu->set_branch_trace(&trace);
+    while (!emu->is_halted())
+        emu->step();
+    trace.finish();
+
+    const std::vector<u16> expected = executed_pcs(ring);
+    REQUIRE(ring.total() < ring.capacity());
+    REQUIRE(trace.get_instructions() == expected.size());
+
+    std::vector<u16> decoded;
+    const u64 count = branch_trace::decode(trace.get_stream(), image, [&](const branch_step& step) {
+        decoded.push_back(step.pc);
+    });
+
+    REQUIRE(count == expected.size());
+    REQUIRE(decoded == expected);
+
+    // Under 4 bits per instruction even for these branch heavy tests, a trace ring record is 128.
+    REQUIRE(trace.get_stream().size() * 2 < expected.size());
+}
+
+TEST_CASE("Branch trace of diagnostics", "[branch_trace]") {
+    SECTION("Running cpudiag.bin")
+        require_branch_trace_decodes("cpudiag.bin");
+
+    SECTION("Running test.com")
+        require_branch_trace_decodes("test.com");
+}
+
+TEST_CASE("Branch trace with interrupts and inputs", "[branch_trace]") {
+    // 0x0000: LXI SP, 0x7000; EI; JMP 0x0004
+    // 0x0038: IN 0x10; EI; RET
+    std::vector<u8> image(65536, 0x00);
+    const std::array<u8, 7> main = { 0x31, 0x00, 0x70, 0xFB, 0xC3, 0x04, 0x00 };
+    const std::array<u8, 4> handler = { 0xDB, 0x10, 0xFB, 0xC9 };
+    std::copy(main.begin(), main.end(), image.begin());
+    std::copy(handler.begin(), handler.end(), image.begin() + 0x38);
+
+    bus cardbus;
+    ram_card ram(0x0000, image.begin(), image.begin() + 0x8000);
+    cardbus.insert(&ram, 0);
+
+    cpu<bus&> processor(cardbus);
+    trace_ring ring(1024);
+    branch_trace trace;
+    processor.set_trace_ring(&ring);
+    processor.set_branch_trace(&trace);
+
+    usize interrupts = 0;
+    for (usize i = 0; i < 200; ++i) {
+        processor.step();
+        if (i % 17 == 5 and processor.is_interrupt_enabled()) {
+            processor.interrupt({ 0xFF, 0x00, 0x00 });
+            ++interrupts;
+        }
+    }
+
+    // A jump the code didn't make is recorded too.
+    processor.set_pc(0x0004);
+    processor.step(3);
+    trace.finish();
+
+    usize interrupted = 0, inputs = 0;
+    std::vector<u16> decoded;
+
+    branch_trace::decode(trace.get_stream(), image, [&](const branch_step& step) {
+        decoded.push_back(step.pc);
+        interrupted += step.interrupted;
+        inputs += step.opcode == 0xDB and step.input == 0xFF;
+    });
+
+    REQUIRE(interrupts > 5);
+    REQUIRE(decoded == executed_pcs(ring));
+    REQUIRE(interrupted == interrupts);
+    REQUIRE(inputs == interrupts);
+
+    SECTION("Saved traces decode the same") {
+        const temp_file file;
+        trace.save(file.path, image);
+
+        std::vector<u8> loaded_image;
+        const std::vector<u8> loaded = branch_trace::load(file.path, loaded_image);
+
+        REQUIRE(loaded == trace.get_stream());
+        REQUIRE(loaded_image == image);
+    }
+
+    SECTION("Traces that don't match the memory are rejected") {
+        image[0x0004] = 0xC2; // JNZ needs a branch bit the trace doesn't have at that point.
+        REQUIRE_THROWS_AS(branch_trace::decode(trace.get_stream(), image, [](const branch_step&) {}), std::runtime_error);
+    }
+}
+
+TEST_CASE("Branch trace of code written by the run", "[branch_trace]") {
+    // 0x0000: LXI SP, 0x7000; LXI H, 0x2000; then one MVI M; INX H per byte of MVI A, 7; DCR A; JNZ 0x2002; RET,
+    // CALL 0x2000; HLT. The page at 0x2000 starts out as IN instructions, which need bytes the trace doesn't have.
+    std::vector<u8> image(65536, 0x00);
+    std::vector<u8> program = { 0x31, 0x00, 0x70, 0x21, 0x00, 0x20 };
+    for (u8 byte : { 0x3E, 0x07, 0x3D, 0xC2, 0x02, 0x20, 0xC9 })
+        program.insert(program.end(), { 0x36, byte, 0x23 });
+    program.insert(program.end(), { 0xCD, 0x00, 0x20, 0x76 });
+
+    std::copy(program.begin(), program.end(), image.begin());
+    std::fill(image.begin() + 0x2000, image.begin() + 0x2100, 0xDB);
+
+    bus cardbus;
+    ram_card ram(0x0000, image.begin(), image.begin() + 0x8000);
+    cardbus.insert(&ram, 0);
+
+    cpu<bus&> processor(cardbus);
+    trace_ring ring(1024);
+    branch_trace trace;
+    processor.set_trace_ring(&ring);
+    processor.set_branch_trace(&trace);
+
+    SECTION("Pages written by the run are recorded before running from them") {
+        branch_trace_tap tap(cardbus, trace);
+        while (!processor.is_halted())
+            processor.step();
+        trace.finish();
+
+        std::vector<u16> decoded;
+        usize loops = 0;
+        const u64 count = branch_trace::decode(trace.get_stream(), image, [&](const branch_step& step) {
+            decoded.push_back(step.pc);
+            loops += step.pc == 0x2002 and step.opcode == 0x3D;
+            if (step.pc == 0x2003)
+                REQUIRE((step.opcode == 0xC2 and step.op1 == 0x02 and step.op2 == 0x20));
+        });
+
+        REQUIRE(count == ring.total());
+        REQUIRE(decoded == executed_pcs(ring));
+        REQUIRE(loops == 7);
+    }
+
+    SECTION("Without the writes, the decoder names where it lost track") {
+        while (!processor.is_halted())
+            processor.step();
+        trace.finish();
+
+        std::string error;
+        try {
+            branch_trace::decode(trace.get_stream(), image, [](const branch_step&) {});
+        } catch (const std::runtime_error& e) {
+            error = e.what();
+        }
+
+        REQUIRE(error.find("0x2000") != std::string::npos);
+    }
+}
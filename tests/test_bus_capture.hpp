@@ -0,0 +1,77 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <cstdio>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "bus_capture.hpp"
+
+// LXI H, 0x0200; MVI M, 0x5A; OUT 0x10; HLT
+constexpr static std::array<u8, 8> CAPTURE_PRG = {
+    0x21, 0x00, 0x02, 0x36, 0x5A, 0xD3, 0x10, 0x76
+};
+
+static std::vector<bus_cycle> capture_run(const std::vector<capture_range>& ranges, u64& dropped) {
+    bus cardbus;
+    ram_card ram(0x0000, 1024);
+    cardbus.insert(&ram, 3);
+
+    cpu<bus&> processor(cardbus);
+    processor.load(CAPTURE_PRG.begin(), CAPTURE_PRG.end());
+
+    {
+        bus_capture capture(cardbus, "bus_capture_test.cap", ranges);
+
+        while (!processor.is_halted()) {
+            capture.begin_instruction(processor.get_pc());
+            processor.step();
+        }
+    }
+
+    std::vector<bus_cycle> cycles = bus_capture::read("bus_capture_test.cap", dropped);
+    std::remove("bus_capture_test.cap");
+    return cycles;
+}
+
+TEST_CASE("Bus cycle capture", "[bus_capture]") {
+    u64 dropped;
+
+    SECTION("Every cycle is captured and decoded with its status.") {
+        std::vector<bus_cycle> cycles = capture_run({}, dropped);
+
+        REQUIRE(dropped == 0);
+        REQUIRE(cycles.size() == 10);
+
+        REQUIRE(cycles[0].adr == 0x0000);
+        REQUIRE(cycles[0].status == (static_cast<u8>(bus_cycle_status::FETCH) | static_cast<u8>(bus_cycle_status::OPCODE)));
+        REQUIRE(cycles[0].slot == 3);
+        REQUIRE(cycles[1].status == static_cast<u8>(bus_cycle_status::FETCH));
+
+        REQUIRE(cycles[5].adr == 0x0200);
+        REQUIRE(cycles[5].data == 0x5A);
+        REQUIRE(cycles[5].status == static_cast<u8>(bus_cycle_status::WRITE));
+
+        REQUIRE(cycles[8].status == (static_cast<u8>(bus_cycle_status::IO) | static_cast<u8>(bus_cycle_status::WRITE)));
+        REQUIRE((cycles[8].adr & 0xFF) == 0x10);
+        REQUIRE(cycles[8].slot == 255);
+
+        REQUIRE(cycles[9].adr == 0x0007);
+        REQUIRE(cycles[9].index == 9);
+    }
+
+    SECTION("Filters only keep the requested ranges.") {
+        std::vector<bus_cycle> cycles = capture_run(bus_capture::parse_filter("io:10,mem:0200-02FF"), dropped);
+
+        REQUIRE(cycles.size() == 2);
+        REQUIRE(cycles[0].adr == 0x0200);
+        REQUIRE(cycles[1].status & static_cast<u8>(bus_cycle_status::IO));
+    }
+
+    SECTION("Malformed filters are rejected.") {
+        REQUIRE_THROWS_AS(bus_capture::parse_filter("rom:0000"), std::invalid_argument);
+        REQUIRE_THROWS_AS(bus_capture::parse_filter("io:100"), std::invalid_argument);
+        REQUIRE_THROWS_AS(bus_capture::parse_filter("mem:20-10"), std::invalid_argument);
+    }
+}
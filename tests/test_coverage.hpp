@@ -0,0 +1,46 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "coverage.hpp"
+
+// LXI H, 0x0100; MOV A, M; JMP skip; HLT (never run); skip: STA 0x0101; HLT
+constexpr static std::array<u8, 12> COVERAGE_PRG = {
+    0x21, 0x00, 0x01, 0x7E, 0xC3, 0x08, 0x00, 0x76, 0x32, 0x01, 0x01, 0x76
+};
+
+TEST_CASE("Address coverage", "[coverage]") {
+    bus cardbus;
+    ram_card ram(0x0000, 1024);
+    cardbus.insert(&ram, 0);
+
+    cpu<bus&> processor(cardbus);
+    processor.load(COVERAGE_PRG.begin(), COVERAGE_PRG.end());
+
+    coverage cov(&cardbus);
+    processor.set_coverage(&cov);
+
+    while (!processor.is_halted())
+        processor.step();
+
+    SECTION("Opcodes, operands and data are told apart.") {
+        REQUIRE(cov.test(coverage_kind::OPCODE, 0x0000));
+        REQUIRE(cov.test(coverage_kind::OPERAND, 0x0001));
+        REQUIRE(!cov.test(coverage_kind::OPCODE, 0x0001));
+        REQUIRE(!cov.test(coverage_kind::OPCODE, 0x0007));
+        REQUIRE(cov.test(coverage_kind::OPCODE, 0x000B));
+
+        REQUIRE(cov.count(coverage_kind::OPCODE) == 5);
+        REQUIRE(cov.count(coverage_kind::OPERAND) == 6);
+        REQUIRE(cov.count(coverage_kind::DATA) == 2);
+        REQUIRE(cov.test(coverage_kind::DATA, 0x0100));
+        REQUIRE(cov.test(coverage_kind::DATA, 0x0101));
+    }
+
+    SECTION("The report has a line per memory card.") {
+        REQUIRE(cov.card_report().find("5 opcodes, 6 operands") != std::string::npos);
+    }
+}
@@ -1,5 +1,8 @@
 #include <catch2/catch_test_macros.hpp>
 
+#include <array>
+#include <memory>
+#include <thread>
 #include <vector>
 #include <string>
 #include <fstream>
@@ -11,7 +14,6 @@
 constexpr static const usize TESTS_N = 4;
 constexpr static const char* TESTFILE[TESTS_N] = { "cpudiag.bin", "test.com", "8080pre.com", "diag2.com" };
 constexpr static const char* PASSED[TESTS_N] = { "ok_cpudiag.txt", "ok_test.txt", "ok_8080pre.txt", "ok_diag2.txt" };
-constexpr static const char* OUTPUT = "out.txt";
 
 using cpu_t = cpu<std::array<u8, 65536>>;
 
@@ -22,36 +24,53 @@ inline std::vector<u8> read_bin(const char* filename) {
     return std::vector<u8>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
 }
 
-inline void test(cpu_t& emu, const char* prg, const char* ok) {
-    std::vector<u8> programv = read_bin(prg);
-    std::vector<u8> okv = read_bin(ok);
+/// @brief Run a diagnostic to its end on a fresh CPU, and get what it printed.
+inline std::string run_diagnostic(const std::vector<u8>& programv) {
+    std::unique_ptr<cpu_t> emu = std::make_unique<cpu_t>(std::array<u8, 65536> {0});
+    std::string output;
 
-    REQUIRE(!programv.empty());
-    REQUIRE(!okv.empty());
+    emu->load(programv.begin(), programv.end(), 0x100, true);
+    emu->do_pseudo_bdos(true);
+    emu->set_pseudo_bdos_redirect(output);
+    while (!emu->is_halted())
+        emu->step();
+    emu->reset_pseudo_bdos_redirect();
 
-    emu.load(programv.begin(), programv.end(), 0x100, true);
-    emu.do_pseudo_bdos(true);
-    emu.set_pseudo_bdos_redirect(OUTPUT);
-    while (!emu.is_halted())
-        emu.step();
-    emu.reset_pseudo_bdos_redirect();
+    return output;
+}
 
-    std::vector<u8> outputv = read_bin(OUTPUT);
+TEST_CASE("CPU running various diagnostics", "[cpu]") {
+    std::array<std::vector<u8>, TESTS_N> programs;
+    std::array<std::string, TESTS_N> outputs;
+    std::array<std::string, TESTS_N> failures;
 
-    REQUIRE(!outputv.empty());
+    for (usize i = 0; i < TESTS_N; ++i) {
+        programs[i] = read_bin(TESTFILE[i]);
+        REQUIRE(!programs[i].empty());
+    }
 
-    std::string outputs(outputv.begin(), outputv.end());
-    std::string oks(okv.begin(), okv.end());
+    // One CPU per diagnostic, each on its own thread, so the run takes as long as the slowest one. Assertions aren't
+    // thread safe, they are all checked once the threads are done.
+    std::vector<std::thread> threads;
+    for (usize i = 0; i < TESTS_N; ++i)
+        threads.emplace_back([&, i]() {
+            try {
+                outputs[i] = run_diagnostic(programs[i]);
+            } catch (const std::exception& e) {
+                failures[i] = e.what();
+            }
+        });
 
-    REQUIRE(oks == outputs);
+    for (std::thread& thread : threads)
+        thread.join();
 
-    emu.clear();
-}
+    for (usize i = 0; i < TESTS_N; ++i) {
+        const std::vector<u8> okv = read_bin(PASSED[i]);
+        INFO("Running " << TESTFILE[i]);
 
-TEST_CASE("CPU running various diagnostics", "[cpu]") {
-    cpu_t emu({0});
-
-    for (usize i = 0; i < TESTS_N; ++i)
-        SECTION("Running " + std::string(TESTFILE[i]))
-            test(emu, TESTFILE[i], PASSED[i]);
+        REQUIRE(!okv.empty());
+        CHECK(failures[i].empty());
+        CHECK(!outputs[i].empty());
+        CHECK(std::string(okv.begin(), okv.end()) == outputs[i]);
+    }
 }
@@ -0,0 +1,84 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "cpu_batch.hpp"
+
+TEST_CASE("Batched CPUs match independent CPUs", "[cpu][batch]") {
+    // Sums 1..n for n read from 0x0200 into 0x0201, with a data dependent branch taken for odd counters.
+    static const std::vector<u8> PROGRAM = {
+        0x31, 0x00, 0x01,   // LXI SP, 0100h
+        0x3A, 0x00, 0x02,   // LDA 0200h
+        0x47,               // MOV B, A
+        0xAF,               // XRA A
+        0x0E, 0x00,         // MVI C, 0
+        0x80,               // loop: ADD B
+        0x4F,               // MOV C, A
+        0x78,               // MOV A, B
+        0xE6, 0x01,         // ANI 1
+        0xCA, 0x15, 0x00,   // JZ even
+        0x0C,               // INR C
+        0x0C,               // INR C
+        0x0D,               // DCR C
+        0x79,               // even: MOV A, C
+        0x05,               // DCR B
+        0xC2, 0x0A, 0x00,   // JNZ loop
+        0x32, 0x01, 0x02,   // STA 0201h
+        0x76                // HLT
+    };
+
+    constexpr usize LANES = 13;
+    cpu_batch batch(LANES);
+    std::vector<std::unique_ptr<cpu_batch::lane_cpu>> reference;
+
+    for (usize i = 0; i < LANES; ++i) {
+        reference.push_back(std::make_unique<cpu_batch::lane_cpu>(std::array<u8, 65536> {}));
+        batch.lane(i).load(PROGRAM.begin(), PROGRAM.end());
+        batch.lane(i).get_adr_space()[0x0200] = i * 7 + 1;
+        reference[i]->load(PROGRAM.begin(), PROGRAM.end());
+        reference[i]->get_adr_space()[0x0200] = i * 7 + 1;
+    }
+
+    batch.run();
+
+    for (usize i = 0; i < LANES; ++i) {
+        while (!reference[i]->is_halted())
+            reference[i]->step();
+
+        REQUIRE(batch.lane(i).is_halted());
+        REQUIRE(batch.lane(i).save_state().registers == reference[i]->save_state().registers);
+        REQUIRE(batch.lane(i).get_adr_space()[0x0201] == reference[i]->get_adr_space()[0x0201]);
+    }
+
+    REQUIRE(batch.get_vector_lane_steps() > batch.get_scalar_lane_steps());
+}
+
+TEST_CASE("Batched CPUs running diagnostics", "[cpu][batch]") {
+    for (usize t = 0; t < TESTS_N; ++t)
+        SECTION("Running " + std::string(TESTFILE[t])) {
+            const std::vector<u8> programv = read_bin(TESTFILE[t]);
+            const std::vector<u8> okv = read_bin(PASSED[t]);
+            cpu_batch batch(3);
+            std::vector<std::string> outputs(batch.size());
+
+            for (usize i = 0; i < batch.size(); ++i) {
+                batch.lane(i).load(programv.begin(), programv.end(), 0x100, true);
+                batch.lane(i).set_pseudo_bdos_redirect(outputs[i]);
+            }
+
+            batch.do_pseudo_bdos(true);
+            batch.run();
+
+            for (usize i = 0; i < batch.size(); ++i) {
+                batch.lane(i).reset_pseudo_bdos_redirect();
+                REQUIRE(batch.lane(i).is_halted());
+                REQUIRE(std::string(okv.begin(), okv.end()) == outputs[i]);
+            }
+
+            REQUIRE(batch.get_vector_lane_steps() > 0);
+        }
+}
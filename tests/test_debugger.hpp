@@ -0,0 +1,99 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "debugger.hpp"
+
+// MVI A, 0; loop: INR A; STA 0x0200; OUT 0x10; CPI 0x05; JNZ loop; HLT
+constexpr static std::array<u8, 14> DEBUGGER_PRG = {
+    0x3E, 0x00, 0x3C, 0x32, 0x00, 0x02, 0xD3, 0x10, 0xFE, 0x05, 0xC2, 0x02, 0x00, 0x76
+};
+
+/// @brief Run like the emulator does, until halted or stopped by the debugger.
+static debug_event debugger_run(cpu<bus&>& processor, debugger& dbg) {
+    dbg.resume(processor.get_pc());
+
+    while (!processor.is_halted()) {
+        const u16 pc = processor.get_pc();
+        if (dbg.check(pc) and dbg.confirm(pc, processor.save_state()))
+            return dbg.event();
+
+        processor.step();
+    }
+
+    return { debug_event_kind::HALTED, processor.get_pc(), 0, 0 };
+}
+
+TEST_CASE("Breakpoints and watchpoints", "[debugger]") {
+    bus cardbus;
+    ram_card ram(0x0000, 1024);
+    cardbus.insert(&ram, 0);
+
+    cpu<bus&> processor(cardbus);
+    processor.load(DEBUGGER_PRG.begin(), DEBUGGER_PRG.end());
+
+    debugger dbg(&cardbus);
+
+    SECTION("Without breakpoints the program runs to the end.") {
+        REQUIRE(debugger_run(processor, dbg).kind == debug_event_kind::HALTED);
+        REQUIRE(processor.save_state().A() == 0x05);
+    }
+
+    SECTION("A breakpoint stops before the instruction, and is stepped over on resume.") {
+        dbg.add_breakpoint(0x0008);
+        REQUIRE(dbg.has_breakpoint(0x0008));
+
+        for (u8 i = 1; i <= 5; ++i) {
+            debug_event ev = debugger_run(processor, dbg);
+            REQUIRE(ev.kind == debug_event_kind::BREAKPOINT);
+            REQUIRE(ev.pc == 0x0008);
+            REQUIRE(processor.save_state().A() == i);
+        }
+
+        dbg.remove_breakpoint(0x0008);
+        REQUIRE(!dbg.has_breakpoint(0x0008));
+        REQUIRE(debugger_run(processor, dbg).kind == debug_event_kind::HALTED);
+    }
+
+    SECTION("A conditional breakpoint only stops when the condition holds.") {
+        dbg.add_breakpoint(0x0002, debug_condition(cpu_registers8::A, debug_compare::EQ, 3));
+
+        REQUIRE(debugger_run(processor, dbg).kind == debug_event_kind::BREAKPOINT);
+        REQUIRE(processor.save_state().A() == 0x03);
+        REQUIRE(debugger_run(processor, dbg).kind == debug_event_kind::HALTED);
+    }
+
+    SECTION("A write watchpoint stops after the writing instruction.") {
+        dbg.add_watchpoint(0x01FF, 2, static_cast<u8>(bus_access::WRITE));
+
+        debug_event ev = debugger_run(processor, dbg);
+        REQUIRE(ev.kind == debug_event_kind::WATCH_WRITE);
+        REQUIRE(ev.adr == 0x0200);
+        REQUIRE(ev.byte == 0x01);
+        REQUIRE(ev.pc == 0x0006);
+
+        dbg.remove_watchpoint(0x01FF, 2, static_cast<u8>(bus_access::WRITE));
+        REQUIRE(debugger_run(processor, dbg).kind == debug_event_kind::HALTED);
+    }
+
+    SECTION("A port watchpoint catches OUT, but not a read watchpoint on the same address.") {
+        dbg.add_port_watchpoint(0x10, static_cast<u8>(bus_access::WRITE));
+        dbg.add_watchpoint(0x1010, 1, static_cast<u8>(bus_access::READ));
+
+        debug_event ev = debugger_run(processor, dbg);
+        REQUIRE(ev.kind == debug_event_kind::PORT_WRITE);
+        REQUIRE(ev.adr == 0x10);
+        REQUIRE(ev.pc == 0x0008);
+    }
+
+    SECTION("Clearing removes everything.") {
+        dbg.add_breakpoint(0x0002);
+        dbg.add_watchpoint(0x0200, 1, static_cast<u8>(bus_access::WRITE));
+        dbg.clear();
+
+        REQUIRE(debugger_run(processor, dbg).kind == debug_event_kind::HALTED);
+    }
+}
@@ -0,0 +1,197 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "typedef.hpp"
+#include "gdb_stub.hpp"
+#include "ux.hpp"
+#include "test_helpers.hpp"
+
+/// @brief A minimal GDB remote protocol client, connected to a stub on a UNIX domain socket.
+struct gdb_client {
+    fd sock;
+
+    explicit gdb_client(const std::string& path) {
+        sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        REQUIRE(sock >= 0);
+
+        // A stub that stopped answering fails the test instead of hanging it.
+        timeval timeout { 2, 0 };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        sockaddr_un adr {};
+        adr.sun_family = AF_UNIX;
+        std::strncpy(adr.sun_path, path.c_str(), sizeof(adr.sun_path) - 1);
+        REQUIRE(connect(sock, reinterpret_cast<sockaddr*>(&adr), sizeof(adr)) == 0);
+    }
+
+    ~gdb_client() { ::close(sock); }
+
+    static std::string frame(const std::string& data) {
+        u8 sum = 0;
+        for (char c : data)
+            sum += static_cast<u8>(c);
+
+        char check[3];
+        std::snprintf(check, sizeof(check), "%02x", sum);
+        return "$" + data + "#" + check;
+    }
+
+    void send_raw(const std::string& data) {
+        REQUIRE(::send(sock, data.data(), data.size(), MSG_NOSIGNAL) == static_cast<isize>(data.size()));
+    }
+
+    char read_char() {
+        char c = 0;
+        REQUIRE(recv(sock, &c, 1, 0) == 1);
+        return c;
+    }
+
+    /// @brief Send a packet and wait for its acknowledgement, the reply is read separately.
+    void send(const std::string& data) {
+        send_raw(frame(data));
+        REQUIRE(read_char() == '+');
+    }
+
+    /// @brief Read a packet, check its checksum and acknowledge it.
+    std::string read_packet() {
+        while (read_char() != '$');
+
+        std::string data;
+        for (char c = read_char(); c != '#'; c = read_char())
+            data += c;
+
+        const std::string check = { read_char(), read_char() };
+        REQUIRE(frame(data).substr(data.size() + 2) == check);
+
+        // The stub may close right after its last packet (exit or detach), the ack then has nowhere to go.
+        ::send(sock, "+", 1, MSG_NOSIGNAL);
+        return data;
+    }
+
+    std::string command(const std::string& data) {
+        send(data);
+        return read_packet();
+    }
+};
+
+TEST_CASE("GDB remote stub", "[gdb]") {
+    // 0100: LXI SP, 0800h; MVI A, 42h; STA 0200h; XRA A; STA 0300h; loop: LDA 0300h; ORA A; JZ loop; HLT
+    const temp_file program(
+        std::string("\x31\x00\x08\x3E\x42\x32\x00\x02\xAF\x32\x00\x03\x3A\x00\x03\xB7\xCA\x0C\x01\x76", 20)
+    );
+    const std::string socket_path = "/tmp/buddy_gdb_" + std::to_string(getpid());
+    const temp_file config(
+        "[emulator]\naot_enabled = false\ngdb_listen = \"" + socket_path + "\"\n"
+        "[[card]]\nslot = 0\ntype = \"ram\"\nat = 0x0000\nrange = 0x1000\n"
+    );
+
+    char rom_at[] = "0x0100", name[] = "buddy";
+    char* argv[] = { name, const_cast<char*>(program.path), rom_at };
+
+    emulator emu(config.path);
+    emu.setup(3, argv);
+
+    // The machine runs on its own thread, like it would while GDB attaches to it.
+    debug_event stop { debug_event_kind::NONE, 0, 0, 0 };
+    std::thread machine([&] { stop = emu.run(); });
+    const alarm_guard guard(10);
+
+    struct joiner {
+        std::thread& thread;
+        ~joiner() {
+            if (thread.joinable())
+                thread.join();
+        }
+    } machine_joiner { machine };
+
+    {
+        gdb_client gdb(socket_path);
+
+        // Whatever a failure left running, setting the exit flag and detaching lets the machine halt.
+        struct release {
+            gdb_client& gdb;
+            ~release() {
+                if (std::uncaught_exceptions() == 0)
+                    return;
+                ::send(gdb.sock, "\x03", 1, MSG_NOSIGNAL);
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                const std::string bye = gdb_client::frame("M300,1:01") + gdb_client::frame("D");
+                ::send(gdb.sock, bye.data(), bye.size(), MSG_NOSIGNAL);
+            }
+        } releaser { gdb };
+
+        // Attaching stops the machine, in its wait loop.
+        REQUIRE(gdb.command("?") == "T05");
+
+        SECTION("Packets, registers, memory, breakpoints, stepping and interrupting") {
+            // A corrupted packet is refused, and taken once sent again.
+            gdb.send_raw("$g#00");
+            REQUIRE(gdb.read_char() == '-');
+
+            std::string regs = gdb.command("g");
+            REQUIRE(regs.size() == 24);
+            REQUIRE(regs.substr(16, 4) == "0008");
+
+            // BC is the second register, little endian.
+            regs.replace(4, 4, "3412");
+            REQUIRE(gdb.command("G" + regs) == "OK");
+            REQUIRE(gdb.command("g").substr(4, 4) == "3412");
+            REQUIRE(gdb.command("p1") == "3412");
+
+            REQUIRE(gdb.command("m200,1") == "42");
+            REQUIRE(gdb.command("M200,2:abcd") == "OK");
+            REQUIRE(gdb.command("m200,2") == "abcd");
+
+            REQUIRE(gdb.command("Z0,110,1") == "OK");
+            gdb.send("c");
+            REQUIRE(gdb.read_packet() == "T05");
+            REQUIRE(gdb.command("g").substr(20, 4) == "1001");
+
+            // JZ is taken, the flag is still clear.
+            gdb.send("s");
+            REQUIRE(gdb.read_packet() == "T05");
+            REQUIRE(gdb.command("g").substr(20, 4) == "0c01");
+            REQUIRE(gdb.command("z0,110,1") == "OK");
+
+            REQUIRE(gdb.command("Z3,300,1") == "OK");
+            gdb.send("c");
+            REQUIRE(gdb.read_packet() == "T05rwatch:0300;");
+            REQUIRE(gdb.command("z3,300,1") == "OK");
+
+            // Ctrl-C is sent outside of a packet, while the machine runs.
+            gdb.send("c");
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            gdb.send_raw("\x03");
+            REQUIRE(gdb.read_packet() == "T02");
+
+            // Releasing the loop halts the machine, which is reported, then the program exits.
+            REQUIRE(gdb.command("M300,1:01") == "OK");
+            gdb.send("c");
+            REQUIRE(gdb.read_packet() == "T05");
+            REQUIRE(gdb.command("g").substr(20, 4) == "1401");
+            gdb.send("c");
+            REQUIRE(gdb.read_packet() == "W00");
+        }
+
+        SECTION("Detaching removes the breakpoints of the client") {
+            REQUIRE(gdb.command("Z0,113,1") == "OK");
+            REQUIRE(gdb.command("M300,1:01") == "OK");
+            REQUIRE(gdb.command("D") == "OK");
+        }
+    }
+
+    machine.join();
+
+    // Without the breakpoint on HLT, the run ends on the halt.
+    REQUIRE(stop.kind == debug_event_kind::HALTED);
+    REQUIRE(stop.pc == 0x0114);
+}
@@ -0,0 +1,63 @@
+#ifndef TEST_HELPERS_HPP_
+#define TEST_HELPERS_HPP_
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <unistd.h>
+
+#include "typedef.hpp"
+
+/// @brief Kill a hung test with SIGALRM, disarmed on scope exit so that a failed section doesn't kill a later test.
+struct alarm_guard {
+    explicit alarm_guard(unsigned seconds) { alarm(seconds); }
+    ~alarm_guard() { alarm(0); }
+
+    alarm_guard(const alarm_guard&) = delete;
+    alarm_guard& operator=(const alarm_guard&) = delete;
+};
+
+/// @brief A file with a unique name in /tmp, removed on scope exit, so that tests never write to the working directory.
+struct temp_file {
+    char path[32] = "/tmp/buddy_test_XXXXXX";
+
+    /// @brief Create an empty file, for the code under test to write.
+    temp_file() {
+        const fd file = mkstemp(path);
+        REQUIRE(file >= 0);
+        ::close(file);
+    }
+
+    /// @brief Create a file holding some contents, for the code under test to read.
+    explicit temp_file(const std::string& contents) {
+        const fd file = mkstemp(path);
+        REQUIRE(file >= 0);
+        REQUIRE(write(file, contents.data(), contents.size()) == static_cast<isize>(contents.size()));
+        ::close(file);
+    }
+
+    ~temp_file() { std::remove(path); }
+
+    temp_file(const temp_file&) = delete;
+    temp_file& operator=(const temp_file&) = delete;
+};
+
+/// @brief A directory with a unique name in /tmp, removed along with its contents on scope exit.
+struct temp_dir {
+    char path[32] = "/tmp/buddy_test_XXXXXX";
+
+    temp_dir() { REQUIRE(mkdtemp(path) != nullptr); }
+
+    ~temp_dir() {
+        std::error_code error;
+        std::filesystem::remove_all(path, error);
+    }
+
+    temp_dir(const temp_dir&) = delete;
+    temp_dir& operator=(const temp_dir&) = delete;
+};
+
+#endif
@@ -0,0 +1,267 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <filesystem>
+#include <cstdio>
+#include <pthread.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "card.hpp"
+#include "io_ring.hpp"
+#include "trace_ring.hpp"
+#include "ux.hpp"
+#include "test_helpers.hpp"
+
+/// @brief Open the slave side of the pseudo-terminal of a serial card, named in its identify detail.
+inline fd open_serial_slave(serial_card& serial) {
+    const std::string detail = serial.identify().detail;
+    const usize from = detail.find("pty: '") + 6;
+    return open(detail.substr(from, detail.find('\'', from) - from).c_str(), O_RDWR | O_NOCTTY);
+}
+
+TEST_CASE("HLT waiting for an interrupt", "[idle]") {
+    bus cardbus;
+    ram_card ram(0x0000, 0x1000, 0x00);
+    cardbus.insert(&ram, 0);
+
+    // 0000: LXI SP, 0800h; MVI A, 95h; OUT 10h; EI; HLT; IN 11h; HLT, and at RST 7: IN 11h; STA 0100h; EI; RET.
+    const std::vector<u8> program = { 0x31, 0x00, 0x08, 0x3E, 0x95, 0xD3, 0x10, 0xFB, 0x76, 0xDB, 0x11, 0x76 };
+    const std::vector<u8> handler = { 0xDB, 0x11, 0x32, 0x00, 0x01, 0xFB, 0xC9 };
+
+    SECTION("An interrupt ends the halt, and returns past the HLT") {
+        vi_card vi(0xFE);
+        cardbus.insert(&vi, 1);
+
+        cpu<bus&> emu(cardbus);
+        emu.load(program.begin(), program.end());
+        emu.load(handler.begin(), handler.end(), 0x0038);
+
+        while (!emu.is_halted())
+            emu.step();
+
+        REQUIRE(emu.get_pc() == 0x0009);
+        REQUIRE(emu.is_interrupt_enabled());
+
+        // Halted, stepping does nothing until the interrupt comes.
+        emu.step(100);
+        REQUIRE(emu.get_pc() == 0x0009);
+
+        vi.request(0);
+        emu.interrupt(cardbus.get_irq());
+        REQUIRE(!emu.is_halted());
+        REQUIRE(emu.get_pc() == 0x0038);
+
+        for (usize i = 0; i < 4; ++i)
+            emu.step();
+        REQUIRE(emu.get_pc() == 0x0009);
+    }
+
+    SECTION("Nothing to wait for") {
+        vi_card vi(0xFE);
+        cardbus.insert(&vi, 1);
+
+        REQUIRE(!cardbus.wait_events());
+        REQUIRE(cardbus.wait_events({}, 0));
+        REQUIRE(!cardbus.is_irq());
+    }
+
+    for (bool with_ring : { false, true }) {
+        if (with_ring and !io_ring::is_supported())
+            continue;
+
+        SECTION(std::string("Serial input wakes the machine up and interrupts it") + (with_ring ? ", through an I/O ring" : "")) {
+            std::unique_ptr<io_ring> ring = with_ring ? std::make_unique<io_ring>() : nullptr;
+            serial_card serial(0x10, SERIAL_BASE_CLOCK, ring.get());
+            cardbus.insert(&serial, 1);
+
+            const fd slave_fd = open_serial_slave(serial);
+            REQUIRE(slave_fd >= 0);
+            const alarm_guard guard(3);
+
+            cpu<bus&> emu(cardbus);
+            emu.load(program.begin(), program.end());
+            emu.load(handler.begin(), handler.end(), 0x0038);
+
+            // Receive interrupts are off until the program enables them.
+            REQUIRE(serial.get_event_fd() == -1);
+
+            while (!emu.is_halted())
+                emu.step();
+
+            cardbus.poll_events();
+            REQUIRE(!cardbus.is_irq());
+            REQUIRE(serial.get_event_fd() != -1);
+            REQUIRE(cardbus.wait_events({}, 0));
+            REQUIRE(!cardbus.is_irq());
+
+            REQUIRE(write(slave_fd, "K", 1) == 1);
+
+            while (!cardbus.is_irq())
+                REQUIRE(cardbus.wait_events());
+
+            emu.interrupt(cardbus.get_irq());
+            REQUIRE(emu.get_pc() == 0x0038);
+
+            // Reading the data frees the register and drops the IRQ.
+            for (usize i = 0; i < 4; ++i)
+                emu.step();
+            REQUIRE(!cardbus.is_irq());
+            REQUIRE(cardbus.peek(0x0100) == 'K');
+            REQUIRE(emu.get_pc() == 0x0009);
+
+            while (!emu.is_halted())
+                emu.step();
+            REQUIRE(emu.get_pc() == 0x000C);
+
+            ::close(slave_fd);
+        }
+    }
+}
+
+TEST_CASE("Emulator idling on HLT", "[idle]") {
+    // 0100: LXI SP, 0800h; MVI A, 95h; OUT 10h; EI; HLT; DI; HLT, and at RST 7: IN 11h; OUT 11h; RET.
+    const temp_file program(std::string("\x31\x00\x08\x3E\x95\xD3\x10\xFB\x76\xF3\x76", 11));
+    const temp_file handler(std::string("\xDB\x11\xD3\x11\xC9", 5));
+
+    auto make_config = [](bool idle) {
+        return "[emulator]\naot_enabled = false\nidle_on_halt = " + std::string(idle ? "true" : "false") + "\n"
+            "[[card]]\nslot = 0\ntype = \"ram\"\nat = 0x0000\nrange = 0x1000\n"
+            "[[card]]\nslot = 1\ntype = \"serial\"\nat = 0x10\n";
+    };
+
+    char rom_at[] = "0x0100", handler_at[] = "0x0038", name[] = "buddy";
+    char* argv[] = { name, const_cast<char*>(program.path), rom_at, const_cast<char*>(handler.path), handler_at };
+
+    SECTION("Without idle_on_halt, the halt ends the run") {
+        const temp_file config(make_config(false));
+        emulator emu(config.path);
+        emu.setup(5, argv);
+
+        REQUIRE(emu.run().pc == 0x0109);
+    }
+
+    SECTION("With idle_on_halt, the run sleeps until serial input interrupts it") {
+        const temp_file config(make_config(true));
+        emulator emu(config.path);
+        emu.setup(5, argv);
+
+        const std::string info = emu.info();
+        const usize from = info.find("pty: '") + 6;
+        const fd slave_fd = open(info.substr(from, info.find('\'', from) - from).c_str(), O_RDWR | O_NOCTTY);
+        REQUIRE(slave_fd >= 0);
+        const alarm_guard guard(3);
+
+        // Typed once the machine sleeps, the handler echoes it and returns to DI; HLT, which ends the run.
+        std::thread typist([slave_fd] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            (void)!write(slave_fd, "K", 1);
+        });
+
+        const debug_event stop = emu.run();
+        typist.join();
+        REQUIRE(stop.kind == debug_event_kind::HALTED);
+        REQUIRE(stop.pc == 0x010B);
+
+        pollfd echo { slave_fd, POLLIN, 0 };
+        REQUIRE(::poll(&echo, 1, 1000) == 1);
+
+        char byte = 0;
+        REQUIRE(read(slave_fd, &byte, 1) == 1);
+        REQUIRE(byte == 'K');
+        ::close(slave_fd);
+    }
+}
+
+TEST_CASE("Emulator trace ring dumps", "[idle][trace]") {
+    // Same program as above, 0100: LXI SP, 0800h; MVI A, 95h; OUT 10h; EI; HLT; DI; HLT, RST 7 echoes the input.
+    const temp_file program(std::string("\x31\x00\x08\x3E\x95\xD3\x10\xFB\x76\xF3\x76", 11));
+    const temp_file handler(std::string("\xDB\x11\xD3\x11\xC9", 5));
+    const temp_file dump;
+    const temp_file copy;
+
+    auto make_config = [&dump](bool idle) {
+        return "[emulator]\naot_enabled = false\ntrace_ring_size = 16\ntrace_dump_to = \"" + std::string(dump.path) + "\"\n"
+            "idle_on_halt = " + std::string(idle ? "true" : "false") + "\n"
+            "[[card]]\nslot = 0\ntype = \"ram\"\nat = 0x0000\nrange = 0x1000\n"
+            "[[card]]\nslot = 1\ntype = \"serial\"\nat = 0x10\n";
+    };
+
+    char rom_at[] = "0x0100", handler_at[] = "0x0038", name[] = "buddy";
+    char* argv[] = { name, const_cast<char*>(program.path), rom_at, const_cast<char*>(handler.path), handler_at };
+    trace_dump_header header;
+
+    SECTION("On halt") {
+        const temp_file config(make_config(false));
+        emulator emu(config.path);
+        emu.setup(5, argv);
+        emu.run();
+
+        // JMP 0100h from the reset vector, then LXI, MVI, OUT, EI and HLT.
+        const std::vector<trace_record> records = trace_ring::read_dump(dump.path, header);
+        REQUIRE(header.total == 6);
+        REQUIRE(records.back().pc == 0x0108);
+    }
+
+    SECTION("On a breakpoint") {
+        const temp_file config(make_config(false));
+        emulator emu(config.path);
+        emu.setup(5, argv);
+        emu.add_breakpoint(0x0105);
+
+        REQUIRE(emu.run().kind == debug_event_kind::BREAKPOINT);
+        const std::vector<trace_record> records = trace_ring::read_dump(dump.path, header);
+        REQUIRE(header.total == 3);
+        REQUIRE(records.back().pc == 0x0103);
+    }
+
+    SECTION("On SIGUSR1, while idling") {
+        const temp_file config(make_config(true));
+        emulator emu(config.path);
+        emu.setup(5, argv);
+
+        const std::string info = emu.info();
+        const usize from = info.find("pty: '") + 6;
+        const fd slave_fd = open(info.substr(from, info.find('\'', from) - from).c_str(), O_RDWR | O_NOCTTY);
+        REQUIRE(slave_fd >= 0);
+        const alarm_guard guard(3);
+
+        // The signal goes to the thread sleeping in poll(), and the dump is copied before the input ends the run.
+        const pthread_t sleeper = pthread_self();
+        const usize dump_size = sizeof(trace_dump_header) + 6 * sizeof(trace_record);
+
+        std::thread requester([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            pthread_kill(sleeper, SIGUSR1);
+
+            while (std::filesystem::file_size(dump.path) != dump_size)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+            std::filesystem::copy_file(dump.path, copy.path, std::filesystem::copy_options::overwrite_existing);
+            (void)!write(slave_fd, "K", 1);
+        });
+
+        const debug_event stop = emu.run();
+        requester.join();
+        REQUIRE(stop.pc == 0x010B);
+
+        std::vector<trace_record> records = trace_ring::read_dump(copy.path, header);
+        REQUIRE(header.total == 6);
+        REQUIRE(records.back().pc == 0x0108);
+
+        // Then RST 7, the handler, DI and HLT, dumped on halt.
+        records = trace_ring::read_dump(dump.path, header);
+        REQUIRE(header.total == 12);
+        REQUIRE(records.back().pc == 0x010A);
+        ::close(slave_fd);
+    }
+}
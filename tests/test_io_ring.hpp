@@ -0,0 +1,189 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "typedef.hpp"
+#include "io_ring.hpp"
+#include "pty.hpp"
+#include "test_helpers.hpp"
+
+struct io_recorder : public io_client {
+    std::vector<std::pair<u8, i32>> results;
+
+    void on_complete(u8 op, i32 result) override { results.push_back({ op, result }); }
+};
+
+TEST_CASE("I/O ring batching", "[io_ring]") {
+    if (!io_ring::is_supported()) {
+        WARN("io_uring is not available on this host, skipping.");
+        return;
+    }
+
+    io_ring ring(8);
+    io_recorder recorder;
+
+    SECTION("File writes and reads at offsets, submitted at once") {
+        const temp_file temp;
+        const fd file = ::open(temp.path, O_RDWR | O_CLOEXEC);
+        REQUIRE(file >= 0);
+
+        std::array<std::array<u8, 64>, 4> blocks;
+        for (usize i = 0; i < blocks.size(); ++i)
+            blocks[i].fill(static_cast<u8>(0xA0 + i));
+
+        // Written out of order on purpose, each lands at its own offset.
+        for (usize i = blocks.size(); i-- > 0;)
+            ring.write(&recorder, i, file, blocks[i].data(), blocks[i].size(), i * blocks[i].size());
+
+        REQUIRE(ring.get_enters() == 0);
+        REQUIRE(ring.get_queued() == blocks.size());
+        REQUIRE(ring.submit() == blocks.size());
+        REQUIRE(ring.get_enters() == 1);
+
+        while (ring.get_in_flight() > 0)
+            ring.wait();
+
+        REQUIRE(recorder.results.size() == blocks.size());
+        for (const auto& [op, result] : recorder.results)
+            REQUIRE(result == static_cast<i32>(blocks[op].size()));
+
+        std::array<u8, 256> back {};
+        recorder.results.clear();
+        ring.read(&recorder, 7, file, back.data(), back.size(), 0);
+        ring.wait();
+
+        REQUIRE(recorder.results.size() == 1);
+        REQUIRE(recorder.results[0].first == 7);
+        REQUIRE(recorder.results[0].second == 256);
+        for (usize i = 0; i < back.size(); ++i)
+            REQUIRE(back[i] == 0xA0 + i / 64);
+
+        ::close(file);
+    }
+
+    SECTION("A full submission queue is submitted to make room") {
+        std::array<char, 1> byte { 'x' };
+        const fd null = open("/dev/null", O_WRONLY);
+        REQUIRE(null >= 0);
+
+        for (usize i = 0; i < 20; ++i)
+            ring.write(&recorder, 0, null, byte.data(), byte.size());
+
+        REQUIRE(ring.get_enters() >= 1);
+        while (ring.get_in_flight() > 0)
+            ring.wait();
+
+        REQUIRE(recorder.results.size() == 20);
+        REQUIRE(ring.get_completed() == 20);
+        ::close(null);
+    }
+
+    SECTION("Invalid operation numbers are refused") {
+        char byte;
+        REQUIRE_THROWS_AS(ring.read(&recorder, io_client::MAX_OPS, 0, &byte, 1), std::invalid_argument);
+        REQUIRE(ring.get_queued() == 0);
+    }
+}
+
+TEST_CASE("Pseudo-terminal served through an I/O ring", "[io_ring][pty]") {
+    if (!io_ring::is_supported()) {
+        WARN("io_uring is not available on this host, skipping.");
+        return;
+    }
+
+    // Declared first, so that the PTY interface detaches before the ring goes away.
+    io_ring ring;
+    pty pty_instance;
+    char buffer[256];
+
+    pty_instance.open();
+    pty_instance.attach(ring);
+    REQUIRE(pty_instance.is_attached());
+
+    fd slave_fd = open(pty_instance.name(), O_RDWR | O_NOCTTY);
+    REQUIRE(slave_fd >= 0);
+
+    alarm(3);
+
+    SECTION("Polling with no input costs no system call once a read is in flight") {
+        REQUIRE(!pty_instance.poll());
+        const u64 enters = ring.get_enters();
+
+        for (usize i = 0; i < 10000; ++i)
+            REQUIRE(!pty_instance.poll());
+
+        REQUIRE(ring.get_enters() == enters);
+    }
+
+    SECTION("Input is buffered, and read back in order") {
+        const std::string message = "HELLO, ALTAIR\r";
+        REQUIRE(write(slave_fd, message.data(), message.size()) == static_cast<isize>(message.size()));
+
+        while (!pty_instance.poll());
+        const u64 enters = ring.get_enters();
+
+        pty_instance.recv(buffer, sizeof(buffer));
+        REQUIRE(message == buffer);
+        REQUIRE(ring.get_enters() == enters);
+
+        for (char c = 1; c > 0; ++c) {
+            REQUIRE(write(slave_fd, &c, 1) == 1);
+            REQUIRE(pty_instance.getch() == c);
+        }
+    }
+
+    SECTION("Output is gathered into one write per submission") {
+        REQUIRE(!pty_instance.poll());
+        const u64 enters = ring.get_enters();
+
+        for (usize i = 0; i < 200; ++i)
+            pty_instance.putch('A' + i % 26);
+
+        // Nothing reached the slave side yet, queueing is not a system call.
+        REQUIRE(ring.get_enters() == enters);
+        REQUIRE(ring.submit() == 1);
+
+        usize total = 0;
+        while (total < 200) {
+            const isize got = read(slave_fd, buffer, sizeof(buffer));
+            REQUIRE(got > 0);
+
+            for (isize i = 0; i < got; ++i, ++total)
+                REQUIRE(buffer[i] == static_cast<char>('A' + total % 26));
+        }
+    }
+
+    SECTION("Queued output is written when detaching") {
+        pty_instance.send("BYE");
+        pty_instance.detach();
+        REQUIRE(!pty_instance.is_attached());
+        REQUIRE(ring.get_in_flight() == 0);
+
+        REQUIRE(read(slave_fd, buffer, 3) == 3);
+        REQUIRE(std::string(buffer, 3) == "BYE");
+
+        // Back on system calls.
+        pty_instance.putch('!');
+        REQUIRE(read(slave_fd, buffer, 1) == 1);
+        REQUIRE(buffer[0] == '!');
+    }
+
+    SECTION("A hung up slave side fails the next read, like the system call would") {
+        ::close(slave_fd);
+        slave_fd = -1;
+
+        while (!pty_instance.poll())
+            ring.wait();
+
+        REQUIRE_THROWS_AS(pty_instance.getch(), std::runtime_error);
+    }
+
+    if (slave_fd >= 0)
+        ::close(slave_fd);
+    alarm(0);
+}
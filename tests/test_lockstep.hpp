@@ -0,0 +1,104 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "lockstep.hpp"
+
+// MVI A, 0; loop: INR A; STA 0x0200; CPI 0x80; JNZ loop; HLT
+constexpr static std::array<u8, 12> LOCKSTEP_PRG = {
+    0x3E, 0x00, 0x3C, 0x32, 0x00, 0x02, 0xFE, 0x80, 0xC2, 0x02, 0x00, 0x76
+};
+
+using lockstep_cpu_t = cpu<std::array<u8, 65536>>;
+
+TEST_CASE("Lockstep differential execution", "[lockstep]") {
+    lockstep_cpu_t reference({0});
+    lockstep_cpu_t candidate({0});
+
+    reference.load(LOCKSTEP_PRG.begin(), LOCKSTEP_PRG.end());
+    candidate.load(LOCKSTEP_PRG.begin(), LOCKSTEP_PRG.end());
+
+    SECTION("Identical engines run to the end without diverging.") {
+        lockstep<lockstep_cpu_t, lockstep_cpu_t> ls(reference, candidate);
+
+        REQUIRE(ls.run());
+        REQUIRE(!ls.diverged());
+        REQUIRE(reference.is_halted());
+        REQUIRE(candidate.is_halted());
+        REQUIRE(reference.get_adr_space()[0x0200] == 0x80);
+    }
+
+    SECTION("A register mismatch is reported on the instruction that caused it.") {
+        lockstep<lockstep_cpu_t, lockstep_cpu_t> ls(reference, candidate);
+
+        REQUIRE(ls.step(10));
+
+        cpu_state bad = candidate.save_state();
+        bad.B(0x42);
+        candidate.load_state(bad);
+
+        REQUIRE(!ls.step());
+        REQUIRE(ls.diverged());
+        REQUIRE(!ls.divergence().in_memory);
+        REQUIRE(ls.divergence().step == 11);
+        REQUIRE(ls.divergence().candidate.B() == 0x42);
+        REQUIRE(ls.divergence().reference.B() == 0x00);
+        REQUIRE(!ls.step());
+    }
+
+    SECTION("A memory mismatch is caught by the digest.") {
+        lockstep<lockstep_cpu_t, lockstep_cpu_t> ls(reference, candidate, 1, 8);
+
+        candidate.get_adr_space()[0x8000] = 0x99;
+
+        REQUIRE(!ls.run());
+        REQUIRE(ls.divergence().in_memory);
+        REQUIRE(ls.divergence().step == 8);
+        REQUIRE(ls.divergence().reference_digest != ls.divergence().candidate_digest);
+        REQUIRE(!ls.divergence().report().empty());
+    }
+
+    SECTION("Memory is compared on its own interval, even off the register interval.") {
+        lockstep<lockstep_cpu_t, lockstep_cpu_t> ls(reference, candidate, 3, 2);
+
+        candidate.get_adr_space()[0x8000] = 0x99;
+
+        REQUIRE(!ls.run());
+        REQUIRE(ls.divergence().in_memory);
+        REQUIRE(ls.divergence().step == 2);
+        REQUIRE(ls.divergence().reference_digest != ls.divergence().candidate_digest);
+    }
+
+    SECTION("Bus-backed and flat array engines agree.") {
+        bus cardbus;
+        ram_card ram(0x0000, 65536);
+        cardbus.insert(&ram, 0);
+        cpu<bus&> bus_candidate(cardbus);
+
+        // Match the flat array fill, since untouched bus RAM reads back BAD_U8.
+        for (usize i = 0; i < 65536; ++i)
+            cardbus.write(i, 0x00);
+
+        bus_candidate.load(LOCKSTEP_PRG.begin(), LOCKSTEP_PRG.end());
+
+        // The program never touches page 0x80, only the digest could read it.
+        struct read_counter : bus_tap {
+            usize reads = 0;
+            u8 page_interest(u8 page, bool io) const override {
+                return (page == 0x80 and !io) ? static_cast<u8>(bus_access::READ) : 0;
+            }
+            void on_access(u16, u8, bool, bus_access) override { ++reads; }
+        } counter;
+        cardbus.attach_tap(&counter);
+
+        lockstep<lockstep_cpu_t, cpu<bus&>> ls(reference, bus_candidate, 1, 64);
+
+        REQUIRE(ls.run());
+        REQUIRE(bus_candidate.is_halted());
+        REQUIRE(counter.reads == 0);
+        cardbus.detach_tap(&counter);
+    }
+}
@@ -0,0 +1,83 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+
+#include "typedef.hpp"
+#include "nvram_card.hpp"
+#include "test_helpers.hpp"
+
+TEST_CASE("NVRAM card kept in a shared file", "[nvram]") {
+    const temp_file file;
+    const char* path = file.path;
+
+    SECTION("Contents survive the card, and the file takes the card size") {
+        {
+            nvram_card nvram(0xE000, path, 0x2000, 0);
+            REQUIRE(nvram.in_range(0xE000));
+            REQUIRE(nvram.in_range(0xFFFF));
+            REQUIRE(!nvram.in_range(0xDFFF));
+
+            for (u16 adr = 0xE000; adr != 0; ++adr)
+                nvram.write(adr, static_cast<u8>(adr * 7));
+        }
+
+        nvram_card nvram(0xE000, path);
+        REQUIRE(nvram.identify().adr_range == 0x2000);
+        for (u16 adr = 0xE000; adr != 0; ++adr)
+            REQUIRE(nvram.read(adr) == static_cast<u8>(adr * 7));
+    }
+
+    SECTION("Only dirty pages are written back, each once") {
+        nvram_card nvram(0x1000, path, 0x4000, 0);
+        REQUIRE(nvram.get_dirty_pages() == 0);
+        REQUIRE(nvram.flush() == 0);
+
+        nvram.write(0x1000, 0x11);
+        nvram.write(0x1001, 0x22);
+        REQUIRE(nvram.get_dirty_pages() == 1);
+
+        REQUIRE(nvram.flush() == 1);
+        REQUIRE(nvram.get_syncs() == 1);
+        REQUIRE(nvram.get_dirty_pages() == 0);
+        REQUIRE(nvram.flush() == 0);
+        REQUIRE(nvram.get_syncs() == 1);
+
+        nvram.write_force(0x4FFF, 0x33);
+        REQUIRE(nvram.flush() >= 1);
+    }
+
+    SECTION("The write-back thread flushes on its own") {
+        nvram_card nvram(0x0000, path, 0x100, 5);
+        nvram.write(0x0080, 0xAB);
+
+        for (usize tries = 0; tries < 200 and nvram.get_syncs() == 0; ++tries)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        REQUIRE(nvram.get_syncs() == 1);
+        REQUIRE(nvram.get_dirty_pages() == 0);
+    }
+
+    SECTION("Reset keeps the contents, the write lock holds") {
+        nvram_card nvram(0x0000, path, 0x100, 0);
+        nvram.write(0x0010, 0x5A);
+        nvram.clear();
+        REQUIRE(nvram.read(0x0010) == 0x5A);
+
+        nvram.w_lock();
+        nvram.write(0x0010, 0x00);
+        REQUIRE(nvram.read(0x0010) == 0x5A);
+    }
+
+    SECTION("An empty file needs a range") {
+        REQUIRE_THROWS_AS(nvram_card(0x0000, path), std::runtime_error);
+    }
+
+    SECTION("The card must fit in the address space") {
+        REQUIRE_THROWS_AS(nvram_card(0xF000, path, 0x2000, 0), std::out_of_range);
+    }
+}
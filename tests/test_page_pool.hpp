@@ -0,0 +1,56 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vector>
+
+#include "typedef.hpp"
+#include "page_pool.hpp"
+
+TEST_CASE("RAM pages shared through a pool", "[page_pool]") {
+    page_pool pool;
+    std::vector<u8> image(1024);
+    for (usize i = 0; i < image.size(); ++i)
+        image[i] = i / POOL_PAGE_SIZE;
+
+    {
+        paged_ram_card first(0x0000, 4096, pool, image, 0x00);
+        paged_ram_card second(0x0000, 4096, pool, image, 0x00);
+
+        // Four distinct image pages, then the zero fill (same as the image's first page).
+        REQUIRE(pool.get_page_count() == 4);
+        REQUIRE(pool.get_ref_count() == 32);
+        REQUIRE(first.get_private_pages() == 0);
+
+        first.write(0x0101, 0xAA);
+        REQUIRE(first.read(0x0101) == 0xAA);
+        REQUIRE(second.read(0x0101) == 0x01);
+        REQUIRE(first.read(0x0100) == 0x01);
+        REQUIRE(first.get_private_pages() == 1);
+        REQUIRE(second.get_private_pages() == 0);
+
+        second.write(0x0200, 0x02);
+        REQUIRE(second.get_private_pages() == 0);
+
+        SECTION("Pages are only shared again once they stop changing") {
+            first.write(0x0101, 0x01);
+            REQUIRE(first.dedup() == 0);
+            REQUIRE(first.get_private_pages() == 1);
+            REQUIRE(first.dedup() == 1);
+            REQUIRE(first.get_private_pages() == 0);
+            REQUIRE(pool.get_page_count() == 4);
+        }
+
+        SECTION("Distinct pages are pooled too") {
+            first.dedup();
+            first.dedup();
+            REQUIRE(first.get_private_pages() == 0);
+            REQUIRE(pool.get_page_count() == 5);
+            REQUIRE(first.read(0x0101) == 0xAA);
+
+            first.clear();
+            REQUIRE(first.read(0x0101) == BAD_U8);
+        }
+    }
+
+    REQUIRE(pool.get_page_count() == 0);
+    REQUIRE(pool.get_ref_count() == 0);
+}
@@ -0,0 +1,67 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vector>
+#include <stdexcept>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "card.hpp"
+#include "port_bus.hpp"
+
+/// @brief An I/O card on ports 0x20 and 0x21 that echoes back what was last written, plus one.
+class echo_card : public card {
+public:
+    std::vector<u8> written;
+    u8 last = 0x00;
+
+    bool in_range(u16 adr) const override { return (adr & 0xFF) == 0x20 or (adr & 0xFF) == 0x21; }
+    card_identify identify() override { return { 0x20, 2, "echo" }; }
+    u8 read(u16) override { return last + 1; }
+    void write(u16, u8 byte) override { written.push_back(byte); last = byte; }
+    void write_force(u16 adr, u8 byte) override { write(adr, byte); }
+    bool is_io() const override { return true; }
+    std::array<u8, 3> get_irq() override { raise_irq(false); return { 0xFF, 0x00, 0x00 }; }
+    void clear() override { written.clear(); }
+};
+
+TEST_CASE("Flat memory CPU with a port table", "[port_bus]") {
+    port_bus ports;
+    echo_card echo;
+    ports.attach(&echo);
+
+    REQUIRE_THROWS_AS(ports.attach(&echo), std::invalid_argument);
+
+    cpu<port_bus&> emu(ports);
+
+    SECTION("IN and OUT reach the attached card") {
+        // MVI A, 41h; OUT 20h; IN 21h; OUT 20h; IN 30h; HLT
+        const std::vector<u8> program = { 0x3E, 0x41, 0xD3, 0x20, 0xDB, 0x21, 0xD3, 0x20, 0xDB, 0x30, 0x76 };
+        emu.load(program.begin(), program.end());
+
+        while (!emu.is_halted())
+            emu.step();
+
+        REQUIRE(echo.written == std::vector<u8> { 0x41, 0x42 });
+        REQUIRE(emu.save_state().A() == BAD_U8);
+    }
+
+    SECTION("Out of place instructions and interrupts") {
+        emu.set_pc(0x1000);
+        emu.execute(0xC3, 0x34, 0x12);
+        REQUIRE(emu.get_pc() == 0x1234);
+
+        ports[0x1234] = 0x00;
+        emu.step();
+        REQUIRE(emu.get_pc() == 0x1235);
+
+        echo.raise_irq(true);
+        REQUIRE(ports.is_irq());
+        emu.interrupt(ports.get_irq());
+        REQUIRE(emu.get_pc() == 0x0038);
+        REQUIRE(!ports.is_irq());
+        REQUIRE(!emu.is_interrupt_enabled());
+    }
+
+    ports.detach(&echo);
+    REQUIRE(ports.read_port(0x20) == BAD_U8);
+}
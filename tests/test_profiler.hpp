@@ -0,0 +1,60 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <sstream>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "guest_profiler.hpp"
+
+// LXI SP, 0x0400; loop: CALL outer; JMP loop; outer: CALL inner; RET; inner: NOP; NOP; RET
+constexpr static std::array<u8, 16> PROFILER_PRG = {
+    0x31, 0x00, 0x04, 0xCD, 0x09, 0x00, 0xC3, 0x03, 0x00, 0xCD, 0x0D, 0x00, 0xC9, 0x00, 0x00, 0xC9
+};
+
+TEST_CASE("Guest sampling profiler", "[profiler]") {
+    cpu<std::array<u8, 65536>> processor({0});
+    processor.load(PROFILER_PRG.begin(), PROFILER_PRG.end());
+
+    SECTION("Cycle counts follow the 8080 timings.") {
+        REQUIRE(util::get_opcode_cycles(0x00) == 4);
+        REQUIRE(util::get_opcode_cycles(0x7E) == 7);
+        REQUIRE(util::get_opcode_cycles(0x36) == 10);
+        REQUIRE(util::get_opcode_cycles(0x2A) == 16);
+        REQUIRE(util::get_opcode_cycles(0xCD) == 17);
+        REQUIRE(util::get_opcode_cycles(0xC5) == 11);
+        REQUIRE(util::get_opcode_cycles(0xE3) == 18);
+        REQUIRE(util::get_opcode_cycles(0xFF) == 11);
+    }
+
+    SECTION("The shadow stack follows calls and returns, and samples are collapsed by symbol.") {
+        guest_profiler prof(1);
+        prof.add_symbol(0x0000, "start");
+        prof.add_symbol(0x0009, "outer");
+        prof.add_symbol(0x000D, "inner");
+        processor.set_profiler(&prof);
+
+        processor.step(3);
+        REQUIRE(processor.get_pc() == 0x000D);
+        REQUIRE(prof.get_depth() == 2);
+
+        processor.step(5);
+        REQUIRE(prof.get_depth() == 0);
+        REQUIRE(prof.get_cycles() == 10 + 17 + 17 + 4 + 4 + 10 + 10 + 10);
+        REQUIRE(prof.get_sample_count() == 8);
+
+        std::ostringstream out;
+        prof.write_collapsed(out);
+        REQUIRE(out.str() == "start 3\nstart;outer 2\nstart;outer;inner 3\n");
+
+        REQUIRE(prof.symbolize(0x000E) == "inner");
+    }
+
+    SECTION("Symbols are read from assembler listings.") {
+        guest_profiler prof(1000);
+        REQUIRE(prof.load_symbols("cpudiag.lst") > 0);
+        REQUIRE(prof.symbolize(0x0145) == "MSG");
+        REQUIRE(prof.symbolize(0x0150) == "PCHAR");
+        REQUIRE(prof.symbolize(0x01AB) == "CPU");
+    }
+}
@@ -0,0 +1,61 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <string>
+#include <unistd.h>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "shm_view.hpp"
+
+TEST_CASE("Shared memory machine view", "[shm_view]") {
+    bus cardbus;
+    ram_card ram(0x0000, 1024);
+    cardbus.insert(&ram, 0);
+
+    // MVI A, 0x42; STA 0x0300; HLT
+    constexpr std::array<u8, 6> prg = { 0x3E, 0x42, 0x32, 0x00, 0x03, 0x76 };
+    cpu<bus&> processor(cardbus);
+    processor.load(prg.begin(), prg.end());
+
+    const std::string name = "/buddy8800-test-" + std::to_string(getpid());
+    shm_view view(cardbus, name, 2);
+    shm_view_reader reader(name);
+
+    REQUIRE(reader.read_state().publishes == 1);
+
+    for (usize i = 0; i < 2; ++i) {
+        processor.step();
+        if (view.tick())
+            view.publish(processor.save_state(), processor.is_halted() ? static_cast<u8>(shm_view_status::HALTED) : 0);
+    }
+
+    const shm_view_state s = reader.read_state();
+    REQUIRE(s.publishes == 2);
+    REQUIRE(s.steps == 2);
+    REQUIRE(s.pc == 0x0005);
+    REQUIRE(s.address == 0x0005);
+    REQUIRE(s.data == 0x76);
+    REQUIRE((s.af >> 8) == 0x42);
+    REQUIRE(!(s.status & static_cast<u8>(shm_view_status::HALTED)));
+
+    u8 byte = 0;
+    reader.read_memory(0x0300, 1, &byte);
+    REQUIRE(byte == 0x42);
+
+    SECTION("Forced writes made after the view exists are published") {
+        // JMP 0x0000, loaded like a ROM from the command line, and patched like GDB does.
+        constexpr std::array<u8, 3> rom = { 0xC3, 0x00, 0x00 };
+        processor.load(rom.begin(), rom.end(), 0x0200);
+        cardbus.write_force(0x0380, 0x99);
+        view.publish(processor.save_state(), 0);
+
+        std::array<u8, 3> back {};
+        reader.read_memory(0x0200, back.size(), back.data());
+        REQUIRE(back == rom);
+
+        reader.read_memory(0x0380, 1, &byte);
+        REQUIRE(byte == 0x99);
+    }
+}
@@ -0,0 +1,283 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "snapshot.hpp"
+#include "snapshot_chain.hpp"
+#include "daemon.hpp"
+#include "test_helpers.hpp"
+
+// MVI A, 0x42; STA 0x0300; HLT
+static constexpr std::array<u8, 6> SNAPSHOT_PRG = { 0x3E, 0x42, 0x32, 0x00, 0x03, 0x76 };
+
+TEST_CASE("Machine snapshot round trip", "[snapshot]") {
+    bus cardbus;
+    ram_card ram(0x0000, 1024);
+    rom_card rom(0xF800, 256, 0xAA);
+    cardbus.insert(&ram, 0);
+    cardbus.insert(&rom, 1);
+
+    cpu<bus&> processor(cardbus);
+    processor.load(SNAPSHOT_PRG.begin(), SNAPSHOT_PRG.end());
+    processor.step(2);
+
+    const temp_file file;
+    machine_snapshot::capture(processor, cardbus).save(file.path);
+
+    processor.step();
+    REQUIRE(processor.is_halted());
+    ram.write(0x0300, 0x00);
+    rom.write_force(0xF800, 0x00);
+
+    machine_snapshot::load(file.path).restore(processor, cardbus);
+
+    REQUIRE(!processor.is_halted());
+    REQUIRE(processor.get_pc() == 0x0005);
+    REQUIRE(processor.save_state().A() == 0x42);
+    REQUIRE(cardbus.read(0x0300) == 0x42);
+    REQUIRE(cardbus.read(0xF800) == 0xAA);
+
+    SECTION("Restoring on different cards fails") {
+        bus other;
+        ram_card small(0x0000, 512);
+        other.insert(&small, 0);
+        cpu<bus&> other_processor(other);
+
+        REQUIRE_THROWS_AS(machine_snapshot::capture(processor, cardbus).restore(other_processor, other), std::runtime_error);
+    }
+}
+
+TEST_CASE("Deferred snapshot of a running machine", "[snapshot]") {
+    page_pool pool;
+    bus cardbus;
+    paged_ram_card ram(0x0000, 1000, pool, std::vector<u8>(SNAPSHOT_PRG.begin(), SNAPSHOT_PRG.end()));
+    rom_card rom(0xF800, 256, 0xAA);
+    cardbus.insert(&ram, 0);
+    cardbus.insert(&rom, 1);
+
+    cpu<bus&> processor(cardbus);
+    processor.step();
+    ram.write(0x0300, 0x11);
+
+    {
+        const deferred_snapshot frozen = deferred_snapshot::freeze(processor, cardbus);
+        REQUIRE(ram.get_private_pages() == 0);
+
+        // The machine keeps going after the freeze, its writes don't reach the frozen view.
+        processor.step();
+        REQUIRE(cardbus.read(0x0300) == 0x42);
+        REQUIRE(ram.get_private_pages() == 1);
+
+        const machine_snapshot snap = frozen.resolve();
+        REQUIRE(snap.regions.size() == 2);
+        REQUIRE(snap.regions[0].data.size() == 1000);
+        REQUIRE(snap.regions[0].data[0x0300] == 0x11);
+        REQUIRE(snap.regions[1].data[0] == 0xAA);
+
+        snap.restore(processor, cardbus);
+        REQUIRE(processor.get_pc() == 0x0002);
+        REQUIRE(!processor.is_halted());
+        REQUIRE(cardbus.read(0x0300) == 0x11);
+    }
+
+    REQUIRE(pool.get_ref_count() == ram.get_page_count() - ram.get_private_pages());
+}
+
+TEST_CASE("Snapshot deltas and chains", "[snapshot]") {
+    page_pool pool;
+    bus cardbus;
+    paged_ram_card paged(0x0000, 1024, pool, std::vector<u8>(SNAPSHOT_PRG.begin(), SNAPSHOT_PRG.end()));
+    ram_card ram(0x8000, 1024);
+    cardbus.insert(&paged, 0);
+    cardbus.insert(&ram, 1);
+    cpu<bus&> processor(cardbus);
+
+    SECTION("Deltas hold the changed pages only") {
+        const machine_snapshot parent = machine_snapshot::capture(processor, cardbus);
+        processor.step(2);
+        ram.write(0x8100, 0x99);
+
+        const snapshot_delta delta = snapshot_delta::diff(parent, machine_snapshot::capture(processor, cardbus));
+        REQUIRE(delta.pages.size() == 2);
+        REQUIRE(delta.get_size() == 2 * DELTA_PAGE_SIZE);
+        REQUIRE(delta.state.get_register16(cpu_registers16::PC) == 0x0005);
+
+        machine_snapshot rebuilt = parent;
+        delta.apply(rebuilt);
+        REQUIRE(rebuilt.regions[0].data[0x0300] == 0x42);
+        REQUIRE(rebuilt.regions[1].data[0x0100] == 0x99);
+
+        std::stringstream stream;
+        delta.write(stream);
+        REQUIRE(snapshot_delta::read(stream, "stream").get_size() == delta.get_size());
+    }
+
+    SECTION("Chains rewind to any checkpoint") {
+        const temp_file journal_file;
+        const std::string journal = journal_file.path;
+        snapshot_chain chain(4, journal);
+
+        REQUIRE(chain.checkpoint(processor, cardbus) == 0);
+        REQUIRE(chain.get_last_size() == 2048);
+
+        REQUIRE(chain.checkpoint(processor, cardbus) == 1);
+        REQUIRE(chain.get_last_size() == 0);
+
+        processor.step(2);
+        REQUIRE(chain.checkpoint(processor, cardbus) == 2);
+        REQUIRE(chain.get_last_size() == DELTA_PAGE_SIZE);
+
+        for (usize i = 0; i < 3; ++i) {
+            ram.write(0x8000 + i, i);
+            chain.checkpoint(processor, cardbus);
+        }
+
+        // 5 deltas is more than 4, the chain was compacted down to 2.
+        REQUIRE(chain.get_first() == 3);
+        REQUIRE(chain.get_last() == 5);
+        REQUIRE_THROWS_AS(chain.get(2), std::out_of_range);
+
+        chain.get(3).restore(processor, cardbus);
+        REQUIRE(processor.get_pc() == 0x0005);
+        REQUIRE(cardbus.read(0x0300) == 0x42);
+        REQUIRE(cardbus.read(0x8000) == 0x00);
+        REQUIRE(cardbus.read(0x8001) != 0x01);
+
+        const machine_snapshot recovered = snapshot_chain::recover(journal);
+        REQUIRE(recovered.regions[1].data[0x0002] == 0x02);
+        REQUIRE(recovered.state.get_register16(cpu_registers16::PC) == 0x0005);
+
+        // A delta cut short by a crash is ignored.
+        std::ofstream(journal, std::ios::binary | std::ios::app) << 'D';
+        REQUIRE(snapshot_chain::recover(journal).regions[1].data[0x0002] == 0x02);
+    }
+}
+
+TEST_CASE("Machine daemon commands", "[daemon]") {
+    const temp_file prg(std::string(reinterpret_cast<const char*>(SNAPSHOT_PRG.data()), SNAPSHOT_PRG.size()));
+    const temp_file config_file(
+        "[emulator]\n[[card]]\nslot = 0\ntype = \"ram\"\nat = 0x0000\nrange = 1024\n"
+        "load = \"" + std::string(prg.path) + "\"\n"
+    );
+    const temp_file snap_file;
+    const std::string config = config_file.path, snap = snap_file.path;
+
+    {
+        machine_daemon daemon("", 2);
+
+        REQUIRE(daemon.command("create " + config) == "OK 1");
+        REQUIRE(daemon.command("memory 1").rfind("OK private=0/4 ", 0) == 0);
+        REQUIRE(daemon.command("step 1 2") == "OK 0x0005");
+        REQUIRE(daemon.command("step 1 0xFFFFFFFFFFFF").rfind("ERR", 0) == 0);
+        REQUIRE(daemon.command("step 1 10001").rfind("ERR", 0) == 0);
+        REQUIRE(daemon.command("snapshot 1 " + snap) == "OK");
+        REQUIRE(daemon.command("stats 1") == "OK state=paused steps=2 pc=0x0005");
+
+        REQUIRE(daemon.command("start 1") == "OK");
+        while (daemon.command("stats 1").rfind("OK state=running", 0) == 0)
+            std::this_thread::yield();
+        REQUIRE(daemon.command("stats 1") == "OK state=halted steps=3 pc=0x0006");
+        REQUIRE(daemon.command("start 1").rfind("ERR", 0) == 0);
+
+        REQUIRE(daemon.command("restore 1 " + snap) == "OK");
+        REQUIRE(daemon.command("list") == "OK 1:paused");
+
+        REQUIRE(daemon.command("checkpoint 1") == "OK 0 bytes=1024");
+        REQUIRE(daemon.command("step 1") == "OK 0x0006");
+        REQUIRE(daemon.command("checkpoint 1") == "OK 1 bytes=0");
+        REQUIRE(daemon.command("rewind 1 0") == "OK");
+        REQUIRE(daemon.command("stats 1") == "OK state=paused steps=4 pc=0x0005");
+        REQUIRE(daemon.command("rewind 1 2").rfind("ERR", 0) == 0);
+        REQUIRE(daemon.command("destroy 1") == "OK");
+        REQUIRE(daemon.command("stats 1").rfind("ERR", 0) == 0);
+        REQUIRE(daemon.command("bogus").rfind("ERR", 0) == 0);
+    }
+}
+
+TEST_CASE("Machine daemon socket", "[daemon]") {
+    // The daemon replaces the file with its socket.
+    const temp_file socket_file;
+    const std::string path = socket_file.path;
+    machine_daemon daemon(path, 1);
+    std::thread server([&] { daemon.serve(); });
+
+    // A blocked daemon fails the test instead of hanging it.
+    const auto connect_client = [&] {
+        const fd sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        timeval timeout { 2, 0 };
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        sockaddr_un adr {};
+        adr.sun_family = AF_UNIX;
+        std::strncpy(adr.sun_path, path.c_str(), sizeof(adr.sun_path) - 1);
+        REQUIRE(connect(sock, reinterpret_cast<sockaddr*>(&adr), sizeof(adr)) == 0);
+        return sock;
+    };
+
+    // Whatever a failure left running, a shutdown request ends serving.
+    struct stopper {
+        std::thread& server;
+        const std::string& path;
+        ~stopper() {
+            if (!server.joinable())
+                return;
+
+            const fd sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_un adr {};
+            adr.sun_family = AF_UNIX;
+            std::strncpy(adr.sun_path, path.c_str(), sizeof(adr.sun_path) - 1);
+            if (connect(sock, reinterpret_cast<sockaddr*>(&adr), sizeof(adr)) == 0)
+                ::send(sock, "shutdown\n", 9, MSG_NOSIGNAL);
+            server.join();
+            ::close(sock);
+        }
+    } server_stopper { server, path };
+
+    // A client that never reads its replies is dropped, instead of blocking the daemon once its buffer is full.
+    const fd slow = connect_client();
+    std::string burst;
+    for (usize i = 0; i < 1000; ++i)
+        burst += "list\n";
+
+    isize sent = 0;
+    for (usize tries = 0; tries < 10000 and sent >= 0; ++tries)
+        sent = ::send(slow, burst.data(), burst.size(), MSG_NOSIGNAL);
+
+    REQUIRE(sent < 0);
+    REQUIRE((errno == EPIPE or errno == ECONNRESET));
+    ::close(slow);
+
+    // Other clients are still served.
+    const fd client = connect_client();
+    const auto request = [&](const std::string& line) {
+        REQUIRE(::send(client, line.data(), line.size(), MSG_NOSIGNAL) == static_cast<isize>(line.size()));
+
+        std::string reply;
+        char c = 0;
+        while (recv(client, &c, 1, 0) == 1 and c != '\n')
+            reply += c;
+        return reply;
+    };
+
+    REQUIRE(request("list\n") == "OK");
+    REQUIRE(request("shutdown\n") == "OK");
+    ::close(client);
+
+    server.join();
+    REQUIRE(daemon.is_stopping());
+}
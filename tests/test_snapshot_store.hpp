@@ -0,0 +1,152 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <vector>
+#include <string>
+#include <random>
+#include <fstream>
+#include <filesystem>
+#include <unistd.h>
+
+#include "typedef.hpp"
+#include "lz.hpp"
+#include "snapshot.hpp"
+#include "snapshot_store.hpp"
+#include "daemon.hpp"
+#include "test_helpers.hpp"
+
+static void require_lz_round_trip(const std::vector<u8>& data) {
+    const std::vector<u8> packed = lz::compress(data.data(), data.size());
+    std::vector<u8> unpacked(data.size());
+
+    lz::decompress(packed.data(), packed.size(), unpacked.data(), unpacked.size());
+    REQUIRE(unpacked == data);
+}
+
+TEST_CASE("LZ compression", "[snapshot_store]") {
+    std::mt19937 rng(8080);
+    std::vector<u8> random(5000);
+    for (u8& byte : random)
+        byte = rng();
+
+    SECTION("Round trips") {
+        require_lz_round_trip({});
+
+        const std::vector<u8> empty = lz::compress(nullptr, 0);
+        lz::decompress(empty.data(), empty.size(), nullptr, 0);
+        require_lz_round_trip({ 1, 2, 3 });
+        require_lz_round_trip(random);
+        require_lz_round_trip(std::vector<u8>(4096, 0xFF));
+
+        std::vector<u8> mixed(random.begin(), random.begin() + 300);
+        mixed.resize(3000, 0x00);
+        mixed.insert(mixed.end(), random.begin(), random.begin() + 300);
+        require_lz_round_trip(mixed);
+    }
+
+    SECTION("Runs compress to a few bytes") {
+        const std::vector<u8> zeros(4096, 0);
+        REQUIRE(lz::compress(zeros.data(), zeros.size()).size() < 16);
+    }
+
+    SECTION("Corrupted streams are rejected") {
+        std::vector<u8> packed = lz::compress(random.data(), random.size());
+        std::vector<u8> out(random.size());
+
+        REQUIRE_THROWS_AS(lz::decompress(packed.data(), packed.size(), out.data(), out.size() - 1), std::runtime_error);
+        REQUIRE_THROWS_AS(lz::decompress(packed.data(), packed.size() - 1, out.data(), out.size()), std::runtime_error);
+    }
+}
+
+TEST_CASE("Snapshot store", "[snapshot_store]") {
+    const temp_dir root_dir;
+    const std::filesystem::path root = root_dir.path;
+
+    machine_snapshot snap;
+    snap.state.set_register16(cpu_registers16::PC, 0x1234);
+    snap.state.set_register16(cpu_registers16::SP, 0xC000);
+    snap.halted = false;
+    snap.interrupts_enabled = true;
+    snap.regions.push_back({ 0, 0x0000, std::vector<u8>(32768, 0x00) });
+    snap.regions.push_back({ 3, 0xF800, std::vector<u8>(2048, 0xFF) });
+
+    for (usize i = 0; i < 32768; i += 7)
+        snap.regions[0].data[i] = i >> 5;
+
+    {
+        snapshot_store store(root);
+
+        // 8 pages of RAM, all different, and 1 short page of ROM.
+        REQUIRE(store.put("boot", snap) == 9);
+        REQUIRE(store.put("boot-again", snap) == 0);
+
+        snap.regions[0].data[100] ^= 0xFF;
+        REQUIRE(store.put("changed", snap) == 1);
+        REQUIRE(store.get_page_count() == 10);
+        REQUIRE(store.list() == std::vector<std::string> { "boot", "boot-again", "changed" });
+
+        // Far less than the 3 snapshots written out in full.
+        REQUIRE(store.get_disk_usage() < 3 * (32768 + 2048) / 4);
+
+        const machine_snapshot loaded = store.get("changed");
+        REQUIRE(loaded.state.get_register16(cpu_registers16::PC) == 0x1234);
+        REQUIRE(loaded.state.get_register16(cpu_registers16::SP) == 0xC000);
+        REQUIRE(!loaded.halted);
+        REQUIRE(loaded.interrupts_enabled);
+        REQUIRE(loaded.regions.size() == 2);
+        REQUIRE(loaded.regions[0].data == snap.regions[0].data);
+        REQUIRE(loaded.regions[1].slot == 3);
+        REQUIRE(loaded.regions[1].start == 0xF800);
+        REQUIRE(loaded.regions[1].data == snap.regions[1].data);
+
+        REQUIRE(store.get("boot").regions[0].data[100] != snap.regions[0].data[100]);
+        REQUIRE_THROWS_AS(store.get("missing"), std::runtime_error);
+        REQUIRE_THROWS_AS(store.put("../escape", snap), std::invalid_argument);
+
+        SECTION("Unreferenced pages are collected") {
+            REQUIRE(store.remove("changed"));
+            REQUIRE(store.collect() == 1);
+            REQUIRE(store.get_page_count() == 9);
+            REQUIRE(store.get("boot").regions[0].data.size() == 32768);
+        }
+
+        SECTION("Corrupted pages are detected") {
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(root / "pages"))
+                if (entry.is_regular_file())
+                    std::ofstream(entry.path(), std::ios::binary | std::ios::trunc) << "junk";
+
+            REQUIRE_THROWS_AS(store.get("boot"), std::runtime_error);
+        }
+    }
+}
+
+TEST_CASE("Machine daemon snapshot store", "[daemon]") {
+    // MVI A, 0x42; STA 0x0300; HLT
+    const temp_file prg(std::string("\x3E\x42\x32\x00\x03\x76", 6));
+    const temp_file config_file(
+        "[emulator]\n[[card]]\nslot = 0\ntype = \"ram\"\nat = 0x0000\nrange = 1024\n"
+        "load = \"" + std::string(prg.path) + "\"\n"
+    );
+    const temp_dir root;
+    const std::string config = config_file.path;
+
+    {
+        machine_daemon without("", 1);
+        REQUIRE(without.command("create " + config) == "OK 1");
+        REQUIRE(without.command("store 1 boot").rfind("ERR", 0) == 0);
+    }
+
+    {
+        machine_daemon daemon("", 2, root.path);
+
+        REQUIRE(daemon.command("create " + config) == "OK 1");
+        REQUIRE(daemon.command("create " + config) == "OK 2");
+        REQUIRE(daemon.command("step 1 1") == "OK 0x0002");
+        REQUIRE(daemon.command("store 1 one") == "OK pages_written=1");
+        REQUIRE(daemon.command("store 2 two") == "OK pages_written=0");
+
+        REQUIRE(daemon.command("step 1 2") == "OK 0x0006");
+        REQUIRE(daemon.command("load 1 one") == "OK");
+        REQUIRE(daemon.command("stats 1") == "OK state=paused steps=3 pc=0x0002");
+        REQUIRE(daemon.command("load 1 missing").rfind("ERR", 0) == 0);
+    }
+}
@@ -0,0 +1,71 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <vector>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "trace_ring.hpp"
+#include "test_helpers.hpp"
+
+// LXI H, 0x1234; MVI A, 0x05; loop: DCR A; JNZ loop; HLT
+constexpr static std::array<u8, 10> TRACE_PRG = {
+    0x21, 0x34, 0x12, 0x3E, 0x05, 0x3D, 0xC2, 0x05, 0x00, 0x76
+};
+
+TEST_CASE("Binary execution trace ring buffer", "[trace]") {
+    cpu<std::array<u8, 65536>> emu({0});
+    trace_ring ring(6);
+
+    emu.load(TRACE_PRG.begin(), TRACE_PRG.end());
+
+    SECTION("Capacity is rounded to a power of two and zero is rejected.") {
+        REQUIRE(ring.capacity() == 8);
+        REQUIRE_THROWS_AS(trace_ring(0), std::invalid_argument);
+    }
+
+    SECTION("Nothing is recorded until a ring is set.") {
+        emu.step(2);
+        REQUIRE(ring.size() == 0);
+    }
+
+    SECTION("The ring keeps only the last instructions, oldest first.") {
+        emu.set_trace_ring(&ring);
+        while (!emu.is_halted())
+            emu.step();
+
+        // LXI, MVI, then 5 times DCR and JNZ, then HLT
+        REQUIRE(ring.total() == 13);
+        REQUIRE(ring.size() == 8);
+        REQUIRE(ring.at(7).opcode == 0x76);
+        REQUIRE(ring.at(7).pc == 0x0009);
+        REQUIRE(ring.at(6).opcode == 0xC2);
+        REQUIRE(ring.at(6).op1 == 0x05);
+        REQUIRE(ring.at(6).op2 == 0x00);
+        REQUIRE(ring.at(6).a == 0x00);
+        REQUIRE(ring.at(6).hl == 0x1234);
+        REQUIRE(ring.at(0).opcode == 0xC2);
+        REQUIRE(ring.at(1).opcode == 0x3D);
+        REQUIRE_THROWS_AS(ring.at(8), std::out_of_range);
+    }
+
+    SECTION("A dump reads back the same records.") {
+        emu.set_trace_ring(&ring);
+        emu.step(4);
+        const temp_file dump;
+        ring.dump(dump.path);
+
+        trace_dump_header header;
+        std::vector<trace_record> records = trace_ring::read_dump(dump.path, header);
+
+        REQUIRE(header.total == 4);
+        REQUIRE(records.size() == 4);
+        REQUIRE(records[0].opcode == 0x21);
+        REQUIRE(records[0].op1 == 0x34);
+        REQUIRE(records[0].op2 == 0x12);
+        REQUIRE(records[1].opcode == 0x3E);
+        REQUIRE(records[1].op1 == 0x05);
+        REQUIRE(records[1].hl == 0x1234);
+        REQUIRE(records[3].pc == 0x0006);
+    }
+}
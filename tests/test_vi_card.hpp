@@ -0,0 +1,172 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "typedef.hpp"
+#include "cpu.hpp"
+#include "bus.hpp"
+#include "card.hpp"
+#include "sysconf.hpp"
+#include "test_helpers.hpp"
+
+TEST_CASE("Vectored interrupt controller", "[vi]") {
+    vi_card vi(0xFE);
+
+    SECTION("Priority, masking and current level") {
+        REQUIRE(!vi.is_irq());
+
+        vi.request(5);
+        vi.request(2);
+        REQUIRE(vi.is_irq());
+        REQUIRE(vi.read(0xFE) == 0b00100100);
+
+        // Level 2 first, as RST 5.
+        REQUIRE(vi.get_irq()[0] == 0xEF);
+        REQUIRE(vi.get_current_level() == 2);
+        REQUIRE(vi.read(0xFF) == 2);
+
+        // Level 5 waits for the end of level 2.
+        REQUIRE(!vi.is_irq());
+        vi.request(1);
+        REQUIRE(vi.is_irq());
+        REQUIRE(vi.get_irq()[0] == 0xF7);
+        REQUIRE(vi.get_current_level() == 1);
+
+        vi.write(0xFF, static_cast<u8>(vi_command::END_OF_INTERRUPT));
+        REQUIRE(vi.get_current_level() == 2);
+        REQUIRE(!vi.is_irq());
+        vi.write(0xFF, static_cast<u8>(vi_command::END_OF_INTERRUPT));
+        REQUIRE(vi.is_irq());
+
+        vi.write(0xFE, 0b00100000);
+        REQUIRE(!vi.is_irq());
+        vi.write(0xFE, 0x00);
+        vi.write(0xFF, static_cast<u8>(vi_command::ENABLE));
+        REQUIRE(!vi.is_irq());
+        vi.write(0xFF, static_cast<u8>(vi_command::ENABLE) | 0x01);
+        REQUIRE(vi.get_irq()[0] == 0xD7);
+
+        REQUIRE_THROWS_AS(vi.request(VI_LEVELS), std::out_of_range);
+    }
+
+    SECTION("Delivery pushes PC once") {
+        bus cardbus;
+        ram_card ram(0x0000, 0x1000, 0x00);
+        cardbus.insert(&ram, 0);
+        cardbus.insert(&vi, 1);
+
+        // 0000: LXI SP, 0800h; EI; NOP; NOP; HLT, and the level 0 handler at RST 7: MVI A, 80h; OUT FFh; HLT.
+        const std::vector<u8> program = { 0x31, 0x00, 0x08, 0xFB, 0x00, 0x00, 0x76 };
+        const std::vector<u8> handler = { 0x3E, 0x80, 0xD3, 0xFF, 0x76 };
+        cpu<bus&> emu(cardbus);
+        emu.load(program.begin(), program.end());
+        emu.load(handler.begin(), handler.end(), 0x0038);
+
+        emu.step();
+        emu.step();
+        vi.request(0);
+
+        emu.step();
+        REQUIRE(emu.is_interrupt_enabled());
+        REQUIRE(cardbus.is_irq());
+        emu.interrupt(cardbus.get_irq());
+
+        REQUIRE(emu.get_pc() == 0x0038);
+        REQUIRE(emu.save_state().SP() == 0x07FE);
+        REQUIRE(cardbus.peek(0x07FE) == 0x05);
+        REQUIRE(cardbus.peek(0x07FF) == 0x00);
+        REQUIRE(vi.get_current_level() == 0);
+
+        while (!emu.is_halted())
+            emu.step();
+
+        REQUIRE(vi.get_current_level() == 0xFF);
+    }
+}
+
+TEST_CASE("Cards routed to the vectored interrupt controller", "[vi]") {
+    bus cardbus;
+    vi_card vi(0xFE);
+    serial_card serial(0x10);
+    cardbus.insert(&vi, 1);
+    cardbus.insert(&serial, 2);
+
+    const std::string detail = serial.identify().detail;
+    const usize from = detail.find("pty: '") + 6;
+    const fd slave_fd = open(detail.substr(from, detail.find('\'', from) - from).c_str(), O_RDWR | O_NOCTTY);
+    REQUIRE(slave_fd >= 0);
+
+    SECTION("Serial input interrupts on the level of the card") {
+        serial.route_irq(&vi, 3);
+
+        // Receive interrupts on, then a byte comes in.
+        cardbus.write(0x10, 0x95, true);
+        REQUIRE(write(slave_fd, "Z", 1) == 1);
+
+        for (usize tries = 0; tries < 100 and !cardbus.is_irq(); ++tries)
+            cardbus.wait_events({}, 10);
+
+        REQUIRE(cardbus.is_irq());
+        REQUIRE(!serial.is_irq());
+        REQUIRE(cardbus.read(0xFE, true) == 0b00001000);
+
+        // Level 3 is RST 4.
+        REQUIRE(cardbus.get_irq()[0] == 0xE7);
+        REQUIRE(vi.get_current_level() == 3);
+
+        // Reading the byte drops the line, the level stays in service until the end of interrupt.
+        REQUIRE(cardbus.read(0x11, true) == 'Z');
+        REQUIRE(cardbus.read(0xFE, true) == 0);
+        cardbus.write(0xFF, static_cast<u8>(vi_command::END_OF_INTERRUPT), true);
+        REQUIRE(vi.get_current_level() == 0xFF);
+        REQUIRE(!cardbus.is_irq());
+    }
+
+    SECTION("A raised line moves with the route") {
+        cardbus.write(0x10, 0x95, true);
+        REQUIRE(write(slave_fd, "Z", 1) == 1);
+
+        for (usize tries = 0; tries < 100 and !serial.is_irq(); ++tries)
+            cardbus.wait_events({}, 10);
+
+        REQUIRE(serial.is_irq());
+        serial.route_irq(&vi, 6);
+        REQUIRE(!serial.is_irq());
+        REQUIRE(vi.read(0xFE) == 0b01000000);
+    }
+
+    ::close(slave_fd);
+}
+
+TEST_CASE("Interrupt routes in the config file", "[vi]") {
+    const temp_file config;
+    const std::string path = config.path;
+    const std::string cards = "[[card]]\nslot = 2\ntype = \"serial\"\nat = 0x10\nvi_level = ";
+
+    auto load = [&](const std::string& contents) {
+        std::ofstream(path) << "[emulator]\n" << contents;
+        return std::make_unique<system_config>(path.c_str());
+    };
+
+    SECTION("The serial card interrupts through the controller, listed after it") {
+        std::unique_ptr<system_config> conf = load(cards + "5\n[[card]]\nslot = 1\ntype = \"vi\"\nat = 0xFE\n");
+        card* serial = conf->get_cards_vec()[0];
+        card* vi = conf->get_cards_vec()[1];
+
+        serial->raise_irq(true);
+        REQUIRE(!serial->is_irq());
+        REQUIRE(vi->is_irq());
+        REQUIRE(conf->get_bus().get_irq()[0] == 0xD7);
+    }
+
+    SECTION("Routes need a controller, and a level it has") {
+        REQUIRE_THROWS_AS(load(cards + "5\n"), std::runtime_error);
+        REQUIRE_THROWS_AS(load(cards + "8\n[[card]]\nslot = 1\ntype = \"vi\"\nat = 0xFE\n"), std::runtime_error);
+    }
+}
@@ -0,0 +1,313 @@
+#include <cstdio>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <set>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "util.hpp"
+
+/*
+ * Ahead-of-time recompiler for ROM images, run at build time (see AOT_ROMS in src/CMakeLists.txt).
+ * Usage: aotgen <output.cpp> <rom.bin>@<load address>[:<entry>,<entry>...] ...
+ *
+ * Each ROM is disassembled by recursive descent from its entry points (the load address if none are given), and
+ * every basic block found is emitted as a C++ function working on the CPU state and the bus. Moves, loads, stores and
+ * jumps are emitted inline, everything else calls back into the interpreter with the operands already decoded. The
+ * output also carries the ROM bytes, so the emulator only runs blocks that match what is actually on the bus.
+ */
+
+static constexpr usize MAX_BLOCK_INSNS = 64;
+static constexpr const char* REG8[8] = { "B", "C", "D", "E", "H", "L", "M", "A" };
+static constexpr const char* REG16[4] = { "BC", "DE", "HL", "SP" };
+static constexpr const char* COND[8] = {
+    "!s.flgZ()", "s.flgZ()", "!s.flgC()", "s.flgC()", "!s.flgP()", "s.flgP()", "!s.flgS()", "s.flgS()"
+};
+
+struct rom_image {
+    std::string name;
+    u16 load_adr;
+    std::vector<u8> data;
+    std::vector<u16> entries;
+};
+
+static std::string hex(unsigned value, int digits) {
+    char out[8];
+    std::snprintf(out, sizeof(out), "%0*X", digits, value);
+    return "0x" + std::string(out);
+}
+
+static bool is_documented(u8 op) {
+    return !((op & 0b11000111) == 0 and op != 0) and op != 0xCB and op != 0xD9 and op != 0xDD and op != 0xED and op != 0xFD;
+}
+
+/// @brief Instructions that end a block: anything that changes PC, halts, or may change what the bus or IRQs do next.
+static bool ends_block(u8 op) {
+    return (op & 0b11000111) == 0b11000010 or (op & 0b11000111) == 0b11000100 or (op & 0b11000111) == 0b11000000
+        or (op & 0b11000111) == 0b11000111 or op == 0xC3 or op == 0xCD or op == 0xC9 or op == 0xE9
+        or op == 0x76 or op == 0xD3 or op == 0xDB or op == 0xFB or op == 0xF3;
+}
+
+/// @brief Whether execution can continue right after the instruction (including returns from calls).
+static bool falls_through(u8 op) {
+    return op != 0xC3 and op != 0xC9 and op != 0xE9;
+}
+
+static rom_image parse_rom_arg(const std::string& arg) {
+    const usize at = arg.find('@');
+    if (at == std::string::npos)
+        throw std::invalid_argument("Expected <rom.bin>@<load address>, got: " + arg);
+
+    rom_image image;
+    const std::string filename = arg.substr(0, at);
+    const usize colon = arg.find(':', at);
+
+    image.load_adr = static_cast<u16>(std::stoul(arg.substr(at + 1, colon - at - 1), nullptr, 0));
+
+    if (colon != std::string::npos) {
+        std::stringstream ss(arg.substr(colon + 1));
+        std::string entry;
+        while (std::getline(ss, entry, ','))
+            image.entries.push_back(static_cast<u16>(std::stoul(entry, nullptr, 0)));
+    }
+
+    if (image.entries.empty())
+        image.entries.push_back(image.load_adr);
+
+    std::ifstream file(filename, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Could not open file: " + filename);
+
+    image.data.assign(std::istreambuf_iterator<char>(file), {});
+    if (image.data.empty() or image.load_adr + image.data.size() > 0x10000)
+        throw std::runtime_error("ROM is empty or does not fit in the address space: " + filename);
+
+    const usize slash = filename.find_last_of('/');
+    const std::string stem = filename.substr(slash == std::string::npos ? 0 : slash + 1);
+    for (char c : stem.substr(0, stem.find('.')))
+        image.name += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+
+    return image;
+}
+
+class recompiler {
+private:
+    const rom_image& rom;
+    std::vector<bool> decoded;
+    std::set<u16> leaders;
+
+    bool in_rom(usize adr, usize len = 1) const {
+        return adr >= rom.load_adr and adr + len <= rom.load_adr + rom.data.size();
+    }
+
+    u8 byte(usize adr) const { return rom.data[adr - rom.load_adr]; }
+
+    void add_leader(u16 adr, std::deque<u16>& work) {
+        if (in_rom(adr) and leaders.insert(adr).second)
+            work.push_back(adr);
+    }
+
+    void discover() {
+        std::deque<u16> work;
+        for (u16 entry : rom.entries)
+            add_leader(entry, work);
+
+        while (!work.empty()) {
+            usize pc = work.front();
+            work.pop_front();
+
+            while (in_rom(pc) and !decoded[pc - rom.load_adr]) {
+                const u8 op = byte(pc);
+                const usize len = util::get_opcode_len(op);
+
+                if (!is_documented(op) or !in_rom(pc, len))
+                    break;
+
+                decoded[pc - rom.load_adr] = true;
+                const usize next = pc + len;
+
+                if (len == 3 and ((op & 0b11000111) == 0b11000010 or (op & 0b11000111) == 0b11000100 or op == 0xC3 or op == 0xCD))
+                    add_leader(static_cast<u16>(byte(pc + 1) | byte(pc + 2) << 8), work);
+                else if ((op & 0b11000111) == 0b11000111)
+                    add_leader(op & 0b00111000, work);
+
+                if (!ends_block(op)) {
+                    pc = next;
+                    continue;
+                }
+
+                if (falls_through(op))
+                    add_leader(static_cast<u16>(next), work);
+                break;
+            }
+        }
+    }
+
+    /// @brief Emit one instruction, true if it set PC itself.
+    static bool emit_insn(std::string& out, usize pc, u8 op, u8 b1, u8 b2) {
+        const u16 next = static_cast<u16>(pc + util::get_opcode_len(op));
+        const u16 imm16 = b1 | b2 << 8;
+        const u8 dst = (op >> 3) & 7, src = op & 7, rp = (op >> 4) & 3;
+        const std::string d = REG8[dst], s = REG8[src];
+
+        out += "    // " + hex(pc, 4) + ": " + util::get_opcode_str(op) + "\n";
+
+        if (op == 0x00)
+            return false;
+
+        out += "    ";
+
+        if ((op & 0xC0) == 0x40 and op != 0x76) {
+            if (dst == 6)
+                out += "b.write(s.HL(), s." + s + "());\n";
+            else if (src == 6)
+                out += "s." + d + "(b.read(s.HL()));\n";
+            else
+                out += "s." + d + "(s." + s + "());\n";
+        } else if ((op & 0xC7) == 0x06) {
+            out += (dst == 6) ? "b.write(s.HL(), " + hex(b1, 2) + ");\n" : "s." + d + "(" + hex(b1, 2) + ");\n";
+        } else if ((op & 0xCF) == 0x01) {
+            out += "s." + std::string(REG16[rp]) + "(" + hex(imm16, 4) + ");\n";
+        } else if ((op & 0xCF) == 0x03 or (op & 0xCF) == 0x0B) {
+            const std::string r = REG16[rp];
+            out += "s." + r + "(static_cast<u16>(s." + r + "() " + ((op & 0x08) ? "- 1" : "+ 1") + "));\n";
+        } else if (op == 0x02 or op == 0x12) {
+            out += "b.write(s." + std::string(REG16[rp]) + "(), s.A());\n";
+        } else if (op == 0x0A or op == 0x1A) {
+            out += "s.A(b.read(s." + std::string(REG16[rp]) + "()));\n";
+        } else if (op == 0x32) {
+            out += "b.write(" + hex(imm16, 4) + ", s.A());\n";
+        } else if (op == 0x3A) {
+            out += "s.A(b.read(" + hex(imm16, 4) + "));\n";
+        } else if (op == 0x22) {
+            out += "b.write(" + hex(imm16, 4) + ", s.L()); b.write(" + hex(static_cast<u16>(imm16 + 1), 4) + ", s.H());\n";
+        } else if (op == 0x2A) {
+            out += "s.L(b.read(" + hex(imm16, 4) + ")); s.H(b.read(" + hex(static_cast<u16>(imm16 + 1), 4) + "));\n";
+        } else if (op == 0xEB) {
+            out += "{ const u16 hl = s.HL(); s.HL(s.DE()); s.DE(hl); }\n";
+        } else if (op == 0xC3) {
+            out += "s.PC(" + hex(imm16, 4) + ");\n";
+            return true;
+        } else if ((op & 0xC7) == 0xC2) {
+            out += "s.PC(" + std::string(COND[dst]) + " ? " + hex(imm16, 4) + " : " + hex(next, 4) + ");\n";
+            return true;
+        } else {
+            out += "c.aot_execute(" + hex(next, 4) + ", " + hex(op, 2) + ", " + hex(b1, 2) + ", " + hex(b2, 2) + ");\n";
+            return ends_block(op);
+        }
+
+        return false;
+    }
+
+public:
+    std::string code;
+    std::vector<std::string> block_entries;
+
+    void compile() {
+        discover();
+
+        std::deque<u16> pending(leaders.begin(), leaders.end());
+
+        while (!pending.empty()) {
+            const u16 start = pending.front();
+            pending.pop_front();
+
+            std::string body;
+            usize pc = start, insns = 0;
+            bool pc_set = false;
+
+            while (in_rom(pc) and decoded[pc - rom.load_adr]) {
+                if (pc != start and leaders.count(pc))
+                    break;
+
+                if (insns == MAX_BLOCK_INSNS) {
+                    // Cut long runs, the rest becomes a block of its own.
+                    leaders.insert(static_cast<u16>(pc));
+                    pending.push_back(static_cast<u16>(pc));
+                    break;
+                }
+
+                const u8 op = byte(pc);
+                const usize len = util::get_opcode_len(op);
+                pc_set = emit_insn(body, pc, op, len > 1 ? byte(pc + 1) : 0, len > 2 ? byte(pc + 2) : 0);
+                pc += len;
+                ++insns;
+
+                if (ends_block(op))
+                    break;
+            }
+
+            if (insns == 0)
+                continue;
+
+            if (!pc_set)
+                body += "    s.PC(" + hex(static_cast<u16>(pc), 4) + ");\n";
+
+            const std::string fn = rom.name + "_" + hex(start, 4).substr(2);
+            code += "void " + fn + "(cpu<bus&>& c) {\n"
+                    "    [[maybe_unused]] cpu_state& s = c.aot_state();\n"
+                    "    [[maybe_unused]] bus& b = c.aot_bus();\n\n" + body + "}\n\n";
+            block_entries.push_back("{ " + hex(start, 4) + ", " + std::to_string(pc - start) + ", " + fn + " }");
+        }
+    }
+
+    recompiler(const rom_image& rom) : rom(rom), decoded(rom.data.size(), false) {}
+};
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <output.cpp> <rom.bin>@<load address>[:<entry>,<entry>...] ...\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        std::string out = "// Generated by aotgen, do not edit.\n\n#include \"aot.hpp\"\n#include \"cpu.hpp\"\n\nnamespace {\n\n";
+        std::string images;
+        usize total_blocks = 0;
+
+        for (int i = 2; i < argc; ++i) {
+            const rom_image rom = parse_rom_arg(argv[i]);
+            recompiler rc(rom);
+            rc.compile();
+
+            if (rc.block_entries.empty())
+                continue;
+
+            out += "const u8 " + rom.name + "_data[] = {";
+            for (usize j = 0; j < rom.data.size(); ++j)
+                out += std::string((j % 16) ? " " : "\n    ") + hex(rom.data[j], 2) + ",";
+            out += "\n};\n\n" + rc.code + "const aot_block " + rom.name + "_blocks[] = {\n";
+
+            for (const std::string& entry : rc.block_entries)
+                out += "    " + entry + ",\n";
+
+            out += "};\n\nconst aot_image " + rom.name + "_image = {\n    \"" + rom.name + "\", " + hex(rom.load_adr, 4) + ", "
+                 + rom.name + "_data, sizeof(" + rom.name + "_data), " + rom.name + "_blocks, "
+                 + std::to_string(rc.block_entries.size()) + "\n};\n\n";
+
+            images += (images.empty() ? "&" : ", &") + rom.name + "_image";
+            total_blocks += rc.block_entries.size();
+            std::printf("aotgen: %s, %zu blocks\n", rom.name.c_str(), rc.block_entries.size());
+        }
+
+        out += "}\n\nconst std::vector<const aot_image*>& aot_builtin_images() {\n"
+               "    static const std::vector<const aot_image*> images = { " + images + " };\n"
+               "    return images;\n}\n";
+
+        std::ofstream file(argv[1], std::ios::trunc);
+        file << out;
+
+        if (!file)
+            throw std::runtime_error("Could not write " + std::string(argv[1]));
+
+        std::printf("aotgen: %zu blocks written to %s\n", total_blocks, argv[1]);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s: %s\n", argv[0], e.what());
+        return 1;
+    }
+
+    return 0;
+}
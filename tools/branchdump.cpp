@@ -0,0 +1,63 @@
+#include <cstdio>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "branch_trace.hpp"
+#include "util.hpp"
+
+/*
+ * Offline decoder for the branch trace of a run (see branch_trace), printing the path it took.
+ * Usage: branchdump <trace file> [last N instructions]
+ */
+int main(int argc, char** argv) {
+    if (argc < 2 or argc > 3) {
+        std::fprintf(stderr, "Usage: %s <trace file> [last N instructions]\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        std::vector<u8> image;
+        const std::vector<u8> stream = branch_trace::load(argv[1], image);
+        const usize last_n = (argc == 3) ? std::stoul(argv[2], nullptr, 0) : SIZE_MAX;
+        std::deque<branch_step> shown;
+
+        const u64 total = branch_trace::decode(stream, image, [&](const branch_step& step) {
+            if (shown.size() == last_n)
+                shown.pop_front();
+            if (last_n > 0)
+                shown.push_back(step);
+        });
+
+        std::printf("%llu instructions from %zu bytes of trace, showing the last %zu.\n\n",
+            static_cast<unsigned long long>(total), stream.size(), shown.size());
+        std::printf("PC      OPCODE     INSTRUCTION\n");
+
+        for (const branch_step& step : shown) {
+            const usize len = util::get_opcode_len(step.opcode);
+            char bytes[16];
+
+            if (len == 3)
+                std::snprintf(bytes, sizeof(bytes), "%02X %02X %02X", step.opcode, step.op1, step.op2);
+            else if (len == 2)
+                std::snprintf(bytes, sizeof(bytes), "%02X %02X", step.opcode, step.op1);
+            else
+                std::snprintf(bytes, sizeof(bytes), "%02X", step.opcode);
+
+            if (step.interrupted)
+                std::printf("        -- interrupt --\n");
+
+            std::printf("%04X    %-8s   %-16s", step.pc, bytes, util::get_opcode_str(step.opcode));
+            if (step.opcode == 0xDB)
+                std::printf("  read %02X", step.input);
+            std::printf("\n");
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s: %s\n", argv[0], e.what());
+        return 1;
+    }
+
+    return 0;
+}
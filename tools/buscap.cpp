@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "bus_capture.hpp"
+
+/*
+ * Viewer and CSV exporter for bus cycle captures written by the emulator (see bus_capture).
+ * Usage: buscap <capture file> [--csv] [filter, like mem:F800-FFFF,io:10-11]
+ */
+int main(int argc, char** argv) {
+    if (argc < 2 or argc > 4) {
+        std::fprintf(stderr, "Usage: %s <capture file> [--csv] [filter]\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        bool csv = false;
+        std::vector<capture_range> ranges;
+
+        for (int i = 2; i < argc; ++i) {
+            if (std::strcmp(argv[i], "--csv") == 0)
+                csv = true;
+            else
+                ranges = bus_capture::parse_filter(argv[i]);
+        }
+
+        u64 dropped;
+        std::vector<bus_cycle> cycles = bus_capture::read(argv[1], dropped);
+
+        if (csv)
+            std::printf("index,address,data,space,direction,kind,slot\n");
+        else
+            std::printf("%zu cycles captured, %llu dropped.\n\nINDEX         ADDR  DATA  SPACE  DIR  KIND     SLOT\n",
+                cycles.size(), static_cast<unsigned long long>(dropped));
+
+        for (const bus_cycle& c : cycles) {
+            const bool io = c.status & static_cast<u8>(bus_cycle_status::IO);
+            const u16 at = io ? (c.adr & 0xFF) : c.adr;
+            bool shown = ranges.empty();
+
+            for (const capture_range& range : ranges)
+                shown = shown or (range.io == io and at >= range.start and at <= range.end);
+
+            if (!shown)
+                continue;
+
+            const char* dir = (c.status & static_cast<u8>(bus_cycle_status::WRITE)) ? "W" : "R";
+            const char* kind = (c.status & static_cast<u8>(bus_cycle_status::OPCODE)) ? "opcode"
+                             : (c.status & static_cast<u8>(bus_cycle_status::FETCH)) ? "operand" : "data";
+            char slot[4] = "-";
+
+            if (c.slot != 255)
+                std::snprintf(slot, sizeof(slot), "%u", static_cast<unsigned>(c.slot));
+
+            if (csv)
+                std::printf("%llu,%04X,%02X,%s,%s,%s,%s\n", static_cast<unsigned long long>(c.index), at, c.data,
+                    io ? "io" : "mem", dir, kind, slot);
+            else
+                std::printf("%-12llu  %04X  %02X    %-5s  %-3s  %-7s  %s\n", static_cast<unsigned long long>(c.index),
+                    at, c.data, io ? "I/O" : "MEM", dir, kind, slot);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s: %s\n", argv[0], e.what());
+        return 1;
+    }
+
+    return 0;
+}
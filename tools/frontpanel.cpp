@@ -0,0 +1,68 @@
+#include <cstdio>
+#include <csignal>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+
+#include "shm_view.hpp"
+
+/*
+ * Terminal front panel for a machine publishing its state in shared memory (see shm_view).
+ * Usage: frontpanel [segment name, /buddy8800 by default] [refresh ms]
+ */
+
+static volatile std::sig_atomic_t running = 1;
+
+static std::string leds(u16 value, usize bits) {
+    std::string out;
+
+    for (usize i = bits; i > 0; --i) {
+        out += (value >> (i - 1)) & 1 ? "\x1B[31;01m●\x1B[0m" : "○";
+        if (i > 1 and (i - 1) % 4 == 0)
+            out += ' ';
+    }
+
+    return out;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 3) {
+        std::fprintf(stderr, "Usage: %s [segment name] [refresh ms]\n", argv[0]);
+        return 1;
+    }
+
+    std::signal(SIGINT, [](int) { running = 0; });
+
+    try {
+        shm_view_reader reader(argc > 1 ? argv[1] : "/buddy8800");
+        const auto refresh = std::chrono::milliseconds(argc > 2 ? std::stoul(argv[2]) : 50);
+        u64 last_steps = reader.read_state().steps;
+
+        std::printf("\x1B[2J");
+
+        while (running) {
+            std::this_thread::sleep_for(refresh);
+
+            const shm_view_state s = reader.read_state();
+            const f64 rate = static_cast<f64>(s.steps - last_steps) * 1000.0 / refresh.count();
+            last_steps = s.steps;
+
+            std::printf("\x1B[H\x1B[33;01m-:-:-:-:- buddy8800 front panel -:-:-:-:-\x1B[0m\n\n");
+            std::printf("  ADDRESS  %s   %04X\n", leds(s.address, 16).c_str(), s.address);
+            std::printf("  DATA     %s             %02X\n\n", leds(s.data, 8).c_str(), s.data);
+            std::printf("  %s HLT   %s INTE   %s IRQ\n\n",
+                leds(s.status & static_cast<u8>(shm_view_status::HALTED) ? 1 : 0, 1).c_str(),
+                leds(s.status & static_cast<u8>(shm_view_status::INTE) ? 1 : 0, 1).c_str(),
+                leds(s.status & static_cast<u8>(shm_view_status::IRQ) ? 1 : 0, 1).c_str());
+            std::printf("  AF %04X  BC %04X  DE %04X  HL %04X  SP %04X  PC %04X\n", s.af, s.bc, s.de, s.hl, s.sp, s.pc);
+            std::printf("  %llu steps, %.0f steps/s        \n", static_cast<unsigned long long>(s.steps), rate);
+            std::fflush(stdout);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s: %s\n", argv[0], e.what());
+        return 1;
+    }
+
+    return 0;
+}
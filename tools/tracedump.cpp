@@ -0,0 +1,62 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "trace_ring.hpp"
+#include "util.hpp"
+
+/*
+ * Offline decoder for the binary execution trace dumped by the emulator (see trace_ring).
+ * Usage: tracedump <trace file> [last N records]
+ */
+int main(int argc, char** argv) {
+    if (argc < 2 or argc > 3) {
+        std::fprintf(stderr, "Usage: %s <trace file> [last N records]\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        trace_dump_header header;
+        std::vector<trace_record> records = trace_ring::read_dump(argv[1], header);
+        usize first = 0;
+
+        if (argc == 3) {
+            usize last_n = std::stoul(argv[2], nullptr, 0);
+            if (last_n < records.size())
+                first = records.size() - last_n;
+        }
+
+        std::printf("%llu instructions recorded, showing the last %zu.\n\n",
+            static_cast<unsigned long long>(header.total), records.size() - first);
+        std::printf("PC      OPCODE     INSTRUCTION       A  F  BC   DE   HL   SP   FLAGS\n");
+
+        for (usize i = first; i < records.size(); ++i) {
+            const trace_record& r = records[i];
+            const usize len = util::get_opcode_len(r.opcode);
+            char bytes[16];
+
+            if (len == 3)
+                std::snprintf(bytes, sizeof(bytes), "%02X %02X %02X", r.opcode, r.op1, r.op2);
+            else if (len == 2)
+                std::snprintf(bytes, sizeof(bytes), "%02X %02X", r.opcode, r.op1);
+            else
+                std::snprintf(bytes, sizeof(bytes), "%02X", r.opcode);
+
+            std::printf("%04X    %-8s   %-16s  %02X %02X %04X %04X %04X %04X %c%c%c%c%c%s%s\n",
+                r.pc, bytes, util::get_opcode_str(r.opcode), r.a, r.f, r.bc, r.de, r.hl, r.sp,
+                (r.f & static_cast<u8>(cpu_flags::S)) ? 'S' : '/',
+                (r.f & static_cast<u8>(cpu_flags::Z)) ? 'Z' : '/',
+                (r.f & static_cast<u8>(cpu_flags::AC)) ? 'A' : '/',
+                (r.f & static_cast<u8>(cpu_flags::P)) ? 'P' : '/',
+                (r.f & static_cast<u8>(cpu_flags::C)) ? 'C' : '/',
+                (r.status & static_cast<u8>(trace_status::INTE)) ? " EI" : "",
+                (r.status & static_cast<u8>(trace_status::INTERRUPT)) ? " IRQ" : "");
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s: %s\n", argv[0], e.what());
+        return 1;
+    }
+
+    return 0;
+}